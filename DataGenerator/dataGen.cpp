@@ -6,18 +6,469 @@
 #include <stdlib.h>
 #include <iomanip>
 #include <time.h>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
 
 #include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "GenericIO.h"
 
 using namespace gio;
 
-int main(int argc, char* argv[])
+//
+// Usage: dataGen <filename> [numParticles] [options]
+//
+//   --dist uniform|nfw|filament|powerlaw	particle distribution (default uniform)
+//   --halos n				NFW halos per rank (default 16)
+//   --concentration c		NFW concentration (default 5)
+//   --halo-fraction f		fraction of the particles in halos, the rest are uniform (default 0.8)
+//   --filaments n			filaments per rank (default 8)
+//   --filament-width w		filament thickness, in units of the rank block (default 0.02)
+//   --gamma g				slope of the power-law correlation function (default 1.8)
+//   --clusters n			top-level power-law clusters per rank (default 8)
+//   --sigma s				velocity dispersion (default 1)
+//   --ids sorted|shuffled	order of the particle ids (default sorted)
+//   --dims x,y,z			rank topology (default: MPI_Dims_create)
+//   --imbalance f			per-rank particle counts vary by up to +-f (default 0)
+//   --octree levels		uniform octree levels, 0 for none (default 2)
+//   --adaptive n			adaptive octree with at most n particles per leaf
+//   --max-depth n			depth limit of the adaptive octree (default 8)
+//   --leaf-order simulation|shuffled|morton	order of the particles in octree leaves (default shuffled)
+//   --compress				compress the variables
+//   --seed n				random seed (default 989)
+//   --csv					also write each rank's particles to raw_output<rank>.csv
+//
+// Particles are generated in blocks, each with its own random stream derived
+// from the seed, the rank and the block number, so the output does not depend
+// on the number of OpenMP threads.
+//
+
+static const size_t BlockSize = 4096;
+
+// SplitMix64: a small, fast generator whose state can be derived from any
+// 64-bit value, which makes independent streams cheap.
+struct Random
 {
-	std::string filename(argv[1]);
-	//std::stringstream log;
+	Random(uint64_t seed) : state(seed) {}
+
+	uint64_t next()
+	{
+		uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	// Uniform in [0, 1)
+	double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+	double gaussian()
+	{
+		double u1 = uniform(), u2 = uniform();
+		return sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * M_PI * u2);
+	}
+
+	// Uniform in the unit ball
+	void ball(double v[3])
+	{
+		do
+		{
+			for (int d = 0; d < 3; ++d)
+				v[d] = 2.0 * uniform() - 1.0;
+		} while (v[0]*v[0] + v[1]*v[1] + v[2]*v[2] > 1.0);
+	}
+
+	uint64_t state;
+};
+
+static uint64_t mixSeed(uint64_t a, uint64_t b)
+{
+	return Random(a * 0xD1B54A32D192ED03ull ^ b).next();
+}
+
+
+struct Options
+{
+	Options() : dist("uniform"), halos(16), concentration(5), haloFraction(0.8),
+				filaments(8), filamentWidth(0.02), gamma(1.8), clusters(8), sigma(1),
+				shuffledIds(false), imbalance(0), octreeLevels(2), adaptiveLeaf(0), maxDepth(8),
+				leafOrder(GenericIO::OctreeLeafShuffled), compress(false), seed(989), csv(false)
+	{
+		dims[0] = dims[1] = dims[2] = 0;
+	}
+
+	std::string dist;
+	int halos;
+	double concentration, haloFraction;
+	int filaments;
+	double filamentWidth, gamma;
+	int clusters;
+	double sigma;
+	bool shuffledIds;
+	int dims[3];
+	double imbalance;
+	int octreeLevels;
+	uint64_t adaptiveLeaf;
+	int maxDepth;
+	GenericIO::OctreeLeafOrder leafOrder;
+	bool compress;
+	uint64_t seed;
+	bool csv;
+};
+
+
+// The extents of a rank's block of the domain
+struct Block
+{
+	double lo[3], size[3];
+
+	// Keeps positions within the block (periodically)
+	void wrap(double p[3]) const
+	{
+		for (int d = 0; d < 3; ++d)
+		{
+			double x = fmod(p[d] - lo[d], size[d]);
+			if (x < 0)
+				x += size[d];
+			p[d] = lo[d] + std::min(x, size[d] * (1 - 1e-7));
+		}
+	}
+
+	double minSize() const { return std::min(size[0], std::min(size[1], size[2])); }
+};
+
+
+struct Particle
+{
+	double pos[3], vel[3], phi;
+};
+
+
+// An NFW halo: the particles are distributed radially following the NFW mass
+// profile out to the virial radius, move with the halo and have a dispersion
+// growing with the halo mass.
+struct Halo
+{
+	double center[3], bulk[3];
+	double rvir, rs, sigma, weight;
+};
+
+// Fraction of the mass of an NFW halo within x = r / rs
+static double nfwMass(double x)
+{
+	return log(1 + x) - x / (1 + x);
+}
+
+static double nfwRadius(double c, double u)
+{
+	// Inverts the enclosed mass by bisection
+	double target = u * nfwMass(c);
+	double lo = 0, hi = c;
+	for (int i = 0; i < 50; ++i)
+	{
+		double mid = 0.5 * (lo + hi);
+		if (nfwMass(mid) < target)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return 0.5 * (lo + hi);
+}
+
+static std::vector<Halo> makeHalos(const Options &opts, const Block &block, Random &rng)
+{
+	// Masses from dN/dM ~ M^-1.9, between 1 and 1000 (in units of the smallest)
+	std::vector<Halo> halos(opts.halos);
+	double rmax = 0.15 * block.minSize();
+	for (size_t h = 0; h < halos.size(); ++h)
+	{
+		double u = rng.uniform();
+		double mass = pow(1 - u * (1 - pow(1000.0, -0.9)), -1 / 0.9);
+		double scale = pow(mass / 1000.0, 1.0 / 3.0);
+
+		for (int d = 0; d < 3; ++d)
+		{
+			halos[h].center[d] = block.lo[d] + rng.uniform() * block.size[d];
+			halos[h].bulk[d] = opts.sigma * rng.gaussian();
+		}
+		halos[h].rvir = rmax * scale;
+		halos[h].rs = halos[h].rvir / opts.concentration;
+		halos[h].sigma = opts.sigma * scale;
+		halos[h].weight = mass;
+	}
+
+	return halos;
+}
+
+static void nfwParticle(const Options &opts, const Block &block, const std::vector<Halo> &halos,
+						const std::vector<double> &cumWeight, Random &rng, Particle &p)
+{
+	if (rng.uniform() >= opts.haloFraction || halos.empty())
+	{
+		for (int d = 0; d < 3; ++d)
+		{
+			p.pos[d] = block.lo[d] + rng.uniform() * block.size[d];
+			p.vel[d] = opts.sigma * rng.gaussian();
+		}
+		p.phi = 0;
+		return;
+	}
+
+	size_t h = std::upper_bound(cumWeight.begin(), cumWeight.end(),
+								rng.uniform() * cumWeight.back()) - cumWeight.begin();
+	h = std::min(h, halos.size() - 1);
+	const Halo &halo = halos[h];
+
+	double x = nfwRadius(opts.concentration, rng.uniform());
+	double dir[3];
+	do
+	{
+		rng.ball(dir);
+	} while (dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2] < 1e-12);
+	double norm = sqrt(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
 
+	for (int d = 0; d < 3; ++d)
+	{
+		p.pos[d] = halo.center[d] + halo.rs * x * dir[d] / norm;
+		p.vel[d] = halo.bulk[d] + halo.sigma * rng.gaussian();
+	}
+	block.wrap(p.pos);
+
+	// The NFW potential (up to a constant), deepest in the most massive halos
+	p.phi = -halo.sigma * halo.sigma * log(1 + x) / std::max(x, 1e-6);
+}
+
+
+// A filament: a segment along which the particles are spread with a Gaussian
+// cross section, flowing along it.
+struct Filament
+{
+	double start[3], dir[3], length, flow;
+};
+
+static std::vector<Filament> makeFilaments(const Options &opts, const Block &block, Random &rng)
+{
+	std::vector<Filament> filaments(opts.filaments);
+	for (size_t f = 0; f < filaments.size(); ++f)
+	{
+		double end[3], len2 = 0;
+		for (int d = 0; d < 3; ++d)
+		{
+			filaments[f].start[d] = block.lo[d] + rng.uniform() * block.size[d];
+			end[d] = block.lo[d] + rng.uniform() * block.size[d];
+			filaments[f].dir[d] = end[d] - filaments[f].start[d];
+			len2 += filaments[f].dir[d] * filaments[f].dir[d];
+		}
+
+		filaments[f].length = std::max(sqrt(len2), 1e-6);
+		for (int d = 0; d < 3; ++d)
+			filaments[f].dir[d] /= filaments[f].length;
+		filaments[f].flow = opts.sigma * (2 * rng.uniform() - 1);
+	}
+
+	return filaments;
+}
+
+static void filamentParticle(const Options &opts, const Block &block,
+							 const std::vector<Filament> &filaments, Random &rng, Particle &p)
+{
+	const Filament &fil = filaments[rng.next() % filaments.size()];
+	double t = rng.uniform() * fil.length;
+	double width = opts.filamentWidth * block.minSize();
+
+	double offset = 0;
+	for (int d = 0; d < 3; ++d)
+	{
+		double o = width * rng.gaussian();
+		p.pos[d] = fil.start[d] + t * fil.dir[d] + o;
+		p.vel[d] = fil.flow * fil.dir[d] + 0.2 * opts.sigma * rng.gaussian();
+		offset += o * o;
+	}
+	block.wrap(p.pos);
+
+	p.phi = -exp(-offset / (2 * width * width));
+}
+
+
+// Hierarchical (Soneira-Peebles) clustering: each cluster holds two
+// sub-clusters, lambda times smaller, placed at random within it. After many
+// levels the two-point correlation function is a power law of slope
+// gamma = 3 - log(2)/log(lambda). The sub-cluster positions and velocities are
+// derived from their path in the hierarchy, so particles sharing a cluster
+// share its position and its (correlated) velocity.
+static void powerLawParticle(const Options &opts, const Block &block, uint64_t rankSeed,
+							 int levels, Random &rng, Particle &p)
+{
+	double dim = std::max(3 - opts.gamma, 0.1);
+	double lambda = pow(2.0, 1 / dim);
+	double radius = 0.25 * block.minSize();
+
+	uint64_t path = mixSeed(rankSeed, rng.next() % opts.clusters);
+	Random top(path);
+	for (int d = 0; d < 3; ++d)
+	{
+		p.pos[d] = block.lo[d] + top.uniform() * block.size[d];
+		p.vel[d] = opts.sigma * top.gaussian();
+	}
+
+	double sigma = opts.sigma;
+	for (int l = 0; l < levels; ++l)
+	{
+		path = mixSeed(path, rng.next() & 1);
+		Random node(path);
+
+		double offset[3];
+		node.ball(offset);
+		sigma /= sqrt(lambda);
+		for (int d = 0; d < 3; ++d)
+		{
+			p.pos[d] += radius * offset[d];
+			p.vel[d] += sigma * node.gaussian();
+		}
+		radius /= lambda;
+	}
+	block.wrap(p.pos);
+
+	p.phi = -(double) levels;
+}
+
+
+// Parses a whole decimal count of at least min (and at most max), rejecting
+// anything else, such as signs, trailing characters or overflow.
+static bool parseCount(const std::string &value, uint64_t min, uint64_t max, uint64_t &n)
+{
+	if (value.empty() || value[0] < '0' || value[0] > '9')
+		return false;
+
+	char *end;
+	errno = 0;
+	unsigned long long v = strtoull(value.c_str(), &end, 10);
+	if (*end != '\0' || errno == ERANGE || v < min || v > max)
+		return false;
+
+	n = v;
+	return true;
+}
+
+static bool parseCount(const std::string &value, int min, int &n)
+{
+	uint64_t v;
+	if (!parseCount(value, min, INT_MAX, v))
+		return false;
+
+	n = (int) v;
+	return true;
+}
+
+
+static bool parseOptions(int argc, char *argv[], int first, int numRanks, Options &opts)
+{
+	for (int a = first; a < argc; ++a)
+	{
+		std::string opt(argv[a]);
+		bool hasValue = a + 1 < argc;
+		std::string value(hasValue ? argv[a+1] : "");
+
+		if (opt == "--compress")
+			opts.compress = true;
+		else if (opt == "--csv")
+			opts.csv = true;
+		else if (!hasValue)
+			return false;
+		else
+		{
+			++a;
+			if (opt == "--dist")
+				opts.dist = value;
+			else if (opt == "--halos")
+			{
+				if (!parseCount(value, 0, opts.halos))
+					return false;
+			}
+			else if (opt == "--concentration")
+				opts.concentration = atof(value.c_str());
+			else if (opt == "--halo-fraction")
+				opts.haloFraction = atof(value.c_str());
+			else if (opt == "--filaments")
+			{
+				if (!parseCount(value, 1, opts.filaments))
+					return false;
+			}
+			else if (opt == "--filament-width")
+				opts.filamentWidth = atof(value.c_str());
+			else if (opt == "--gamma")
+				opts.gamma = atof(value.c_str());
+			else if (opt == "--clusters")
+			{
+				if (!parseCount(value, 1, opts.clusters))
+					return false;
+			}
+			else if (opt == "--sigma")
+				opts.sigma = atof(value.c_str());
+			else if (opt == "--ids")
+				opts.shuffledIds = (value == "shuffled");
+			else if (opt == "--dims")
+			{
+				if (sscanf(value.c_str(), "%d,%d,%d", &opts.dims[0], &opts.dims[1], &opts.dims[2]) != 3)
+					return false;
+
+				// MPI_Dims_create requires the given (nonzero) dimensions to
+				// divide the rank count, and to multiply to it when all are
+				// given.
+				int given = 1, free = 0;
+				for (int d = 0; d < 3; ++d)
+				{
+					if (opts.dims[d] < 0)
+						return false;
+					if (opts.dims[d] == 0)
+						++free;
+					else
+						given *= opts.dims[d];
+				}
+
+				if (numRanks % given != 0 || (free == 0 && given != numRanks))
+					return false;
+			}
+			else if (opt == "--imbalance")
+				opts.imbalance = atof(value.c_str());
+			else if (opt == "--octree")
+				opts.octreeLevels = atoi(value.c_str());
+			else if (opt == "--adaptive")
+				opts.adaptiveLeaf = strtoull(value.c_str(), 0, 10);
+			else if (opt == "--max-depth")
+				opts.maxDepth = atoi(value.c_str());
+			else if (opt == "--leaf-order")
+			{
+				if (value == "simulation")
+					opts.leafOrder = GenericIO::OctreeLeafSimulation;
+				else if (value == "shuffled")
+					opts.leafOrder = GenericIO::OctreeLeafShuffled;
+				else if (value == "morton")
+					opts.leafOrder = GenericIO::OctreeLeafMorton;
+				else
+					return false;
+			}
+			else if (opt == "--seed")
+				opts.seed = strtoull(value.c_str(), 0, 10);
+			else
+				return false;
+		}
+	}
+
+	return opts.dist == "uniform" || opts.dist == "nfw" || opts.dist == "filament" ||
+		   opts.dist == "powerlaw";
+}
+
+
+int main(int argc, char* argv[])
+{
 	//
 	// MPI Init
 	int myRank, numRanks;
@@ -26,40 +477,92 @@ int main(int argc, char* argv[])
 	MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
 	MPI_Comm Comm = MPI_COMM_WORLD;
 
+	// The particle count, if given, precedes the options
+	Options opts;
+	uint64_t requested = 1000;
+	int first = (argc >= 3 && argv[2][0] != '-') ? 3 : 2;
+	if (argc < 2 || (first == 3 && !parseCount(argv[2], 0, SIZE_MAX, requested)) ||
+		!parseOptions(argc, argv, first, numRanks, opts))
+	{
+		if (myRank == 0)
+			std::cerr << "Usage: " << argv[0] << " <filename> [numParticles] [--dist uniform|nfw|filament|powerlaw] "
+					  << "[--halos n] [--concentration c] [--halo-fraction f] [--filaments n] [--filament-width w] "
+					  << "[--gamma g] [--clusters n] [--sigma s] [--ids sorted|shuffled] [--dims x,y,z] "
+					  << "[--imbalance f] [--octree levels] [--adaptive n] [--max-depth n] "
+					  << "[--leaf-order simulation|shuffled|morton] [--compress] [--seed n] [--csv]" << std::endl;
+		MPI_Finalize();
+		return 1;
+	}
+	std::string filename(argv[1]);
 
-	//srand (time(NULL) + myRank);
-	srand (989 + myRank);
-	
 	{
-		// float simExtents[6]={0,256, 0,256, 0,256};
-		int dims[3]= {2, 2, 2};
 		int periods[3] = { 0, 0, 0 };
 		int physOrigin[3] = {0, 0, 0};
 		int physScale[3] = {256, 256, 256};
-		
-		size_t numParticles = 1000;
-		if (argc == 3)
-			numParticles = atoi(argv[2]);
-		std::cout << "num particles: " << numParticles << std::endl;
 
+		size_t numParticles = requested;
+
+		MPI_Dims_create(numRanks, 3, opts.dims);
+		MPI_Cart_create(Comm, 3, opts.dims, periods, 0, &Comm);
+
+		int coords[3];
+		MPI_Cart_coords(Comm, myRank, 3, coords);
+
+		Block block;
+		for (int d = 0; d < 3; ++d)
+		{
+			block.size[d] = double(physScale[d] - physOrigin[d]) / opts.dims[d];
+			block.lo[d] = physOrigin[d] + coords[d] * block.size[d];
+		}
 
-		MPI_Cart_create(Comm, 3, dims, periods, 0, &Comm);
-		
-		unsigned method = GenericIO::FileIOMPI;
-		//unsigned method = GenericIO::FileIOPOSIX;
+		uint64_t rankSeed = mixSeed(opts.seed, myRank);
+		Random rankRng(rankSeed);
+
+		// Per-rank imbalance
+		if (opts.imbalance > 0)
+			numParticles = (size_t) std::max(0.0, numParticles * (1 + opts.imbalance * (2 * rankRng.uniform() - 1)));
+
+		uint64_t firstId = 0, count = numParticles;
+		MPI_Exscan(&count, &firstId, 1, MPI_UINT64_T, MPI_SUM, Comm);
+		if (myRank == 0)
+			firstId = 0;
+
+		if (myRank == 0)
+			std::cout << "num particles: " << numParticles << " (rank 0), distribution: " << opts.dist
+					  << ", ranks: " << opts.dims[0] << "x" << opts.dims[1] << "x" << opts.dims[2] << std::endl;
 
-		filename.append("Oct");
-		GenericIO newGIO(Comm, filename);//, method);
+		std::vector<Halo> halos;
+		std::vector<double> cumWeight;
+		if (opts.dist == "nfw")
+		{
+			halos = makeHalos(opts, block, rankRng);
+			double sum = 0;
+			for (size_t h = 0; h < halos.size(); ++h)
+				cumWeight.push_back(sum += halos[h].weight);
+		}
+
+		std::vector<Filament> filaments;
+		if (opts.dist == "filament")
+			filaments = makeFilaments(opts, block, rankRng);
+
+		int levels = 0;
+		if (opts.dist == "powerlaw")
+			levels = std::min(40, (int) ceil(log2(std::max(2.0, double(numParticles) / std::max(opts.clusters, 1)))));
+
+		if (opts.octreeLevels > 0 || opts.adaptiveLeaf > 0)
+			filename.append("Oct");
+
+		GenericIO::setDefaultShouldCompress(opts.compress);
+		GenericIO newGIO(Comm, filename);
 		newGIO.setNumElems(numParticles);
 
-        for (int d = 0; d < 3; ++d)
-        {
-            newGIO.setPhysOrigin(physOrigin[d], d);
-            newGIO.setPhysScale(physScale[d], d);
-        }
+		for (int d = 0; d < 3; ++d)
+		{
+			newGIO.setPhysOrigin(physOrigin[d], d);
+			newGIO.setPhysScale(physScale[d], d);
+		}
 
 
-		
 		//
 		// Variables
 		std::vector<float> xx, yy, zz, vx, vy, vz, phi;
@@ -75,128 +578,96 @@ int main(int argc, char* argv[])
 		phi.resize(numParticles  + newGIO.requestedExtraSpace() / sizeof(float));
 		id.resize(numParticles   + newGIO.requestedExtraSpace() / sizeof(int64_t));
 		mask.resize(numParticles + newGIO.requestedExtraSpace() / sizeof(uint16_t));
-		
 
-		int offsetX, offsetY, offsetZ;
-		int _8RankOffset = 128;
-		if (myRank == 0)
-		{
-			offsetX = 0;				offsetY = 0;			offsetZ = 0;
-		}
-		else if (myRank == 1)
-		{
-			offsetX = 0;				offsetY = 0;			offsetZ = _8RankOffset;
-		}
-		else if (myRank == 2)
-		{
-			offsetX = 0;				offsetY = _8RankOffset;	offsetZ = 0;
-		}
-		else if (myRank == 3)
-		{
-			offsetX = 0;				offsetY = _8RankOffset;	offsetZ = _8RankOffset;
-		}
-		else if (myRank == 4)
-		{
-			offsetX = _8RankOffset;		offsetY = 0;			offsetZ = 0;
-		}
-		else if (myRank == 5)
-		{
-			offsetX = _8RankOffset;		offsetY = 0;			offsetZ = _8RankOffset;
-		}
-		else if (myRank == 6)
-		{
-			offsetX = _8RankOffset;		offsetY = _8RankOffset;	offsetZ = 0;
-		}
-		else if (myRank == 7)
-		{
-			offsetX = _8RankOffset;		offsetY = _8RankOffset;	offsetZ = _8RankOffset;
-		}
+		size_t numBlocks = (numParticles + BlockSize - 1) / BlockSize;
 
-		MPI_Barrier(MPI_COMM_WORLD);
-		//log << offsetX << ", " << offsetY << ", " << offsetZ << std::endl;
-
-
-		double maxX, maxY, maxZ;
-		maxX = maxY = maxZ = 0;
-		double randomNum;
-		for (uint64_t i=0; i<numParticles; i++)
+	  #ifdef _OPENMP
+		#pragma omp parallel for schedule(dynamic)
+	  #endif
+		for (size_t b = 0; b < numBlocks; ++b)
 		{
-			randomNum = ((rand() % 12800)/100.0) + offsetX;	//log << randomNum << ", ";
-			xx[i] = randomNum;	
-
-			randomNum = ((rand() % 12800)/100.0) + offsetY;	//log << randomNum << ", ";
-			yy[i] = randomNum;
-
-			randomNum = ((rand() % 12800)/100.0) + offsetZ;	//log << randomNum << "\n";
-			zz[i] = randomNum;
-
-			vx[i] = (double) (rand() % 1000 / 1000.0);
-			vy[i] = (double) (rand() % 1000 / 1000.0);
-			vz[i] = (double) (rand() % 1000 / 1000.0);
-			phi[i] = (double) (rand() % 1000 / 100.0);
-			mask[i] = (uint16_t)myRank;
-			id[i] = myRank*numParticles + i;
-
-			if (xx[i] > maxX)
-				maxX = xx[i];
-			if (yy[i] > maxY)
-				maxY = yy[i];
-			if (zz[i] > maxZ)
-				maxZ = zz[i];
+			Random rng(mixSeed(rankSeed, b + 1));
+			size_t end = std::min(numParticles, (b + 1) * BlockSize);
+			for (size_t i = b * BlockSize; i < end; ++i)
+			{
+				Particle p;
+				if (opts.dist == "nfw")
+					nfwParticle(opts, block, halos, cumWeight, rng, p);
+				else if (opts.dist == "filament")
+					filamentParticle(opts, block, filaments, rng, p);
+				else if (opts.dist == "powerlaw")
+					powerLawParticle(opts, block, rankSeed, levels, rng, p);
+				else
+				{
+					for (int d = 0; d < 3; ++d)
+					{
+						p.pos[d] = block.lo[d] + rng.uniform() * block.size[d];
+						p.vel[d] = rng.uniform();
+					}
+					p.phi = rng.uniform() * 10;
+				}
+
+				xx[i] = p.pos[0];	yy[i] = p.pos[1];	zz[i] = p.pos[2];
+				vx[i] = p.vel[0];	vy[i] = p.vel[1];	vz[i] = p.vel[2];
+				phi[i] = p.phi;
+				mask[i] = (uint16_t)myRank;
+				id[i] = firstId + i;
+			}
 		}
 
+		if (opts.shuffledIds)
+			for (size_t i = numParticles; i > 1; --i)
+				std::swap(id[i - 1], id[rankRng.next() % i]);
+
 		unsigned CoordFlagsX = GenericIO::VarIsPhysCoordX;
-        unsigned CoordFlagsY = GenericIO::VarIsPhysCoordY;
-        unsigned CoordFlagsZ = GenericIO::VarIsPhysCoordZ;
+		unsigned CoordFlagsY = GenericIO::VarIsPhysCoordY;
+		unsigned CoordFlagsZ = GenericIO::VarIsPhysCoordZ;
 
 		newGIO.addVariable("x", xx, CoordFlagsX | GenericIO::VarHasExtraSpace);
-        newGIO.addVariable("y", yy, CoordFlagsY | GenericIO::VarHasExtraSpace);
+		newGIO.addVariable("y", yy, CoordFlagsY | GenericIO::VarHasExtraSpace);
 		newGIO.addVariable("z", zz, CoordFlagsZ | GenericIO::VarHasExtraSpace);
 		newGIO.addVariable("vx", vx, GenericIO::VarHasExtraSpace);
-        newGIO.addVariable("vy", vy, GenericIO::VarHasExtraSpace);
-        newGIO.addVariable("vz", vz, GenericIO::VarHasExtraSpace);
-        newGIO.addVariable("phi", phi, GenericIO::VarHasExtraSpace);
+		newGIO.addVariable("vy", vy, GenericIO::VarHasExtraSpace);
+		newGIO.addVariable("vz", vz, GenericIO::VarHasExtraSpace);
+		newGIO.addVariable("phi", phi, GenericIO::VarHasExtraSpace);
 		newGIO.addVariable("id", id, GenericIO::VarHasExtraSpace);
 		newGIO.addVariable("mask", mask, GenericIO::VarHasExtraSpace);
 
-		std::stringstream ss;
-		for (int i=0; i<numParticles; i++)
+		if (opts.csv)
 		{
-			ss 	<< std::setw(8) << xx[i] << "  " 
-				<< std::setw(8) << yy[i] << "  " 
-				<< std::setw(8) << zz[i]  << "  " 
-				<< std::setw(8) << vx[i] << "  " 
-				<< std::setw(8) << vy[i] << "  " 
-				<< std::setw(8) << vz[i] << "  " 
-				<< std::setw(8) << phi[i] << "  " 
-				<< std::setw(8) << id[i] << "  " 
-				<< std::setw(8) << mask[i] << std::endl;
-
-			//<< "  " << vx[i] << "  " << vy[i] << "  " << vz[i] << "  " << phi[i] < "  " << id[i] < "  " << mask[i] << std::endl;
+			std::stringstream ss;
+			for (size_t i=0; i<numParticles; i++)
+			{
+				ss 	<< std::setw(8) << xx[i] << "  "
+					<< std::setw(8) << yy[i] << "  "
+					<< std::setw(8) << zz[i]  << "  "
+					<< std::setw(8) << vx[i] << "  "
+					<< std::setw(8) << vy[i] << "  "
+					<< std::setw(8) << vz[i] << "  "
+					<< std::setw(8) << phi[i] << "  "
+					<< std::setw(8) << id[i] << "  "
+					<< std::setw(8) << mask[i] << std::endl;
+			}
+
+			std::ofstream myfile;
+			myfile.open ("raw_output" + std::to_string(myRank) + ".csv");
+			myfile << ss.str();
+			myfile.close();
 		}
 
-		std::ofstream myfile;
-  		myfile.open ("raw_output" + std::to_string(myRank) + ".csv");
-  		myfile << ss.str();
-  		myfile.close();
-  
-
-		newGIO.useOctree(2);	// num levels, shuffle true by default
-        newGIO.write();
+		if (opts.adaptiveLeaf > 0)
+			newGIO.useAdaptiveOctree(opts.adaptiveLeaf, opts.maxDepth, opts.leafOrder);
+		else if (opts.octreeLevels > 0)
+			newGIO.useOctree(opts.octreeLevels, opts.leafOrder);
+		newGIO.write();
 
 		MPI_Barrier(MPI_COMM_WORLD);
 	}
 
-	
-	//std::ofstream outputFile( ("dataGEn_" + std::to_string(myRank) + "_.log").c_str(), std::ios::out);
-	//outputFile << log.str();
-	//outputFile.close();
 
-	
 	MPI_Finalize();
 
 	return 0;
 }
 
 // ./compile.sh
-// mpirun -np 8 ./dataGen outputFile 10000
\ No newline at end of file
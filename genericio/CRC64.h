@@ -1449,7 +1449,9 @@ static const size_t crc64_min_thread_bytes = 1024;
 static inline uint64_t crc64_omp(const void *input, size_t nbytes)
 {
     #ifdef _OPENMP
-    if (nbytes > 2 * crc64_min_thread_bytes)
+    // Within a parallel region, the nested region would get a single thread
+    // (leaving the other partial checksums unset), so compute it directly.
+    if (nbytes > 2 * crc64_min_thread_bytes && !omp_in_parallel())
     {
         int nthreads = omp_get_max_threads();
 
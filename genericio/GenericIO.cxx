@@ -45,6 +45,8 @@
 
 extern "C" {
 #include "blosc.h"
+#include "zstd.h"
+#include "zdict.h"
 }
 
 #include <sstream>
@@ -56,6 +58,9 @@ extern "C" {
 #include <cassert>
 #include <cstddef>
 #include <cstring>
+#include <chrono>
+#include <functional>
+#include <mutex>
 
 #ifndef GENERICIO_NO_MPI
     #include <ctime>
@@ -65,6 +70,11 @@ extern "C" {
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <limits.h>
+
+#ifdef __linux__
+    #include <sys/uio.h>
+#endif
 
 #ifdef __bgq__
     #include <mpix.h>
@@ -79,7 +89,64 @@ using namespace std;
 namespace gio {
 
 
+thread_local size_t GenericFileIO::ReadDone = 0;
+
+void GenericFileIO::writev(const std::vector<Segment> &Segments, off_t offset,
+                           const std::string &D) {
+  for (size_t i = 0; i < Segments.size(); ++i) {
+        write(Segments[i].Buf, Segments[i].Count, offset, D);
+        offset += Segments[i].Count;
+    }
+}
+
 #ifndef GENERICIO_NO_MPI
+// MPI counts are ints, so no single transfer (or datatype block) is larger
+// than this.
+static const size_t MaxMPITransfer = 1 << 30;
+
+// A datatype describing all segments in memory (relative to MPI_BOTTOM), with
+// large segments split into blocks of at most MaxMPITransfer bytes.
+static MPI_Datatype getSegmentsType(const std::vector<GenericFileIO::Segment> &Segments) {
+    vector<int> Lengths;
+    vector<MPI_Aint> Displacements;
+  for (size_t i = 0; i < Segments.size(); ++i) {
+    for (size_t Done = 0; Done < Segments[i].Count; Done += MaxMPITransfer) {
+            MPI_Aint Addr;
+            MPI_Get_address((char *) Segments[i].Buf + Done, &Addr);
+            Lengths.push_back((int) std::min(Segments[i].Count - Done, MaxMPITransfer));
+            Displacements.push_back(Addr);
+        }
+    }
+
+    MPI_Datatype T;
+    MPI_Type_create_hindexed((int) Lengths.size(), Lengths.empty() ? 0 : &Lengths[0],
+                             Displacements.empty() ? 0 : &Displacements[0], MPI_BYTE, &T);
+    MPI_Type_commit(&T);
+    return T;
+}
+
+// Drops the first Done bytes, which may end in the middle of a segment.
+static void skipSegments(std::vector<GenericFileIO::Segment> &Segments, size_t Done) {
+    size_t First = 0;
+  while (First < Segments.size() && Done >= Segments[First].Count) {
+        Done -= Segments[First].Count;
+        ++First;
+    }
+
+    Segments.erase(Segments.begin(), Segments.begin() + First);
+  if (Done > 0) {
+        Segments[0].Buf = ((const char *) Segments[0].Buf) + Done;
+        Segments[0].Count -= Done;
+    }
+}
+
+static size_t segmentsSize(const std::vector<GenericFileIO::Segment> &Segments) {
+    size_t Size = 0;
+    for (size_t i = 0; i < Segments.size(); ++i)
+        Size += Segments[i].Count;
+    return Size;
+}
+
 GenericFileIO_MPI::~GenericFileIO_MPI() {
     (void) MPI_File_close(&FH);
 }
@@ -100,19 +167,33 @@ void GenericFileIO_MPI::setSize(size_t sz) {
         throw runtime_error("Unable to set size for file: " + FileName);
 }
 
+size_t GenericFileIO_MPI::getSize() {
+    MPI_Offset sz;
+    if (MPI_File_get_size(FH, &sz) != MPI_SUCCESS)
+        throw runtime_error("Unable to get size for file: " + FileName);
+
+    return (size_t) sz;
+}
+
 void GenericFileIO_MPI::read(void *buf, size_t count, off_t offset,
                              const std::string &D) {
+    ReadDone = 0;
   while (count > 0) {
         MPI_Status status;
-        if (MPI_File_read_at(FH, offset, buf, count, MPI_BYTE, &status) != MPI_SUCCESS)
+        if (MPI_File_read_at(FH, offset, buf, (int) std::min(count, MaxMPITransfer),
+                             MPI_BYTE, &status) != MPI_SUCCESS)
             throw runtime_error("Unable to read " + D + " from file: " + FileName);
 
         int scount;
         (void) MPI_Get_count(&status, MPI_BYTE, &scount);
+        if (scount <= 0)
+            throw runtime_error("Unable to read " + D + " from file: " + FileName +
+                                ": unexpected end of file");
 
         count -= scount;
         buf = ((char *) buf) + scount;
         offset += scount;
+        ReadDone += scount;
     }
 }
 
@@ -120,11 +201,14 @@ void GenericFileIO_MPI::write(const void *buf, size_t count, off_t offset,
                               const std::string &D) {
   while (count > 0) {
         MPI_Status status;
-        if (MPI_File_write_at(FH, offset, (void *) buf, count, MPI_BYTE, &status) != MPI_SUCCESS)
+        if (MPI_File_write_at(FH, offset, (void *) buf, (int) std::min(count, MaxMPITransfer),
+                              MPI_BYTE, &status) != MPI_SUCCESS)
             throw runtime_error("Unable to write " + D + " to file: " + FileName);
 
         int scount;
         (void) MPI_Get_count(&status, MPI_BYTE, &scount);
+        if (scount <= 0)
+            throw runtime_error("Unable to write " + D + " to file: " + FileName);
 
         count -= scount;
         buf = ((char *) buf) + scount;
@@ -132,13 +216,41 @@ void GenericFileIO_MPI::write(const void *buf, size_t count, off_t offset,
     }
 }
 
+void GenericFileIO_MPI::writev(const std::vector<Segment> &Segments, off_t offset,
+                               const std::string &D) {
+    vector<Segment> Remaining(Segments);
+  while (segmentsSize(Remaining) > 0) {
+        MPI_Datatype T = getSegmentsType(Remaining);
+
+        MPI_Status status;
+        int Err = MPI_File_write_at(FH, offset, MPI_BOTTOM, 1, T, &status);
+
+        // The bytes written, which may be a part of the datatype (and exceed
+        // an int), are its basic elements.
+        MPI_Count scount = 0;
+        if (Err == MPI_SUCCESS)
+            (void) MPI_Get_elements_x(&status, T, &scount);
+        MPI_Type_free(&T);
+
+        if (Err != MPI_SUCCESS)
+            throw runtime_error("Unable to write " + D + " to file: " + FileName);
+        if (scount <= 0)
+            throw runtime_error("Unable to write " + D + " to file: " + FileName);
+
+        offset += scount;
+        skipSegments(Remaining, (size_t) scount);
+    }
+}
+
 void GenericFileIO_MPICollective::read(void *buf, size_t count, off_t offset,
                              const std::string &D) {
     int Continue = 0;
+    ReadDone = 0;
 
   do {
         MPI_Status status;
-        if (MPI_File_read_at_all(FH, offset, buf, count, MPI_BYTE, &status) != MPI_SUCCESS)
+        if (MPI_File_read_at_all(FH, offset, buf, (int) std::min(count, MaxMPITransfer),
+                                 MPI_BYTE, &status) != MPI_SUCCESS)
             throw runtime_error("Unable to read " + D + " from file: " + FileName);
 
     int scount = 0;
@@ -149,6 +261,7 @@ void GenericFileIO_MPICollective::read(void *buf, size_t count, off_t offset,
         count -= scount;
         buf = ((char *) buf) + scount;
         offset += scount;
+        ReadDone += scount;
 
         int NeedContinue = (count > 0);
         MPI_Allreduce(&NeedContinue, &Continue, 1, MPI_INT, MPI_SUM, Comm);
@@ -161,7 +274,8 @@ void GenericFileIO_MPICollective::write(const void *buf, size_t count, off_t off
 
   do {
         MPI_Status status;
-        if (MPI_File_write_at_all(FH, offset, (void *) buf, count, MPI_BYTE, &status) != MPI_SUCCESS)
+        if (MPI_File_write_at_all(FH, offset, (void *) buf, (int) std::min(count, MaxMPITransfer),
+                                  MPI_BYTE, &status) != MPI_SUCCESS)
             throw runtime_error("Unable to write " + D + " to file: " + FileName);
 
     int scount = 0;
@@ -177,6 +291,38 @@ void GenericFileIO_MPICollective::write(const void *buf, size_t count, off_t off
         MPI_Allreduce(&NeedContinue, &Continue, 1, MPI_INT, MPI_SUM, Comm);
   } while (Continue);
 }
+
+void GenericFileIO_MPICollective::writev(const std::vector<Segment> &Segments, off_t offset,
+                                         const std::string &D) {
+    vector<Segment> Remaining(Segments);
+    int Continue = 0;
+
+  do {
+        MPI_Datatype T = getSegmentsType(Remaining);
+
+        // One collective call for all of the variables of all ranks, which the
+        // MPI-IO layer can aggregate.
+        MPI_Status status;
+        int Err = MPI_File_write_at_all(FH, offset, MPI_BOTTOM, 1, T, &status);
+
+    MPI_Count scount = 0;
+    // On some systems, MPI_Get_count will not return zero even when count is zero.
+    if (Err == MPI_SUCCESS && segmentsSize(Remaining) > 0)
+        (void) MPI_Get_elements_x(&status, T, &scount);
+        MPI_Type_free(&T);
+
+        if (Err != MPI_SUCCESS)
+            throw runtime_error("Unable to write " + D + " to file: " + FileName);
+
+        offset += scount;
+        skipSegments(Remaining, (size_t) scount);
+
+        // Ranks with a short write continue, and the others join in with
+        // empty writes.
+        int NeedContinue = (segmentsSize(Remaining) > 0);
+        MPI_Allreduce(&NeedContinue, &Continue, 1, MPI_INT, MPI_SUM, Comm);
+  } while (Continue);
+}
 #endif
 
 GenericFileIO_POSIX::~GenericFileIO_POSIX() {
@@ -200,8 +346,17 @@ void GenericFileIO_POSIX::setSize(size_t sz) {
         throw runtime_error("Unable to set size for file: " + FileName);
 }
 
+size_t GenericFileIO_POSIX::getSize() {
+    struct stat st;
+    if (fstat(FH, &st) == -1)
+        throw runtime_error("Unable to get size for file: " + FileName);
+
+    return (size_t) st.st_size;
+}
+
 void GenericFileIO_POSIX::read(void *buf, size_t count, off_t offset,
                                const std::string &D) {
+    ReadDone = 0;
   while (count > 0) {
         ssize_t scount;
         errno = 0;
@@ -213,9 +368,14 @@ void GenericFileIO_POSIX::read(void *buf, size_t count, off_t offset,
                                 ": " + strerror(errno));
         }
 
+        if (scount == 0)
+            throw runtime_error("Unable to read " + D + " from file: " + FileName +
+                                ": unexpected end of file");
+
         count -= scount;
         buf = ((char *) buf) + scount;
         offset += scount;
+        ReadDone += scount;
     }
 }
 
@@ -238,6 +398,48 @@ void GenericFileIO_POSIX::write(const void *buf, size_t count, off_t offset,
     }
 }
 
+#ifdef __linux__
+void GenericFileIO_POSIX::writev(const std::vector<Segment> &Segments, off_t offset,
+                                 const std::string &D) {
+    vector<struct iovec> IOV;
+  for (size_t i = 0; i < Segments.size(); ++i) {
+    if (Segments[i].Count > 0) {
+            struct iovec V;
+            V.iov_base = (void *) Segments[i].Buf;
+            V.iov_len = Segments[i].Count;
+            IOV.push_back(V);
+        }
+    }
+
+    size_t First = 0;
+  while (First < IOV.size()) {
+        ssize_t scount;
+        errno = 0;
+    if ((scount = pwritev(FH, &IOV[First], (int) std::min(IOV.size() - First, (size_t) IOV_MAX),
+                          offset)) == -1) {
+            if (errno == EINTR)
+                continue;
+
+            throw runtime_error("Unable to write " + D + " to file: " + FileName +
+                                ": " + strerror(errno));
+        }
+
+        // Skip what was written (which may end in the middle of a segment).
+        offset += scount;
+    while (scount > 0) {
+      if ((size_t) scount >= IOV[First].iov_len) {
+                scount -= IOV[First].iov_len;
+                ++First;
+      } else {
+                IOV[First].iov_base = ((char *) IOV[First].iov_base) + scount;
+                IOV[First].iov_len -= scount;
+                scount = 0;
+            }
+        }
+    }
+}
+#endif
+
 static bool isBigEndian() {
     const uint32_t one = 1;
     return !(*((char *)(&one)));
@@ -311,6 +513,15 @@ struct GlobalHeader {
     endian_specific_value<uint64_t, IsBigEndian> BlocksStart;
     endian_specific_value<uint64_t, IsBigEndian> OctreeSize;
     endian_specific_value<uint64_t, IsBigEndian> OctreeStart;
+    endian_specific_value<uint64_t, IsBigEndian> DictsSize;
+    endian_specific_value<uint64_t, IsBigEndian> DictsStart;
+    endian_specific_value<uint64_t, IsBigEndian> Flags;
+};
+
+enum {
+    // The file ends with a step index (set in the first step's header by
+    // append, so that readers of single-step files need not look for one).
+    GlobalHasSteps      = (1 << 0)
 };
 
 enum {
@@ -354,11 +565,217 @@ struct CompressHeader {
 };
 const char *CompressName = "BLOSC";
 
+// Chunked blocks: the rows of the block are split into chunks of ChunkRows
+// rows, each stored (and, when compressing, compressed) separately and
+// followed by its own CRC. The block starts with the chunk table, which is
+// also followed by a CRC; chunk starting offsets are relative to the start of
+// the block.
+template <bool IsBigEndian>
+struct ChunkTableHeader {
+    endian_specific_value<uint64_t, IsBigEndian> ChunkRows;
+    endian_specific_value<uint64_t, IsBigEndian> NChunks;
+};
+
+template <bool IsBigEndian>
+struct ChunkHeader {
+    char Filter[FilterNameSize];
+    endian_specific_value<uint64_t, IsBigEndian> Start;
+    endian_specific_value<uint64_t, IsBigEndian> Size;
+};
+const char *ChunkedName = "CHUNKED";
+
+// Transposed blocks (Filters[0] = CHUNKED, Filters[1] = SOA) hold a variable
+// of several components (e.g. a float4) as a separate stream for each
+// component, chunked as above: the table lists the chunks of each component in
+// turn, so that entry k * N + c, of the N chunks of each component, holds
+// component k of the rows of chunk c, and NChunks counts the entries of all
+// of the components.
+const char *TransposedName = "SOA";
+
+// Integer packing: the values are split into blocks of IntPackBlock, each
+// stored as a header followed by the values, less a reference, bit-packed at
+// the block's width. The reference is either the block's minimum value
+// (IntPackFOR) or, for the zigzag-coded differences from the preceding value
+// (IntPackDelta, which suits nearly sorted ids), their minimum. Whole blocks
+// are filtered with Filters[0] = INTPACK, and Filters[1] = BLOSC when the
+// packed values were then compressed; chunks name the pair IPBLOSC.
+template <bool IsBigEndian>
+struct IntPackHeader {
+    endian_specific_value<uint64_t, IsBigEndian> NValues;
+    endian_specific_value<uint64_t, IsBigEndian> ValueSize;
+};
+
+template <bool IsBigEndian>
+struct IntPackBlockHeader {
+    unsigned char Mode;
+    unsigned char Bits;
+    unsigned char Pad[6];
+    endian_specific_value<uint64_t, IsBigEndian> Ref;
+};
+const char *IntPackName = "INTPACK";
+const char *IntPackBloscName = "IPBLOSC";
+
+// Dictionary compression: the header holds a zstd dictionary for each
+// variable (trained at write time from samples of all of the ranks' blocks),
+// and blocks or chunks filtered with ZDICT are zstd frames compressed against
+// it. The dictionary section starts with a table of these entries, one for
+// each variable, whose offsets are relative to the start of the section; a
+// variable without a dictionary has a zero-size entry.
+template <bool IsBigEndian>
+struct DictHeader {
+    endian_specific_value<uint64_t, IsBigEndian> Start;
+    endian_specific_value<uint64_t, IsBigEndian> Size;
+};
+const char *ZstdDictName = "ZDICT";
+
+// Multi-step files: each step is a complete header (with absolute data
+// offsets) followed by its data, and the file ends with the step index and a
+// fixed-size trailer pointing to it.
+template <bool IsBigEndian>
+struct StepIndexEntry {
+    endian_specific_value<uint64_t, IsBigEndian> HeaderStart;
+    endian_specific_value<uint64_t, IsBigEndian> HeaderSize; // Including the CRC
+    endian_specific_value<uint64_t, IsBigEndian> DataEnd;
+    endian_specific_value<uint64_t, IsBigEndian> NElems;
+};
+
+template <bool IsBigEndian>
+struct StepIndexTrailer {
+    char Magic[MagicSize];
+    endian_specific_value<uint64_t, IsBigEndian> NSteps;
+    endian_specific_value<uint64_t, IsBigEndian> IndexStart;
+    endian_specific_value<uint64_t, IsBigEndian> IndexCRC;
+};
+
+static const char *StepMagicBE = "HACCSTB";
+static const char *StepMagicLE = "HACCSTL";
+
 #pragma pack()
 
+struct StepInfo {
+    uint64_t HeaderStart, HeaderSize, DataEnd, NElems;
+};
+
+// Define a "safe" version of offsetof (offsetof itself might not work for
+// non-POD types, and at least xlC v12.1 will complain about this if you try).
+#define offsetof_safe(S, F) (size_t(&(S)->F) - size_t(S))
+
+// Whether a file, given the header at its start, may have a step index.
+// Headers from before the flag do not tell, and the file must be looked at.
+template <bool IsBigEndian>
+static bool mayHaveSteps(const GlobalHeader<IsBigEndian> *GH) {
+    if (offsetof_safe(GH, Flags) >= GH->GlobalHeaderSize)
+        return true;
+    return (GH->Flags & GlobalHasSteps) != 0;
+}
+
+// The trailer and (usually) the whole index are fetched with one read of the
+// end of the file.
+static const size_t StepIndexTailRead = 64*1024;
+
+template <bool IsBigEndian>
+static size_t stepIndexSize(size_t NSteps) {
+    return NSteps * sizeof(StepIndexEntry<IsBigEndian>) + sizeof(StepIndexTrailer<IsBigEndian>);
+}
+
+// Returns false, and no steps, if the file has no step index. When the
+// caller already holds the whole file (Head), nothing is read; the end of the
+// file read can be kept (in TailCache) for the next call.
+template <bool IsBigEndian>
+static bool readStepIndex(GenericFileIO *GFIO, const string &FileName,
+                          vector<StepInfo> &Steps, uint64_t KnownSize = (uint64_t) -1,
+                          const vector<char> *Head = 0, vector<char> *TailCache = 0) {
+    Steps.clear();
+
+    size_t FileSize = KnownSize == (uint64_t) -1 ? GFIO->getSize() : KnownSize;
+    if (FileSize < sizeof(StepIndexTrailer<IsBigEndian>))
+        return false;
+
+    size_t TailSize = std::min(FileSize, StepIndexTailRead);
+    vector<char> Tail;
+  if (Head && Head->size() == FileSize) {
+        Tail.assign(Head->end() - TailSize, Head->end());
+  } else if (TailCache && TailCache->size() == TailSize) {
+        Tail = *TailCache;
+  } else {
+        Tail.resize(TailSize);
+        GFIO->read(&Tail[0], TailSize, FileSize - TailSize, "step index");
+        if (TailCache)
+            *TailCache = Tail;
+    }
+
+    StepIndexTrailer<IsBigEndian> *T =
+        (StepIndexTrailer<IsBigEndian> *) &Tail[TailSize - sizeof(StepIndexTrailer<IsBigEndian>)];
+    const char *StepMagic = IsBigEndian ? StepMagicBE : StepMagicLE;
+    if (string(T->Magic, T->Magic + MagicSize - 1) != StepMagic)
+        return false;
+
+    uint64_t NSteps = T->NSteps, IndexStart = T->IndexStart, IndexCRC = T->IndexCRC;
+    size_t IndexSize = NSteps * sizeof(StepIndexEntry<IsBigEndian>);
+    if (NSteps == 0 || IndexStart + stepIndexSize<IsBigEndian>(NSteps) != FileSize)
+        throw runtime_error("Invalid step index in file: " + FileName);
+
+    vector<char> Index;
+  if (IndexSize + sizeof(StepIndexTrailer<IsBigEndian>) <= TailSize) {
+        size_t IndexPos = TailSize - sizeof(StepIndexTrailer<IsBigEndian>) - IndexSize;
+        Index.assign(Tail.begin() + IndexPos, Tail.begin() + IndexPos + IndexSize);
+  } else {
+        Index.resize(IndexSize);
+        GFIO->read(&Index[0], IndexSize, IndexStart, "step index");
+    }
+
+    if (crc64_omp(&Index[0], IndexSize) != IndexCRC)
+        throw runtime_error("Step index CRC check failed: " + FileName);
+
+    StepIndexEntry<IsBigEndian> *E = (StepIndexEntry<IsBigEndian> *) &Index[0];
+  for (uint64_t i = 0; i < NSteps; ++i, ++E) {
+        StepInfo SI;
+        SI.HeaderStart = E->HeaderStart;
+        SI.HeaderSize = E->HeaderSize;
+        SI.DataEnd = E->DataEnd;
+        SI.NElems = E->NElems;
+        Steps.push_back(SI);
+    }
+
+    return true;
+}
+
+template <bool IsBigEndian>
+static void writeStepIndex(GenericFileIO *GFIO, const vector<StepInfo> &Steps,
+                           uint64_t IndexStart) {
+    size_t IndexSize = Steps.size() * sizeof(StepIndexEntry<IsBigEndian>);
+    vector<char> Index(stepIndexSize<IsBigEndian>(Steps.size()), 0);
+
+    StepIndexEntry<IsBigEndian> *E = (StepIndexEntry<IsBigEndian> *) &Index[0];
+  for (size_t i = 0; i < Steps.size(); ++i, ++E) {
+        E->HeaderStart = Steps[i].HeaderStart;
+        E->HeaderSize = Steps[i].HeaderSize;
+        E->DataEnd = Steps[i].DataEnd;
+        E->NElems = Steps[i].NElems;
+    }
+
+    StepIndexTrailer<IsBigEndian> *T = (StepIndexTrailer<IsBigEndian> *) &Index[IndexSize];
+    const char *StepMagic = IsBigEndian ? StepMagicBE : StepMagicLE;
+    std::copy(StepMagic, StepMagic + MagicSize, T->Magic);
+    T->NSteps = Steps.size();
+    T->IndexStart = IndexStart;
+    T->IndexCRC = crc64_omp(&Index[0], IndexSize);
+
+    GFIO->write(&Index[0], Index.size(), IndexStart, "step index");
+}
+
 unsigned GenericIO::DefaultFileIOType = FileIOPOSIX;
 int GenericIO::DefaultPartition = 0;
 bool GenericIO::DefaultShouldCompress = false;
+uint64_t GenericIO::DefaultChunkRows = 0;
+bool GenericIO::DefaultIntPack = false;
+size_t GenericIO::DefaultDictionarySize = 0;
+double GenericIO::DefaultAdaptiveCompression = 0;
+bool GenericIO::DefaultTranspose = false;
+GenericIO::RedistributionMode GenericIO::DefaultRedistribution = GenericIO::RedistributeBlocks;
+size_t GenericIO::DefaultHeaderPrefetch = 1024*1024;
+size_t GenericIO::MaxTraceEvents = 1024*1024;
+GenericIO::RetryPolicy GenericIO::DefaultReadRetry;
 
   #ifndef GENERICIO_NO_MPI
     std::size_t GenericIO::CollectiveMPIIOThreshold = 0;
@@ -366,678 +783,2268 @@ bool GenericIO::DefaultShouldCompress = false;
 
 static bool blosc_initialized = false;
 
-#ifndef GENERICIO_NO_MPI
-void GenericIO::write() {
-    if (isBigEndian())
-        write<true>();
-    else
-        write<false>();
-}
-
-// Note: writing errors are not currently recoverable (one rank may fail
-// while the others don't).
-template <bool IsBigEndian>
-void GenericIO::write() {
-    const char *Magic = IsBigEndian ? MagicBE : MagicLE;
+static void initBlosc() {
+    #ifdef _OPENMP
+    #pragma omp master
+    {
+    #endif
 
-    uint64_t FileSize = 0;
+  if (!blosc_initialized) {
+            blosc_init();
+            blosc_initialized = true;
+        }
 
-    int NRanks, Rank;
-    MPI_Comm_rank(Comm, &Rank);
-    MPI_Comm_size(Comm, &NRanks);
+        #ifdef _OPENMP
+        blosc_set_nthreads(omp_get_max_threads());
+    }
+        #endif
+}
 
-    #ifdef __bgq__
-    MPI_Barrier(Comm);
+// Decompression uses a private context, which needs no global blosc state, so
+// that cursors can decompress on several threads at once. Within a parallel
+// region, each call is single threaded.
+static int decompressBlosc(const void *Src, void *Dest, size_t DestSize) {
+    int NThreads = 1;
+    #ifdef _OPENMP
+    if (!omp_in_parallel())
+        NThreads = omp_get_max_threads();
     #endif
-    MPI_Comm_split(Comm, Partition, Rank, &SplitComm);
 
-    int SplitNRanks, SplitRank;
-    MPI_Comm_rank(SplitComm, &SplitRank);
-    MPI_Comm_size(SplitComm, &SplitNRanks);
+    return blosc_decompress_ctx(Src, Dest, DestSize, NThreads);
+}
 
+enum IntPackMode {
+    IntPackFOR = 0,
+    IntPackDelta = 1
+};
 
-    // Making a duplicate
-    bool useDuplicateData = false;
-    std::vector<GioData> _Vars;
-    _Vars.resize(Vars.size());
-    for (int i=0; i<Vars.size(); i++)
-        _Vars[i].data = Vars[i].Data;
+// Each block of IntPackBlock values is packed as four interleaved lanes of
+// 64-bit words (value i goes to lane i % 4), so that the same shifts apply to
+// every lane and the loops over the lanes vectorize; a block of width Bits
+// takes exactly 4 * Bits words. There is a kernel for each width; the
+// unpacking loops are fully unrolled, so that all of the shifts are constants.
+static const size_t IntPackLanes = 4;
+static const size_t IntPackBlock = 64 * IntPackLanes;
+
+template <unsigned Bits>
+static void intPackBits(const uint64_t *In, uint64_t *Out) {
+    for (size_t w = 0; w < IntPackLanes * Bits; ++w)
+        Out[w] = 0;
+
+  for (unsigned p = 0; p < 64 && Bits > 0; ++p) {
+        const unsigned Bit = p * Bits, W = Bit / 64, S = Bit % 64;
+    for (size_t l = 0; l < IntPackLanes; ++l) {
+            Out[W * IntPackLanes + l] |= In[p * IntPackLanes + l] << S;
+            if (S + Bits > 64)
+                Out[(W + 1) * IntPackLanes + l] |= In[p * IntPackLanes + l] >> ((64 - S) % 64);
+        }
+    }
+}
 
+template <unsigned Bits>
+static void intUnpackBits(const uint64_t *In, uint64_t *Out) {
+    const uint64_t Mask = Bits == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << (Bits % 64)) - 1;
+    #ifdef __GNUC__
+    #pragma GCC unroll 64
+    #endif
+  for (unsigned p = 0; p < 64; ++p) {
+        const unsigned Bit = p * Bits, W = Bit / 64, S = Bit % 64;
+    for (size_t l = 0; l < IntPackLanes; ++l) {
+            uint64_t V = Bits == 0 ? 0 : In[W * IntPackLanes + l] >> S;
+            if (S + Bits > 64)
+                V |= In[(W + 1) * IntPackLanes + l] << ((64 - S) % 64);
+            Out[p * IntPackLanes + l] = V & Mask;
+        }
+    }
+}
 
-    string LocalFileName;
-  if (SplitNRanks != NRanks) {
-    if (Rank == 0) {
-            // In split mode, the specified file becomes the rank map, and the real
-            // data is partitioned.
+typedef void (*IntPackBitsFn)(const uint64_t *, uint64_t *);
 
-            vector<int> MapRank, MapPartition;
-            MapRank.resize(NRanks);
-            for (int i = 0; i < NRanks; ++i) MapRank[i] = i;
+template <unsigned Bits>
+struct IntPackTable {
+  static void fill(IntPackBitsFn *Pack, IntPackBitsFn *Unpack) {
+        Pack[Bits] = intPackBits<Bits>;
+        Unpack[Bits] = intUnpackBits<Bits>;
+        IntPackTable<Bits - 1>::fill(Pack, Unpack);
+    }
+};
 
-            MapPartition.resize(NRanks);
-            MPI_Gather(&Partition, 1, MPI_INT, &MapPartition[0], 1, MPI_INT, 0, Comm);
+template <>
+struct IntPackTable<0> {
+  static void fill(IntPackBitsFn *Pack, IntPackBitsFn *Unpack) {
+        Pack[0] = intPackBits<0>;
+        Unpack[0] = intUnpackBits<0>;
+    }
+};
 
-            GenericIO GIO(MPI_COMM_SELF, FileName, FileIOType);
-            GIO.setNumElems(NRanks);
-            GIO.addVariable("$rank", MapRank); /* this is for use by humans; the reading
-                                            code assumes that the partitions are in
-                                            rank order */
-            GIO.addVariable("$partition", MapPartition);
+struct IntPackKernels {
+    IntPackBitsFn Pack[65], Unpack[65];
+    IntPackKernels() { IntPackTable<64>::fill(Pack, Unpack); }
+};
 
-            vector<int> CX, CY, CZ;
-            int TopoStatus;
-            MPI_Topo_test(Comm, &TopoStatus);
-      if (TopoStatus == MPI_CART) {
-                CX.resize(NRanks);
-                CY.resize(NRanks);
-                CZ.resize(NRanks);
+static const IntPackKernels &intPackKernels() {
+    static const IntPackKernels K;
+    return K;
+}
 
-        for (int i = 0; i < NRanks; ++i) {
-                    int C[3];
-                    MPI_Cart_coords(Comm, i, 3, C);
+template <typename U>
+static U unzigzag(U Z) {
+    return (U) ((U) (Z >> 1) ^ (U) (U(0) - (U) (Z & 1)));
+}
 
-                    CX[i] = C[0];
-                    CY[i] = C[1];
-                    CZ[i] = C[2];
-                }
+#ifndef GENERICIO_NO_MPI
+static unsigned intPackWidth(uint64_t X) {
+    unsigned B = 0;
+    for (; X; X >>= 1)
+        ++B;
+    return B;
+}
 
-                GIO.addVariable("$x", CX);
-                GIO.addVariable("$y", CY);
-                GIO.addVariable("$z", CZ);
-            }
+template <typename U>
+static U zigzag(U D) {
+    const U Top = (U) (D >> (8 * sizeof(U) - 1));
+    return (U) ((U) (D << 1) ^ (U) (U(0) - Top));
+}
 
-            GIO.write();
+// Appends the packed form of the NValues values (native byte order) to Out.
+template <bool IsBigEndian, typename U>
+static void intPackValues(const U *In, uint64_t NValues, bool IsSigned,
+                          vector<unsigned char> &Out) {
+    const U SignBit = IsSigned ? (U) ((U) 1 << (8 * sizeof(U) - 1)) : (U) 0;
+    const IntPackKernels &K = intPackKernels();
+    uint64_t For[IntPackBlock], Delta[IntPackBlock], Words[IntPackLanes * 64];
+
+    U Prev = 0;
+  for (uint64_t First = 0; First < NValues; First += IntPackBlock) {
+        size_t N = (size_t) std::min<uint64_t>(IntPackBlock, NValues - First);
+        const U *V = In + First;
+
+        // The minimum is taken with the sign bit flipped, so that signed
+        // values order correctly; differences are the same either way.
+        U MinK = (U) ~(U) 0, MaxK = 0, MinZ = (U) ~(U) 0, MaxZ = 0;
+    for (size_t i = 0; i < N; ++i) {
+            U Key = (U) (V[i] ^ SignBit);
+            MinK = std::min(MinK, Key);
+            MaxK = std::max(MaxK, Key);
+
+            U Z = zigzag<U>((U) (V[i] - (i ? V[i - 1] : Prev)));
+            Delta[i] = Z;
+            MinZ = std::min(MinZ, Z);
+            MaxZ = std::max(MaxZ, Z);
+        }
+
+        unsigned ForBits = intPackWidth((U) (MaxK - MinK)),
+                 DeltaBits = intPackWidth((U) (MaxZ - MinZ));
+
+        IntPackBlockHeader<IsBigEndian> BH;
+        memset(&BH, 0, sizeof(BH));
+    if (DeltaBits < ForBits) {
+            BH.Mode = IntPackDelta;
+            BH.Bits = DeltaBits;
+            BH.Ref = (uint64_t) MinZ;
+            for (size_t i = 0; i < N; ++i)
+                For[i] = (U) (Delta[i] - MinZ);
     } else {
-            MPI_Gather(&Partition, 1, MPI_INT, 0, 0, MPI_INT, 0, Comm);
+            U Ref = (U) (MinK ^ SignBit);
+            BH.Mode = IntPackFOR;
+            BH.Bits = ForBits;
+            BH.Ref = (uint64_t) Ref;
+            for (size_t i = 0; i < N; ++i)
+                For[i] = (U) (V[i] - Ref);
         }
 
-        stringstream ss;
-        ss << FileName << "#" << Partition;
-        LocalFileName = ss.str();
-  } else {
-        LocalFileName = FileName;
-    }
+        for (size_t i = N; i < IntPackBlock; ++i)
+            For[i] = 0;
 
-    RankHeader<IsBigEndian> RHLocal;
-    int Dims[3], Periods[3], Coords[3];
+        K.Pack[BH.Bits](For, Words);
 
-    int TopoStatus;
-    MPI_Topo_test(Comm, &TopoStatus);
-  if (TopoStatus == MPI_CART) {
-        MPI_Cart_get(Comm, 3, Dims, Periods, Coords);
-  } else {
-        Dims[0] = NRanks;
-        std::fill(Dims + 1, Dims + 3, 1);
-        std::fill(Periods, Periods + 3, 0);
-        Coords[0] = Rank;
-        std::fill(Coords + 1, Coords + 3, 0);
+        size_t Pos = Out.size(), WordBytes = IntPackLanes * BH.Bits * sizeof(uint64_t);
+        Out.resize(Pos + sizeof(BH) + WordBytes);
+        memcpy(&Out[Pos], &BH, sizeof(BH));
+        if (WordBytes)
+            memcpy(&Out[Pos + sizeof(BH)], Words, WordBytes);
+
+        Prev = V[N - 1];
     }
+}
 
+// Packs NValues integers of ValueSize bytes each, appending them (after an
+// IntPackHeader) to Out.
+template <bool IsBigEndian>
+static void intPack(const void *Data, uint64_t NValues, size_t ValueSize, bool IsSigned,
+                    vector<unsigned char> &Out) {
+    IntPackHeader<IsBigEndian> H;
+    H.NValues = NValues;
+    H.ValueSize = ValueSize;
+    Out.insert(Out.end(), (unsigned char *) &H, (unsigned char *) (&H + 1));
+
+  switch (ValueSize) {
+    case 1: intPackValues<IsBigEndian>((const uint8_t *) Data, NValues, IsSigned, Out); break;
+    case 2: intPackValues<IsBigEndian>((const uint16_t *) Data, NValues, IsSigned, Out); break;
+    case 4: intPackValues<IsBigEndian>((const uint32_t *) Data, NValues, IsSigned, Out); break;
+    case 8: intPackValues<IsBigEndian>((const uint64_t *) Data, NValues, IsSigned, Out); break;
+    default: throw runtime_error("Cannot pack integers of this size");
+    }
+}
+#endif
 
-    float myExtents[6];
-    float physicalDims[3];
-    for (int i=0; i<3; i++)
-        physicalDims[i] = (PhysScale[i]-PhysOrigin[i])/Dims[i];
+// The values are produced in the file's byte order, like the other filters'
+// output, so that they are swapped along with unfiltered data.
+template <bool IsBigEndian, typename U>
+static bool intUnpackValues(const unsigned char *Src, const unsigned char *End,
+                            U *Dest, uint64_t NValues) {
+    const IntPackKernels &K = intPackKernels();
+    uint64_t Words[IntPackLanes * 64], Vals[IntPackBlock];
+
+    U Prev = 0;
+  for (uint64_t First = 0; First < NValues; First += IntPackBlock) {
+        IntPackBlockHeader<IsBigEndian> BH;
+        if ((size_t) (End - Src) < sizeof(BH))
+            return false;
+        memcpy(&BH, Src, sizeof(BH));
+        Src += sizeof(BH);
+
+        size_t WordBytes = IntPackLanes * BH.Bits * sizeof(uint64_t);
+        if (BH.Bits > 8 * sizeof(U) || (size_t) (End - Src) < WordBytes)
+            return false;
+        if (WordBytes)
+            memcpy(Words, Src, WordBytes);
+        Src += WordBytes;
 
-    for (int i=0; i<3; i++)
-    {
-        myExtents[i*2]     = Coords[i] * physicalDims[i];
-        myExtents[i*2 + 1] = myExtents[i*2] + physicalDims[i];
+        if (IsBigEndian != isBigEndian())
+            for (size_t w = 0; w < IntPackLanes * BH.Bits; ++w)
+                bswap(&Words[w], sizeof(uint64_t));
+
+        K.Unpack[BH.Bits](Words, Vals);
+
+        size_t N = (size_t) std::min<uint64_t>(IntPackBlock, NValues - First);
+        const U Ref = (U) (uint64_t) BH.Ref;
+        U *V = Dest + First;
+    if (BH.Mode == IntPackFOR) {
+            for (size_t i = 0; i < N; ++i)
+                V[i] = (U) (Ref + (U) Vals[i]);
+    } else if (BH.Mode == IntPackDelta) {
+      for (size_t i = 0; i < N; ++i) {
+                Prev = (U) (Prev + unzigzag<U>((U) (Ref + (U) Vals[i])));
+                V[i] = Prev;
+            }
+    } else {
+            return false;
+        }
+
+        Prev = V[N - 1];
     }
 
-    std::copy(Coords, Coords + 3, RHLocal.Coords);
-    RHLocal.NElems = NElems;
-    RHLocal.Start = 0;
-    RHLocal.GlobalRank = Rank;
+    if (IsBigEndian != isBigEndian())
+        for (uint64_t i = 0; i < NValues; ++i)
+            bswap(&Dest[i], sizeof(U));
 
-    bool ShouldCompress = DefaultShouldCompress;
-    const char *EnvStr = getenv("GENERICIO_COMPRESS");
-  if (EnvStr) {
-        int Mod = atoi(EnvStr);
-        ShouldCompress = (Mod > 0);
-    }
+    return Src == End;
+}
 
-    bool NeedsBlockHeaders = ShouldCompress;
-    EnvStr = getenv("GENERICIO_FORCE_BLOCKS");
-  if (!NeedsBlockHeaders && EnvStr) {
-        int Mod = atoi(EnvStr);
-        NeedsBlockHeaders = (Mod > 0);
+// Unpacks what intPack produced into Dest, which holds DestSize bytes.
+// Returns false if the packed data is malformed or of the wrong size.
+template <bool IsBigEndian>
+static bool intUnpack(const unsigned char *Src, size_t SrcSize, void *Dest, size_t DestSize) {
+    IntPackHeader<IsBigEndian> H;
+    if (SrcSize < sizeof(H))
+        return false;
+    memcpy(&H, Src, sizeof(H));
+
+    uint64_t NValues = H.NValues, ValueSize = H.ValueSize;
+    if (ValueSize == 0 || NValues != DestSize / ValueSize || DestSize % ValueSize)
+        return false;
+
+    const unsigned char *Begin = Src + sizeof(H), *End = Src + SrcSize;
+  switch (ValueSize) {
+    case 1: return intUnpackValues<IsBigEndian>(Begin, End, (uint8_t *) Dest, NValues);
+    case 2: return intUnpackValues<IsBigEndian>(Begin, End, (uint16_t *) Dest, NValues);
+    case 4: return intUnpackValues<IsBigEndian>(Begin, End, (uint32_t *) Dest, NValues);
+    case 8: return intUnpackValues<IsBigEndian>(Begin, End, (uint64_t *) Dest, NValues);
     }
 
+    return false;
+}
 
-    
-    //Check if we can build an octree
-    if (hasOctree)
-    {
-        bool foundx, foundy, foundz;
-        foundx = foundy = foundz = false;
-        
-        for (size_t i = 0; i < Vars.size(); ++i)
-            if (Vars[i].IsPhysCoordX)
-            {
-                foundx = true;
-                break;
-            }
+// A compressed frame (of a whole block, or of a chunk) is a CompressHeader
+// followed by the data as transformed by these filters.
+enum FrameFilter {
+    FrameRaw,
+    FrameBlosc,
+    FrameIntPack,
+    FrameIntPackBlosc,
+    FrameZstdDict
+};
 
+static const int ZstdDictLevel = 9;
+
+// The encodings which compressFrame can try (each producing one of the frame
+// filters above; both blosc variants produce FrameBlosc frames, as blosc
+// records its shuffle and codec itself).
+enum FrameCodec {
+    CodecBlosc = 1,         // blosclz with byte shuffling
+    CodecBloscLZ4 = 2,      // lz4 with bit shuffling
+    CodecIntPack = 4,
+    CodecIntPackBlosc = 8,
+    CodecZstdDict = 16,
+    CodecsDefault = CodecBlosc | CodecIntPack | CodecIntPackBlosc | CodecZstdDict,
+    CodecsAll = CodecsDefault | CodecBloscLZ4
+};
 
-        for (size_t i = 0; i < Vars.size(); ++i)
-            if (Vars[i].IsPhysCoordY)
-            {
-                foundy = true;
-                break;
-            }
+#ifndef GENERICIO_NO_MPI
+// A variable's trained dictionary, as written to the header, with the
+// decompression dictionary which readers build from it.
+struct FrameDictionary {
+    const unsigned char *Data;
+    size_t Size;
+    ZSTD_DDict *DDict;
+};
+
+// Compresses Bytes bytes of Data, appending the frame to Frame, with each of
+// the encodings in Codecs which applies: integer data (IntSize is the size of
+// its values, zero for other data) can be INTPACKed, alone or followed by
+// blosc, and, given a dictionary, all data compressed with zstd against it.
+// The smallest result is kept. Returns FrameRaw, leaving Frame unchanged,
+// when nothing fits within the original size. Sampling (for selectCodec)
+// keeps the compression single-threaded.
+template <bool IsBigEndian>
+static FrameFilter compressFrame(const void *Data, size_t Bytes, size_t TypeSize,
+                                 size_t IntSize, bool IsSigned, vector<unsigned char> &Frame,
+                                 const FrameDictionary *Dict = 0,
+                                 unsigned Codecs = CodecsDefault, bool Sampling = false) {
+    size_t Start = Frame.size(), DataStart = Start + sizeof(CompressHeader<IsBigEndian>);
+    Frame.resize(DataStart + Bytes);
+
+    FrameFilter F = FrameRaw;
+    size_t Best = Bytes;
+  if (Codecs & CodecBlosc) {
+        int CSize = blosc_compress(9, BLOSC_SHUFFLE, TypeSize, Bytes, Data,
+                                   &Frame[DataStart], Bytes);
+    if (CSize > 0) {
+            F = FrameBlosc;
+            Best = CSize;
+        }
+    }
 
+  if ((Codecs & CodecBloscLZ4) && Bytes > 0) {
+        // A sample is too small to be worth splitting between threads (and
+        // timing it so would misjudge the codec's speed on its own).
+        int NThreads = 1;
+        #ifdef _OPENMP
+        if (!Sampling && !omp_in_parallel())
+            NThreads = omp_get_max_threads();
+        #endif
 
-        for (size_t i = 0; i < Vars.size(); ++i)
-            if (Vars[i].IsPhysCoordZ)
-            {
-                foundz = true;
-                break;
-            }
+        vector<unsigned char> C(Bytes);
+        int CSize = blosc_compress_ctx(5, BLOSC_BITSHUFFLE, TypeSize, Bytes, Data, &C[0],
+                                       C.size(), "lz4", 0, NThreads);
+    if (CSize > 0 && (size_t) CSize < Best) {
+            F = FrameBlosc;
+            Best = CSize;
+            std::copy(C.begin(), C.begin() + CSize, &Frame[DataStart]);
+        }
+    }
 
-        
-        // If the data has no position data, we can't build an octree
-        hasOctree = hasOctree && foundx;
-        hasOctree = hasOctree && foundy;
-        hasOctree = hasOctree && foundz;
+  if (IntSize > 0 && Bytes > 0 && (Codecs & (CodecIntPack | CodecIntPackBlosc))) {
+        vector<unsigned char> Packed;
+        intPack<IsBigEndian>(Data, Bytes / IntSize, IntSize, IsSigned, Packed);
+
+        int PCSize = 0;
+        vector<unsigned char> PackedC(Packed.size());
+        if (Codecs & CodecIntPackBlosc)
+            PCSize = blosc_compress(9, BLOSC_SHUFFLE, sizeof(uint64_t), Packed.size(),
+                                    &Packed[0], &PackedC[0], PackedC.size());
+        bool UsePacked = (Codecs & CodecIntPack) && Packed.size() < Best;
+    if (PCSize > 0 && (size_t) PCSize < Best &&
+        (!UsePacked || (size_t) PCSize < Packed.size())) {
+            F = FrameIntPackBlosc;
+            Best = PCSize;
+            std::copy(PackedC.begin(), PackedC.begin() + PCSize, &Frame[DataStart]);
+    } else if (UsePacked) {
+            F = FrameIntPack;
+            Best = Packed.size();
+            std::copy(Packed.begin(), Packed.end(), &Frame[DataStart]);
+        }
+    }
 
+  if (Dict && Bytes > 0 && (Codecs & CodecZstdDict)) {
+        // The bundled zstd (0.7.4) can emit corrupt frames when compressing
+        // with a prepared ZSTD_CDict, so the dictionary is loaded for each
+        // frame, and the frame is only kept if it decompresses back to Data.
+        vector<unsigned char> Z(ZSTD_compressBound(Bytes));
+        ZSTD_CCtx *CCtx = ZSTD_createCCtx();
+        size_t ZSize = ZSTD_compress_usingDict(CCtx, &Z[0], Z.size(), Data, Bytes,
+                                               Dict->Data, Dict->Size, ZstdDictLevel);
+        ZSTD_freeCCtx(CCtx);
+
+    if (!ZSTD_isError(ZSize) && ZSize < Best) {
+            vector<unsigned char> Check(Bytes);
+            ZSTD_DCtx *DCtx = ZSTD_createDCtx();
+            size_t DSize = ZSTD_decompress_usingDDict(DCtx, &Check[0], Bytes, &Z[0], ZSize,
+                                                      Dict->DDict);
+            ZSTD_freeDCtx(DCtx);
+            if (DSize != Bytes || memcmp(&Check[0], Data, Bytes) != 0)
+                ZSize = Best;
+        }
 
-        // Only makes sense to build octree if we are going to partition the ranks
-        if (numOctreeLevels < 2)
-            hasOctree = false;
+    if (!ZSTD_isError(ZSize) && ZSize < Best) {
+            F = FrameZstdDict;
+            Best = ZSize;
+            std::copy(Z.begin(), Z.begin() + ZSize, &Frame[DataStart]);
+        }
     }
 
-    //
-    // Octree
-    if (hasOctree)
-    {
-        Timer initOctreeClock, findLeafExtentClock, findPartitionClock, rearrageClock, gatherClock, createOctreeHeaderClock;
+  if (F == FrameRaw) {
+        Frame.resize(Start);
+        return F;
+    }
 
-      Memory ongoingMem;          ongoingMem.start();
-      Timer createOctreeClock;    createOctreeClock.start();
-        
+    Frame.resize(DataStart + Best);
+    CompressHeader<IsBigEndian> *CH = (CompressHeader<IsBigEndian> *) &Frame[Start];
+    CH->OrigCRC = crc64_omp(Data, Bytes);
+    return F;
+}
 
-        #define DEBUG_ON 0
-      #ifdef DEBUG_ON
-        std::stringstream log;
-      #endif
+// Adaptive codec selection compresses a sample of SelectPieces pieces, of
+// SelectPieceBytes each and spread over the data, with each codec alone.
+static const size_t SelectPieces = 4;
+static const size_t SelectPieceBytes = 16*1024;
+// A codec saving less than this fraction of the sample is not worth its CPU
+// time, and the data is stored raw.
+static const double SelectMinSaving = 0.05;
+
+// Returns the codec (as a mask for compressFrame) which best compresses a
+// sample of Data among those compressing at least MinMBps MB/s, or zero when
+// the data should be stored raw.
+template <bool IsBigEndian>
+static unsigned selectCodec(const void *Data, size_t Bytes, size_t TypeSize,
+                            size_t IntSize, bool IsSigned, const FrameDictionary *Dict,
+                            double MinMBps) {
+    size_t RowSize = std::max<size_t>(TypeSize, 1);
+    size_t PieceBytes = std::max<size_t>(SelectPieceBytes / RowSize, 1) * RowSize;
+    size_t NRows = Bytes / RowSize;
+
+    const char *Sample = (const char *) Data;
+    size_t SampleBytes = NRows * RowSize;
+    vector<char> Pieces;
+  if (SampleBytes > SelectPieces * PieceBytes) {
+        size_t PieceRows = PieceBytes / RowSize;
+        for (size_t p = 0; p < SelectPieces; ++p) {
+            size_t Row = (NRows - PieceRows) / (SelectPieces - 1) * p;
+            Pieces.insert(Pieces.end(), Sample + Row * RowSize,
+                          Sample + (Row + PieceRows) * RowSize);
+        }
 
-        size_t numParticles = NElems;   // num of particles for my rank
+        Sample = &Pieces[0];
+        SampleBytes = Pieces.size();
+    }
 
-        //
-        // MPI Rank 
-        int myRank = Rank;
-        int numRanks = NRanks;
+    if (SampleBytes == 0)
+        return 0;
+
+    unsigned Best = 0;
+    size_t BestSize = (size_t) (SampleBytes * (1.0 - SelectMinSaving));
+    vector<unsigned char> Frame;
+  for (unsigned C = 1; C <= CodecsAll; C <<= 1) {
+        if ((C & (CodecIntPack | CodecIntPackBlosc)) && IntSize == 0)
+            continue;
+        if (C == CodecZstdDict && !Dict)
+            continue;
+
+        Frame.clear();
+        std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+        FrameFilter F = compressFrame<IsBigEndian>(Sample, SampleBytes, TypeSize, IntSize,
+                                                   IsSigned, Frame, Dict, C, true);
+        double Time = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - Start).count();
+        if (F == FrameRaw)
+            continue;
+
+        size_t Size = Frame.size() - sizeof(CompressHeader<IsBigEndian>);
+        if (Time > 0 && SampleBytes / Time < MinMBps * 1e6)
+            continue;
+
+    if (Size < BestSize) {
+            Best = C;
+            BestSize = Size;
+        }
+    }
 
+    return Best;
+}
+#endif
 
-        //
-        // Simulation and rank extents
-        float simExtents[6];
-        simExtents[0] = PhysOrigin[0];  simExtents[1] = PhysScale[0];
-        simExtents[2] = PhysOrigin[1];  simExtents[3] = PhysScale[1];
-        simExtents[4] = PhysOrigin[2];  simExtents[5] = PhysScale[2];
+// Undoes compressFrame: the frame (FrameSize bytes, without its CRC) is
+// unpacked into Dest, which holds DestSize bytes. DDict is the variable's
+// dictionary, if the file has one. Returns 0 on success and 2 for a
+// decompression CRC error (or malformed data).
+template <bool IsBigEndian>
+static int decompressFrame(FrameFilter F, const unsigned char *Frame, size_t FrameSize,
+                           void *Dest, size_t DestSize, const ZSTD_DDict *DDict = 0) {
+    if (FrameSize < sizeof(CompressHeader<IsBigEndian>))
+        return 2;
+
+    const CompressHeader<IsBigEndian> *CH = (const CompressHeader<IsBigEndian> *) Frame;
+    const unsigned char *Data = Frame + sizeof(CompressHeader<IsBigEndian>);
+    size_t DataSize = FrameSize - sizeof(CompressHeader<IsBigEndian>);
+
+  if (F == FrameBlosc) {
+        if (decompressBlosc(Data, Dest, DestSize) != (int) DestSize)
+            return 2;
+  } else if (F == FrameIntPack) {
+        if (!intUnpack<IsBigEndian>(Data, DataSize, Dest, DestSize))
+            return 2;
+  } else if (F == FrameIntPackBlosc) {
+        size_t NBytes, CBytes, BlockSize;
+        blosc_cbuffer_sizes(Data, &NBytes, &CBytes, &BlockSize);
+        if (CBytes > DataSize || NBytes == 0)
+            return 2;
+
+        vector<unsigned char> Packed(NBytes);
+        if (decompressBlosc(Data, &Packed[0], NBytes) != (int) NBytes ||
+            !intUnpack<IsBigEndian>(&Packed[0], NBytes, Dest, DestSize))
+            return 2;
+  } else if (F == FrameZstdDict) {
+        if (!DDict)
+            return 2;
+
+        ZSTD_DCtx *DCtx = ZSTD_createDCtx();
+        size_t Size = ZSTD_decompress_usingDDict(DCtx, Dest, DestSize, Data, DataSize, DDict);
+        ZSTD_freeDCtx(DCtx);
+        if (ZSTD_isError(Size) || Size != DestSize)
+            return 2;
+  } else {
+        return 2;
+    }
 
-        float physicalDims[3];
-        for (int i=0; i<3; i++)
-            physicalDims[i] = (PhysScale[i]-PhysOrigin[i])/Dims[i];
+    if (CH->OrigCRC != crc64_omp(Dest, DestSize))
+        return 2;
 
-        float myRankExtents[6];
-        for (int i=0; i<3; i++)
-        {
-            myRankExtents[i*2]     = Coords[i] * physicalDims[i];
-            myRankExtents[i*2 + 1] = myRankExtents[i*2] + physicalDims[i];
-        }
+    return 0;
+}
 
-      
-            
-      initOctreeClock.start();
+// The frame filter named by a chunk header.
+static FrameFilter chunkFrameFilter(const char *Filter) {
+    if (Filter[0] == '\0')
+        return FrameRaw;
+    if (strncmp(Filter, CompressName, FilterNameSize) == 0)
+        return FrameBlosc;
+    if (strncmp(Filter, IntPackName, FilterNameSize) == 0)
+        return FrameIntPack;
+    if (strncmp(Filter, IntPackBloscName, FilterNameSize) == 0)
+        return FrameIntPackBlosc;
+    if (strncmp(Filter, ZstdDictName, FilterNameSize) == 0)
+        return FrameZstdDict;
+
+    stringstream ss;
+    ss << "Unknown chunk filter \"" << string(Filter, strnlen(Filter, FilterNameSize)) << "\"";
+    throw runtime_error(ss.str());
+}
 
-        //
-        // Create octree structure
-        Octree gioOctree(myRank, myRankExtents);
-        gioOctree.init(numOctreeLevels, simExtents, Dims[0], Dims[1], Dims[2]); // num octree levels, sim extent, sim decompisition
+// The frame filter named by a block header, except that chunked blocks (whose
+// chunks name their own filters) set IsChunked instead. Throws for unknown
+// filters.
+template <bool IsBigEndian>
+static FrameFilter blockFrameFilter(const BlockHeader<IsBigEndian> *BH, bool &IsChunked,
+                                    const string &VarName) {
+    FrameFilter F = FrameRaw;
+    size_t NUsed = 1;
+    IsChunked = false;
+  if (strncmp(BH->Filters[0], ChunkedName, FilterNameSize) == 0) {
+        IsChunked = true;
+        if (strncmp(BH->Filters[1], TransposedName, FilterNameSize) == 0)
+            NUsed = 2;
+  } else if (strncmp(BH->Filters[0], CompressName, FilterNameSize) == 0) {
+        F = FrameBlosc;
+  } else if (strncmp(BH->Filters[0], IntPackName, FilterNameSize) == 0) {
+        F = FrameIntPack;
+    if (strncmp(BH->Filters[1], CompressName, FilterNameSize) == 0) {
+            F = FrameIntPackBlosc;
+            NUsed = 2;
+        }
+  } else if (strncmp(BH->Filters[0], ZstdDictName, FilterNameSize) == 0) {
+        F = FrameZstdDict;
+  } else {
+        NUsed = 0;
+    }
 
-      initOctreeClock.stop();
-      findLeafExtentClock.start();
+    for (size_t f = NUsed; f < MaxFilters; ++f)
+    if (BH->Filters[f][0] != '\0') {
+            stringstream ss;
+            ss << "Unknown filter \"" << string(BH->Filters[f], strnlen(BH->Filters[f], FilterNameSize)) <<
+               "\" on variable " << VarName;
+            throw runtime_error(ss.str());
+        }
 
-        //
-        // Get the extents of each of my leaves
-        std::vector<float> leavesExtentsVec = gioOctree.getMyLeavesExtent(myRankExtents, numOctreeLevels);
-        int numleavesForMyRank = leavesExtentsVec.size()/6;
-        float *leavesExtents = &leavesExtentsVec[0];
+    return F;
+}
 
-      findLeafExtentClock.stop();
-      findPartitionClock.start();
+template <bool IsBigEndian>
+static bool isTransposed(const BlockHeader<IsBigEndian> *BH) {
+    return strncmp(BH->Filters[0], ChunkedName, FilterNameSize) == 0 &&
+           strncmp(BH->Filters[1], TransposedName, FilterNameSize) == 0;
+}
 
+template <bool IsBigEndian>
+static size_t chunkTableSize(uint64_t NChunks) {
+    return sizeof(ChunkTableHeader<IsBigEndian>) + NChunks * sizeof(ChunkHeader<IsBigEndian>);
+}
 
-        //
-        // Find the partition for each particle
-        // Use fisrt instance of position for octree
-        float *_xx, *_yy, *_zz;
-        for (size_t i = 0; i < Vars.size(); ++i)
-            if (Vars[i].IsPhysCoordX)
-            {
-                _xx = (float*)Vars[i].Data;
-                break;
-            }
+// Copies N values of ES bytes, InStride bytes apart in In, to OutStride bytes
+// apart in Out (gathering or scattering the components of rows).
+template <size_t ES>
+static void copyStrided(const char *In, size_t InStride, char *Out, size_t OutStride,
+                        uint64_t N) {
+    for (uint64_t r = 0; r < N; ++r)
+        memcpy(Out + r * OutStride, In + r * InStride, ES);
+}
 
-        for (size_t i = 0; i < Vars.size(); ++i)
-            if (Vars[i].IsPhysCoordY)
-            {
-                _yy = (float*)Vars[i].Data;
-                break;
-            }
+static void copyStrided(const char *In, size_t InStride, char *Out, size_t OutStride,
+                        uint64_t N, size_t ES) {
+  if (InStride == ES && OutStride == ES) {
+        memcpy(Out, In, N * ES);
+        return;
+    }
 
-        for (size_t i = 0; i < Vars.size(); ++i)
-            if (Vars[i].IsPhysCoordZ)
-            {
-                _zz = (float*)Vars[i].Data;
-                break;
-            }
-    
-        // Find the partition
-        std::vector<int> leafPosition;                    // which leaf is the particle in
-        std::vector<uint64_t> numParticlesForMyLeaf;      // #particles per leaf
-        numParticlesForMyLeaf = gioOctree.findLeaf(_xx,_yy,_zz, numParticles, numleavesForMyRank, leavesExtents, leafPosition);
+  switch (ES) {
+    case 1: copyStrided<1>(In, InStride, Out, OutStride, N); break;
+    case 2: copyStrided<2>(In, InStride, Out, OutStride, N); break;
+    case 4: copyStrided<4>(In, InStride, Out, OutStride, N); break;
+    case 8: copyStrided<8>(In, InStride, Out, OutStride, N); break;
+    default:
+        for (uint64_t r = 0; r < N; ++r)
+            memcpy(Out + r * OutStride, In + r * InStride, ES);
+    }
+}
 
+#ifndef GENERICIO_NO_MPI
+static const char *chunkFilterName(FrameFilter F) {
+  switch (F) {
+    case FrameBlosc: return CompressName;
+    case FrameIntPack: return IntPackName;
+    case FrameIntPackBlosc: return IntPackBloscName;
+    case FrameZstdDict: return ZstdDictName;
+    default: return "";
+    }
+}
 
-      findPartitionClock.stop();
+static void setBlockFilters(char (*Filters)[FilterNameSize], FrameFilter F) {
+  if (F == FrameBlosc) {
+        strncpy(Filters[0], CompressName, FilterNameSize);
+  } else if (F == FrameZstdDict) {
+        strncpy(Filters[0], ZstdDictName, FilterNameSize);
+  } else if (F == FrameIntPack || F == FrameIntPackBlosc) {
+        strncpy(Filters[0], IntPackName, FilterNameSize);
+        if (F == FrameIntPackBlosc)
+            strncpy(Filters[1], CompressName, FilterNameSize);
+    }
+}
 
+// Builds a chunked block (without the trailing block CRC) from Streams, each
+// of NElems rows of RowSize bytes (a single stream, or the components of a
+// transposed variable), the chunks of each stream listed in turn. Each
+// stream is compressed with its Codecs (or not at all, for zero); IntSize and
+// Dict are as for compressFrame.
+template <bool IsBigEndian>
+static void packChunks(const vector<const void *> &Streams, uint64_t NElems, size_t RowSize,
+                       uint64_t ChunkRows, bool ShouldCompress,
+                       size_t IntSize, bool IsSigned, const FrameDictionary *Dict,
+                       const vector<unsigned> &Codecs, vector<unsigned char> &Block) {
+    uint64_t NStreamChunks = (NElems + ChunkRows - 1) / ChunkRows;
+    uint64_t NChunks = Streams.size() * NStreamChunks;
+    size_t TableSize = chunkTableSize<IsBigEndian>(NChunks);
+
+    Block.assign(TableSize + CRCSize, 0);
+    Block.reserve(TableSize + CRCSize + Streams.size() * NElems * RowSize +
+                  NChunks * (sizeof(CompressHeader<IsBigEndian>) + CRCSize));
+
+    if (ShouldCompress)
+        initBlosc();
+
+  for (uint64_t e = 0; e < NChunks; ++e) {
+        size_t k = e / NStreamChunks;
+        uint64_t c = e % NStreamChunks;
+        const char *CData = ((const char *) Streams[k]) + c * ChunkRows * RowSize;
+        size_t CBytes = std::min(ChunkRows, NElems - c * ChunkRows) * RowSize;
+        size_t Start = Block.size();
+
+        FrameFilter F = FrameRaw;
+        if (ShouldCompress && Codecs[k])
+            F = compressFrame<IsBigEndian>(CData, CBytes, RowSize, IntSize, IsSigned, Block,
+                                           Dict, Codecs[k]);
+
+        if (F == FrameRaw)
+            Block.insert(Block.end(), CData, CData + CBytes);
+
+        ChunkHeader<IsBigEndian> *CE =
+            ((ChunkHeader<IsBigEndian> *) &Block[sizeof(ChunkTableHeader<IsBigEndian>)]) + e;
+        strncpy(CE->Filter, chunkFilterName(F), FilterNameSize);
+        CE->Start = Start;
+        CE->Size = Block.size() - Start;
+
+        Block.resize(Block.size() + CRCSize);
+        crc64_invert(crc64_omp(&Block[Start], Block.size() - Start - CRCSize),
+                     &Block[Block.size() - CRCSize]);
+    }
 
-      #ifdef DEBUG_ON
-        log << "\nnumleavesForMyRank: " << numleavesForMyRank << std::endl;
-        log << "numParticles: " << numParticles << "\n";
-        log << "octreeLeafshuffle: " << octreeLeafshuffle << "\n";
-        
-        log << "\nOctree initialization took : " << initOctreeClock.getDuration() << " s\n";
-        log << "Octree Find octree leaf extents took : " << findLeafExtentClock.getDuration() << " s\n";
-        log << "Octree Find particle position took : " << findPartitionClock.getDuration() << " s\n";
-        log << "\n|After findLeaf: " << ongoingMem.getMemoryInUseInMB() << " MB " << std::endl;
-      #endif
-      
-      rearrageClock.start();
+    ChunkTableHeader<IsBigEndian> *TH = (ChunkTableHeader<IsBigEndian> *) &Block[0];
+    TH->ChunkRows = ChunkRows;
+    TH->NChunks = NChunks;
+    crc64_invert(crc64_omp(&Block[0], TableSize), &Block[TableSize]);
+}
+#endif
 
+// Unpacks one chunk (Frame points to its data, followed by its CRC) into
+// Dest. Returns 0 on success, 1 for a CRC error and 2 for a decompression CRC
+// error.
+template <bool IsBigEndian>
+static int unpackChunk(const ChunkHeader<IsBigEndian> *CE, unsigned char *Frame,
+                       bool CheckCRC, void *Dest, size_t DestSize,
+                       const ZSTD_DDict *DDict) {
+    if (CheckCRC && crc64_omp(Frame, CE->Size + CRCSize) != (uint64_t) -1)
+        return 1;
+
+    FrameFilter F = chunkFrameFilter(CE->Filter);
+  if (F != FrameRaw) {
+        return decompressFrame<IsBigEndian>(F, Frame, CE->Size, Dest, DestSize, DDict);
+  } else {
+        if (CE->Size != DestSize)
+            return 1;
 
-        //
-        // Duplicate each of the variable
-        useDuplicateData = true;
-        for (size_t i = 0; i < Vars.size(); ++i)
-        {
-            _Vars[i].init(i, Vars[i].Name, static_cast<int>(Vars[i].Size), Vars[i].IsFloat, Vars[i].IsSigned, Vars[i].IsPhysCoordX, Vars[i].IsPhysCoordY, Vars[i].IsPhysCoordZ);
-            _Vars[i].setNumElements(numParticles);
-            _Vars[i].allocateMem(1);
+        std::copy(Frame, Frame + DestSize, (unsigned char *) Dest);
+    }
 
-            std::memcpy(_Vars[i].data, Vars[i].Data, numParticles*Vars[i].Size );
+    return 0;
+}
 
+// Unpacks a whole chunked block, whose block CRC has already been checked,
+// into rows of RowSize bytes. Transposed blocks have NComps components
+// (otherwise one), which are interleaved into the rows.
+template <bool IsBigEndian>
+static int unpackChunkedBlock(unsigned char *Block, uint64_t NElems, size_t RowSize,
+                              size_t NComps, void *Dest, const ZSTD_DDict *DDict) {
+    ChunkTableHeader<IsBigEndian> *TH = (ChunkTableHeader<IsBigEndian> *) Block;
+    uint64_t ChunkRows = TH->ChunkRows, NChunks = TH->NChunks;
+    if (ChunkRows == 0 || NChunks != NComps * ((NElems + ChunkRows - 1) / ChunkRows))
+        return 1;
+
+    uint64_t NStreamChunks = NChunks / NComps;
+    size_t ElemSize = RowSize / NComps;
+    vector<char> Values;
+    ChunkHeader<IsBigEndian> *CE = (ChunkHeader<IsBigEndian> *) (TH + 1);
+  for (uint64_t e = 0; e < NChunks; ++e) {
+        size_t k = e / NStreamChunks;
+        uint64_t c = e % NStreamChunks;
+        uint64_t CRows = std::min(ChunkRows, NElems - c * ChunkRows);
+        char *Out = ((char *) Dest) + c * ChunkRows * RowSize;
+    if (NComps == 1) {
+            int Err = unpackChunk<IsBigEndian>(&CE[e], Block + CE[e].Start, false, Out,
+                                               CRows * RowSize, DDict);
+            if (Err)
+                return Err;
+            continue;
         }
 
-        //
-        // Rearrange the array based on leaves
-        for (size_t i = 0; i < Vars.size(); ++i)
-        {
-            if (Vars[i].IsFloat)
-            {
-                float *_temp;
-                _temp = (float*)_Vars[i].data;
-                gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _temp, numParticles, octreeLeafshuffle);
-            }
-            else
-                if (Vars[i].IsSigned)
-                {
-                    if (Vars[i].Size == 1)
-                    {
-                        int8_t *_temp;
-                        _temp = (int8_t*)_Vars[i].data;
-                        gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _temp, numParticles, octreeLeafshuffle);
-                    }
-                    else if (Vars[i].Size == 2)
-                    {
-                        int16_t *_temp;
-                        _temp = (int16_t*)_Vars[i].data;
-                        gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _temp, numParticles, octreeLeafshuffle);
-                    }
-                    else if (Vars[i].Size == 4)
-                    {
-                        int32_t *_temp;
-                        _temp = (int32_t*)_Vars[i].data;
-                        gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _temp, numParticles, octreeLeafshuffle);
-                    }
-                    else if (Vars[i].Size == 8)
-                    {
-                        int64_t *_temp;
-                        _temp = (int64_t*)_Vars[i].data;
-                        gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _temp, numParticles, octreeLeafshuffle);
-                    }
-                }
-                else
-                {
-                    if (Vars[i].Size == 1)
-                    {
-                        uint8_t *_temp;
-                        _temp = (uint8_t*)_Vars[i].data;
-                        gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _temp, numParticles, octreeLeafshuffle);
-                    }
-                    else if (Vars[i].Size == 2)
-                    {
-                        uint16_t *_temp;
-                        _temp = (uint16_t*)_Vars[i].data;
-                        gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _temp, numParticles, octreeLeafshuffle);
-                    }
-                    else if (Vars[i].Size == 4)
-                    {
-                        uint32_t *_temp;
-                        _temp = (uint32_t*)_Vars[i].data;
-                        gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _temp, numParticles, octreeLeafshuffle);
-                    }
-                    else if (Vars[i].Size == 8)
-                    {
-                        uint64_t *_temp;
-                        _temp = (uint64_t*)_Vars[i].data;
-                        gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _temp, numParticles, octreeLeafshuffle);
-                    }
-                    
-                }
+        Values.resize(CRows * ElemSize);
+        int Err = unpackChunk<IsBigEndian>(&CE[e], Block + CE[e].Start, false, &Values[0],
+                                           Values.size(), DDict);
+        if (Err)
+            return Err;
 
-          #ifdef DEBUG_ON
-            log << gioOctree.getLog();
-          #endif
-        }
+        copyStrided(&Values[0], ElemSize, Out + k * ElemSize, RowSize, CRows, ElemSize);
+    }
 
-        leafPosition.clear();   leafPosition.shrink_to_fit();
+    return 0;
+}
 
-      rearrageClock.stop(); 
-      gatherClock.start();
+// Reads rows [FirstRow, FirstRow + NRows) of the chunked block starting at
+// BlockStart into Dest, reading and checking only the chunk table and the
+// chunks which overlap those rows. Transposed blocks have NComps components
+// (otherwise one); all of them are read and interleaved into rows of RowSize
+// bytes when Comp is negative, and otherwise only component Comp, whose values
+// are stored consecutively. Returns as unpackChunk does; I/O errors are
+// thrown.
+template <bool IsBigEndian>
+static int readChunkedRows(GenericFileIO *GFIO, uint64_t BlockStart, uint64_t NElems,
+                           size_t RowSize, size_t NComps, int Comp,
+                           uint64_t FirstRow, uint64_t NRows,
+                           void *Dest, const string &Name, uint64_t &ReadSize,
+                           const ZSTD_DDict *DDict) {
+    ChunkTableHeader<IsBigEndian> TH;
+    GFIO->read(&TH, sizeof(TH), BlockStart, Name + " chunk table");
+    ReadSize = sizeof(TH);
+
+    uint64_t ChunkRows = TH.ChunkRows, NChunks = TH.NChunks;
+    if (ChunkRows == 0 || NChunks != NComps * ((NElems + ChunkRows - 1) / ChunkRows))
+        return 1;
+
+    vector<unsigned char> Table(chunkTableSize<IsBigEndian>(NChunks) + CRCSize);
+    GFIO->read(&Table[0], Table.size(), BlockStart, Name + " chunk table");
+    ReadSize += Table.size();
+
+    if (crc64_omp(&Table[0], Table.size()) != (uint64_t) -1)
+        return 1;
+
+    if (NRows == 0)
+        return 0;
+
+    uint64_t NStreamChunks = NChunks / NComps;
+    size_t ElemSize = RowSize / NComps;
+    size_t OutRowSize = Comp < 0 ? RowSize : ElemSize;
+    uint64_t FirstChunk = FirstRow / ChunkRows,
+             LastChunk = (FirstRow + NRows - 1) / ChunkRows;
+
+    vector<unsigned char> Span, Rows;
+  for (size_t k = 0; k < NComps; ++k) {
+        if (Comp >= 0 && k != (size_t) Comp)
+            continue;
+
+        ChunkHeader<IsBigEndian> *CE =
+            ((ChunkHeader<IsBigEndian> *) &Table[sizeof(ChunkTableHeader<IsBigEndian>)]) +
+            k * NStreamChunks;
+        uint64_t SpanStart = CE[FirstChunk].Start,
+                 SpanEnd = CE[LastChunk].Start + CE[LastChunk].Size + CRCSize;
+
+        Span.resize(SpanEnd - SpanStart);
+        GFIO->read(&Span[0], Span.size(), BlockStart + SpanStart, Name);
+        ReadSize += Span.size();
+
+    for (uint64_t c = FirstChunk; c <= LastChunk; ++c) {
+            uint64_t ChunkFirstRow = c * ChunkRows;
+            uint64_t ChunkNRows = std::min(ChunkRows, NElems - ChunkFirstRow);
+            uint64_t Begin = std::max(FirstRow, ChunkFirstRow),
+                     End = std::min(FirstRow + NRows, ChunkFirstRow + ChunkNRows);
+            char *Out = ((char *) Dest) + (Begin - FirstRow) * OutRowSize;
+
+            // Whole chunks of consecutive values are unpacked in place, others
+            // through a buffer.
+            bool InPlace = (Begin == ChunkFirstRow && End == ChunkFirstRow + ChunkNRows &&
+                            OutRowSize == ElemSize);
+            if (!InPlace)
+                Rows.resize(ChunkNRows * ElemSize);
+
+            int Err = unpackChunk<IsBigEndian>(&CE[c], &Span[CE[c].Start - SpanStart], true,
+                                               InPlace ? (void *) Out : (void *) &Rows[0],
+                                               ChunkNRows * ElemSize, DDict);
+            if (Err)
+                return Err;
+
+            if (!InPlace)
+                copyStrided((const char *) &Rows[(Begin - ChunkFirstRow) * ElemSize], ElemSize,
+                            Out + (Comp < 0 ? k * ElemSize : 0), OutRowSize, End - Begin,
+                            ElemSize);
+        }
+    }
 
+    return 0;
+}
 
-        //
-        // Gather num leaves each rank has
-        int *numLeavesPerRank = new int[numRanks];
-        MPI_Allgather( &numleavesForMyRank, 1, MPI_INT,  numLeavesPerRank, 1, MPI_INT,  MPI_COMM_WORLD);
-    
+// Wall-clock time in seconds, comparable across the ranks where MPI provides
+// a global clock.
+static double statNow() {
+  #ifndef GENERICIO_NO_MPI
+    return MPI_Wtime();
+  #else
+    return std::chrono::duration<double>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
+  #endif
+}
 
+const char *GenericIO::getStatPhaseName(StatPhase P) {
+    static const char *Names[NumStatPhases] = {
+        "io", "crc", "compress", "decompress", "bswap", "octree", "header", "barrier"
+    };
 
-        //
-        // Gather num particles in each leaf for each rank
-        int totalLeavesForSim = numLeavesPerRank[0];
+    return Names[P];
+}
 
-        int *_offsets = new int[numRanks];
-        _offsets[0] = 0;
+bool GenericIO::traceFull() const {
+    size_t Max = MaxTraceEvents;
+    const char *EnvStr = getenv("GENERICIO_TRACE_EVENTS");
+    if (EnvStr)
+        Max = strtoull(EnvStr, 0, 10);
 
-        for (int i=1; i<numRanks; i++)
-        {
-            totalLeavesForSim += numLeavesPerRank[i];
-            _offsets[i] = _offsets[i-1] + numLeavesPerRank[i-1];
+    return TraceEvents.size() >= Max;
+}
+
+void GenericIO::beginCall(const char *Call) {
+    if (getenv("GENERICIO_TRACE"))
+        Tracing = true;
+
+    CallStart = statNow();
+    CallRetriesBefore = ReadStats.Retries;
+    CurVar = -1;
+
+    // Untraced calls, including those made once the trace is full, are
+    // accumulated into the (untraced) record of their name, so that neither
+    // the log nor the trace grows without bound.
+    bool Traced = Tracing && !traceFull();
+  if (!Traced) {
+    for (size_t i = 0; i < CallLog.size(); ++i) {
+      if (!CallLog[i].Traced && CallLog[i].Call == Call) {
+                CurCall = i;
+                return;
+            }
         }
+    }
 
-        uint64_t *numParticlesPerLeaf = new uint64_t[totalLeavesForSim];
-        uint64_t *myLeavesCount = &numParticlesForMyLeaf[0];
-        MPI_Allgatherv( myLeavesCount, numleavesForMyRank, MPI_UINT64_T,  numParticlesPerLeaf, numLeavesPerRank, _offsets, MPI_UINT64_T,  MPI_COMM_WORLD); 
+    CallStats CS;
+    CS.Call = Call;
+    CS.Traced = Traced;
+    CS.Start = CallStart;
+    CS.TotalTime = 0;
+    CS.FileBytes = CS.RawBytes = CS.Retries = 0;
+    std::fill(CS.Time, CS.Time + NumStatPhases, 0.0);
 
-        if (_offsets != NULL)
-            delete []_offsets;
-        _offsets = NULL;
+    CallLog.push_back(CS);
+    CurCall = CallLog.size() - 1;
+}
 
+void GenericIO::endCall() {
+    CallStats &CS = CallLog[CurCall];
+    CS.TotalTime += statNow() - CallStart;
+    CS.Retries += ReadStats.Retries - CallRetriesBefore;
 
+    CurCall = CurVar = -1;
+}
 
-        //
-        // Gather extents for each rank        
-        int *_extentsCountPerRank = new int[numRanks];
-        int *_offsetsExtents = new int[numRanks];
-        float *allOctreeLeavesExtents = new float[totalLeavesForSim*6];
-        
-        _offsetsExtents[0] = 0;
-        _extentsCountPerRank[0] = numLeavesPerRank[0]*6;
-        for (int r=1; r<numRanks; r++)
-        {
-            _extentsCountPerRank[r] = numLeavesPerRank[r]*6;
-            _offsetsExtents[r] = _offsetsExtents[r-1] + numLeavesPerRank[r-1]*6;
-        }
-        
-        MPI_Allgatherv(leavesExtents, numleavesForMyRank*6, MPI_FLOAT,  allOctreeLeavesExtents, _extentsCountPerRank, _offsetsExtents, MPI_FLOAT,  MPI_COMM_WORLD); 
+void GenericIO::beginVariable(const string &Name) {
+    if (CurCall < 0)
+        return;
 
+    vector<VariableStats> &VS = CallLog[CurCall].Vars;
+  for (size_t i = 0; i < VS.size(); ++i) {
+    if (VS[i].Name == Name) {
+            CurVar = i;
+            return;
+        }
+    }
 
-        leavesExtentsVec.clear();   leavesExtentsVec.shrink_to_fit();
-        leavesExtents = NULL;
+    VariableStats V;
+    V.Name = Name;
+    V.FileBytes = V.RawBytes = 0;
+    std::fill(V.Time, V.Time + NumStatPhases, 0.0);
 
-        if (_offsetsExtents != NULL)
-            delete []_offsetsExtents;
-        _offsetsExtents = NULL;
+    VS.push_back(V);
+    CurVar = VS.size() - 1;
+}
 
-        if (_extentsCountPerRank != NULL)
-            delete []_extentsCountPerRank;
-        _extentsCountPerRank = NULL;
+void GenericIO::addPhase(StatPhase P, double Start) {
+    if (CurCall < 0)
+        return;
 
-      gatherClock.stop();
-      createOctreeHeaderClock.start();
-      
+    double Time = statNow() - Start;
+    CallLog[CurCall].Time[P] += Time;
+    if (CurVar >= 0)
+        CallLog[CurCall].Vars[CurVar].Time[P] += Time;
 
-        if (SplitRank == 0)
-        {
-            //
-            // Create Header info
-            addOctreeHeader( (uint64_t)((int)octreeLeafshuffle), (uint64_t)numOctreeLevels, (uint64_t)totalLeavesForSim );
+  if (Tracing) {
+    if (!CallLog[CurCall].Traced || traceFull()) {
+            ++DroppedTraceEvents;
+    } else {
+            TraceEvent E = { CurCall, CurVar, P, Start, Time };
+            TraceEvents.push_back(E);
+        }
+    }
+}
 
-            //
-            // Add Octree ranks
-            int _leafCounter = 0;
-            for (int r=0; r<numRanks; r++)
-            {
-                uint64_t offsetInRank = 0;
-                for (int l=0; l<numLeavesPerRank[r]; l++)
-                {
-                    uint64_t _leafExtents[6];
+void GenericIO::addBytes(uint64_t FileBytes, uint64_t RawBytes) {
+    if (CurCall < 0)
+        return;
 
-                    for (int i=0; i<6; i++)
-                        _leafExtents[i] = (uint64_t) round( allOctreeLeavesExtents[_leafCounter*6 + i] );
-                                            
-                    addOctreeRow(_leafCounter, _leafExtents, numParticlesPerLeaf[_leafCounter], offsetInRank, r);
+    CallLog[CurCall].FileBytes += FileBytes;
+    CallLog[CurCall].RawBytes += RawBytes;
+  if (CurVar >= 0) {
+        CallLog[CurCall].Vars[CurVar].FileBytes += FileBytes;
+        CallLog[CurCall].Vars[CurVar].RawBytes += RawBytes;
+    }
+}
 
-                    offsetInRank += numParticlesPerLeaf[_leafCounter];
-                    _leafCounter++;
-                }
-            }
-        }
+void GenericIO::reduceCallStats(ReducedStats &RS) {
+    const int NValues = NumStatPhases + 1;
 
-        
+    double Local[NValues];
+    std::fill(Local, Local + NValues, 0.0);
+    uint64_t LocalCounts[3] = { 0, 0, 0 };
+  for (size_t i = 0; i < CallLog.size(); ++i) {
+        for (int p = 0; p < NumStatPhases; ++p)
+            Local[p] += CallLog[i].Time[p];
+        Local[NumStatPhases] += CallLog[i].TotalTime;
 
-        if (numLeavesPerRank != NULL)
-            delete []numLeavesPerRank;
-        numLeavesPerRank = NULL;
+        LocalCounts[0] += CallLog[i].FileBytes;
+        LocalCounts[1] += CallLog[i].RawBytes;
+        LocalCounts[2] += CallLog[i].Retries;
+    }
 
-        if (numParticlesPerLeaf != NULL)
-            delete []numParticlesPerLeaf;
-        numParticlesPerLeaf = NULL;
+  #ifndef GENERICIO_NO_MPI
+    int NRanks, Rank;
+    MPI_Comm_rank(Comm, &Rank);
+    MPI_Comm_size(Comm, &NRanks);
 
-        if (allOctreeLeavesExtents != NULL)
-            delete []allOctreeLeavesExtents;
-        allOctreeLeavesExtents = NULL;
+    MPI_Allreduce(Local, RS.Min, NValues, MPI_DOUBLE, MPI_MIN, Comm);
+    MPI_Allreduce(Local, RS.Mean, NValues, MPI_DOUBLE, MPI_SUM, Comm);
+    for (int p = 0; p < NValues; ++p)
+        RS.Mean[p] /= NRanks;
 
+    struct { double Value; int Rank; } LocalLoc[NValues], MaxLoc[NValues];
+  for (int p = 0; p < NValues; ++p) {
+        LocalLoc[p].Value = Local[p];
+        LocalLoc[p].Rank = Rank;
+    }
 
-      createOctreeHeaderClock.stop();
-      ongoingMem.stop();
-      createOctreeClock.stop();
+    MPI_Allreduce(LocalLoc, MaxLoc, NValues, MPI_DOUBLE_INT, MPI_MAXLOC, Comm);
+  for (int p = 0; p < NValues; ++p) {
+        RS.Max[p] = MaxLoc[p].Value;
+        RS.MaxRank[p] = MaxLoc[p].Rank;
+    }
 
+    uint64_t Counts[3];
+    MPI_Allreduce(LocalCounts, Counts, 3, MPI_UINT64_T, MPI_SUM, Comm);
+  #else
+  for (int p = 0; p < NValues; ++p) {
+        RS.Min[p] = RS.Max[p] = RS.Mean[p] = Local[p];
+        RS.MaxRank[p] = 0;
+    }
 
-      #ifdef DEBUG_ON
-        log << "\nOctree rearrage took : " << rearrageClock.getDuration() << " s\n";
-        log << "Octree gathers took : " << gatherClock.getDuration() << " s\n";
-        log << "Octree octree header creation took : " << createOctreeHeaderClock.getDuration() << " s\n";
+    uint64_t *Counts = LocalCounts;
+  #endif
 
-        log << "\n|After, mem leaked: " << ongoingMem.getMemorySizeInMB() << " MB " << std::endl;
-        log << "\n\nOctree processing took:: " << createOctreeClock.getDuration() << " s " << std::endl;
-        writeLog("log_" + std::to_string(myRank) ,log.str());
-      #endif
-    }   // end octree
-    
+    RS.FileBytes = Counts[0];
+    RS.RawBytes = Counts[1];
+    RS.Retries = Counts[2];
+}
 
+static string jsonString(const string &S) {
+    string R("\"");
+  for (size_t i = 0; i < S.size(); ++i) {
+        if (S[i] == '"' || S[i] == '\\')
+            R += '\\';
+        if ((unsigned char) S[i] >= 0x20)
+            R += S[i];
+    }
 
-    vector<BlockHeader<IsBigEndian> > LocalBlockHeaders;
-    vector<void *> LocalData;
-    vector<bool> LocalHasExtraSpace;
-    vector<vector<unsigned char> > LocalCData;
-  if (NeedsBlockHeaders) {
-        LocalBlockHeaders.resize(Vars.size());
-        LocalData.resize(Vars.size());
-        LocalHasExtraSpace.resize(Vars.size());
-        if (ShouldCompress)
-            LocalCData.resize(Vars.size());
+    return R + "\"";
+}
 
-    for (size_t i = 0; i < Vars.size(); ++i) {
-            // Filters null by default, leave null starting address (needs to be
-            // calculated by the header-writing rank).
-            memset(&LocalBlockHeaders[i], 0, sizeof(BlockHeader<IsBigEndian>));
-      if (ShouldCompress) {
-                LocalCData[i].resize(sizeof(CompressHeader<IsBigEndian>));
+void GenericIO::writeTrace(const string &TraceFileName) {
+    int NRanks, Rank;
+  #ifndef GENERICIO_NO_MPI
+    MPI_Comm_rank(Comm, &Rank);
+    MPI_Comm_size(Comm, &NRanks);
+  #else
+    Rank = 0;
+    NRanks = 1;
+  #endif
 
-                CompressHeader<IsBigEndian> *CH = (CompressHeader<IsBigEndian>*) &LocalCData[i][0];
-                //CH->OrigCRC = crc64_omp(Vars[i].Data, Vars[i].Size * NElems);
-                CH->OrigCRC = crc64_omp(_Vars[i].data, Vars[i].Size * NElems);
+    // Timestamps are microseconds from the start of the earliest call on any
+    // rank.
+    double Origin = CallLog.empty() ? std::numeric_limits<double>::max() : CallLog[0].Start;
+  #ifndef GENERICIO_NO_MPI
+    double LocalOrigin = Origin;
+    MPI_Allreduce(&LocalOrigin, &Origin, 1, MPI_DOUBLE, MPI_MIN, Comm);
+  #endif
 
-                #ifdef _OPENMP
-                #pragma omp master
-                {
-                #endif
+    // Each call is an event of its own, with its phases nested inside.
+    stringstream ss;
+    ss.precision(15);
+    ss << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << Rank <<
+          ",\"args\":{\"name\":\"rank " << Rank << "\"}}";
+    if (DroppedTraceEvents)
+        ss << ",\n{\"name\":\"process_labels\",\"ph\":\"M\",\"pid\":" << Rank <<
+              ",\"args\":{\"labels\":\"" << DroppedTraceEvents << " events dropped\"}}";
+  for (size_t i = 0; i < CallLog.size(); ++i) {
+        ss << ",\n{\"name\":" << jsonString(CallLog[i].Call) << ",\"cat\":\"call\",\"ph\":\"X\"" <<
+              ",\"ts\":" << (CallLog[i].Start - Origin) * 1e6 <<
+              ",\"dur\":" << CallLog[i].TotalTime * 1e6 <<
+              ",\"pid\":" << Rank << ",\"tid\":0,\"args\":{\"file_bytes\":" <<
+              CallLog[i].FileBytes << ",\"raw_bytes\":" << CallLog[i].RawBytes <<
+              ",\"retries\":" << CallLog[i].Retries << "}}";
+    }
 
-       if (!blosc_initialized) {
-                        blosc_init();
-                        blosc_initialized = true;
-                    }
+  for (size_t i = 0; i < TraceEvents.size(); ++i) {
+        const TraceEvent &E = TraceEvents[i];
+        ss << ",\n{\"name\":\"" << getStatPhaseName(E.Phase) << "\",\"cat\":" <<
+              jsonString(CallLog[E.Call].Call) << ",\"ph\":\"X\"" <<
+              ",\"ts\":" << (E.Start - Origin) * 1e6 << ",\"dur\":" << E.Time * 1e6 <<
+              ",\"pid\":" << Rank << ",\"tid\":0";
+        if (E.Var >= 0)
+            ss << ",\"args\":{\"variable\":" << jsonString(CallLog[E.Call].Vars[E.Var].Name) << "}";
+        ss << "}";
+    }
 
-                    #ifdef _OPENMP
-                    blosc_set_nthreads(omp_get_max_threads());
-                }
-                    #endif
+    // Rank 0 writes its own events and then, in turn, those of each other
+    // rank, received in pieces of at most MaxMPITransfer bytes; neither a
+    // rank's events nor their total need fit in an int, and rank 0 holds
+    // only one piece at a time.
+    string Local = ss.str();
 
-                LocalCData[i].resize(LocalCData[i].size() + NElems * Vars[i].Size);
-                // if (blosc_compress(9, 1, Vars[i].Size, NElems * Vars[i].Size, Vars[i].Data,
-                //                    &LocalCData[i][0] + sizeof(CompressHeader<IsBigEndian>),
-                //                    NElems * Vars[i].Size) <= 0)
-                if (blosc_compress(9, 1, Vars[i].Size, NElems * Vars[i].Size, _Vars[i].data,
-                                   &LocalCData[i][0] + sizeof(CompressHeader<IsBigEndian>),
-                                   NElems * Vars[i].Size) <= 0)
-                    goto nocomp;
+    ofstream ofs;
+  if (Rank == 0) {
+        ofs.open(TraceFileName.c_str(), ofstream::out | ofstream::trunc);
+        ofs << "{\"traceEvents\":[\n";
+        ofs.write(Local.data(), Local.size());
+    }
 
-                strncpy(LocalBlockHeaders[i].Filters[0], CompressName, FilterNameSize);
-                size_t CNBytes, CCBytes, CBlockSize;
-                blosc_cbuffer_sizes(&LocalCData[i][0] + sizeof(CompressHeader<IsBigEndian>),
-                                    &CNBytes, &CCBytes, &CBlockSize);
-                LocalCData[i].resize(CCBytes + sizeof(CompressHeader<IsBigEndian>));
+  #ifndef GENERICIO_NO_MPI
+    MPI_Comm TraceComm;
+    MPI_Comm_dup(Comm, &TraceComm);
 
-                LocalBlockHeaders[i].Size = LocalCData[i].size();
-                LocalCData[i].resize(LocalCData[i].size() + CRCSize);
-                LocalData[i] = &LocalCData[i][0];
-                LocalHasExtraSpace[i] = true;
-      } else {
-              nocomp:
-                LocalBlockHeaders[i].Size = NElems * Vars[i].Size;
-                //LocalData[i] = Vars[i].Data;
-                LocalData[i] = _Vars[i].data;
-                LocalHasExtraSpace[i] = Vars[i].HasExtraSpace;
+    uint64_t LocalSize = Local.size();
+  if (Rank == 0) {
+        vector<char> Piece;
+    for (int i = 1; i < NRanks; ++i) {
+            uint64_t Size;
+            MPI_Recv(&Size, 1, MPI_UINT64_T, i, 0, TraceComm, MPI_STATUS_IGNORE);
+
+            ofs << ",\n";
+      for (uint64_t Done = 0; Done < Size; Done += Piece.size()) {
+                Piece.resize(std::min(Size - Done, (uint64_t) MaxMPITransfer));
+                MPI_Recv(&Piece[0], (int) Piece.size(), MPI_CHAR, i, 0, TraceComm,
+                         MPI_STATUS_IGNORE);
+                ofs.write(&Piece[0], Piece.size());
             }
         }
+  } else {
+        MPI_Send(&LocalSize, 1, MPI_UINT64_T, 0, 0, TraceComm);
+        for (uint64_t Done = 0; Done < LocalSize; Done += MaxMPITransfer)
+            MPI_Send((void *) (Local.data() + Done),
+                     (int) std::min(LocalSize - Done, (uint64_t) MaxMPITransfer),
+                     MPI_CHAR, 0, 0, TraceComm);
     }
 
-    double StartTime = MPI_Wtime();
+    MPI_Comm_free(&TraceComm);
+  #endif
 
-    if (SplitRank == 0)
-    {        
-        std::string serializedOctree;
-        uint64_t octreeSize = 0;
-        uint64_t octreeStart = 0;
-        if (hasOctree)
-        {
-            //std::cout << "Serializing octree" << std::endl;
-            serializedOctree = octreeData.serialize(IsBigEndian);
-            octreeSize  = serializedOctree.size();
-        }
+    int Err = 0;
+  if (Rank == 0) {
+        ofs << "\n]}\n";
+        ofs.close();
 
-        uint64_t HeaderSize = sizeof(GlobalHeader<IsBigEndian>) + Vars.size() * sizeof(VariableHeader<IsBigEndian>) +
-                              SplitNRanks * sizeof(RankHeader<IsBigEndian>) + CRCSize + octreeSize;
+        Err = !ofs;
+    }
 
-        if (NeedsBlockHeaders)
-            HeaderSize += SplitNRanks * Vars.size() * sizeof(BlockHeader<IsBigEndian>) + octreeSize;
+  #ifndef GENERICIO_NO_MPI
+    MPI_Bcast(&Err, 1, MPI_INT, 0, Comm);
+  #endif
 
-        vector<char> Header(HeaderSize, 0);
-        GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &Header[0];
-        std::copy(Magic, Magic + MagicSize, GH->Magic);
-        GH->HeaderSize = HeaderSize - CRCSize;
-        GH->NElems = NElems; // This will be updated later
-        std::copy(Dims, Dims + 3, GH->Dims);
-        GH->NVars = Vars.size();
-        GH->VarsSize = sizeof(VariableHeader<IsBigEndian>);
-        GH->VarsStart = sizeof(GlobalHeader<IsBigEndian>) + octreeSize;
-        GH->NRanks = SplitNRanks;
-        GH->RanksSize = sizeof(RankHeader<IsBigEndian>);
-        GH->RanksStart = GH->VarsStart + Vars.size() * sizeof(VariableHeader<IsBigEndian>);
-        GH->GlobalHeaderSize = sizeof(GlobalHeader<IsBigEndian>);
-        std::copy(PhysOrigin, PhysOrigin + 3, GH->PhysOrigin);
-        std::copy(PhysScale,  PhysScale  + 3, GH->PhysScale);
+    if (Err)
+        throw runtime_error("Unable to write the trace file: " + TraceFileName);
+}
 
+#ifndef GENERICIO_NO_MPI
+void GenericIO::write() {
+    if (isBigEndian())
+        write<true>();
+    else
+        write<false>();
+}
 
-        if (hasOctree)
-        {
-            octreeStart = sizeof(GlobalHeader<IsBigEndian>);
-            std::copy( serializedOctree.begin(), serializedOctree.end(), &Header[GH->GlobalHeaderSize] );
-        }
-        GH->OctreeSize = octreeSize;
-        GH->OctreeStart = octreeStart;
+void GenericIO::append() {
+    if (isBigEndian())
+        write<true>(true);
+    else
+        write<false>(true);
+}
 
+// With adaptive compression, the codec chosen for a variable (by name and
+// row size; each component of a transposed variable is chosen for
+// separately) is reused by this process's later writes, and chosen afresh
+// from new samples every SelectInterval writes.
+static const unsigned SelectInterval = 16;
 
-        if (!NeedsBlockHeaders)
-        {
-            GH->BlocksSize = GH->BlocksStart = 0;
-        }
-        else
-        {
-            GH->BlocksSize = sizeof(BlockHeader<IsBigEndian>);
-            GH->BlocksStart = GH->RanksStart + SplitNRanks * sizeof(RankHeader<IsBigEndian>);
-        }
+struct CodecChoice {
+    unsigned Codecs, Uses;
+};
 
-        uint64_t RecordSize = 0;
-        VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &Header[GH->VarsStart];
-    for (size_t i = 0; i < Vars.size(); ++i, ++VH) {
-            string VName(Vars[i].Name);
-            VName.resize(NameSize);
+// Shared by all of the process's writers, which may run concurrently (in
+// threads of their own), and so only used under CodecChoicesMutex.
+static map<pair<string, size_t>, CodecChoice> CodecChoices;
+static std::mutex CodecChoicesMutex;
+
+// The number of streams which a variable is written as when transposing:
+// one for each element of a variable of several, otherwise one.
+static size_t transposedComponents(const GenericIO::Variable &Var) {
+    if (Var.ElementSize == 0 || Var.Size <= Var.ElementSize || Var.Size % Var.ElementSize)
+        return 1;
+    return Var.Size / Var.ElementSize;
+}
 
-            std::copy(VName.begin(), VName.end(), VH->Name);
-            uint64_t VFlags = 0;
-            if (Vars[i].IsFloat)  VFlags |= FloatValue;
-            if (Vars[i].IsSigned) VFlags |= SignedValue;
-            if (Vars[i].IsPhysCoordX) VFlags |= ValueIsPhysCoordX;
-            if (Vars[i].IsPhysCoordY) VFlags |= ValueIsPhysCoordY;
-            if (Vars[i].IsPhysCoordZ) VFlags |= ValueIsPhysCoordZ;
-            if (Vars[i].MaybePhysGhost) VFlags |= ValueMaybePhysGhost;
-            VH->Flags = VFlags;
-            RecordSize += VH->Size = Vars[i].Size;
-            VH->ElementSize = Vars[i].ElementSize;
+template <bool IsBigEndian>
+static unsigned adaptiveCodec(const string &Name, size_t RowSize, bool IsSigned,
+                              const void *Data, uint64_t NElems, size_t IntSize,
+                              const FrameDictionary *Dict, double MinMBps) {
+    pair<string, size_t> Key(Name, RowSize);
+  {
+        std::lock_guard<std::mutex> Lock(CodecChoicesMutex);
+        map<pair<string, size_t>, CodecChoice>::iterator I = CodecChoices.find(Key);
+    if (I != CodecChoices.end() && I->second.Uses < SelectInterval &&
+        (Dict || I->second.Codecs != CodecZstdDict)) {
+            ++I->second.Uses;
+            return I->second.Codecs;
         }
+    }
 
-        MPI_Gather(&RHLocal, sizeof(RHLocal), MPI_BYTE,
-                   &Header[GH->RanksStart], sizeof(RHLocal),
-                   MPI_BYTE, 0, SplitComm);
+    // The sample is compressed without holding the lock.
+    unsigned Codecs = selectCodec<IsBigEndian>(Data, NElems * RowSize, RowSize, IntSize,
+                                                IsSigned, Dict, MinMBps);
+    // An empty block says nothing about the variable.
+  if (NElems > 0) {
+        std::lock_guard<std::mutex> Lock(CodecChoicesMutex);
+        CodecChoice &C = CodecChoices[Key];
+        C.Codecs = Codecs;
+        C.Uses = 1;
+    }
 
-    if (NeedsBlockHeaders) {
-            MPI_Gather(&LocalBlockHeaders[0],
-                       Vars.size()*sizeof(BlockHeader<IsBigEndian>), MPI_BYTE,
-                       &Header[GH->BlocksStart],
-                       Vars.size()*sizeof(BlockHeader<IsBigEndian>), MPI_BYTE,
-                       0, SplitComm);
+    return Codecs;
+}
 
-            BlockHeader<IsBigEndian> *BH = (BlockHeader<IsBigEndian> *) &Header[GH->BlocksStart];
-            for (int i = 0; i < SplitNRanks; ++i)
-      for (size_t j = 0; j < Vars.size(); ++j, ++BH) {
-                    if (i == 0 && j == 0)
-                        BH->Start = HeaderSize;
-                    else
-                        BH->Start = BH[-1].Start + BH[-1].Size + CRCSize;
-                }
+// Dictionaries are trained on about this many times their size of samples
+// (as zstd recommends), each at most a whole block or DictMaxSample bytes.
+static const size_t DictSampleRatio = 100;
+static const size_t DictMaxSample = 128*1024;
+// A dictionary is stored once in the header, so it is limited to this
+// fraction of the variable's size over all ranks, and none is trained where
+// that leaves less than DictMinSize bytes.
+static const size_t DictDataRatio = 32;
+static const size_t DictMinSize = 1024;
+
+// Trains a dictionary of up to DictSize bytes (less for small variables) for
+// each variable, on rank 0 of Comm, from the blocks (Data, of Bytes bytes) of
+// every Stride-th rank, with the stride chosen to gather about
+// DictSampleRatio times the dictionary size. Every rank receives the
+// dictionaries, which are empty where none was worth training, where
+// training failed (for example, for too few samples), or where the
+// dictionary would not pay for itself. TypeSizes are the variables' element
+// sizes, for blosc's shuffle.
+static void trainDictionaries(MPI_Comm Comm, const vector<const void *> &Data,
+                              const vector<size_t> &Bytes, const vector<size_t> &TypeSizes,
+                              size_t DictSize,
+                              vector< vector<unsigned char> > &Dicts) {
+    int Rank, NRanks;
+    MPI_Comm_rank(Comm, &Rank);
+    MPI_Comm_size(Comm, &NRanks);
+    size_t NVars = Data.size();
 
-            RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &Header[GH->RanksStart];
-            RH->Start = HeaderSize; ++RH;
-      for (int i = 1; i < SplitNRanks; ++i, ++RH) {
-                RH->Start =
-                    ((BlockHeader<IsBigEndian> *) &Header[GH->BlocksStart])[i * Vars.size()].Start;
-                GH->NElems += RH->NElems;
+    vector<uint64_t> SampleBytes(2 * NVars), TotalBytes(2 * NVars);
+  for (size_t i = 0; i < NVars; ++i) {
+        SampleBytes[i] = std::min(Bytes[i], DictMaxSample);
+        SampleBytes[NVars + i] = Bytes[i];
+    }
+    MPI_Allreduce(&SampleBytes[0], &TotalBytes[0], 2 * NVars, MPI_UINT64_T, MPI_SUM, Comm);
+    SampleBytes.resize(NVars);
+
+    vector<size_t> VarDictSizes(NVars);
+    for (size_t i = 0; i < NVars; ++i)
+        VarDictSizes[i] = std::min<uint64_t>(DictSize, TotalBytes[NVars + i] / DictDataRatio);
+
+    // This rank's samples, concatenated, and their sizes (zero for variables
+    // not sampled here).
+    vector<char> Samples;
+  for (size_t i = 0; i < NVars; ++i) {
+        uint64_t Budget = DictSampleRatio * std::max(VarDictSizes[i], DictMinSize);
+        uint64_t Stride = std::max<uint64_t>(1, (TotalBytes[i] + Budget - 1) / Budget);
+    if (VarDictSizes[i] < DictMinSize || Rank % Stride != 0 || SampleBytes[i] == 0) {
+            SampleBytes[i] = 0;
+            continue;
+        }
+
+        Samples.insert(Samples.end(), (const char *) Data[i],
+                       (const char *) Data[i] + SampleBytes[i]);
+    }
+
+    int LocalSize = Samples.size();
+    vector<int> RecvSizes(Rank == 0 ? NRanks : 1), Displs(RecvSizes.size(), 0);
+    vector<uint64_t> AllSampleBytes(Rank == 0 ? NRanks * NVars : 1);
+    MPI_Gather(&LocalSize, 1, MPI_INT, &RecvSizes[0], 1, MPI_INT, 0, Comm);
+    MPI_Gather(&SampleBytes[0], NVars, MPI_UINT64_T, &AllSampleBytes[0], NVars,
+               MPI_UINT64_T, 0, Comm);
+
+    vector<char> AllSamples(1);
+  if (Rank == 0) {
+        for (int r = 1; r < NRanks; ++r)
+            Displs[r] = Displs[r-1] + RecvSizes[r-1];
+        AllSamples.resize(std::max(1, Displs[NRanks-1] + RecvSizes[NRanks-1]));
+    }
+
+    Samples.resize(std::max<size_t>(Samples.size(), 1));
+    MPI_Gatherv(&Samples[0], LocalSize, MPI_BYTE, &AllSamples[0], &RecvSizes[0],
+                &Displs[0], MPI_BYTE, 0, Comm);
+
+    vector<uint64_t> DictSizes(NVars, 0);
+    Dicts.assign(NVars, vector<unsigned char>());
+  if (Rank == 0) {
+    for (size_t i = 0; i < NVars; ++i) {
+            vector<char> VarSamples;
+            vector<size_t> VarSizes;
+      for (int r = 0; r < NRanks; ++r) {
+                size_t Pos = Displs[r];
+                for (size_t v = 0; v < i; ++v)
+                    Pos += AllSampleBytes[r * NVars + v];
+
+                size_t Size = AllSampleBytes[r * NVars + i];
+        if (Size > 0) {
+                    VarSamples.insert(VarSamples.end(), &AllSamples[Pos], &AllSamples[Pos] + Size);
+                    VarSizes.push_back(Size);
+                }
+            }
+
+            if (VarSizes.empty())
+                continue;
+
+            Dicts[i].resize(VarDictSizes[i]);
+            size_t Size = ZDICT_trainFromBuffer(&Dicts[i][0], VarDictSizes[i], &VarSamples[0],
+                                                &VarSizes[0], VarSizes.size());
+            DictSizes[i] = ZDICT_isError(Size) ? 0 : Size;
+
+            // The trainer can emit entropy tables that zstd itself refuses
+            // to load (e.g. for constant columns); such a dictionary is
+            // dropped so that readers never see it.
+            FrameDictionary Dict = { &Dicts[i][0], DictSizes[i], 0 };
+            if (DictSizes[i] > 0)
+                Dict.DDict = ZSTD_createDDict(Dict.Data, Dict.Size);
+      if (!Dict.DDict) {
+                DictSizes[i] = 0;
+                continue;
+            }
+
+            // So is a dictionary which, judging by the samples, would not
+            // save the space that it takes in the header.
+            double Saved = 0;
+            vector<unsigned char> Frame;
+      for (size_t s = 0, Pos = 0; s < VarSizes.size(); Pos += VarSizes[s++]) {
+                size_t Plain = VarSizes[s], WithDict = VarSizes[s];
+                Frame.clear();
+                if (compressFrame<false>(&VarSamples[Pos], VarSizes[s], TypeSizes[i], 0, false,
+                                         Frame, 0, CodecBlosc) != FrameRaw)
+                    Plain = Frame.size();
+                Frame.clear();
+                if (compressFrame<false>(&VarSamples[Pos], VarSizes[s], TypeSizes[i], 0, false,
+                                         Frame, &Dict, CodecBlosc | CodecZstdDict) != FrameRaw)
+                    WithDict = Frame.size();
+                Saved += (double) Plain - (double) WithDict;
+            }
+
+            ZSTD_freeDDict(Dict.DDict);
+            if (Saved * TotalBytes[NVars + i] / VarSamples.size() <= DictSizes[i])
+                DictSizes[i] = 0;
+        }
+    }
+
+    MPI_Bcast(&DictSizes[0], NVars, MPI_UINT64_T, 0, Comm);
+  for (size_t i = 0; i < NVars; ++i) {
+        Dicts[i].resize(DictSizes[i]);
+        if (DictSizes[i] > 0)
+            MPI_Bcast(&Dicts[i][0], DictSizes[i], MPI_BYTE, 0, Comm);
+    }
+}
+
+// Note: writing errors are not currently recoverable (one rank may fail
+// while the others don't).
+template <bool IsBigEndian>
+void GenericIO::write(bool Append) {
+    const char *Magic = IsBigEndian ? MagicBE : MagicLE;
+    CallScope Scope(*this, Append ? "append" : "write");
+
+    for (size_t i = 0; i < Vars.size(); ++i)
+        if (Vars[i].Stride != Vars[i].Size)
+            throw runtime_error("Variable " + Vars[i].Name +
+                                " has a stride, and can only be read");
+
+    // Whatever was read of this file before no longer describes it.
+    PrefixFileName.clear();
+    HeaderPrefix.clear();
+    HeaderTail.clear();
+
+    uint64_t FileSize = 0;
+
+    int NRanks, Rank;
+    MPI_Comm_rank(Comm, &Rank);
+    MPI_Comm_size(Comm, &NRanks);
+
+    #ifdef __bgq__
+    MPI_Barrier(Comm);
+    #endif
+    MPI_Comm_split(Comm, Partition, Rank, &SplitComm);
+
+    int SplitNRanks, SplitRank;
+    MPI_Comm_rank(SplitComm, &SplitRank);
+    MPI_Comm_size(SplitComm, &SplitNRanks);
+
+
+    // Making a duplicate (kept in duplicateData, of any row size)
+    std::vector<GioData> _Vars;
+    std::vector< std::vector<char> > duplicateData;
+    _Vars.resize(Vars.size());
+    for (int i=0; i<Vars.size(); i++)
+        _Vars[i].data = Vars[i].Data;
+
+
+    string LocalFileName;
+  if (SplitNRanks != NRanks) {
+    if (Rank == 0) {
+            // In split mode, the specified file becomes the rank map, and the real
+            // data is partitioned.
+
+            vector<int> MapRank, MapPartition;
+            MapRank.resize(NRanks);
+            for (int i = 0; i < NRanks; ++i) MapRank[i] = i;
+
+            MapPartition.resize(NRanks);
+            MPI_Gather(&Partition, 1, MPI_INT, &MapPartition[0], 1, MPI_INT, 0, Comm);
+
+            GenericIO GIO(MPI_COMM_SELF, FileName, FileIOType);
+            GIO.setNumElems(NRanks);
+            GIO.addVariable("$rank", MapRank); /* this is for use by humans; the reading
+                                            code assumes that the partitions are in
+                                            rank order */
+            GIO.addVariable("$partition", MapPartition);
+
+            vector<int> CX, CY, CZ;
+            int TopoStatus;
+            MPI_Topo_test(Comm, &TopoStatus);
+      if (TopoStatus == MPI_CART) {
+                CX.resize(NRanks);
+                CY.resize(NRanks);
+                CZ.resize(NRanks);
+
+        for (int i = 0; i < NRanks; ++i) {
+                    int C[3];
+                    MPI_Cart_coords(Comm, i, 3, C);
+
+                    CX[i] = C[0];
+                    CY[i] = C[1];
+                    CZ[i] = C[2];
+                }
+
+                GIO.addVariable("$x", CX);
+                GIO.addVariable("$y", CY);
+                GIO.addVariable("$z", CZ);
+            }
+
+            GIO.write();
+    } else {
+            MPI_Gather(&Partition, 1, MPI_INT, 0, 0, MPI_INT, 0, Comm);
+        }
+
+        stringstream ss;
+        ss << FileName << "#" << Partition;
+        LocalFileName = ss.str();
+  } else {
+        LocalFileName = FileName;
+    }
+
+    RankHeader<IsBigEndian> RHLocal;
+    int Dims[3], Periods[3], Coords[3];
+
+    int TopoStatus;
+    MPI_Topo_test(Comm, &TopoStatus);
+  if (TopoStatus == MPI_CART) {
+        MPI_Cart_get(Comm, 3, Dims, Periods, Coords);
+  } else {
+        Dims[0] = NRanks;
+        std::fill(Dims + 1, Dims + 3, 1);
+        std::fill(Periods, Periods + 3, 0);
+        Coords[0] = Rank;
+        std::fill(Coords + 1, Coords + 3, 0);
+    }
+
+
+    float myExtents[6];
+    float physicalDims[3];
+    for (int i=0; i<3; i++)
+        physicalDims[i] = (PhysScale[i]-PhysOrigin[i])/Dims[i];
+
+    for (int i=0; i<3; i++)
+    {
+        myExtents[i*2]     = Coords[i] * physicalDims[i];
+        myExtents[i*2 + 1] = myExtents[i*2] + physicalDims[i];
+    }
+
+    std::copy(Coords, Coords + 3, RHLocal.Coords);
+    RHLocal.NElems = NElems;
+    RHLocal.Start = 0;
+    RHLocal.GlobalRank = Rank;
+
+    bool ShouldCompress = DefaultShouldCompress;
+    const char *EnvStr = getenv("GENERICIO_COMPRESS");
+  if (EnvStr) {
+        int Mod = atoi(EnvStr);
+        ShouldCompress = (Mod > 0);
+    }
+
+    uint64_t ChunkRows = DefaultChunkRows;
+    EnvStr = getenv("GENERICIO_CHUNK_ROWS");
+    if (EnvStr)
+        ChunkRows = strtoull(EnvStr, 0, 10);
+
+    bool IntPack = DefaultIntPack;
+    EnvStr = getenv("GENERICIO_INTPACK");
+    if (EnvStr)
+        IntPack = (atoi(EnvStr) > 0);
+
+    size_t DictSize = DefaultDictionarySize;
+    EnvStr = getenv("GENERICIO_DICT_SIZE");
+    if (EnvStr)
+        DictSize = strtoull(EnvStr, 0, 10);
+    if (!ShouldCompress)
+        DictSize = 0;
+
+    double AdaptiveMBps = DefaultAdaptiveCompression;
+    EnvStr = getenv("GENERICIO_ADAPTIVE");
+    if (EnvStr)
+        AdaptiveMBps = atof(EnvStr);
+    if (!ShouldCompress)
+        AdaptiveMBps = 0;
+
+    bool Transpose = DefaultTranspose;
+    EnvStr = getenv("GENERICIO_TRANSPOSE");
+    if (EnvStr)
+        Transpose = (atoi(EnvStr) > 0);
+
+    vector<size_t> NComps(Vars.size(), 1);
+    bool AnyTransposed = false;
+  for (size_t i = 0; i < Vars.size() && Transpose; ++i) {
+        NComps[i] = transposedComponents(Vars[i]);
+        AnyTransposed |= NComps[i] > 1;
+    }
+
+    bool NeedsBlockHeaders = ShouldCompress || ChunkRows > 0 || AnyTransposed;
+    EnvStr = getenv("GENERICIO_FORCE_BLOCKS");
+  if (!NeedsBlockHeaders && EnvStr) {
+        int Mod = atoi(EnvStr);
+        NeedsBlockHeaders = (Mod > 0);
+    }
+
+
+    
+    //Check if we can build an octree
+    if (hasOctree)
+    {
+        bool foundx, foundy, foundz;
+        foundx = foundy = foundz = false;
+        
+        for (size_t i = 0; i < Vars.size(); ++i)
+            if (Vars[i].IsPhysCoordX)
+            {
+                foundx = true;
+                break;
+            }
+
+
+        for (size_t i = 0; i < Vars.size(); ++i)
+            if (Vars[i].IsPhysCoordY)
+            {
+                foundy = true;
+                break;
+            }
+
+
+        for (size_t i = 0; i < Vars.size(); ++i)
+            if (Vars[i].IsPhysCoordZ)
+            {
+                foundz = true;
+                break;
+            }
+
+        
+        // If the data has no position data, we can't build an octree
+        hasOctree = hasOctree && foundx;
+        hasOctree = hasOctree && foundy;
+        hasOctree = hasOctree && foundz;
+
+
+        // Only makes sense to build octree if we are going to partition the ranks
+        if (!octreeAdaptive && numOctreeLevels < 2)
+            hasOctree = false;
+    }
+
+    //
+    // Octree
+    if (hasOctree)
+    {
+        double OctreeStart = statNow();
+        Timer initOctreeClock, findLeafExtentClock, findPartitionClock, rearrageClock, gatherClock, createOctreeHeaderClock;
+
+      Memory ongoingMem;          ongoingMem.start();
+      Timer createOctreeClock;    createOctreeClock.start();
+        
+
+        #define DEBUG_ON 0
+      #ifdef DEBUG_ON
+        std::stringstream log;
+      #endif
+
+        size_t numParticles = NElems;   // num of particles for my rank
+
+        //
+        // MPI Rank 
+        int myRank = Rank;
+        int numRanks = NRanks;
+
+
+        //
+        // Simulation and rank extents
+        float simExtents[6];
+        simExtents[0] = PhysOrigin[0];  simExtents[1] = PhysScale[0];
+        simExtents[2] = PhysOrigin[1];  simExtents[3] = PhysScale[1];
+        simExtents[4] = PhysOrigin[2];  simExtents[5] = PhysScale[2];
+
+        float physicalDims[3];
+        for (int i=0; i<3; i++)
+            physicalDims[i] = (PhysScale[i]-PhysOrigin[i])/Dims[i];
+
+        float myRankExtents[6];
+        for (int i=0; i<3; i++)
+        {
+            myRankExtents[i*2]     = Coords[i] * physicalDims[i];
+            myRankExtents[i*2 + 1] = myRankExtents[i*2] + physicalDims[i];
+        }
+
+      
+            
+      initOctreeClock.start();
+
+        //
+        // Create octree structure
+        Octree gioOctree(myRank, myRankExtents);
+        gioOctree.init(numOctreeLevels, simExtents, Dims[0], Dims[1], Dims[2]); // num octree levels, sim extent, sim decompisition
+
+      initOctreeClock.stop();
+      findLeafExtentClock.start();
+
+        //
+        // Get the extents of each of my leaves
+        std::vector<float> leavesExtentsVec;
+        if (!octreeAdaptive)
+            leavesExtentsVec = gioOctree.getMyLeavesExtent(myRankExtents, numOctreeLevels);
+        int numleavesForMyRank = leavesExtentsVec.size()/6;
+        float *leavesExtents = leavesExtentsVec.empty() ? NULL : &leavesExtentsVec[0];
+
+      findLeafExtentClock.stop();
+      findPartitionClock.start();
+
+
+        //
+        // Find the partition for each particle
+        // Use fisrt instance of position for octree, which is either float or
+        // double (and the octree functions are instantiated for each)
+        const Variable *posVars[3] = { NULL, NULL, NULL };
+        for (size_t i = 0; i < Vars.size(); ++i)
+        {
+            if (!posVars[0] && Vars[i].IsPhysCoordX) posVars[0] = &Vars[i];
+            if (!posVars[1] && Vars[i].IsPhysCoordY) posVars[1] = &Vars[i];
+            if (!posVars[2] && Vars[i].IsPhysCoordZ) posVars[2] = &Vars[i];
+        }
+
+        for (int d = 0; d < 3; ++d)
+            if (!posVars[d] || !posVars[d]->IsFloat || posVars[d]->Size != posVars[0]->Size ||
+                (posVars[d]->Size != sizeof(float) && posVars[d]->Size != sizeof(double)))
+                throw runtime_error("An octree requires float or double position variables "
+                                    "(of the same type) to write: " + FileName);
+
+        bool doublePositions = (posVars[0]->Size == sizeof(double));
+        float *_xx = (float*)posVars[0]->Data, *_yy = (float*)posVars[1]->Data, *_zz = (float*)posVars[2]->Data;
+        double *_dxx = (double*)posVars[0]->Data, *_dyy = (double*)posVars[1]->Data, *_dzz = (double*)posVars[2]->Data;
+    
+        // Find the partition
+        std::vector<int> leafPosition;                    // which leaf is the particle in
+        std::vector<uint64_t> numParticlesForMyLeaf;      // #particles per leaf
+        std::vector<GIOOctreeNode> myNodes;               // adaptive octree structure of my rank
+        if (octreeAdaptive)
+        {
+            // the leaves follow the particle distribution
+            if (doublePositions)
+                numParticlesForMyLeaf = gioOctree.buildAdaptiveLeaves(_dxx,_dyy,_dzz, numParticles, octreeMaxLeafParticles, numOctreeLevels,
+                                                                      leavesExtentsVec, myNodes, leafPosition);
+            else
+                numParticlesForMyLeaf = gioOctree.buildAdaptiveLeaves(_xx,_yy,_zz, numParticles, octreeMaxLeafParticles, numOctreeLevels,
+                                                                      leavesExtentsVec, myNodes, leafPosition);
+            numleavesForMyRank = leavesExtentsVec.size()/6;
+            leavesExtents = &leavesExtentsVec[0];
+        }
+        else if (doublePositions)
+            numParticlesForMyLeaf = gioOctree.findLeaf(_dxx,_dyy,_dzz, numParticles, numleavesForMyRank, leavesExtents, leafPosition);
+        else
+            numParticlesForMyLeaf = gioOctree.findLeaf(_xx,_yy,_zz, numParticles, numleavesForMyRank, leavesExtents, leafPosition);
+
+
+      findPartitionClock.stop();
+
+
+      #ifdef DEBUG_ON
+        log << "\nnumleavesForMyRank: " << numleavesForMyRank << std::endl;
+        log << "octreeAdaptive: " << octreeAdaptive << "\n";
+        log << "numParticles: " << numParticles << "\n";
+        log << "octreeLeafOrder: " << octreeLeafOrder << "\n";
+        
+        log << "\nOctree initialization took : " << initOctreeClock.getDuration() << " s\n";
+        log << "Octree Find octree leaf extents took : " << findLeafExtentClock.getDuration() << " s\n";
+        log << "Octree Find particle position took : " << findPartitionClock.getDuration() << " s\n";
+        log << "\n|After findLeaf: " << ongoingMem.getMemoryInUseInMB() << " MB " << std::endl;
+      #endif
+      
+      rearrageClock.start();
+
+
+        //
+        // The Morton order is computed once, from the positions, for all variables
+        bool octreeLeafshuffle = (octreeLeafOrder == OctreeLeafShuffled);
+        std::vector<size_t> mortonIndex;
+        std::vector<uint64_t> mySubLeafStarts;
+        const std::vector<size_t> *leafOrder = NULL;
+        int subLeafLevels = 0;
+        if (octreeLeafOrder == OctreeLeafMorton)
+        {
+            // The sub-leaf index has the same levels for all leaves
+            uint64_t myCounts[2] = { numParticles, (uint64_t)numleavesForMyRank }, allCounts[2];
+            MPI_Allreduce(myCounts, allCounts, 2, MPI_UINT64_T, MPI_SUM, MPI_COMM_WORLD);
+            subLeafLevels = gioOctreeSubLeafLevels(allCounts[0] / std::max(allCounts[1], (uint64_t)1));
+
+            if (doublePositions)
+                mortonIndex = gioOctree.createMortonIndex(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _dxx, _dyy, _dzz, numParticles,
+                                                          leavesExtents, subLeafLevels, mySubLeafStarts);
+            else
+                mortonIndex = gioOctree.createMortonIndex(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, _xx, _yy, _zz, numParticles,
+                                                          leavesExtents, subLeafLevels, mySubLeafStarts);
+            leafOrder = &mortonIndex;
+        }
+
+        //
+        // The rows are rearranged based on leaves: the order is found once, by
+        // moving the row indices, and each variable (whatever its type and
+        // number of components) is then gathered into a duplicate in that order
+        std::vector<uint64_t> rowOrder(numParticles);
+        for (size_t r = 0; r < numParticles; ++r)
+            rowOrder[r] = r;
+        if (numParticles > 0)
+            gioOctree.reorganizeArrayInPlace(numleavesForMyRank, numParticlesForMyLeaf, leafPosition, &rowOrder[0], numParticles, octreeLeafshuffle, leafOrder);
+
+      #ifdef DEBUG_ON
+        log << gioOctree.getLog();
+      #endif
+
+        duplicateData.resize(Vars.size());
+        for (size_t i = 0; i < Vars.size(); ++i)
+        {
+            _Vars[i].init(i, Vars[i].Name, static_cast<int>(Vars[i].Size), Vars[i].IsFloat, Vars[i].IsSigned, Vars[i].IsPhysCoordX, Vars[i].IsPhysCoordY, Vars[i].IsPhysCoordZ);
+            _Vars[i].setNumElements(numParticles);
+
+            size_t rowSize = Vars[i].Size;
+            duplicateData[i].resize((numParticles + 1) * rowSize);
+            _Vars[i].data = &duplicateData[i][0];
+
+            const char *from = (const char *) Vars[i].Data;
+            char *to = (char *) _Vars[i].data;
+            for (size_t r = 0; r < numParticles; ++r)
+                std::memcpy(to + r * rowSize, from + rowOrder[r] * rowSize, rowSize);
+        }
+        rowOrder.clear();   rowOrder.shrink_to_fit();
+
+        leafPosition.clear();   leafPosition.shrink_to_fit();
+        mortonIndex.clear();    mortonIndex.shrink_to_fit();
+
+      rearrageClock.stop(); 
+      gatherClock.start();
+
+
+        //
+        // Gather num leaves each rank has
+        int *numLeavesPerRank = new int[numRanks];
+        MPI_Allgather( &numleavesForMyRank, 1, MPI_INT,  numLeavesPerRank, 1, MPI_INT,  MPI_COMM_WORLD);
+    
+
+
+        //
+        // Gather num particles in each leaf for each rank
+        int totalLeavesForSim = numLeavesPerRank[0];
+
+        int *_offsets = new int[numRanks];
+        _offsets[0] = 0;
+
+        for (int i=1; i<numRanks; i++)
+        {
+            totalLeavesForSim += numLeavesPerRank[i];
+            _offsets[i] = _offsets[i-1] + numLeavesPerRank[i-1];
+        }
+
+        uint64_t *numParticlesPerLeaf = new uint64_t[totalLeavesForSim];
+        uint64_t *myLeavesCount = &numParticlesForMyLeaf[0];
+        MPI_Allgatherv( myLeavesCount, numleavesForMyRank, MPI_UINT64_T,  numParticlesPerLeaf, numLeavesPerRank, _offsets, MPI_UINT64_T,  MPI_COMM_WORLD); 
+
+        if (_offsets != NULL)
+            delete []_offsets;
+        _offsets = NULL;
+
+
+
+        //
+        // Gather extents for each rank        
+        int *_extentsCountPerRank = new int[numRanks];
+        int *_offsetsExtents = new int[numRanks];
+        float *allOctreeLeavesExtents = new float[totalLeavesForSim*6];
+        
+        _offsetsExtents[0] = 0;
+        _extentsCountPerRank[0] = numLeavesPerRank[0]*6;
+        for (int r=1; r<numRanks; r++)
+        {
+            _extentsCountPerRank[r] = numLeavesPerRank[r]*6;
+            _offsetsExtents[r] = _offsetsExtents[r-1] + numLeavesPerRank[r-1]*6;
+        }
+        
+        MPI_Allgatherv(leavesExtents, numleavesForMyRank*6, MPI_FLOAT,  allOctreeLeavesExtents, _extentsCountPerRank, _offsetsExtents, MPI_FLOAT,  MPI_COMM_WORLD); 
+
+
+        leavesExtentsVec.clear();   leavesExtentsVec.shrink_to_fit();
+        leavesExtents = NULL;
+
+        if (_offsetsExtents != NULL)
+            delete []_offsetsExtents;
+        _offsetsExtents = NULL;
+
+        if (_extentsCountPerRank != NULL)
+            delete []_extentsCountPerRank;
+        _extentsCountPerRank = NULL;
+
+
+        //
+        // Gather the adaptive octree nodes of each rank
+        std::vector<int> numNodesPerRank, _nodeOffsets;
+        std::vector<double> allNodesExtents;
+        std::vector<uint64_t> allNodesInfo;   // firstChild, leafID, numParticles, depth
+        if (octreeAdaptive)
+        {
+            int numNodesForMyRank = myNodes.size();
+            numNodesPerRank.resize(numRanks);
+            MPI_Allgather( &numNodesForMyRank, 1, MPI_INT,  &numNodesPerRank[0], 1, MPI_INT,  MPI_COMM_WORLD);
+
+            std::vector<double> myNodesExtents;
+            std::vector<uint64_t> myNodesInfo;
+            for (int n=0; n<numNodesForMyRank; n++)
+            {
+                myNodesExtents.insert(myNodesExtents.end(), myNodes[n].extents, myNodes[n].extents + 6);
+                myNodesInfo.push_back(myNodes[n].firstChild);
+                myNodesInfo.push_back(myNodes[n].leafID);
+                myNodesInfo.push_back(myNodes[n].numParticles);
+                myNodesInfo.push_back(myNodes[n].depth);
+            }
+            myNodes.clear();    myNodes.shrink_to_fit();
+
+            std::vector<int> _extentsCounts(numRanks), _extentsOffsets(numRanks), _infoCounts(numRanks), _infoOffsets(numRanks);
+            _nodeOffsets.resize(numRanks);
+            int totalNodesForSim = 0;
+            for (int r=0; r<numRanks; r++)
+            {
+                _nodeOffsets[r] = totalNodesForSim;
+                _extentsCounts[r]  = numNodesPerRank[r]*6;   _extentsOffsets[r] = totalNodesForSim*6;
+                _infoCounts[r]     = numNodesPerRank[r]*4;   _infoOffsets[r]    = totalNodesForSim*4;
+                totalNodesForSim += numNodesPerRank[r];
+            }
+
+            allNodesExtents.resize(totalNodesForSim*6);
+            allNodesInfo.resize(totalNodesForSim*4);
+            MPI_Allgatherv(&myNodesExtents[0], numNodesForMyRank*6, MPI_DOUBLE,  &allNodesExtents[0], &_extentsCounts[0], &_extentsOffsets[0], MPI_DOUBLE,  MPI_COMM_WORLD);
+            MPI_Allgatherv(&myNodesInfo[0], numNodesForMyRank*4, MPI_UINT64_T,  &allNodesInfo[0], &_infoCounts[0], &_infoOffsets[0], MPI_UINT64_T,  MPI_COMM_WORLD);
+        }
+
+        //
+        // Gather the sub-leaf index of Morton-ordered leaves
+        std::vector<uint64_t> allSubLeafStarts;
+        if (octreeLeafOrder == OctreeLeafMorton)
+        {
+            int numCells = 1 << (3*subLeafLevels);
+            std::vector<int> _startsCounts(numRanks), _startsOffsets(numRanks);
+            int totalStarts = 0;
+            for (int r=0; r<numRanks; r++)
+            {
+                _startsCounts[r] = numLeavesPerRank[r]*numCells;
+                _startsOffsets[r] = totalStarts;
+                totalStarts += _startsCounts[r];
+            }
+
+            allSubLeafStarts.resize(totalStarts);
+            MPI_Allgatherv(mySubLeafStarts.empty() ? NULL : &mySubLeafStarts[0], numleavesForMyRank*numCells, MPI_UINT64_T,
+                           allSubLeafStarts.empty() ? NULL : &allSubLeafStarts[0], &_startsCounts[0], &_startsOffsets[0], MPI_UINT64_T,  MPI_COMM_WORLD);
+        }
+
+      gatherClock.stop();
+      createOctreeHeaderClock.start();
+      
+
+        if (SplitRank == 0)
+        {
+            //
+            // Create Header info
+            addOctreeHeader( (uint64_t)octreeLeafOrder, (uint64_t)numOctreeLevels, (uint64_t)totalLeavesForSim );
+
+            //
+            // Add Octree ranks
+            int _leafCounter = 0;
+            for (int r=0; r<numRanks; r++)
+            {
+                uint64_t offsetInRank = 0;
+                for (int l=0; l<numLeavesPerRank[r]; l++)
+                {
+                    double _leafExtents[6];
+
+                    for (int i=0; i<6; i++)
+                        _leafExtents[i] = allOctreeLeavesExtents[_leafCounter*6 + i];
+                                            
+                    addOctreeRow(_leafCounter, _leafExtents, numParticlesPerLeaf[_leafCounter], offsetInRank, r);
+
+                    offsetInRank += numParticlesPerLeaf[_leafCounter];
+                    _leafCounter++;
+                }
+            }
+
+            octreeData.subLeafLevels = allSubLeafStarts.empty() ? 0 : subLeafLevels;
+            octreeData.subLeafStarts.swap(allSubLeafStarts);
+
+            //
+            // Add adaptive nodes, moving the rank local node and leaf indices to global ones
+            octreeData.nodes.clear();
+            if (octreeAdaptive)
+            {
+                int _nodeCounter = 0, _firstLeafOfRank = 0;
+                for (int r=0; r<numRanks; r++)
+                {
+                    for (int n=0; n<numNodesPerRank[r]; n++)
+                    {
+                        GIOOctreeNode node;
+                        std::copy(&allNodesExtents[_nodeCounter*6], &allNodesExtents[_nodeCounter*6] + 6, node.extents);
+                        node.firstChild   = allNodesInfo[_nodeCounter*4 + 0];
+                        node.leafID       = allNodesInfo[_nodeCounter*4 + 1];
+                        node.numParticles = allNodesInfo[_nodeCounter*4 + 2];
+                        node.depth        = allNodesInfo[_nodeCounter*4 + 3];
+
+                        if (node.firstChild != GIO_OCTREE_NONE)
+                            node.firstChild += _nodeOffsets[r];
+                        if (node.leafID != GIO_OCTREE_NONE)
+                            node.leafID += _firstLeafOfRank;
+
+                        octreeData.nodes.push_back(node);
+                        _nodeCounter++;
+                    }
+
+                    _firstLeafOfRank += numLeavesPerRank[r];
+                }
+            }
+        }
+
+        
+
+        if (numLeavesPerRank != NULL)
+            delete []numLeavesPerRank;
+        numLeavesPerRank = NULL;
+
+        if (numParticlesPerLeaf != NULL)
+            delete []numParticlesPerLeaf;
+        numParticlesPerLeaf = NULL;
+
+        if (allOctreeLeavesExtents != NULL)
+            delete []allOctreeLeavesExtents;
+        allOctreeLeavesExtents = NULL;
+
+
+      createOctreeHeaderClock.stop();
+      ongoingMem.stop();
+      createOctreeClock.stop();
+
+
+      #ifdef DEBUG_ON
+        log << "\nOctree rearrage took : " << rearrageClock.getDuration() << " s\n";
+        log << "Octree gathers took : " << gatherClock.getDuration() << " s\n";
+        log << "Octree octree header creation took : " << createOctreeHeaderClock.getDuration() << " s\n";
+
+        log << "\n|After, mem leaked: " << ongoingMem.getMemorySizeInMB() << " MB " << std::endl;
+        log << "\n\nOctree processing took:: " << createOctreeClock.getDuration() << " s " << std::endl;
+        if (getenv("GENERICIO_OCTREE_LOG"))
+            writeLog("log_" + std::to_string(myRank) ,log.str());
+      #endif
+
+        addPhase(StatOctree, OctreeStart);
+    }   // end octree
+    
+
+
+    vector<BlockHeader<IsBigEndian> > LocalBlockHeaders;
+    vector<void *> LocalData;
+    vector<vector<unsigned char> > LocalCData;
+    vector<vector<unsigned char> > Dicts;
+  if (NeedsBlockHeaders) {
+        LocalBlockHeaders.resize(Vars.size());
+        LocalData.resize(Vars.size());
+        if (ShouldCompress || ChunkRows > 0 || AnyTransposed)
+            LocalCData.resize(Vars.size());
+
+        // Each component of a transposed variable is stored consecutively.
+        vector<vector<char> > Transposed(Vars.size());
+    for (size_t i = 0; i < Vars.size(); ++i) {
+            if (NComps[i] == 1)
+                continue;
+
+            double TransposeStart = statNow();
+            size_t ES = Vars[i].ElementSize;
+            Transposed[i].resize(NElems * Vars[i].Size);
+            for (size_t k = 0; k < NComps[i]; ++k)
+                copyStrided(((const char *) _Vars[i].data) + k * ES, Vars[i].Size,
+                            Transposed[i].data() + k * NElems * ES, ES, NElems, ES);
+            addPhase(StatCompress, TransposeStart);
+        }
+
+        vector<FrameDictionary> FrameDicts(Vars.size());
+        vector<const FrameDictionary *> VarDicts(Vars.size(), (const FrameDictionary *) 0);
+    if (DictSize > 0) {
+            double DictStart = statNow();
+            vector<const void *> Data;
+            vector<size_t> Bytes, TypeSizes;
+      for (size_t i = 0; i < Vars.size(); ++i) {
+                Data.push_back(NComps[i] > 1 ? Transposed[i].data() : _Vars[i].data);
+                Bytes.push_back(NElems * Vars[i].Size);
+                TypeSizes.push_back(Vars[i].Size / NComps[i]);
+            }
+
+            trainDictionaries(SplitComm, Data, Bytes, TypeSizes, DictSize, Dicts);
+      for (size_t i = 0; i < Vars.size(); ++i) {
+                if (Dicts[i].empty())
+                    continue;
+
+                FrameDictionary &D = FrameDicts[i];
+                D.Data = &Dicts[i][0];
+                D.Size = Dicts[i].size();
+                D.DDict = ZSTD_createDDict(D.Data, D.Size);
+                if (D.DDict)
+                    VarDicts[i] = &D;
+            }
+            addPhase(StatCompress, DictStart);
+        }
+
+    for (size_t i = 0; i < Vars.size(); ++i) {
+            // Filters null by default, leave null starting address (needs to be
+            // calculated by the header-writing rank).
+            memset(&LocalBlockHeaders[i], 0, sizeof(BlockHeader<IsBigEndian>));
+            beginVariable(Vars[i].Name);
+            double CompressStart = statNow();
+
+            size_t IntSize = 0;
+            size_t ES = Vars[i].ElementSize;
+            if (IntPack && !Vars[i].IsFloat && (ES == 1 || ES == 2 || ES == 4 || ES == 8))
+                IntSize = ES;
+
+            // The streams written: the variable, or each of its components.
+            size_t StreamSize = Vars[i].Size / NComps[i];
+            vector<const void *> Streams;
+            for (size_t k = 0; k < NComps[i]; ++k)
+                Streams.push_back(NComps[i] > 1 ? Transposed[i].data() + k * NElems * StreamSize :
+                                  (const char *) _Vars[i].data);
+
+            vector<unsigned> Codecs(NComps[i], CodecsDefault);
+      for (size_t k = 0; k < NComps[i] && AdaptiveMBps > 0; ++k) {
+                string Name = Vars[i].Name;
+                if (NComps[i] > 1)
+                    Name += "." + std::to_string(k);
+                Codecs[k] = adaptiveCodec<IsBigEndian>(Name, StreamSize, Vars[i].IsSigned,
+                                                       Streams[k], NElems, IntSize, VarDicts[i],
+                                                       AdaptiveMBps);
+            }
+            bool CompressVar = ShouldCompress && Codecs[0] != 0;
+
+      if (ChunkRows > 0 || NComps[i] > 1) {
+                uint64_t StreamChunkRows = ChunkRows > 0 ? ChunkRows : std::max<uint64_t>(NElems, 1);
+                packChunks<IsBigEndian>(Streams, NElems, StreamSize, StreamChunkRows,
+                                        ShouldCompress, IntSize, Vars[i].IsSigned, VarDicts[i],
+                                        Codecs, LocalCData[i]);
+
+                strncpy(LocalBlockHeaders[i].Filters[0], ChunkedName, FilterNameSize);
+                if (NComps[i] > 1)
+                    strncpy(LocalBlockHeaders[i].Filters[1], TransposedName, FilterNameSize);
+                LocalBlockHeaders[i].Size = LocalCData[i].size();
+                LocalData[i] = &LocalCData[i][0];
+      } else if (CompressVar) {
+                initBlosc();
+
+                FrameFilter F = compressFrame<IsBigEndian>(_Vars[i].data, NElems * Vars[i].Size,
+                                                           Vars[i].Size, IntSize, Vars[i].IsSigned,
+                                                           LocalCData[i], VarDicts[i], Codecs[0]);
+                if (F == FrameRaw)
+                    goto nocomp;
+
+                setBlockFilters(LocalBlockHeaders[i].Filters, F);
+                LocalBlockHeaders[i].Size = LocalCData[i].size();
+                LocalData[i] = &LocalCData[i][0];
+      } else {
+              nocomp:
+                LocalBlockHeaders[i].Size = NElems * Vars[i].Size;
+                //LocalData[i] = Vars[i].Data;
+                LocalData[i] = _Vars[i].data;
+            }
+
+            addPhase(StatCompress, CompressStart);
+        }
+        endVariable();
+
+        for (size_t i = 0; i < Vars.size(); ++i)
+          if (VarDicts[i])
+            ZSTD_freeDDict(FrameDicts[i].DDict);
+    }
+
+    double StartTime = MPI_Wtime();
+    double HeaderStart = statNow();
+
+    if (SplitRank == 0)
+    {        
+        // When appending, the new step starts where the data of the last step
+        // ends (overwriting the old step index, which is rewritten at the end).
+        vector<StepInfo> Steps;
+        vector<char> FirstHeader;
+        uint64_t StepStart = 0;
+        struct stat StepFileStat;
+        if (Append && stat(LocalFileName.c_str(), &StepFileStat) == 0)
+        {
+            GenericFileIO_POSIX StepFile;
+            StepFile.open(LocalFileName, true);
+
+            GlobalHeader<IsBigEndian> OldGH;
+            StepFile.read(&OldGH, sizeof(GlobalHeader<IsBigEndian>), 0, "global header");
+            if (string(OldGH.Magic, OldGH.Magic + MagicSize - 1) != Magic)
+                throw runtime_error("Won't append to " + LocalFileName + ": invalid file-type identifier or endianness");
+
+            if (!mayHaveSteps(&OldGH) ||
+                !readStepIndex<IsBigEndian>(&StepFile, LocalFileName, Steps))
+            {
+                // The first header is marked once the file has steps.
+                FirstHeader.resize(OldGH.HeaderSize + CRCSize);
+                StepFile.read(&FirstHeader[0], FirstHeader.size(), 0, "header");
+
+                StepInfo SI;
+                SI.HeaderStart = 0;
+                SI.HeaderSize = OldGH.HeaderSize + CRCSize;
+                SI.DataEnd = StepFile.getSize();
+                SI.NElems = OldGH.NElems;
+                Steps.push_back(SI);
+            }
+
+            StepStart = Steps.back().DataEnd;
+        }
+
+        std::string serializedOctree;
+        uint64_t octreeSize = 0;
+        uint64_t octreeStart = 0;
+        if (hasOctree)
+        {
+            //std::cout << "Serializing octree" << std::endl;
+            serializedOctree = octreeData.serialize(IsBigEndian);
+            octreeSize  = serializedOctree.size();
+        }
+
+        uint64_t HeaderSize = sizeof(GlobalHeader<IsBigEndian>) + Vars.size() * sizeof(VariableHeader<IsBigEndian>) +
+                              SplitNRanks * sizeof(RankHeader<IsBigEndian>) + CRCSize + octreeSize;
+
+        if (NeedsBlockHeaders)
+            HeaderSize += SplitNRanks * Vars.size() * sizeof(BlockHeader<IsBigEndian>) + octreeSize;
+
+        uint64_t DictsSize = 0;
+        for (size_t i = 0; i < Dicts.size(); ++i)
+            DictsSize += Dicts[i].size();
+        if (DictsSize > 0)
+            DictsSize += Vars.size() * sizeof(DictHeader<IsBigEndian>);
+        HeaderSize += DictsSize;
+
+        vector<char> Header(HeaderSize, 0);
+        GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &Header[0];
+        std::copy(Magic, Magic + MagicSize, GH->Magic);
+        GH->HeaderSize = HeaderSize - CRCSize;
+        GH->NElems = NElems; // This will be updated later
+        std::copy(Dims, Dims + 3, GH->Dims);
+        GH->NVars = Vars.size();
+        GH->VarsSize = sizeof(VariableHeader<IsBigEndian>);
+        GH->VarsStart = sizeof(GlobalHeader<IsBigEndian>) + octreeSize;
+        GH->NRanks = SplitNRanks;
+        GH->RanksSize = sizeof(RankHeader<IsBigEndian>);
+        GH->RanksStart = GH->VarsStart + Vars.size() * sizeof(VariableHeader<IsBigEndian>);
+        GH->GlobalHeaderSize = sizeof(GlobalHeader<IsBigEndian>);
+        GH->Flags = Append ? GlobalHasSteps : 0;
+        std::copy(PhysOrigin, PhysOrigin + 3, GH->PhysOrigin);
+        std::copy(PhysScale,  PhysScale  + 3, GH->PhysScale);
+
+
+        if (hasOctree)
+        {
+            octreeStart = sizeof(GlobalHeader<IsBigEndian>);
+            std::copy( serializedOctree.begin(), serializedOctree.end(), &Header[GH->GlobalHeaderSize] );
+        }
+        GH->OctreeSize = octreeSize;
+        GH->OctreeStart = octreeStart;
+
+
+        if (!NeedsBlockHeaders)
+        {
+            GH->BlocksSize = GH->BlocksStart = 0;
+        }
+        else
+        {
+            GH->BlocksSize = sizeof(BlockHeader<IsBigEndian>);
+            GH->BlocksStart = GH->RanksStart + SplitNRanks * sizeof(RankHeader<IsBigEndian>);
+        }
+
+    if (DictsSize > 0) {
+            GH->DictsSize = DictsSize;
+            GH->DictsStart = GH->BlocksStart + SplitNRanks * Vars.size() * sizeof(BlockHeader<IsBigEndian>);
+
+            DictHeader<IsBigEndian> *DH = (DictHeader<IsBigEndian> *) &Header[GH->DictsStart];
+            uint64_t DictStart = Vars.size() * sizeof(DictHeader<IsBigEndian>);
+      for (size_t i = 0; i < Vars.size(); ++i, ++DH) {
+                DH->Start = DictStart;
+                DH->Size = Dicts[i].size();
+                std::copy(Dicts[i].begin(), Dicts[i].end(), &Header[GH->DictsStart + DictStart]);
+                DictStart += Dicts[i].size();
+            }
+        }
+
+        uint64_t RecordSize = 0;
+        VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &Header[GH->VarsStart];
+    for (size_t i = 0; i < Vars.size(); ++i, ++VH) {
+            string VName(Vars[i].Name);
+            VName.resize(NameSize);
+
+            std::copy(VName.begin(), VName.end(), VH->Name);
+            uint64_t VFlags = 0;
+            if (Vars[i].IsFloat)  VFlags |= FloatValue;
+            if (Vars[i].IsSigned) VFlags |= SignedValue;
+            if (Vars[i].IsPhysCoordX) VFlags |= ValueIsPhysCoordX;
+            if (Vars[i].IsPhysCoordY) VFlags |= ValueIsPhysCoordY;
+            if (Vars[i].IsPhysCoordZ) VFlags |= ValueIsPhysCoordZ;
+            if (Vars[i].MaybePhysGhost) VFlags |= ValueMaybePhysGhost;
+            VH->Flags = VFlags;
+            RecordSize += VH->Size = Vars[i].Size;
+            VH->ElementSize = Vars[i].ElementSize;
+        }
+
+        MPI_Gather(&RHLocal, sizeof(RHLocal), MPI_BYTE,
+                   &Header[GH->RanksStart], sizeof(RHLocal),
+                   MPI_BYTE, 0, SplitComm);
+
+    if (NeedsBlockHeaders) {
+            MPI_Gather(&LocalBlockHeaders[0],
+                       Vars.size()*sizeof(BlockHeader<IsBigEndian>), MPI_BYTE,
+                       &Header[GH->BlocksStart],
+                       Vars.size()*sizeof(BlockHeader<IsBigEndian>), MPI_BYTE,
+                       0, SplitComm);
+
+            BlockHeader<IsBigEndian> *BH = (BlockHeader<IsBigEndian> *) &Header[GH->BlocksStart];
+            for (int i = 0; i < SplitNRanks; ++i)
+      for (size_t j = 0; j < Vars.size(); ++j, ++BH) {
+                    if (i == 0 && j == 0)
+                        BH->Start = StepStart + HeaderSize;
+                    else
+                        BH->Start = BH[-1].Start + BH[-1].Size + CRCSize;
+                }
+
+            RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &Header[GH->RanksStart];
+            RH->Start = StepStart + HeaderSize; ++RH;
+      for (int i = 1; i < SplitNRanks; ++i, ++RH) {
+                RH->Start =
+                    ((BlockHeader<IsBigEndian> *) &Header[GH->BlocksStart])[i * Vars.size()].Start;
+                GH->NElems += RH->NElems;
             }
 
             // Compute the total file size.
@@ -1045,7 +3052,7 @@ void GenericIO::write() {
             FileSize = BH[-1].Start + LastData;
     } else {
             RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &Header[GH->RanksStart];
-            RH->Start = HeaderSize; ++RH;
+            RH->Start = StepStart + HeaderSize; ++RH;
       for (int i = 1; i < SplitNRanks; ++i, ++RH) {
                 uint64_t PrevNElems = RH[-1].NElems;
                 uint64_t PrevData = PrevNElems * RecordSize + CRCSize * Vars.size();
@@ -1081,9 +3088,38 @@ void GenericIO::write() {
         else
             FH.get() = new GenericFileIO_POSIX();
 
+        uint64_t DataEnd = FileSize;
+        if (Append)
+        {
+            StepInfo SI;
+            SI.HeaderStart = StepStart;
+            SI.HeaderSize = HeaderSize;
+            SI.DataEnd = DataEnd;
+            SI.NElems = GH->NElems;
+            Steps.push_back(SI);
+
+            FileSize = DataEnd + stepIndexSize<IsBigEndian>(Steps.size());
+        }
+
         FH.get()->open(LocalFileName);
         FH.get()->setSize(FileSize);
-        FH.get()->write(&Header[0], HeaderSize, 0, "header");
+        FH.get()->write(&Header[0], HeaderSize, StepStart, "header");
+        if (Append)
+            writeStepIndex<IsBigEndian>(FH.get(), Steps, DataEnd);
+
+        // A file which had a single step has its first header marked (with
+        // a new CRC), unless the header predates the flag.
+        GlobalHeader<IsBigEndian> *FirstGH = FirstHeader.empty() ? 0 :
+                                             (GlobalHeader<IsBigEndian> *) &FirstHeader[0];
+    if (FirstGH && offsetof_safe(FirstGH, Flags) < FirstGH->GlobalHeaderSize) {
+            FirstGH->Flags = FirstGH->Flags | GlobalHasSteps;
+            uint64_t FirstCRC = crc64_omp(&FirstHeader[0], FirstHeader.size() - CRCSize);
+            crc64_invert(FirstCRC, &FirstHeader[FirstHeader.size() - CRCSize]);
+            FH.get()->write(&FirstHeader[0], FirstHeader.size(), 0, "header");
+        }
+
+        // Only the new step is reported as written
+        FileSize -= StepStart;
 
         close();
   } else {
@@ -1096,8 +3132,11 @@ void GenericIO::write() {
             MPI_Scatter(0, 0, MPI_BYTE, &LocalBlockHeaders[0], sizeof(BlockHeader<IsBigEndian>)*Vars.size(),
                         MPI_BYTE, 0, SplitComm);
     }
+    addPhase(StatHeader, HeaderStart);
 
+    double BarrierStart = statNow();
     MPI_Barrier(SplitComm);
+    addPhase(StatBarrier, BarrierStart);
 
     if (FileIOType == FileIOMPI)
         FH.get() = new GenericFileIO_MPI(SplitComm);
@@ -1108,42 +3147,35 @@ void GenericIO::write() {
 
     FH.get()->open(LocalFileName);
 
-    uint64_t Offset = RHLocal.Start;
+    // This rank's variables (each followed by its CRC) are contiguous in the
+    // file, so they are written with a single vectored request.
+    vector<GenericFileIO::Segment> Segments;
+    vector<char> CRCs(Vars.size() * CRCSize);
   for (size_t i = 0; i < Vars.size(); ++i) {
         uint64_t WriteSize = NeedsBlockHeaders ?
                              LocalBlockHeaders[i].Size : NElems * Vars[i].Size;
         //void *Data = NeedsBlockHeaders ? LocalData[i] : Vars[i].Data;
         void *Data = NeedsBlockHeaders ? LocalData[i] : _Vars[i].data;
-        uint64_t CRC = crc64_omp(Data, WriteSize);
-        bool HasExtraSpace = NeedsBlockHeaders ?
-                             LocalHasExtraSpace[i] : Vars[i].HasExtraSpace;
-        char *CRCLoc = HasExtraSpace ?  ((char *) Data) + WriteSize : (char *) &CRC;
-
-        if (NeedsBlockHeaders)
-            Offset = LocalBlockHeaders[i].Start;
-
-        // When using extra space for the CRC write, preserve the original contents.
-        char CRCSave[CRCSize];
-        if (HasExtraSpace)
-            std::copy(CRCLoc, CRCLoc + CRCSize, CRCSave);
-
-        crc64_invert(CRC, CRCLoc);
-
-    if (HasExtraSpace) {
-            FH.get()->write(Data, WriteSize + CRCSize, Offset, Vars[i].Name + " with CRC");
-    } else {
-            FH.get()->write(Data, WriteSize, Offset, Vars[i].Name);
-            FH.get()->write(CRCLoc, CRCSize, Offset + WriteSize, Vars[i].Name + " CRC");
-        }
+        beginVariable(Vars[i].Name);
+        double CRCStart = statNow();
+        crc64_invert(crc64_omp(Data, WriteSize), &CRCs[i * CRCSize]);
+        addPhase(StatCRC, CRCStart);
+        addBytes(WriteSize + CRCSize, NElems * Vars[i].Size);
+
+        Segments.push_back(GenericFileIO::Segment(Data, WriteSize));
+        Segments.push_back(GenericFileIO::Segment(&CRCs[i * CRCSize], CRCSize));
+    }
 
-        if (HasExtraSpace)
-            std::copy(CRCSave, CRCSave + CRCSize, CRCLoc);
+    endVariable();
 
-        Offset += WriteSize + CRCSize;
-    }
+    double IOStart = statNow();
+    FH.get()->writev(Segments, RHLocal.Start, "variables");
+    addPhase(StatIO, IOStart);
 
     close();
+    BarrierStart = statNow();
     MPI_Barrier(Comm);
+    addPhase(StatBarrier, BarrierStart);
 
     double EndTime = MPI_Wtime();
     double TotalTime = EndTime - StartTime;
@@ -1163,23 +3195,87 @@ void GenericIO::write() {
     }
 
 
-    if (useDuplicateData)
-    {
-        for (int i=0; i<Vars.size(); i++)
-            _Vars[i].deAllocateMem();
-    }
-
     MPI_Comm_free(&SplitComm);
     SplitComm = MPI_COMM_NULL;
 }
 #endif // GENERICIO_NO_MPI
 
+// Splits the rows of all file ranks evenly across NRanks readers, weighting
+// each row by one or (ByBytes) by the number of bytes stored for its rank per
+// row, and returns the file ranks and row ranges read by reader Rank. The
+// split points of neighboring readers are computed identically, so every row
+// is read exactly once.
+template <bool IsBigEndian>
+static void planRowRedistribution(vector<char> &Header, bool ByBytes, int NRanks, int Rank,
+                                  vector<int> &SourceRanks, vector<uint64_t> &RowStarts,
+                                  vector<uint64_t> &RowCounts) {
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &Header[0];
+    bool HasBlocks = offsetof(GlobalHeader<IsBigEndian>, BlocksStart) < GH->GlobalHeaderSize && GH->BlocksSize > 0;
+
+    uint64_t RecordSize = 0;
+    for (uint64_t j = 0; j < GH->NVars; ++j)
+        RecordSize += ((VariableHeader<IsBigEndian> *) &Header[GH->VarsStart + j * GH->VarsSize])->Size;
+
+    vector<uint64_t> NRows(GH->NRanks), Weights(GH->NRanks);
+    uint64_t TotalWeight = 0;
+  for (uint64_t i = 0; i < GH->NRanks; ++i) {
+        RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &Header[GH->RanksStart + i * GH->RanksSize];
+        NRows[i] = RH->NElems;
+        Weights[i] = NRows[i];
+
+    if (ByBytes && NRows[i] > 0) {
+      if (HasBlocks) {
+                Weights[i] = 0;
+        for (uint64_t j = 0; j < GH->NVars; ++j) {
+                    BlockHeader<IsBigEndian> *BH = (BlockHeader<IsBigEndian> *)
+                                                   &Header[GH->BlocksStart + (i * GH->NVars + j) * GH->BlocksSize];
+                    Weights[i] += BH->Size + CRCSize;
+                }
+      } else {
+                Weights[i] = NRows[i] * RecordSize + GH->NVars * CRCSize;
+            }
+        }
+
+        TotalWeight += Weights[i];
+    }
+
+    // The split point between readers k-1 and k, in weight units (computed
+    // without overflowing TotalWeight*k).
+    uint64_t Lo = (TotalWeight / NRanks) * Rank + (TotalWeight % NRanks) * Rank / NRanks,
+             Hi = (TotalWeight / NRanks) * (Rank + 1) + (TotalWeight % NRanks) * (Rank + 1) / NRanks;
+
+    uint64_t RankStart = 0;
+  for (uint64_t i = 0; i < GH->NRanks; RankStart += Weights[i], ++i) {
+        uint64_t RankEnd = RankStart + Weights[i];
+        if (!Weights[i] || RankEnd <= Lo || RankStart >= Hi)
+            continue;
+
+        uint64_t Bounds[2] = { std::max(Lo, RankStart) - RankStart, std::min(Hi, RankEnd) - RankStart };
+        uint64_t Rows[2];
+    for (int b = 0; b < 2; ++b) {
+            if (Bounds[b] >= Weights[i])
+                Rows[b] = NRows[i];
+            else if (Weights[i] == NRows[i])
+                Rows[b] = Bounds[b];
+            else
+                Rows[b] = (uint64_t) ((long double) Bounds[b] * NRows[i] / Weights[i]);
+        }
+
+    if (Rows[1] > Rows[0]) {
+            SourceRanks.push_back((int) i);
+            RowStarts.push_back(Rows[0]);
+            RowCounts.push_back(Rows[1] - Rows[0]);
+        }
+    }
+}
+
 template <bool IsBigEndian>
 void GenericIO::readHeaderLeader(void *GHPtr, MismatchBehavior MB, int NRanks,
                                  int Rank, int SplitNRanks,
                                  string &LocalFileName, uint64_t &HeaderSize,
-                                 vector<char> &Header) {
+                                 vector<char> &Header, uint64_t HeaderStart) {
     GlobalHeader<IsBigEndian> &GH = *(GlobalHeader<IsBigEndian> *) GHPtr;
+    bool PlanRows = false, PlanByBytes = false, PlanSpatial = false;
 
   if (MB == MismatchDisallowed) {
     if (SplitNRanks != (int) GH.NRanks) {
@@ -1218,7 +3314,32 @@ void GenericIO::readHeaderLeader(void *GHPtr, MismatchBehavior MB, int NRanks,
   } else if (MB == MismatchRedistribute && !Redistributing) {
         Redistributing = true;
 
+        RedistributionMode RM = Redistribution;
+        const char *EnvStr = getenv("GENERICIO_REDISTRIBUTE");
+    if (EnvStr) {
+            if (string(EnvStr) == "rows")
+                RM = RedistributeRows;
+            else if (string(EnvStr) == "bytes")
+                RM = RedistributeBytes;
+            else if (string(EnvStr) == "blocks")
+                RM = RedistributeBlocks;
+            else if (string(EnvStr) == "spatial")
+                RM = RedistributeSpatial;
+        }
+
         int NFileRanks = RankMap.empty() ? (int) GH.NRanks : (int) RankMap.size();
+
+        // The row-based plans need the rank headers, so they are made once the
+        // full header has been read. On a matching rank count, each reader
+        // keeps its own block (and so the decomposition).
+        PlanRows = (RM == RedistributeRows || RM == RedistributeBytes) &&
+                   RankMap.empty() && NFileRanks != NRanks;
+        PlanByBytes = RM == RedistributeBytes;
+        PlanSpatial = RM == RedistributeSpatial;
+
+        if (PlanSpatial && !RankMap.empty())
+            throw runtime_error("Won't read " + LocalFileName +
+                                ": spatial redistribution of partitioned outputs is not supported");
         int NFileRanksPerRank = NFileRanks / NRanks;
         int NRemFileRank = NFileRanks % NRanks;
 
@@ -1249,12 +3370,640 @@ void GenericIO::readHeaderLeader(void *GHPtr, MismatchBehavior MB, int NRanks,
     
     HeaderSize = GH.HeaderSize;
     Header.resize(HeaderSize + CRCSize, 0xFE /* poison */);
-    FH.get()->read(&Header[0], HeaderSize + CRCSize, 0, "header");
+    readThroughPrefix(&Header[0], HeaderSize + CRCSize, HeaderStart, "header");
 
     uint64_t CRC = crc64_omp(&Header[0], HeaderSize + CRCSize);
   if (CRC != (uint64_t) -1) {
         throw runtime_error("Header CRC check failed: " + LocalFileName);
     }
+
+  if (PlanRows) {
+        SourceRanks.clear();
+        planRowRedistribution<IsBigEndian>(Header, PlanByBytes, NRanks, Rank,
+                                           SourceRanks, SourceRowStarts, SourceRowCounts);
+  } else if (PlanSpatial) {
+        SourceRanks.clear();
+        planSpatialRedistribution<IsBigEndian>(Header, LocalFileName);
+    }
+}
+
+// Assigns to this reader the octree leaves which intersect its subdomain of
+// the Cartesian communicator, merging runs of leaves that are contiguous in
+// the file. Leaves not entirely inside the subdomain are filtered by position
+// after reading.
+template <bool IsBigEndian>
+void GenericIO::planSpatialRedistribution(vector<char> &Header, const string &LocalFileName) {
+    int Dims[3] = { 1, 1, 1 }, Coords[3] = { 0, 0, 0 };
+  #ifndef GENERICIO_NO_MPI
+    int TopoStatus, NDims = 0;
+    MPI_Topo_test(Comm, &TopoStatus);
+    if (TopoStatus == MPI_CART)
+        MPI_Cartdim_get(Comm, &NDims);
+
+    if (NDims != 3)
+        throw runtime_error("Won't read " + LocalFileName +
+                            ": spatial redistribution requires a 3D Cartesian communicator");
+
+    int Periods[3];
+    MPI_Cart_get(Comm, 3, Dims, Periods, Coords);
+  #endif
+
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &Header[0];
+    if (GH->VarsStart == 168 || GH->OctreeSize == 0)
+        throw runtime_error("Won't read " + LocalFileName +
+                            ": spatial redistribution requires an octree");
+
+    if (GH->OctreeStart + GH->OctreeSize > Header.size())
+        throw runtime_error("Octree section lies outside of the header: " + LocalFileName);
+
+    GIOOctree Octree;
+    Octree.deserialize(&Header[GH->OctreeStart], IsBigEndian, GH->OctreeSize);
+
+    // The global domain is the bounding box of the leaves; the outer faces are
+    // left open so that every row belongs to exactly one reader.
+    double Global[6] = { HUGE_VAL, -HUGE_VAL, HUGE_VAL, -HUGE_VAL, HUGE_VAL, -HUGE_VAL };
+  for (size_t l = 0; l < Octree.rows.size(); ++l) {
+        double Ext[6] = { Octree.rows[l].minX, Octree.rows[l].maxX, Octree.rows[l].minY,
+                          Octree.rows[l].maxY, Octree.rows[l].minZ, Octree.rows[l].maxZ };
+    for (int d = 0; d < 3; ++d) {
+            Global[2*d]   = std::min(Global[2*d], Ext[2*d]);
+            Global[2*d+1] = std::max(Global[2*d+1], Ext[2*d+1]);
+        }
+    }
+
+  for (int d = 0; d < 3; ++d) {
+        double Width = (Global[2*d+1] - Global[2*d]) / Dims[d];
+        SpatialDomain[2*d]   = Coords[d] == 0 ?
+                               -HUGE_VAL : Global[2*d] + Width * Coords[d];
+        SpatialDomain[2*d+1] = Coords[d] == Dims[d] - 1 ?
+                               HUGE_VAL : Global[2*d] + Width * (Coords[d] + 1);
+    }
+
+    SourceRowStarts.clear();
+    SourceRowCounts.clear();
+    SourceRowsFiltered.clear();
+  for (size_t l = 0; l < Octree.rows.size(); ++l) {
+        GIOOctreeRow &Leaf = Octree.rows[l];
+        if (Leaf.numParticles == 0)
+            continue;
+
+        double Ext[6] = { Leaf.minX, Leaf.maxX, Leaf.minY, Leaf.maxY, Leaf.minZ, Leaf.maxZ };
+        bool Overlaps = true, Inside = true;
+    for (int d = 0; d < 3; ++d) {
+            Overlaps = Overlaps && Ext[2*d] < SpatialDomain[2*d+1] && Ext[2*d+1] > SpatialDomain[2*d];
+            Inside = Inside && Ext[2*d] >= SpatialDomain[2*d] && Ext[2*d+1] <= SpatialDomain[2*d+1];
+        }
+
+        if (!Overlaps)
+            continue;
+
+        int Source = (int) Leaf.partitionLocation;
+    if (!SourceRanks.empty() && SourceRanks.back() == Source &&
+        SourceRowStarts.back() + SourceRowCounts.back() == Leaf.offsetInFile &&
+        SourceRowsFiltered.back() == (char) !Inside) {
+            SourceRowCounts.back() += Leaf.numParticles;
+            continue;
+        }
+
+        SourceRanks.push_back(Source);
+        SourceRowStarts.push_back(Leaf.offsetInFile);
+        SourceRowCounts.push_back(Leaf.numParticles);
+        SourceRowsFiltered.push_back(!Inside);
+    }
+}
+
+// Finds the (floating-point) position variables among those read.
+void GenericIO::getPositionVars(int PosVar[3], const string &Error) {
+    std::fill(PosVar, PosVar + 3, -1);
+  for (size_t i = 0; i < Vars.size(); ++i) {
+        if (PosVar[0] == -1 && (Vars[i].IsPhysCoordX || Vars[i].Name == "x")) PosVar[0] = i;
+        if (PosVar[1] == -1 && (Vars[i].IsPhysCoordY || Vars[i].Name == "y")) PosVar[1] = i;
+        if (PosVar[2] == -1 && (Vars[i].IsPhysCoordZ || Vars[i].Name == "z")) PosVar[2] = i;
+    }
+
+    for (int d = 0; d < 3; ++d)
+        if (PosVar[d] == -1 || !Vars[PosVar[d]].IsFloat ||
+            (Vars[PosVar[d]].Size != sizeof(float) && Vars[PosVar[d]].Size != sizeof(double)))
+            throw runtime_error(Error + " requires reading the (floating-point) "
+                                "position variables from: " + OpenFileName);
+}
+
+// Moves N rows of V from row From to row To (not after From).
+static void moveRows(const GenericIO::Variable &V, size_t From, size_t N, size_t To) {
+    char *Data = (char *) V.Data;
+  if (V.Stride == V.Size) {
+        std::memmove(Data + To * V.Size, Data + From * V.Size, N * V.Size);
+        return;
+    }
+
+    for (size_t k = 0; k < N; ++k)
+        std::memmove(Data + (To + k) * V.Stride, Data + (From + k) * V.Stride, V.Size);
+}
+
+// Returns the value of the (floating-point) position variable V in row r.
+static double positionValue(const GenericIO::Variable &V, size_t r) {
+    const char *P = ((const char *) V.Data) + r * V.Stride;
+    return V.Size == sizeof(float) ? (double) *(const float *) P : *(const double *) P;
+}
+
+// Compacts rows [RowOffset, RowOffset + NRows) of all variables to those whose
+// position lies inside this reader's subdomain.
+void GenericIO::filterSpatialRows(size_t RowOffset, size_t NRows, size_t &NKept) {
+    int PosVar[3];
+    getPositionVars(PosVar, "Spatial redistribution");
+
+    size_t Out = RowOffset;
+  for (size_t r = RowOffset; r < RowOffset + NRows; ++r) {
+        bool Inside = true;
+    for (int d = 0; d < 3 && Inside; ++d) {
+            double P = positionValue(Vars[PosVar[d]], r);
+            Inside = P >= SpatialDomain[2*d] && P < SpatialDomain[2*d+1];
+        }
+
+        if (!Inside)
+            continue;
+
+        if (Out != r)
+            for (size_t i = 0; i < Vars.size(); ++i)
+                moveRows(Vars[i], r, 1, Out);
+        ++Out;
+    }
+
+    NKept = Out - RowOffset;
+}
+
+// Selects the leaves intersecting the region. With Periodic, the box is first
+// split into (up to eight) boxes inside the physical domain; Boxes holds their
+// extents, six per box.
+void GenericIO::planRegion(const double Box[6], bool Periodic, int EffRank,
+                           vector<double> &Boxes, vector<RegionRun> &Runs) {
+    if (!hasOctree)
+        throw runtime_error("Region reads require an octree: " + OpenFileName);
+
+    double Origin[3], Scale[3];
+    readPhysOrigin(Origin);
+    readPhysScale(Scale);
+
+    vector<double> Ranges[3];
+  for (int d = 0; d < 3; ++d) {
+        double Lo = Box[2*d], Hi = Box[2*d+1];
+    if (!(Lo <= Hi)) {
+            stringstream ss;
+            ss << "Invalid region: " << Lo << " - " << Hi << " in dimension " << d;
+            throw runtime_error(ss.str());
+        }
+
+    if (!Periodic || Scale[d] <= 0) {
+            Ranges[d].push_back(Lo);
+            Ranges[d].push_back(Hi);
+    } else if (Hi - Lo >= Scale[d]) {
+            Ranges[d].push_back(Origin[d]);
+            Ranges[d].push_back(Origin[d] + Scale[d]);
+    } else {
+            double Shift = floor((Lo - Origin[d]) / Scale[d]) * Scale[d];
+            Lo -= Shift;
+            Hi -= Shift;
+
+            Ranges[d].push_back(Lo);
+            Ranges[d].push_back(std::min(Hi, Origin[d] + Scale[d]));
+      if (Hi > Origin[d] + Scale[d]) {
+                Ranges[d].push_back(Origin[d]);
+                Ranges[d].push_back(Hi - Scale[d]);
+            }
+        }
+    }
+
+    Boxes.clear();
+    for (size_t i = 0; i < Ranges[0].size(); i += 2)
+        for (size_t j = 0; j < Ranges[1].size(); j += 2)
+      for (size_t k = 0; k < Ranges[2].size(); k += 2) {
+                double B[6] = { Ranges[0][i], Ranges[0][i+1], Ranges[1][j],
+                                Ranges[1][j+1], Ranges[2][k], Ranges[2][k+1] };
+                Boxes.insert(Boxes.end(), B, B + 6);
+            }
+
+    // Adjacent leaves of a rank are read together. Of the leaves partially in
+    // the region, only the cells of the sub-leaf index (if any) that overlap
+    // it are read.
+    Runs.clear();
+    bool SubLeaves = octreeData.hasSubLeafIndex();
+  for (size_t l = 0; l < octreeData.rows.size(); ++l) {
+        GIOOctreeRow &Leaf = octreeData.rows[l];
+        if (Leaf.numParticles == 0 || (EffRank != -1 && Leaf.partitionLocation != (uint64_t) EffRank))
+            continue;
+
+        double Ext[6] = { Leaf.minX, Leaf.maxX, Leaf.minY, Leaf.maxY, Leaf.minZ, Leaf.maxZ };
+        bool Overlaps, Inside;
+        regionOverlap(Ext, Boxes, 0.0, Overlaps, Inside);
+        if (!Overlaps)
+            continue;
+
+    if (Inside || !SubLeaves) {
+            addRegionRun(Runs, (int) Leaf.partitionLocation, Leaf.offsetInFile, Leaf.numParticles, !Inside);
+            continue;
+        }
+
+        // The cells' extents are computed, so they are padded against the
+        // rounding of the positions' cells when written.
+        double Pad = 1e-9 * std::max(std::max(Leaf.maxX - Leaf.minX, Leaf.maxY - Leaf.minY),
+                                     Leaf.maxZ - Leaf.minZ);
+    for (uint64_t c = 0; c < octreeData.getNumSubLeafCells(); ++c) {
+            uint64_t Start, Count;
+            double CellExt[6];
+            octreeData.getSubLeafCell(l, c, Start, Count, CellExt);
+            if (Count == 0)
+                continue;
+
+            regionOverlap(CellExt, Boxes, Pad, Overlaps, Inside);
+            if (Overlaps)
+                addRegionRun(Runs, (int) Leaf.partitionLocation, Leaf.offsetInFile + Start, Count, !Inside);
+        }
+    }
+}
+
+// Whether the extents (half-open, padded by Pad) overlap one of the region's
+// boxes, and whether they are inside one.
+void GenericIO::regionOverlap(const double Ext[6], const vector<double> &Boxes, double Pad,
+                              bool &Overlaps, bool &Inside) {
+    double PaddedExt[6];
+    for (int d = 0; d < 3; ++d) {
+        PaddedExt[2*d] = Ext[2*d] - Pad;
+        PaddedExt[2*d+1] = Ext[2*d+1] + Pad;
+    }
+
+    Overlaps = Inside = false;
+  for (size_t b = 0; b < Boxes.size(); b += 6) {
+        if (!gioOctreeBoxIntersect(PaddedExt, &Boxes[b]))
+            continue;
+
+        Overlaps = true;
+        bool InBox = true;
+        for (int d = 0; d < 3; ++d)
+            InBox = InBox && PaddedExt[2*d] >= Boxes[b + 2*d] && PaddedExt[2*d+1] <= Boxes[b + 2*d+1];
+        Inside = Inside || InBox;
+    }
+}
+
+// Appends rows [Start, Start + Count) of a rank, extending the last run when
+// they follow it.
+void GenericIO::addRegionRun(vector<RegionRun> &Runs, int Rank, uint64_t Start,
+                             uint64_t Count, bool Filtered) {
+  if (!Runs.empty() && Runs.back().Rank == Rank &&
+      Runs.back().Start + Runs.back().Count == Start) {
+        Runs.back().Count += Count;
+        Runs.back().Filtered = Runs.back().Filtered || Filtered;
+        return;
+    }
+
+    RegionRun R = { Rank, Start, Count, Filtered };
+    Runs.push_back(R);
+}
+
+// Clears the mask of the rows whose coordinate lies outside [Lo, Hi]. The
+// loop has no branches, so that it can be vectorized.
+template <typename T>
+static void maskRegionRows(const T *Pos, size_t NRows, double Lo, double Hi,
+                           unsigned char *Mask) {
+    for (size_t r = 0; r < NRows; ++r)
+        Mask[r] &= (unsigned char) ((Pos[r] >= Lo) & (Pos[r] <= Hi));
+}
+
+// Compacts rows [RowOffset, RowOffset + NRows) of all variables to those whose
+// position lies inside one of the region's boxes.
+void GenericIO::filterRegionRows(const int PosVar[3], size_t RowOffset, size_t NRows,
+                                 const vector<double> &Boxes, size_t &NKept) {
+    vector<unsigned char> Keep(NRows, 0), Mask(NRows);
+    vector<double> Strided;
+  for (size_t b = 0; b < Boxes.size(); b += 6) {
+        std::fill(Mask.begin(), Mask.end(), 1);
+    for (int d = 0; d < 3; ++d) {
+            const Variable &V = Vars[PosVar[d]];
+      if (V.Stride != V.Size) {
+                // Positions stored with a stride are gathered first.
+                Strided.resize(NRows);
+                for (size_t r = 0; r < NRows; ++r)
+                    Strided[r] = positionValue(V, RowOffset + r);
+                maskRegionRows(&Strided[0], NRows, Boxes[b + 2*d], Boxes[b + 2*d+1],
+                               &Mask[0]);
+      } else if (V.Size == sizeof(float))
+                maskRegionRows(((float *) V.Data) + RowOffset, NRows,
+                               Boxes[b + 2*d], Boxes[b + 2*d+1], &Mask[0]);
+            else
+                maskRegionRows(((double *) V.Data) + RowOffset, NRows,
+                               Boxes[b + 2*d], Boxes[b + 2*d+1], &Mask[0]);
+        }
+
+        for (size_t r = 0; r < NRows; ++r)
+            Keep[r] |= Mask[r];
+    }
+
+    size_t Out = 0;
+  for (size_t r = 0; r < NRows; ++r) {
+        if (!Keep[r])
+            continue;
+
+        if (Out != r)
+            for (size_t i = 0; i < Vars.size(); ++i)
+                moveRows(Vars[i], RowOffset + r, 1, RowOffset + Out);
+        ++Out;
+    }
+
+    NKept = Out;
+}
+
+// Makes this copy a cursor which reads independently of the other ranks (and
+// of the object it was copied from): it opens (other partitions) on its own,
+// as redistributing readers do, and its reads are not accounted for in the
+// original's calls.
+void GenericIO::makeIndependentCursor() {
+    Redistributing = true;
+    CurCall = CurVar = -1;
+  #ifndef GENERICIO_NO_MPI
+    SplitComm = MPI_COMM_NULL;
+  #endif
+}
+
+// Independent cursors can read on several threads, unless MPI lacks the
+// thread support.
+bool GenericIO::cursorsCanUseThreads() {
+  #ifndef GENERICIO_NO_MPI
+    int Provided;
+    MPI_Query_thread(&Provided);
+    return Provided == MPI_THREAD_MULTIPLE;
+  #else
+    return true;
+  #endif
+}
+
+size_t GenericIO::readRegionNumElems(const double Box[6], bool Periodic, int EffRank) {
+    vector<double> Boxes;
+    vector<RegionRun> Runs;
+    planRegion(Box, Periodic, EffRank, Boxes, Runs);
+
+    size_t NElems = 0;
+    for (size_t r = 0; r < Runs.size(); ++r)
+        NElems += Runs[r].Count;
+    return NElems;
+}
+
+size_t GenericIO::readRegion(const double Box[6], bool Periodic, int EffRank) {
+    CallScope Scope(*this, "readRegion");
+
+    vector<double> Boxes;
+    vector<RegionRun> Runs;
+    planRegion(Box, Periodic, EffRank, Boxes, Runs);
+
+    int PosVar[3];
+    getPositionVars(PosVar, "Region reads");
+
+    // Each run is read to (and filtered within) its own rows of the
+    // variables, which are compacted at the end.
+    vector<size_t> RunOffsets(Runs.size(), 0), NKept(Runs.size(), 0);
+    for (size_t r = 1; r < Runs.size(); ++r)
+        RunOffsets[r] = RunOffsets[r-1] + Runs[r-1].Count;
+
+    bool Threaded = cursorsCanUseThreads();
+    uint64_t TotalReadSize = 0;
+    int NErrs[3] = { 0, 0, 0 };
+    string Error;
+
+    #ifdef _OPENMP
+    #pragma omp parallel if(Threaded && Runs.size() > 1) reduction(+:TotalReadSize)
+    #endif
+  {
+        // Each thread reads through its own cursor; the reads are accounted
+        // for in this call.
+        GenericIO Cursor(*this);
+        Cursor.makeIndependentCursor();
+
+        int CursorErrs[3] = { 0, 0, 0 };
+
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+        #endif
+    for (int r = 0; r < (int) Runs.size(); ++r) {
+      try {
+                int RunErrs[3] = { 0, 0, 0 };
+                Cursor.readDataSection(Runs[r].Start, Runs[r].Count, Runs[r].Rank,
+                                       RunOffsets[r], 0, TotalReadSize, RunErrs);
+        if (RunErrs[0] || RunErrs[1] || RunErrs[2]) {
+                    for (int e = 0; e < 3; ++e)
+                        CursorErrs[e] += RunErrs[e];
+                    continue;
+                }
+
+                NKept[r] = Runs[r].Count;
+                if (Runs[r].Filtered)
+                    filterRegionRows(PosVar, RunOffsets[r], Runs[r].Count, Boxes, NKept[r]);
+      } catch (std::exception &e) {
+                #ifdef _OPENMP
+                #pragma omp critical
+                #endif
+                Error = e.what();
+            }
+        }
+
+        #ifdef _OPENMP
+        #pragma omp critical
+        #endif
+        for (int e = 0; e < 3; ++e)
+            NErrs[e] += CursorErrs[e];
+    }
+
+    if (!Error.empty())
+        throw runtime_error(Error);
+
+    ReadStats.CRCErrors += NErrs[1];
+    ReadStats.DecompressionErrors += NErrs[2];
+  if (NErrs[0] > 0 || NErrs[1] > 0 || NErrs[2] > 0) {
+        stringstream ss;
+        ss << "Experienced " << NErrs[0] << " I/O error(s), " <<
+           NErrs[1] << " CRC error(s) and " << NErrs[2] <<
+           " decompression CRC error(s) reading: " << OpenFileName;
+        throw runtime_error(ss.str());
+    }
+
+    size_t Out = 0, RowSize = 0;
+    for (size_t i = 0; i < Vars.size(); ++i)
+        RowSize += Vars[i].Size;
+  for (size_t r = 0; r < Runs.size(); ++r) {
+        if (Out != RunOffsets[r])
+            for (size_t i = 0; i < Vars.size(); ++i)
+                moveRows(Vars[i], RunOffsets[r], NKept[r], Out);
+        Out += NKept[r];
+    }
+
+    addBytes(TotalReadSize, Out * RowSize);
+    NumReadRows = Out;
+    return Out;
+}
+
+// Finds the header of the selected step (and the number of steps) of the file
+// opened by the leader.
+template <bool IsBigEndian>
+uint64_t GenericIO::readStepHeaderStart(const string &LocalFileName, const void *GHPtr) {
+    vector<StepInfo> Steps;
+    if (mayHaveSteps((const GlobalHeader<IsBigEndian> *) GHPtr))
+        readStepIndex<IsBigEndian>(FH.get(), LocalFileName, Steps, PrefixFileSize, &HeaderPrefix,
+                                   &HeaderTail);
+    NSteps = Steps.empty() ? 1 : Steps.size();
+
+  if (Step < 0 || (uint64_t) Step >= NSteps) {
+        stringstream ss;
+        ss << "Won't read " << LocalFileName << ": step " << Step <<
+           " requested, but the file has " << NSteps << " step(s)";
+        throw runtime_error(ss.str());
+    }
+
+    return Steps.empty() ? 0 : Steps[Step].HeaderStart;
+}
+
+static size_t getHeaderPrefetch(size_t Prefetch) {
+    const char *EnvStr = getenv("GENERICIO_HEADER_PREFETCH");
+    if (EnvStr)
+        Prefetch = strtoull(EnvStr, 0, 10);
+    return std::max(Prefetch, sizeof(GlobalHeader<false>));
+}
+
+// Reads the first Prefetch bytes of the file (or all of it, if smaller) with
+// one request.
+static void readPrefix(GenericFileIO *GFIO, size_t Prefetch, uint64_t FileSize,
+                       vector<char> &Prefix) {
+    Prefix.resize(std::min((uint64_t) Prefetch, FileSize));
+    if (!Prefix.empty())
+        GFIO->read(&Prefix[0], Prefix.size(), 0, "header prefix");
+}
+
+// Reads from the file, taking whatever part of the range is covered by the
+// prefix from memory.
+static void readThrough(GenericFileIO *GFIO, const vector<char> &Prefix, void *Buf,
+                        size_t Count, uint64_t Offset, const string &D) {
+    size_t Covered = 0;
+  if (Offset < Prefix.size()) {
+        Covered = std::min((uint64_t) Count, Prefix.size() - Offset);
+        std::copy(Prefix.begin() + Offset, Prefix.begin() + Offset + Covered, (char *) Buf);
+    }
+
+    if (Covered < Count)
+        GFIO->read(((char *) Buf) + Covered, Count - Covered, Offset + Covered, D);
+}
+
+// Reads the start of the file opened by the leader with one request, unless
+// it is already held (as after checking for a rank map), so that the global
+// header, the step index of small files and usually the whole header need no
+// further reads.
+void GenericIO::fetchHeaderPrefix(const string &LocalFileName) {
+    if (PrefixFileName == LocalFileName && !HeaderPrefix.empty())
+        return;
+
+    PrefixFileName.clear();
+    HeaderTail.clear();
+    PrefixFileSize = FH.get()->getSize();
+    readPrefix(FH.get(), getHeaderPrefetch(HeaderPrefetch), PrefixFileSize, HeaderPrefix);
+    PrefixFileName = LocalFileName;
+}
+
+void GenericIO::readThroughPrefix(void *Buf, size_t Count, uint64_t Offset,
+                                  const string &D) {
+    readThrough(FH.get(), HeaderPrefix, Buf, Count, Offset, D);
+}
+
+GenericIO::RetryPolicy GenericIO::getRetryPolicy() {
+    RetryPolicy P = ReadRetry;
+
+    const char *EnvStr = getenv("GENERICIO_RETRY_COUNT");
+    if (EnvStr)
+        P.MaxRetries = atoi(EnvStr);
+
+    EnvStr = getenv("GENERICIO_RETRY_SLEEP");
+    if (EnvStr)
+        P.InitialDelay = atoi(EnvStr) / 1000.0;
+
+    EnvStr = getenv("GENERICIO_RETRY_DEADLINE");
+    if (EnvStr)
+        P.Deadline = atof(EnvStr);
+
+    return P;
+}
+
+// Paces the retries of one read under a retry policy.
+class RetryPacer {
+  public:
+  RetryPacer(const GenericIO::RetryPolicy &P)
+        : Policy(P), Retries(0), Delay(P.InitialDelay),
+          Start(std::chrono::steady_clock::now()) {
+        int Rank;
+        #ifndef GENERICIO_NO_MPI
+        MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+        #else
+        Rank = 0;
+        #endif
+
+        Seed = (unsigned) time(0) ^ (unsigned) getpid() ^ ((unsigned) Rank * 2654435761u);
+    }
+
+    // Waits before the next attempt, which will request Bytes bytes. Returns
+    // false, without waiting, once the retries or the deadline are used up.
+  bool wait(GenericIO::IOStats &Stats, uint64_t Bytes) {
+        double Elapsed = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - Start).count();
+
+        double Sleep = Delay * (1 + Policy.Jitter * (2.0 * rand_r(&Seed) / RAND_MAX - 1));
+        Sleep = std::max(Sleep, 0.0);
+        if (Policy.Deadline > 0)
+            Sleep = std::min(Sleep, Policy.Deadline - Elapsed);
+
+    if (Retries >= Policy.MaxRetries || Sleep < 0 ||
+        (Policy.Deadline > 0 && Elapsed >= Policy.Deadline)) {
+            ++Stats.FailedReads;
+            return false;
+        }
+
+        usleep((useconds_t) (Sleep * 1e6));
+        Delay = std::min(Delay * Policy.Backoff, Policy.MaxDelay);
+        ++Retries;
+
+        ++Stats.Retries;
+        Stats.RetriedBytes += Bytes;
+        Stats.RetryWait += Sleep;
+        return true;
+    }
+
+  private:
+    GenericIO::RetryPolicy Policy;
+    int Retries;
+    double Delay;
+    unsigned Seed;
+    std::chrono::steady_clock::time_point Start;
+};
+
+// Reads the range (through the prefix), retrying failed reads under the retry
+// policy. A retry requests only the bytes which were not read before the
+// failure. Returns false if the read was given up on.
+bool GenericIO::readRetrying(void *Buf, size_t Count, uint64_t Offset,
+                             const string &D) {
+    RetryPacer Pacer(getRetryPolicy());
+    ++ReadStats.Reads;
+
+    size_t Done = 0;
+  for (;;) {
+    try {
+            // Only the leader holds the prefix, so collective reads, which
+            // every rank must make, always go to the file.
+            if (FileIOType == FileIOMPICollective)
+                FH.get()->read(((char *) Buf) + Done, Count - Done, Offset + Done, D);
+            else
+                readThroughPrefix(((char *) Buf) + Done, Count - Done, Offset + Done, D);
+            return true;
+    } catch (...) {
+            if (FileIOType != FileIOMPICollective && Offset + Done < HeaderPrefix.size())
+                Done += std::min((uint64_t) (Count - Done), HeaderPrefix.size() - (Offset + Done));
+            Done += FH.get()->getReadDone();
+        }
+
+        if (!Pacer.wait(ReadStats, Count - Done))
+            return false;
+    }
 }
 
 void GenericIO::readOctreeHeader(int octreeOffset, int octreeStringSize, bool bigEndian)
@@ -1263,7 +4012,13 @@ void GenericIO::readOctreeHeader(int octreeOffset, int octreeStringSize, bool bi
     octreeHeader.resize(octreeStringSize);
     FH.get()->read(&octreeHeader[0], octreeStringSize, octreeOffset, "Octree Header");
 
-    octreeData.deserialize(&octreeHeader[0], bigEndian);
+    octreeData.deserialize(&octreeHeader[0], bigEndian, octreeStringSize);
+}
+
+void GenericIO::readOctreeHeader(const char *octreeSection, size_t octreeStringSize, bool bigEndian)
+{
+    std::vector<char> octreeHeader(octreeSection, octreeSection + octreeStringSize);
+    octreeData.deserialize(&octreeHeader[0], bigEndian, octreeStringSize);
 }
 
 // Note: Errors from this function should be recoverable. This means that if
@@ -1285,12 +4040,14 @@ void GenericIO::openAndReadHeader(MismatchBehavior MB, int EffRank, bool CheckPa
         // First, check to see if the file is a rank map.
         unsigned long RanksInMap = 0;
     if (Rank == 0) {
-      try {
-                #ifndef GENERICIO_NO_MPI
-                GenericIO GIO(MPI_COMM_SELF, FileName, FileIOType);
-                #else
-                GenericIO GIO(FileName, FileIOType);
-                #endif
+            #ifndef GENERICIO_NO_MPI
+            GenericIO GIO(MPI_COMM_SELF, FileName, FileIOType);
+            #else
+            GenericIO GIO(FileName, FileIOType);
+            #endif
+            GIO.HeaderPrefetch = HeaderPrefetch;
+
+      try {
                 GIO.openAndReadHeader(MismatchDisallowed, 0, false);
                 RanksInMap = GIO.readNumElems();
 
@@ -1303,6 +4060,15 @@ void GenericIO::openAndReadHeader(MismatchBehavior MB, int EffRank, bool CheckPa
                 RankMap.clear();
                 RanksInMap = 0;
             }
+
+            // Unless the file is a rank map, its header is read next, and
+            // the probe has already fetched it.
+      if (RanksInMap == 0 && GIO.PrefixFileName == FileName) {
+                PrefixFileName = FileName;
+                PrefixFileSize = GIO.PrefixFileSize;
+                HeaderPrefix.swap(GIO.HeaderPrefix);
+                HeaderTail.swap(GIO.HeaderTail);
+            }
         }
 
         #ifndef GENERICIO_NO_MPI
@@ -1341,10 +4107,19 @@ void GenericIO::openAndReadHeader(MismatchBehavior MB, int EffRank, bool CheckPa
         #endif
     }
 
-    if (LocalFileName == OpenFileName)
+    if (LocalFileName == OpenFileName && Step == OpenStep)
         return;
     FH.close();
 
+    CallScope Scope(*this, "openAndReadHeader");
+    double OpenStart = statNow();
+
+  if (PrefixFileName != LocalFileName) {
+        PrefixFileName.clear();
+        HeaderPrefix.clear();
+        HeaderTail.clear();
+    }
+
     int SplitNRanks, SplitRank;
     #ifndef GENERICIO_NO_MPI
     MPI_Comm_rank(SplitComm, &SplitRank);
@@ -1373,16 +4148,25 @@ void GenericIO::openAndReadHeader(MismatchBehavior MB, int EffRank, bool CheckPa
 
     try {
             FH.get()->open(LocalFileName, true);
+            fetchHeaderPrefix(LocalFileName);
 
             GlobalHeader<false> GH; // endianness does not matter yet...
-            FH.get()->read(&GH, sizeof(GlobalHeader<false>), 0, "global header");
+            readThroughPrefix(&GH, sizeof(GlobalHeader<false>), 0, "global header");
 
       if (string(GH.Magic, GH.Magic + MagicSize - 1) == MagicLE) {
+                uint64_t HeaderStart = readStepHeaderStart<false>(LocalFileName, &GH);
+                if (HeaderStart != 0)
+                    readThroughPrefix(&GH, sizeof(GlobalHeader<false>), HeaderStart, "global header");
+
                 readHeaderLeader<false>(&GH, MB, NRanks, Rank, SplitNRanks, LocalFileName,
-                                        HeaderSize, Header);
+                                        HeaderSize, Header, HeaderStart);
       } else if (string(GH.Magic, GH.Magic + MagicSize - 1) == MagicBE) {
+                uint64_t HeaderStart = readStepHeaderStart<true>(LocalFileName, &GH);
+                if (HeaderStart != 0)
+                    readThroughPrefix(&GH, sizeof(GlobalHeader<false>), HeaderStart, "global header");
+
                 readHeaderLeader<true>(&GH, MB, NRanks, Rank, SplitNRanks, LocalFileName,
-                                       HeaderSize, Header);
+                                       HeaderSize, Header, HeaderStart);
       } else {
                 string Error = "invalid file-type identifier";
                 throw runtime_error("Won't read " + LocalFileName + ": " + Error);
@@ -1410,6 +4194,7 @@ void GenericIO::openAndReadHeader(MismatchBehavior MB, int EffRank, bool CheckPa
 
   #ifndef GENERICIO_NO_MPI
     MPI_Bcast(&HeaderSize, 1, MPI_UINT64_T, 0, SplitComm);
+    MPI_Bcast(&NSteps, 1, MPI_UINT64_T, 0, SplitComm);
   #endif
 
     Header.resize(HeaderSize, 0xFD /* poison */);
@@ -1427,17 +4212,23 @@ void GenericIO::openAndReadHeader(MismatchBehavior MB, int EffRank, bool CheckPa
     Timer readOctreeClock;
     readOctreeClock.start();
 
-    int octreeStart = 0;
-    int octreeSize = 0;
-    if (GH->VarsStart != 168)      // for files that do not have octrees
-        if (GH->OctreeSize != 0)   // for files with octree support but have no octree in place
+    bool isBigEndian = string(GH->Magic, GH->Magic + MagicSize - 1) == MagicBE;
+    GlobalHeader<true> *GHBE = (GlobalHeader<true> *) &Header[0];
+    uint64_t varsStart   = isBigEndian ? (uint64_t) GHBE->VarsStart : (uint64_t) GH->VarsStart;
+    uint64_t octreeStart = 0;
+    uint64_t octreeSize  = isBigEndian ? (uint64_t) GHBE->OctreeSize : (uint64_t) GH->OctreeSize;
+    if (varsStart != 168)          // for files that do not have octrees
+        if (octreeSize != 0)       // for files with octree support but have no octree in place
         {
-            bool isBigEndian = string(GH->Magic, GH->Magic + MagicSize - 1) == MagicBE;
             hasOctree = true;
-            octreeSize = GH->OctreeSize;
-            octreeStart = GH->OctreeStart;
-            
-            readOctreeHeader(octreeStart, octreeSize, isBigEndian);
+            octreeStart = isBigEndian ? (uint64_t) GHBE->OctreeStart : (uint64_t) GH->OctreeStart;
+
+            // The octree section lives inside the header, which has already
+            // been broadcast to every rank (the file itself is closed here).
+            if (octreeStart + octreeSize > Header.size())
+                throw runtime_error("Octree section lies outside of the header: " + LocalFileName);
+
+            readOctreeHeader(&Header[octreeStart], octreeSize, isBigEndian);
         }
     readOctreeClock.stop();
     
@@ -1446,10 +4237,20 @@ void GenericIO::openAndReadHeader(MismatchBehavior MB, int EffRank, bool CheckPa
 
     FH.getHeaderCache().swap(Header);
     OpenFileName = LocalFileName;
+    OpenStep = Step;
+
+    if (FH.isBigEndian())
+        loadDictionaries<true>();
+    else
+        loadDictionaries<false>();
+    addPhase(StatHeader, OpenStart);
 
     #ifndef GENERICIO_NO_MPI
-    if (!DisableCollErrChecking)
+    if (!DisableCollErrChecking) {
+        double BarrierStart = statNow();
         MPI_Barrier(Comm);
+        addPhase(StatBarrier, BarrierStart);
+    }
 
   if (FileIOType == FileIOMPI)
     FH.get() = new GenericFileIO_MPI(SplitComm);
@@ -1514,86 +4315,646 @@ uint64_t GenericIO::readTotalNumElems() {
     return readTotalNumElems<false>();
 }
 
-template <bool IsBigEndian>
-uint64_t GenericIO::readTotalNumElems() {
-    if (RankMap.size())
-        return (uint64_t) - 1;
+template <bool IsBigEndian>
+uint64_t GenericIO::readTotalNumElems() {
+    if (RankMap.size())
+        return (uint64_t) - 1;
+
+    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
+    return GH->NElems;
+}
+
+void GenericIO::readPhysOrigin(double Origin[3]) {
+    if (FH.isBigEndian())
+        readPhysOrigin<true>(Origin);
+    else
+        readPhysOrigin<false>(Origin);
+}
+
+template <bool IsBigEndian>
+void GenericIO::loadDictionaries() {
+    vector<char> &Header = FH.getHeaderCache();
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &Header[0];
+    vector< shared_ptr<void> > &Dicts = FH.getDictionaries();
+
+    Dicts.clear();
+    if (offsetof_safe(GH, DictsStart) >= GH->GlobalHeaderSize || GH->DictsSize == 0)
+        return;
+
+    uint64_t DictsStart = GH->DictsStart, DictsSize = GH->DictsSize, NVars = GH->NVars;
+    if (DictsStart + DictsSize > Header.size() ||
+        NVars * sizeof(DictHeader<IsBigEndian>) > DictsSize)
+        throw runtime_error("Dictionary section lies outside of the header: " + OpenFileName);
+
+    Dicts.resize(NVars);
+    DictHeader<IsBigEndian> *DH = (DictHeader<IsBigEndian> *) &Header[DictsStart];
+  for (uint64_t j = 0; j < NVars; ++j, ++DH) {
+        uint64_t Start = DH->Start, Size = DH->Size;
+        if (Size == 0)
+            continue;
+
+        ZSTD_DDict *DDict = 0;
+        if (Start + Size <= DictsSize)
+            DDict = ZSTD_createDDict(&Header[DictsStart + Start], Size);
+    if (!DDict) {
+            stringstream ss;
+            ss << "Invalid dictionary for variable " << j << " in: " << OpenFileName;
+            throw runtime_error(ss.str());
+        }
+
+        Dicts[j] = shared_ptr<void>(DDict, [](void *D) { ZSTD_freeDDict((ZSTD_DDict *) D); });
+    }
+}
+
+static const ZSTD_DDict *fileDictionary(vector< shared_ptr<void> > &Dicts, size_t Var) {
+    return Var < Dicts.size() ? (const ZSTD_DDict *) Dicts[Var].get() : 0;
+}
+
+// The file variable which Name reads: the one of that name or, failing that,
+// for a name of the form <variable>.<component> (x, y, z or w, or an index),
+// that component of a variable of several (as transposedComponents counts
+// them). Comp is set to the component, or to -1 for whole variables. Returns
+// NVars if there is no such variable.
+template <bool IsBigEndian>
+static uint64_t findFileVariable(vector<char> &Header, const string &Name, int &Comp) {
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &Header[0];
+    uint64_t NVars = GH->NVars;
+    Comp = -1;
+
+    auto Find = [&](const string &N) -> uint64_t {
+    for (uint64_t j = 0; j < NVars; ++j) {
+            VariableHeader<IsBigEndian> *VH =
+                (VariableHeader<IsBigEndian> *) &Header[GH->VarsStart + j * GH->VarsSize];
+            if (string(VH->Name, strnlen(VH->Name, NameSize)) == N)
+                return j;
+        }
+
+        return NVars;
+    };
+
+    uint64_t j = Find(Name);
+    size_t Dot = Name.rfind('.');
+    if (j < NVars || Dot == string::npos || Dot + 1 == Name.size())
+        return j;
+
+    string C = Name.substr(Dot + 1);
+    int K = -1;
+    const char *Letters = "xyzw";
+    if (C.size() == 1 && strchr(Letters, C[0]))
+        K = strchr(Letters, C[0]) - Letters;
+    else if (C.find_first_not_of("0123456789") == string::npos && C.size() < 6)
+        K = atoi(C.c_str());
+
+    j = Find(Name.substr(0, Dot));
+    if (K < 0 || j == NVars)
+        return NVars;
+
+    VariableHeader<IsBigEndian> *VH =
+        (VariableHeader<IsBigEndian> *) &Header[GH->VarsStart + j * GH->VarsSize];
+    size_t Size = VH->Size, ElementSize = Size;
+    if (offsetof_safe(VH, ElementSize) < GH->VarsSize)
+        ElementSize = VH->ElementSize;
+    if (ElementSize == 0 || Size <= ElementSize || Size % ElementSize ||
+        (size_t) K >= Size / ElementSize)
+        return NVars;
+
+    Comp = K;
+    return j;
+}
+
+static void swapElements(void *Data, uint64_t N, size_t ElementSize) {
+    for (uint64_t j = 0; j < N; ++j)
+        bswap(((char *) Data) + j * ElementSize, ElementSize);
+}
+
+// The types of values which a read can convert between.
+enum ValueType {
+    TypeInt8, TypeInt16, TypeInt32, TypeInt64,
+    TypeUInt8, TypeUInt16, TypeUInt32, TypeUInt64,
+    TypeFloat, TypeDouble
+};
+
+// Returns the ValueType of values of Size bytes, or -1 if there is none.
+static int valueType(size_t Size, bool IsFloat, bool IsSigned) {
+  if (IsFloat) {
+        if (Size == sizeof(float))
+            return TypeFloat;
+        if (Size == sizeof(double))
+            return TypeDouble;
+        return -1;
+    }
+
+  switch (Size) {
+    case 1: return IsSigned ? TypeInt8 : TypeUInt8;
+    case 2: return IsSigned ? TypeInt16 : TypeUInt16;
+    case 4: return IsSigned ? TypeInt32 : TypeUInt32;
+    case 8: return IsSigned ? TypeInt64 : TypeUInt64;
+    }
+    return -1;
+}
+
+typedef void (*ConvertKernel)(const char *In, size_t InStride, char *Out,
+                              size_t OutStride, uint64_t N, size_t NValues);
+
+// Converts N rows of NValues values of type S, InStride bytes apart in In, to
+// values of type D, OutStride bytes apart in Out. Contiguous rows are
+// converted in a single loop, which can be vectorized.
+template <typename S, typename D>
+static void convertValues(const char *In, size_t InStride, char *Out, size_t OutStride,
+                          uint64_t N, size_t NValues) {
+  if (InStride == NValues * sizeof(S) && OutStride == NValues * sizeof(D)) {
+        const S *I = (const S *) In;
+        D *O = (D *) Out;
+        for (uint64_t k = 0; k < N * NValues; ++k)
+            O[k] = (D) I[k];
+        return;
+    }
+
+  for (uint64_t r = 0; r < N; ++r) {
+        const char *RowIn = In + r * InStride;
+        char *RowOut = Out + r * OutStride;
+    for (size_t k = 0; k < NValues; ++k) {
+            S V;
+            memcpy(&V, RowIn + k * sizeof(S), sizeof(S));
+            D W = (D) V;
+            memcpy(RowOut + k * sizeof(D), &W, sizeof(D));
+        }
+    }
+}
+
+template <typename S>
+static ConvertKernel convertKernel(int To) {
+  switch (To) {
+    case TypeInt8:   return convertValues<S, int8_t>;
+    case TypeInt16:  return convertValues<S, int16_t>;
+    case TypeInt32:  return convertValues<S, int32_t>;
+    case TypeInt64:  return convertValues<S, int64_t>;
+    case TypeUInt8:  return convertValues<S, uint8_t>;
+    case TypeUInt16: return convertValues<S, uint16_t>;
+    case TypeUInt32: return convertValues<S, uint32_t>;
+    case TypeUInt64: return convertValues<S, uint64_t>;
+    case TypeFloat:  return convertValues<S, float>;
+    case TypeDouble: return convertValues<S, double>;
+    }
+    return 0;
+}
+
+// Returns the kernel converting values of type From to type To, or null if
+// they are the same (or cannot be converted).
+static ConvertKernel convertKernel(int From, int To) {
+    if (From == To)
+        return 0;
+
+  switch (From) {
+    case TypeInt8:   return convertKernel<int8_t>(To);
+    case TypeInt16:  return convertKernel<int16_t>(To);
+    case TypeInt32:  return convertKernel<int32_t>(To);
+    case TypeInt64:  return convertKernel<int64_t>(To);
+    case TypeUInt8:  return convertKernel<uint8_t>(To);
+    case TypeUInt16: return convertKernel<uint16_t>(To);
+    case TypeUInt32: return convertKernel<uint32_t>(To);
+    case TypeUInt64: return convertKernel<uint64_t>(To);
+    case TypeFloat:  return convertKernel<float>(To);
+    case TypeDouble: return convertKernel<double>(To);
+    }
+    return 0;
+}
+
+// Returns the kernel converting the values of a file variable (VarSize bytes
+// per row, of ElementSize bytes each) to those of V, which is to be converted,
+// or throws if they cannot be.
+static ConvertKernel checkConversion(const GenericIO::Variable &V, size_t VarSize,
+                                     size_t ElementSize, bool IsFloat, bool IsSigned,
+                                     const string &FileName) {
+    int From = valueType(ElementSize, IsFloat, IsSigned),
+        To = valueType(V.ElementSize, V.IsFloat, V.IsSigned);
+  if (From < 0 || To < 0) {
+        stringstream ss;
+        ss << "Cannot convert variable " << V.Name << " in: " << FileName <<
+           ": current element size: " << V.ElementSize << ", file: " << ElementSize;
+        throw runtime_error(ss.str());
+    }
+
+  if (VarSize / ElementSize != V.Size / V.ElementSize) {
+        stringstream ss;
+        ss << "Cannot convert variable " << V.Name << " in: " << FileName <<
+           ": current values per row: " << V.Size / V.ElementSize <<
+           ", file: " << VarSize / ElementSize;
+        throw runtime_error(ss.str());
+    }
+
+    return convertKernel(From, To);
+}
+
+// Stores N rows read in the layout of the file (RowSize bytes, InStride bytes
+// apart in In) as the rows of a variable, OutStride bytes apart in Out,
+// converting their NValues values with Convert if given.
+static void storeRows(const char *In, size_t InStride, char *Out, size_t OutStride,
+                      uint64_t N, size_t RowSize, ConvertKernel Convert, size_t NValues) {
+    if (Convert)
+        Convert(In, InStride, Out, OutStride, N, NValues);
+    else
+        copyStrided(In, InStride, Out, OutStride, N, RowSize);
+}
+
+// Reads rows of the chunked block of file variable Var at BlockStart as
+// readChunkedRows does, retrying the whole read (the chunks are read
+// separately) under the retry policy. Returns false if the read was given up
+// on; otherwise Err is what readChunkedRows returned.
+template <bool IsBigEndian>
+bool GenericIO::readChunkedRetrying(uint64_t Var, uint64_t BlockStart, uint64_t NElems,
+                                    size_t RowSize, size_t NComps, int Comp,
+                                    uint64_t FirstRow, uint64_t NRows, void *Dest,
+                                    const string &Name, uint64_t &ReadSize, int &Err) {
+    RetryPacer Pacer(getRetryPolicy());
+    ++ReadStats.Reads;
+  for (;;) {
+    try {
+            Err = readChunkedRows<IsBigEndian>(FH.get(), BlockStart, NElems, RowSize, NComps,
+                                               Comp, FirstRow, NRows, Dest, Name, ReadSize,
+                                               fileDictionary(FH.getDictionaries(), Var));
+            return true;
+    } catch (...) { }
+
+        if (!Pacer.wait(ReadStats, NRows * RowSize))
+            return false;
+    }
+}
+
+template <bool IsBigEndian>
+void GenericIO::readPhysOrigin(double Origin[3]) {
+    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
+  if (offsetof_safe(GH, PhysOrigin) >= GH->GlobalHeaderSize) {
+        std::fill(Origin, Origin + 3, 0.0);
+        return;
+    }
+
+    std::copy(GH->PhysOrigin, GH->PhysOrigin + 3, Origin);
+}
+
+void GenericIO::readPhysScale(double Scale[3]) {
+    if (FH.isBigEndian())
+        readPhysScale<true>(Scale);
+    else
+        readPhysScale<false>(Scale);
+}
+
+template <bool IsBigEndian>
+void GenericIO::readPhysScale(double Scale[3]) {
+    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
+  if (offsetof_safe(GH, PhysScale) >= GH->GlobalHeaderSize) {
+        std::fill(Scale, Scale + 3, 0.0);
+        return;
+    }
+
+    std::copy(GH->PhysScale, GH->PhysScale + 3, Scale);
+}
+
+template <bool IsBigEndian>
+static size_t getRankIndex(int EffRank, GlobalHeader<IsBigEndian> *GH,
+                           vector<int> &RankMap, vector<char> &HeaderCache) {
+    if (RankMap.empty())
+        return EffRank;
+
+  for (size_t i = 0; i < GH->NRanks; ++i) {
+        RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &HeaderCache[GH->RanksStart +
+                                      i * GH->RanksSize];
+        if (offsetof_safe(RH, GlobalRank) >= GH->RanksSize)
+            return EffRank;
+
+        if ((int) RH->GlobalRank == EffRank)
+            return i;
+    }
+
+    assert(false && "Index requested of an invalid rank");
+    return (size_t) - 1;
+}
+
+int GenericIO::readGlobalRankNumber(int EffRank) {
+    if (FH.isBigEndian())
+        return readGlobalRankNumber<true>(EffRank);
+    return readGlobalRankNumber<false>(EffRank);
+}
+
+template <bool IsBigEndian>
+int GenericIO::readGlobalRankNumber(int EffRank) {
+  if (EffRank == -1) {
+        #ifndef GENERICIO_NO_MPI
+        MPI_Comm_rank(Comm, &EffRank);
+        #else
+        EffRank = 0;
+        #endif
+    }
+
+    if ((size_t) EffRank < Catalog.size())
+        return Catalog[EffRank].GlobalRank;
+
+    openAndReadHeader(MismatchAllowed, EffRank, false);
+
+    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
+
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
+    size_t RankIndex = getRankIndex<IsBigEndian>(EffRank, GH, RankMap, FH.getHeaderCache());
+
+    assert(RankIndex < GH->NRanks && "Invalid rank specified");
+
+    RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->RanksStart +
+                                  RankIndex * GH->RanksSize];
+
+    if (offsetof_safe(RH, GlobalRank) >= GH->RanksSize)
+        return EffRank;
+
+    return (int) RH->GlobalRank;
+}
+
+void GenericIO::getSourceRanks(vector<int> &SR) {
+    SR.clear();
+
+  if (Redistributing) {
+        std::copy(SourceRanks.begin(), SourceRanks.end(), std::back_inserter(SR));
+        return;
+    }
+
+    int Rank;
+    #ifndef GENERICIO_NO_MPI
+    MPI_Comm_rank(Comm, &Rank);
+    #else
+    Rank = 0;
+    #endif
+
+    SR.push_back(Rank);
+}
+
+void GenericIO::getSourceRows(vector<uint64_t> &Starts, vector<uint64_t> &Counts) {
+    vector<int> SR;
+    getSourceRanks(SR);
+
+  if (!SourceRowCounts.empty()) {
+        Starts = SourceRowStarts;
+        Counts = SourceRowCounts;
+        return;
+    }
+
+    Starts.assign(SR.size(), 0);
+    Counts.clear();
+    for (size_t i = 0; i < SR.size(); ++i)
+        Counts.push_back(readNumElems(SR[i]));
+}
+
+// Catalog entries are exchanged as this many 64-bit words: the global rank,
+// the partition, the index within the partition, NElems, Start, the three
+// coordinates and the GlobalRank field.
+static const size_t CatalogEntryWords = 9;
+
+template <bool IsBigEndian>
+static void addCatalogEntries(const vector<char> &Header, int Partition,
+                              bool Partitioned, vector<uint64_t> &Packed) {
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &Header[0];
+  for (uint64_t i = 0; i < GH->NRanks; ++i) {
+        RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &Header[GH->RanksStart +
+                                      i * GH->RanksSize];
+        uint64_t GlobalRank = offsetof_safe(RH, GlobalRank) < GH->RanksSize ?
+                              (uint64_t) RH->GlobalRank : i;
+
+        // As in getRankIndex, partitions are indexed by the GlobalRank field.
+        Packed.push_back(Partitioned ? GlobalRank : i);
+        Packed.push_back(Partition);
+        Packed.push_back(i);
+        Packed.push_back(RH->NElems);
+        Packed.push_back(RH->Start);
+        for (int d = 0; d < 3; ++d)
+            Packed.push_back(RH->Coords[d]);
+        Packed.push_back(GlobalRank);
+    }
+}
+
+// Reads the header of the current step of one partition. Only POSIX I/O is
+// used, so that several threads can do this at once.
+template <bool IsBigEndian>
+static void readCatalogHeader(GenericFileIO_POSIX &F, const string &Name, int Step,
+                              uint64_t FileSize, const vector<char> &Prefix,
+                              vector<char> &Header) {
+    vector<StepInfo> Steps;
+    GlobalHeader<IsBigEndian> GH;
+    readThrough(&F, Prefix, &GH, sizeof(GlobalHeader<IsBigEndian>), 0, "global header");
+    if (mayHaveSteps(&GH))
+        readStepIndex<IsBigEndian>(&F, Name, Steps, FileSize, &Prefix);
+
+  if (Step < 0 || (uint64_t) Step >= (Steps.empty() ? 1 : Steps.size())) {
+        stringstream ss;
+        ss << "Won't read " << Name << ": step " << Step << " requested, but the file has " <<
+           (Steps.empty() ? 1 : Steps.size()) << " step(s)";
+        throw runtime_error(ss.str());
+    }
+
+    uint64_t HeaderStart = Steps.empty() ? 0 : Steps[Step].HeaderStart;
+    if (HeaderStart != 0)
+        readThrough(&F, Prefix, &GH, sizeof(GlobalHeader<IsBigEndian>), HeaderStart, "global header");
+
+    Header.resize(GH.HeaderSize + CRCSize, 0xFE /* poison */);
+    readThrough(&F, Prefix, &Header[0], Header.size(), HeaderStart, "header");
+
+    if (crc64_omp(&Header[0], Header.size()) != (uint64_t) -1)
+        throw runtime_error("Header CRC check failed: " + Name);
+}
+
+static void readPartitionEntries(const string &FileName, int Partition, int Step,
+                                 size_t Prefetch, vector<uint64_t> &Packed) {
+    stringstream ss;
+    ss << FileName << "#" << Partition;
+    string Name = ss.str();
+
+    GenericFileIO_POSIX F;
+    F.open(Name, true);
+
+    uint64_t FileSize = F.getSize();
+    vector<char> Prefix, Header;
+    readPrefix(&F, Prefetch, FileSize, Prefix);
+
+    GlobalHeader<false> GH; // endianness does not matter yet...
+    readThrough(&F, Prefix, &GH, sizeof(GlobalHeader<false>), 0, "global header");
+
+  if (string(GH.Magic, GH.Magic + MagicSize - 1) == MagicLE) {
+        readCatalogHeader<false>(F, Name, Step, FileSize, Prefix, Header);
+        addCatalogEntries<false>(Header, Partition, true, Packed);
+  } else if (string(GH.Magic, GH.Magic + MagicSize - 1) == MagicBE) {
+        readCatalogHeader<true>(F, Name, Step, FileSize, Prefix, Header);
+        addCatalogEntries<true>(Header, Partition, true, Packed);
+  } else {
+        throw runtime_error("Won't read " + Name + ": invalid file-type identifier");
+    }
+}
+
+void GenericIO::readRankCatalog() {
+    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
+
+    Catalog.clear();
+    vector<uint64_t> Packed;
+
+  if (RankMap.empty()) {
+        if (FH.isBigEndian())
+            addCatalogEntries<true>(FH.getHeaderCache(), 0, false, Packed);
+        else
+            addCatalogEntries<false>(FH.getHeaderCache(), 0, false, Packed);
+  } else {
+        int NRanks, Rank;
+        #ifndef GENERICIO_NO_MPI
+        MPI_Comm_rank(Comm, &Rank);
+        MPI_Comm_size(Comm, &NRanks);
+        #else
+        Rank = 0;
+        NRanks = 1;
+        #endif
+
+        // The partitions are dealt out to the ranks, and each rank reads its
+        // partitions' headers from several threads.
+        vector<int> Partitions(RankMap);
+        std::sort(Partitions.begin(), Partitions.end());
+        Partitions.erase(std::unique(Partitions.begin(), Partitions.end()), Partitions.end());
+
+        vector<int> LocalPartitions;
+        for (size_t i = Rank; i < Partitions.size(); i += NRanks)
+            LocalPartitions.push_back(Partitions[i]);
+
+        size_t Prefetch = getHeaderPrefetch(HeaderPrefetch);
+        string Error;
+
+        #ifdef _OPENMP
+        #pragma omp parallel for schedule(dynamic)
+        #endif
+    for (int i = 0; i < (int) LocalPartitions.size(); ++i) {
+            vector<uint64_t> LocalPacked;
+      try {
+                readPartitionEntries(FileName, LocalPartitions[i], Step, Prefetch, LocalPacked);
+      } catch (std::exception &e) {
+                #ifdef _OPENMP
+                #pragma omp critical
+                #endif
+                Error = e.what();
+            }
+
+            #ifdef _OPENMP
+            #pragma omp critical
+            #endif
+            Packed.insert(Packed.end(), LocalPacked.begin(), LocalPacked.end());
+        }
+
+        // Errors from this function are recoverable: if one rank throws, all do.
+        #ifndef GENERICIO_NO_MPI
+        int Failed = !Error.empty(), AnyFailed;
+        MPI_Allreduce(&Failed, &AnyFailed, 1, MPI_INT, MPI_MAX, Comm);
+        if (AnyFailed)
+            throw runtime_error(Error.empty() ? "Failure reading the rank catalog on another rank" : Error);
+
+        int Count = Packed.size();
+        vector<int> Counts(NRanks), Displs(NRanks, 0);
+        MPI_Allgather(&Count, 1, MPI_INT, &Counts[0], 1, MPI_INT, Comm);
+        for (int i = 1; i < NRanks; ++i)
+            Displs[i] = Displs[i - 1] + Counts[i - 1];
+
+        vector<uint64_t> AllPacked(Displs[NRanks - 1] + Counts[NRanks - 1]);
+        MPI_Allgatherv(Packed.empty() ? 0 : &Packed[0], Count, MPI_UINT64_T,
+                       AllPacked.empty() ? 0 : &AllPacked[0], &Counts[0], &Displs[0],
+                       MPI_UINT64_T, Comm);
+        Packed.swap(AllPacked);
+        #else
+        if (!Error.empty())
+            throw runtime_error(Error);
+        #endif
+    }
+
+    size_t NR = RankMap.empty() ? Packed.size() / CatalogEntryWords : RankMap.size();
+    vector<RankInfo> NewCatalog(NR);
+    vector<char> Seen(NR, 0);
+  for (size_t i = 0; i < Packed.size(); i += CatalogEntryWords) {
+        uint64_t *E = &Packed[i];
+    if (E[0] >= NR || Seen[E[0]] || (!RankMap.empty() && RankMap[E[0]] != (int) E[1])) {
+            stringstream ss;
+            ss << "Inconsistent rank catalog for " << FileName << ": global rank " << E[0] <<
+               " in partition " << E[1];
+            throw runtime_error(ss.str());
+        }
+
+        RankInfo &RI = NewCatalog[E[0]];
+        RI.Partition = E[1];
+        RI.Index = E[2];
+        RI.NElems = E[3];
+        RI.Start = E[4];
+        for (int d = 0; d < 3; ++d)
+            RI.Coords[d] = (int) E[5 + d];
+        RI.GlobalRank = (int) E[8];
+        Seen[E[0]] = 1;
+    }
 
-    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
-    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
-    return GH->NElems;
-}
+    if (std::count(Seen.begin(), Seen.end(), 0))
+        throw runtime_error("Incomplete rank catalog for " + FileName);
 
-void GenericIO::readPhysOrigin(double Origin[3]) {
-    if (FH.isBigEndian())
-        readPhysOrigin<true>(Origin);
-    else
-        readPhysOrigin<false>(Origin);
+    Catalog.swap(NewCatalog);
 }
 
-// Define a "safe" version of offsetof (offsetof itself might not work for
-// non-POD types, and at least xlC v12.1 will complain about this if you try).
-#define offsetof_safe(S, F) (size_t(&(S)->F) - size_t(S))
+size_t GenericIO::readNumElems(int EffRank) {
+  if (EffRank == -1 && Redistributing) {
+        DisableCollErrChecking = true;
 
-template <bool IsBigEndian>
-void GenericIO::readPhysOrigin(double Origin[3]) {
-    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
-    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
-  if (offsetof_safe(GH, PhysOrigin) >= GH->GlobalHeaderSize) {
-        std::fill(Origin, Origin + 3, 0.0);
-        return;
-    }
+        size_t TotalSize = 0;
+        for (int i = 0, ie = SourceRanks.size(); i != ie; ++i)
+            TotalSize += SourceRowCounts.empty() ?
+                         readNumElems(SourceRanks[i]) : SourceRowCounts[i];
 
-    std::copy(GH->PhysOrigin, GH->PhysOrigin + 3, Origin);
-}
+        DisableCollErrChecking = false;
+        return TotalSize;
+    }
 
-void GenericIO::readPhysScale(double Scale[3]) {
     if (FH.isBigEndian())
-        readPhysScale<true>(Scale);
-    else
-        readPhysScale<false>(Scale);
+        return readNumElems<true>(EffRank);
+    return readNumElems<false>(EffRank);
 }
 
 template <bool IsBigEndian>
-void GenericIO::readPhysScale(double Scale[3]) {
-    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
-    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
-  if (offsetof_safe(GH, PhysScale) >= GH->GlobalHeaderSize) {
-        std::fill(Scale, Scale + 3, 0.0);
-        return;
+size_t GenericIO::readNumElems(int EffRank) {
+  if (EffRank == -1) {
+        #ifndef GENERICIO_NO_MPI
+        MPI_Comm_rank(Comm, &EffRank);
+        #else
+        EffRank = 0;
+        #endif
     }
 
-    std::copy(GH->PhysScale, GH->PhysScale + 3, Scale);
-}
+    if ((size_t) EffRank < Catalog.size())
+        return Catalog[EffRank].NElems;
 
-template <bool IsBigEndian>
-static size_t getRankIndex(int EffRank, GlobalHeader<IsBigEndian> *GH,
-                           vector<int> &RankMap, vector<char> &HeaderCache) {
-    if (RankMap.empty())
-        return EffRank;
+    openAndReadHeader(Redistributing ? MismatchRedistribute : MismatchAllowed,
+                      EffRank, false);
 
-  for (size_t i = 0; i < GH->NRanks; ++i) {
-        RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &HeaderCache[GH->RanksStart +
-                                      i * GH->RanksSize];
-        if (offsetof_safe(RH, GlobalRank) >= GH->RanksSize)
-            return EffRank;
+    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
 
-        if ((int) RH->GlobalRank == EffRank)
-            return i;
-    }
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
+    size_t RankIndex = getRankIndex<IsBigEndian>(EffRank, GH, RankMap, FH.getHeaderCache());
 
-    assert(false && "Index requested of an invalid rank");
-    return (size_t) - 1;
+    assert(RankIndex < GH->NRanks && "Invalid rank specified");
+
+    RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->RanksStart +
+                                  RankIndex * GH->RanksSize];
+    return (size_t) RH->NElems;
 }
 
-int GenericIO::readGlobalRankNumber(int EffRank) {
+void GenericIO::readCoords(int Coords[3], int EffRank) {
+  if (EffRank == -1 && Redistributing) {
+        std::fill(Coords, Coords + 3, 0);
+        return;
+    }
+
     if (FH.isBigEndian())
-        return readGlobalRankNumber<true>(EffRank);
-    return readGlobalRankNumber<false>(EffRank);
+        readCoords<true>(Coords, EffRank);
+    else
+        readCoords<false>(Coords, EffRank);
 }
 
 template <bool IsBigEndian>
-int GenericIO::readGlobalRankNumber(int EffRank) {
+void GenericIO::readCoords(int Coords[3], int EffRank) {
   if (EffRank == -1) {
         #ifndef GENERICIO_NO_MPI
         MPI_Comm_rank(Comm, &EffRank);
@@ -1602,6 +4963,11 @@ int GenericIO::readGlobalRankNumber(int EffRank) {
         #endif
     }
 
+  if ((size_t) EffRank < Catalog.size()) {
+        std::copy(Catalog[EffRank].Coords, Catalog[EffRank].Coords + 3, Coords);
+        return;
+    }
+
     openAndReadHeader(MismatchAllowed, EffRank, false);
 
     assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
@@ -1614,62 +4980,226 @@ int GenericIO::readGlobalRankNumber(int EffRank) {
     RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->RanksStart +
                                   RankIndex * GH->RanksSize];
 
-    if (offsetof_safe(RH, GlobalRank) >= GH->RanksSize)
-        return EffRank;
+    std::copy(RH->Coords, RH->Coords + 3, Coords);
+}
 
-    return (int) RH->GlobalRank;
+
+
+
+void GenericIO::getVariableInfo(vector<VariableInfo> &VI)
+{
+    if (FH.isBigEndian())
+        getVariableInfo<true>(VI);
+    else
+        getVariableInfo<false>(VI);
 }
 
-void GenericIO::getSourceRanks(vector<int> &SR) {
-    SR.clear();
+template <bool IsBigEndian>
+void GenericIO::getVariableInfo(vector<VariableInfo> &VI)
+{
+    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
 
-  if (Redistributing) {
-        std::copy(SourceRanks.begin(), SourceRanks.end(), std::back_inserter(SR));
-        return;
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
+    for (uint64_t j = 0; j < GH->NVars; ++j)
+    {
+        VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->VarsStart +
+                                          j * GH->VarsSize];
+
+        string VName(VH->Name, VH->Name + NameSize);
+        size_t VNameNull = VName.find('\0');
+        if (VNameNull < NameSize)
+            VName.resize(VNameNull);
+
+        size_t ElementSize = VH->Size;
+        if (offsetof_safe(VH, ElementSize) < GH->VarsSize)
+            ElementSize = VH->ElementSize;
+
+        bool IsFloat = (bool) (VH->Flags & FloatValue),
+             IsSigned = (bool) (VH->Flags & SignedValue),
+             IsPhysCoordX = (bool) (VH->Flags & ValueIsPhysCoordX),
+             IsPhysCoordY = (bool) (VH->Flags & ValueIsPhysCoordY),
+             IsPhysCoordZ = (bool) (VH->Flags & ValueIsPhysCoordZ),
+             MaybePhysGhost = (bool) (VH->Flags & ValueMaybePhysGhost);
+        VI.push_back(VariableInfo(VName, (size_t) VH->Size, IsFloat, IsSigned,
+                                  IsPhysCoordX, IsPhysCoordY, IsPhysCoordZ,
+                                  MaybePhysGhost, ElementSize));
     }
+}
 
-    int Rank;
+void GenericIO::setNaturalDefaultPartition()
+{
+    #ifdef __bgq__
+    DefaultPartition = MPIX_IO_link_id();
+    #else
     #ifndef GENERICIO_NO_MPI
+    bool UseName = true;
+    const char *EnvStr = getenv("GENERICIO_PARTITIONS_USE_NAME");
+    if (EnvStr)
+    {
+        int Mod = atoi(EnvStr);
+        UseName = (Mod != 0);
+    }
+
+    if (UseName)
+    {
+        // This is a heuristic to generate ~256 partitions based on the
+        // names of the nodes.
+        char Name[MPI_MAX_PROCESSOR_NAME];
+        int Len = 0;
+
+        MPI_Get_processor_name(Name, &Len);
+        unsigned char color = 0;
+        for (int i = 0; i < Len; ++i)
+            color += (unsigned char) Name[i];
+
+        DefaultPartition = color;
+    }
+
+    // This is for debugging.
+    EnvStr = getenv("GENERICIO_RANK_PARTITIONS");
+    if (EnvStr)
+    {
+        int Mod = atoi(EnvStr);
+        if (Mod > 0)
+        {
+            int Rank;
+            MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+            DefaultPartition += Rank % Mod;
+        }
+    }
+    #endif
+    #endif
+}
+
+
+
+void GenericIO::readData(int EffRank, bool PrintStats, bool CollStats){
+    CallScope Scope(*this, "readData");
+    int Rank;
+  #ifndef GENERICIO_NO_MPI
     MPI_Comm_rank(Comm, &Rank);
-    #else
+  #else
     Rank = 0;
-    #endif
+  #endif
 
-    SR.push_back(Rank);
-}
+    uint64_t TotalReadSize = 0;
+  #ifndef GENERICIO_NO_MPI
+    double StartTime = MPI_Wtime();
+  #else
+    double StartTime = double(clock()) / CLOCKS_PER_SEC;
+  #endif
+
+    int NErrs[3] = { 0, 0, 0 };
 
-size_t GenericIO::readNumElems(int EffRank) {
   if (EffRank == -1 && Redistributing) {
         DisableCollErrChecking = true;
 
-        size_t TotalSize = 0;
-        for (int i = 0, ie = SourceRanks.size(); i != ie; ++i)
-            TotalSize += readNumElems(SourceRanks[i]);
+        size_t RowOffset = 0;
+    for (int i = 0, ie = SourceRanks.size(); i != ie; ++i) {
+            size_t NElem = readNumElems(SourceRanks[i]);
+
+            // Ranks split with other readers are read in part (whole ranks are
+            // still read, and checked, as a whole).
+      if (!SourceRowCounts.empty() && SourceRowCounts[i] != NElem) {
+                readDataSection(SourceRowStarts[i], SourceRowCounts[i], SourceRanks[i],
+                                RowOffset, Rank, TotalReadSize, NErrs);
+                NElem = SourceRowCounts[i];
+      } else {
+                readData(SourceRanks[i], RowOffset, Rank, TotalReadSize, NErrs);
+            }
+
+            if (!SourceRowsFiltered.empty() && SourceRowsFiltered[i] &&
+                !NErrs[0] && !NErrs[1] && !NErrs[2])
+                filterSpatialRows(RowOffset, NElem, NElem);
+
+            RowOffset += NElem;
+        }
+
+        NumReadRows = RowOffset;
+        DisableCollErrChecking = false;
+  } else {
+        readData(EffRank, 0, Rank, TotalReadSize, NErrs);
+        NumReadRows = readNumElems(EffRank);
+    }
+
+    ReadStats.CRCErrors += NErrs[1];
+    ReadStats.DecompressionErrors += NErrs[2];
+
+    int AllNErrs[3];
+  #ifndef GENERICIO_NO_MPI
+    double BarrierStart = statNow();
+    MPI_Allreduce(NErrs, AllNErrs, 3, MPI_INT, MPI_SUM, Comm);
+    addPhase(StatBarrier, BarrierStart);
+  #else
+    AllNErrs[0] = NErrs[0]; AllNErrs[1] = NErrs[1]; AllNErrs[2] = NErrs[2];
+  #endif
+
+  if (AllNErrs[0] > 0 || AllNErrs[1] > 0 || AllNErrs[2] > 0) {
+        stringstream ss;
+        ss << "Experienced " << AllNErrs[0] << " I/O error(s), " <<
+           AllNErrs[1] << " CRC error(s) and " << AllNErrs[2] <<
+           " decompression CRC error(s) reading: " << OpenFileName;
+        throw runtime_error(ss.str());
+    }
+
+  #ifndef GENERICIO_NO_MPI
+    BarrierStart = statNow();
+    MPI_Barrier(Comm);
+    addPhase(StatBarrier, BarrierStart);
+  #endif
+
+  #ifndef GENERICIO_NO_MPI
+    double EndTime = MPI_Wtime();
+  #else
+    double EndTime = double(clock()) / CLOCKS_PER_SEC;
+  #endif
+
+    double TotalTime = EndTime - StartTime;
+    double MaxTotalTime;
+  #ifndef GENERICIO_NO_MPI
+    if (CollStats)
+        MPI_Reduce(&TotalTime, &MaxTotalTime, 1, MPI_DOUBLE, MPI_MAX, 0, Comm);
+    else
+  #endif
+        MaxTotalTime = TotalTime;
+
+    uint64_t AllTotalReadSize;
+  #ifndef GENERICIO_NO_MPI
+    if (CollStats)
+        MPI_Reduce(&TotalReadSize, &AllTotalReadSize, 1, MPI_UINT64_T, MPI_SUM, 0, Comm);
+    else
+  #endif
+        AllTotalReadSize = TotalReadSize;
 
-        DisableCollErrChecking = false;
-        return TotalSize;
+  if (Rank == 0 && PrintStats) {
+        double Rate = ((double) AllTotalReadSize) / MaxTotalTime / (1024.*1024.);
+        cout << "Read " << Vars.size() << " variables from " << FileName <<
+             " (" << AllTotalReadSize << " bytes) in " << MaxTotalTime << "s: " <<
+             Rate << " MB/s [excluding header read]" << endl;
     }
+}
 
+void GenericIO::readData(int EffRank, size_t RowOffset, int Rank,
+                         uint64_t &TotalReadSize, int NErrs[3]) {
     if (FH.isBigEndian())
-        return readNumElems<true>(EffRank);
-    return readNumElems<false>(EffRank);
+        readData<true>(EffRank, RowOffset, Rank, TotalReadSize, NErrs);
+    else
+        readData<false>(EffRank, RowOffset, Rank, TotalReadSize, NErrs);
 }
 
+// Note: Errors from this function should be recoverable. This means that if
+// one rank throws an exception, then all ranks should.
 template <bool IsBigEndian>
-size_t GenericIO::readNumElems(int EffRank) {
-  if (EffRank == -1) {
-        #ifndef GENERICIO_NO_MPI
-        MPI_Comm_rank(Comm, &EffRank);
-        #else
-        EffRank = 0;
-        #endif
-    }
-
+void GenericIO::readData(int EffRank, size_t RowOffset, int Rank,
+                         uint64_t &TotalReadSize, int NErrs[3]) {
     openAndReadHeader(Redistributing ? MismatchRedistribute : MismatchAllowed,
                       EffRank, false);
 
     assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
 
+    if (EffRank == -1)
+        EffRank = Rank;
+
     GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
     size_t RankIndex = getRankIndex<IsBigEndian>(EffRank, GH, RankMap, FH.getHeaderCache());
 
@@ -1677,137 +5207,289 @@ size_t GenericIO::readNumElems(int EffRank) {
 
     RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->RanksStart +
                                   RankIndex * GH->RanksSize];
-    return (size_t) RH->NElems;
-}
 
-void GenericIO::readCoords(int Coords[3], int EffRank) {
-  if (EffRank == -1 && Redistributing) {
-        std::fill(Coords, Coords + 3, 0);
-        return;
-    }
+  for (size_t i = 0; i < Vars.size(); ++i) {
+        uint64_t Offset = RH->Start;
+        bool VarFound = false;
+        int Comp;
+        uint64_t FileVar = findFileVariable<IsBigEndian>(FH.getHeaderCache(), Vars[i].Name, Comp);
+    for (uint64_t j = 0; j < GH->NVars; ++j) {
+            VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->VarsStart +
+                                              j * GH->VarsSize];
 
-    if (FH.isBigEndian())
-        readCoords<true>(Coords, EffRank);
-    else
-        readCoords<false>(Coords, EffRank);
-}
+            uint64_t ReadSize = RH->NElems * VH->Size + CRCSize;
+      if (j != FileVar) {
+                Offset += ReadSize;
+                continue;
+            }
 
-template <bool IsBigEndian>
-void GenericIO::readCoords(int Coords[3], int EffRank) {
-  if (EffRank == -1) {
-        #ifndef GENERICIO_NO_MPI
-        MPI_Comm_rank(Comm, &EffRank);
-        #else
-        EffRank = 0;
-        #endif
-    }
+            size_t ElementSize = VH->Size;
+            if (offsetof_safe(VH, ElementSize) < GH->VarsSize)
+                ElementSize = VH->ElementSize;
 
-    openAndReadHeader(MismatchAllowed, EffRank, false);
+            VarFound = true;
+            beginVariable(Vars[i].Name);
+            bool IsFloat = (bool) (VH->Flags & FloatValue),
+                 IsSigned = (bool) (VH->Flags & SignedValue);
+            size_t VarSize = Comp < 0 ? (size_t) VH->Size : ElementSize;
+            ConvertKernel Convert = 0;
+      if (Vars[i].Convert) {
+                Convert = checkConversion(Vars[i], VarSize, ElementSize, IsFloat, IsSigned,
+                                          OpenFileName);
+      } else if (VarSize != Vars[i].Size) {
+                stringstream ss;
+                ss << "Size mismatch for variable " << Vars[i].Name <<
+                   " in: " << OpenFileName << ": current: " << Vars[i].Size <<
+                   ", file: " << VarSize;
+                throw runtime_error(ss.str());
+      } else if (ElementSize != Vars[i].ElementSize) {
+                stringstream ss;
+                ss << "Element size mismatch for variable " << Vars[i].Name <<
+                   " in: " << OpenFileName << ": current: " << Vars[i].ElementSize <<
+                   ", file: " << ElementSize;
+                throw runtime_error(ss.str());
+      } else if (IsFloat != Vars[i].IsFloat) {
+                string Float("float"), Int("integer");
+                stringstream ss;
+                ss << "Type mismatch for variable " << Vars[i].Name <<
+                   " in: " << OpenFileName << ": current: " <<
+                   (Vars[i].IsFloat ? Float : Int) <<
+                   ", file: " << (IsFloat ? Float : Int);
+                throw runtime_error(ss.str());
+      } else if (IsSigned != Vars[i].IsSigned) {
+                string Signed("signed"), Uns("unsigned");
+                stringstream ss;
+                ss << "Type mismatch for variable " << Vars[i].Name <<
+                   " in: " << OpenFileName << ": current: " <<
+                   (Vars[i].IsSigned ? Signed : Uns) <<
+                   ", file: " << (IsSigned ? Signed : Uns);
+                throw runtime_error(ss.str());
+            }
 
-    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
+            size_t VarOffset = RowOffset * Vars[i].Stride;
+            void *VarData = ((char *) Vars[i].Data) + VarOffset;
 
-    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
-    size_t RankIndex = getRankIndex<IsBigEndian>(EffRank, GH, RankMap, FH.getHeaderCache());
+            vector<unsigned char> LData;
+            void *Data = VarData;
+            bool HasExtraSpace = Vars[i].HasExtraSpace;
+            bool IsChunked = false, Transposed = false;
+            FrameFilter Filter = FrameRaw;
+            if (offsetof_safe(GH, BlocksStart) < GH->GlobalHeaderSize &&
+          GH->BlocksSize > 0) {
+                BlockHeader<IsBigEndian> *BH = (BlockHeader<IsBigEndian> *)
+                                               &FH.getHeaderCache()[GH->BlocksStart +
+                                                       (RankIndex * GH->NVars + j) * GH->BlocksSize];
+                ReadSize = BH->Size + CRCSize;
+                Offset = BH->Start;
 
-    assert(RankIndex < GH->NRanks && "Invalid rank specified");
+                Filter = blockFrameFilter(BH, IsChunked, Vars[i].Name);
+                Transposed = isTransposed(BH);
+            }
+            size_t NComps = Transposed ? VH->Size / ElementSize : 1;
+
+            // Rows to be converted or stored with a stride, and a component of
+            // a variable not stored transposed, are read (and unpacked) in the
+            // layout of the file, and then stored in a single pass.
+            bool Staged = Convert || Vars[i].Stride != Vars[i].Size ||
+                          (Comp >= 0 && !Transposed);
+            size_t StagedRowSize = Comp >= 0 && Transposed ? ElementSize : (size_t) VH->Size;
+            size_t StoredOffset = Comp >= 0 && !Transposed ? Comp * ElementSize : 0;
+            size_t StoredSize = Comp >= 0 ? ElementSize : (size_t) VH->Size;
+            vector<char> StagedRows;
+            char *DestData = (char *) VarData;
+      if (Staged) {
+                StagedRows.resize(RH->NElems * StagedRowSize + CRCSize);
+                VarData = Data = &StagedRows[0];
+                HasExtraSpace = true;
+            }
 
-    RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->RanksStart +
-                                  RankIndex * GH->RanksSize];
+            // Only the chunks of a single component of a transposed variable
+            // are read.
+      if (Comp >= 0 && Transposed) {
+                int Err = 0;
+                double PhaseStart = statNow();
+                bool ReadOkay = readChunkedRetrying<IsBigEndian>(j, Offset, RH->NElems, VH->Size,
+                                                                 NComps, Comp, 0, RH->NElems,
+                                                                 VarData, Vars[i].Name,
+                                                                 ReadSize, Err);
+                addPhase(StatIO, PhaseStart);
+        if (!ReadOkay) {
+                    ++NErrs[0];
+                    break;
+                }
 
-    std::copy(RH->Coords, RH->Coords + 3, Coords);
-}
+                TotalReadSize += ReadSize;
+                addBytes(ReadSize, RH->NElems * Vars[i].Size);
+        if (Err) {
+                    ++NErrs[Err];
+                    break;
+                }
 
+        if (IsBigEndian != isBigEndian()) {
+                    PhaseStart = statNow();
+                    swapElements(VarData, RH->NElems, ElementSize);
+                    addPhase(StatByteSwap, PhaseStart);
+                }
 
+                if (Staged)
+                    storeRows(&StagedRows[0], StagedRowSize, DestData, Vars[i].Stride,
+                              RH->NElems, StoredSize, Convert, 1);
+                break;
+            }
 
+      if (IsChunked || Filter != FrameRaw) {
+                LData.resize(ReadSize);
+                Data = &LData[0];
+                HasExtraSpace = true;
+            }
 
-void GenericIO::getVariableInfo(vector<VariableInfo> &VI)
-{
-    if (FH.isBigEndian())
-        getVariableInfo<true>(VI);
-    else
-        getVariableInfo<false>(VI);
-}
+            assert(HasExtraSpace && "Extra space required for reading");
 
-template <bool IsBigEndian>
-void GenericIO::getVariableInfo(vector<VariableInfo> &VI)
-{
-    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
+            char CRCSave[CRCSize];
+            char *CRCLoc = ((char *) Data) + ReadSize - CRCSize;
+            if (HasExtraSpace)
+                std::copy(CRCLoc, CRCLoc + CRCSize, CRCSave);
 
-    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
-    for (uint64_t j = 0; j < GH->NVars; ++j)
-    {
-        VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->VarsStart +
-                                          j * GH->VarsSize];
+            uint64_t RetriesBefore = ReadStats.Retries;
+            double PhaseStart = statNow();
+            bool ReadOkay = readRetrying(Data, ReadSize, Offset, Vars[i].Name);
+            addPhase(StatIO, PhaseStart);
+      if (!ReadOkay) {
+                ++NErrs[0];
+                break;
+            }
 
-        string VName(VH->Name, VH->Name + NameSize);
-        size_t VNameNull = VName.find('\0');
-        if (VNameNull < NameSize)
-            VName.resize(VNameNull);
+            TotalReadSize += ReadSize;
+            addBytes(ReadSize, RH->NElems * Vars[i].Size);
 
-        size_t ElementSize = VH->Size;
-        if (offsetof_safe(VH, ElementSize) < GH->VarsSize)
-            ElementSize = VH->ElementSize;
+            PhaseStart = statNow();
+            uint64_t CRC = crc64_omp(Data, ReadSize);
+            addPhase(StatCRC, PhaseStart);
+      if (CRC != (uint64_t) -1) {
+                ++NErrs[1];
 
-        bool IsFloat = (bool) (VH->Flags & FloatValue),
-             IsSigned = (bool) (VH->Flags & SignedValue),
-             IsPhysCoordX = (bool) (VH->Flags & ValueIsPhysCoordX),
-             IsPhysCoordY = (bool) (VH->Flags & ValueIsPhysCoordY),
-             IsPhysCoordZ = (bool) (VH->Flags & ValueIsPhysCoordZ),
-             MaybePhysGhost = (bool) (VH->Flags & ValueMaybePhysGhost);
-        VI.push_back(VariableInfo(VName, (size_t) VH->Size, IsFloat, IsSigned,
-                                  IsPhysCoordX, IsPhysCoordY, IsPhysCoordZ,
-                                  MaybePhysGhost, ElementSize));
-    }
-}
+                int Rank;
+                #ifndef GENERICIO_NO_MPI
+                MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+                #else
+                Rank = 0;
+                #endif
 
-void GenericIO::setNaturalDefaultPartition()
-{
-    #ifdef __bgq__
-    DefaultPartition = MPIX_IO_link_id();
-    #else
-    #ifndef GENERICIO_NO_MPI
-    bool UseName = true;
-    const char *EnvStr = getenv("GENERICIO_PARTITIONS_USE_NAME");
-    if (EnvStr)
-    {
-        int Mod = atoi(EnvStr);
-        UseName = (Mod != 0);
-    }
+                // All ranks will do this and have a good time!
+                string dn = "gio_crc_errors";
+                mkdir(dn.c_str(), 0777);
 
-    if (UseName)
-    {
-        // This is a heuristic to generate ~256 partitions based on the
-        // names of the nodes.
-        char Name[MPI_MAX_PROCESSOR_NAME];
-        int Len = 0;
+                srand(time(0));
+                int DumpNum = rand();
+                stringstream ssd;
+                ssd << dn << "/gio_crc_error_dump." << Rank << "." << DumpNum << ".bin";
+
+                stringstream ss;
+                ss << dn << "/gio_crc_error_log." << Rank << ".txt";
+
+                ofstream ofs(ss.str().c_str(), ofstream::out | ofstream::app);
+                ofs << "On-Disk CRC Error Report:\n";
+                ofs << "Variable: " << Vars[i].Name << "\n";
+                ofs << "File: " << OpenFileName << "\n";
+                ofs << "I/O Retries: " << ReadStats.Retries - RetriesBefore << "\n"; 
+                ofs << "Size: " << ReadSize << " bytes\n";
+                ofs << "Offset: " << Offset << " bytes\n";
+                ofs << "CRC: " << CRC << " (expected is -1)\n";
+                ofs << "Dump file: " << ssd.str() << "\n";
+                ofs << "\n";
+                ofs.close();
+
+                ofstream dofs(ssd.str().c_str(), ofstream::out);
+                dofs.write((const char *) Data, ReadSize);
+                dofs.close();
+
+                uint64_t RawCRC = crc64_omp(Data, ReadSize - CRCSize);
+                unsigned char *UData = (unsigned char *) Data;
+                crc64_invert(RawCRC, &UData[ReadSize - CRCSize]);
+                uint64_t NewCRC = crc64_omp(Data, ReadSize);
+                std::cerr << "Recalulated CRC: " << NewCRC << ((NewCRC == -1) ? "ok" : "bad") << "\n";
+                break;
+            }
+
+            if (HasExtraSpace)
+                std::copy(CRCSave, CRCSave + CRCSize, CRCLoc);
+
+            PhaseStart = statNow();
+      if (IsChunked) {
+                int Err = unpackChunkedBlock<IsBigEndian>(&LData[0], RH->NElems,
+                                                          VH->Size, NComps, VarData,
+                                                          fileDictionary(FH.getDictionaries(), j));
+        if (Err) {
+                    ++NErrs[Err];
+                    break;
+                }
+      } else if (LData.size()) {
+                int Err = decompressFrame<IsBigEndian>(Filter, &LData[0], ReadSize - CRCSize,
+                                                       VarData, VH->Size * RH->NElems,
+                                                       fileDictionary(FH.getDictionaries(), j));
+        if (Err) {
+                    ++NErrs[Err];
+                    break;
+                }
+            }
+            if (LData.size())
+                addPhase(StatDecompress, PhaseStart);
+
+            // Byte swap the data if necessary.
+      if (IsBigEndian != isBigEndian()) {
+                PhaseStart = statNow();
+                for (size_t j = 0;
+             j < RH->NElems*(VH->Size/ElementSize); ++j) {
+                    char *Offset = ((char *) VarData) + j * ElementSize;
+                    bswap(Offset, ElementSize);
+                }
+                addPhase(StatByteSwap, PhaseStart);
+            }
+
+            if (Staged)
+                storeRows(&StagedRows[StoredOffset], StagedRowSize, DestData, Vars[i].Stride,
+                          RH->NElems, StoredSize, Convert, StoredSize / ElementSize);
+            break;
+        }
+        endVariable();
 
-        MPI_Get_processor_name(Name, &Len);
-        unsigned char color = 0;
-        for (int i = 0; i < Len; ++i)
-            color += (unsigned char) Name[i];
+        if (!VarFound)
+            throw runtime_error("Variable " + Vars[i].Name +
+                                " not found in: " + OpenFileName);
 
-        DefaultPartition = color;
-    }
+        // This is for debugging.
+    if (NErrs[0] || NErrs[1] || NErrs[2]) {
+            const char *EnvStr = getenv("GENERICIO_VERBOSE");
+      if (EnvStr) {
+                int Mod = atoi(EnvStr);
+        if (Mod > 0) {
+                    int Rank;
+                    #ifndef GENERICIO_NO_MPI
+                    MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+                    #else
+                    Rank = 0;
+                    #endif
 
-    // This is for debugging.
-    EnvStr = getenv("GENERICIO_RANK_PARTITIONS");
-    if (EnvStr)
-    {
-        int Mod = atoi(EnvStr);
-        if (Mod > 0)
-        {
-            int Rank;
-            MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
-            DefaultPartition += Rank % Mod;
+                    std::cerr << "Rank " << Rank << ": " << NErrs[0] << " I/O error(s), " <<
+                              NErrs[1] << " CRC error(s) and " << NErrs[2] <<
+                              " decompression CRC error(s) reading: " << Vars[i].Name <<
+                              " from: " << OpenFileName << "\n";
+
+                    std::cerr.flush();
+                }
+            }
         }
+
+        if (NErrs[0] || NErrs[1] || NErrs[2])
+            break;
     }
-    #endif
-    #endif
 }
 
 
 
-void GenericIO::readData(int EffRank, bool PrintStats, bool CollStats){
+void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRank, bool PrintStats, bool CollStats)
+{
+    CallScope Scope(*this, "readDataSection");
     int Rank;
   #ifndef GENERICIO_NO_MPI
     MPI_Comm_rank(Comm, &Rank);
@@ -1824,28 +5506,38 @@ void GenericIO::readData(int EffRank, bool PrintStats, bool CollStats){
 
     int NErrs[3] = { 0, 0, 0 };
 
-  if (EffRank == -1 && Redistributing) {
+    if (EffRank == -1 && Redistributing)
+    {
         DisableCollErrChecking = true;
 
         size_t RowOffset = 0;
-    for (int i = 0, ie = SourceRanks.size(); i != ie; ++i) {
-            readData(SourceRanks[i], RowOffset, Rank, TotalReadSize, NErrs);
+        for (int i = 0, ie = SourceRanks.size(); i != ie; ++i)
+        {
+            readDataSection(readOffset, readNumRows, SourceRanks[i], RowOffset, Rank, TotalReadSize, NErrs);
             RowOffset += readNumElems(SourceRanks[i]);
         }
 
         DisableCollErrChecking = false;
-  } else {
-        readData(EffRank, 0, Rank, TotalReadSize, NErrs);
+    }
+    else
+    {
+        readDataSection(readOffset, readNumRows, EffRank, 0, Rank, TotalReadSize, NErrs);
     }
 
+    ReadStats.CRCErrors += NErrs[1];
+    ReadStats.DecompressionErrors += NErrs[2];
+
     int AllNErrs[3];
   #ifndef GENERICIO_NO_MPI
+    double BarrierStart = statNow();
     MPI_Allreduce(NErrs, AllNErrs, 3, MPI_INT, MPI_SUM, Comm);
+    addPhase(StatBarrier, BarrierStart);
   #else
     AllNErrs[0] = NErrs[0]; AllNErrs[1] = NErrs[1]; AllNErrs[2] = NErrs[2];
   #endif
 
-  if (AllNErrs[0] > 0 || AllNErrs[1] > 0 || AllNErrs[2] > 0) {
+    if (AllNErrs[0] > 0 || AllNErrs[1] > 0 || AllNErrs[2] > 0)
+    {
         stringstream ss;
         ss << "Experienced " << AllNErrs[0] << " I/O error(s), " <<
            AllNErrs[1] << " CRC error(s) and " << AllNErrs[2] <<
@@ -1854,7 +5546,9 @@ void GenericIO::readData(int EffRank, bool PrintStats, bool CollStats){
     }
 
   #ifndef GENERICIO_NO_MPI
+    BarrierStart = statNow();
     MPI_Barrier(Comm);
+    addPhase(StatBarrier, BarrierStart);
   #endif
 
   #ifndef GENERICIO_NO_MPI
@@ -1880,7 +5574,8 @@ void GenericIO::readData(int EffRank, bool PrintStats, bool CollStats){
   #endif
         AllTotalReadSize = TotalReadSize;
 
-  if (Rank == 0 && PrintStats) {
+    if (Rank == 0 && PrintStats)
+    {
         double Rate = ((double) AllTotalReadSize) / MaxTotalTime / (1024.*1024.);
         cout << "Read " << Vars.size() << " variables from " << FileName <<
              " (" << AllTotalReadSize << " bytes) in " << MaxTotalTime << "s: " <<
@@ -1888,21 +5583,19 @@ void GenericIO::readData(int EffRank, bool PrintStats, bool CollStats){
     }
 }
 
-void GenericIO::readData(int EffRank, size_t RowOffset, int Rank,
-                         uint64_t &TotalReadSize, int NErrs[3]) {
+
+void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRank, size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3])
+{
     if (FH.isBigEndian())
-        readData<true>(EffRank, RowOffset, Rank, TotalReadSize, NErrs);
+        readDataSection<true>(readOffset, readNumRows, EffRank, RowOffset, Rank, TotalReadSize, NErrs);
     else
-        readData<false>(EffRank, RowOffset, Rank, TotalReadSize, NErrs);
+        readDataSection<false>(readOffset, readNumRows, EffRank, RowOffset, Rank, TotalReadSize, NErrs);
 }
 
-// Note: Errors from this function should be recoverable. This means that if
-// one rank throws an exception, then all ranks should.
 template <bool IsBigEndian>
-void GenericIO::readData(int EffRank, size_t RowOffset, int Rank,
-                         uint64_t &TotalReadSize, int NErrs[3]) {
-    openAndReadHeader(Redistributing ? MismatchRedistribute : MismatchAllowed,
-                      EffRank, false);
+void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRank, size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3])
+{
+    openAndReadHeader(Redistributing ? MismatchRedistribute : MismatchAllowed, EffRank, false);
 
     assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
 
@@ -1917,44 +5610,47 @@ void GenericIO::readData(int EffRank, size_t RowOffset, int Rank,
     RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->RanksStart +
                                   RankIndex * GH->RanksSize];
 
-  for (size_t i = 0; i < Vars.size(); ++i) {
+    for (size_t i = 0; i < Vars.size(); ++i)
+    {
         uint64_t Offset = RH->Start;
         bool VarFound = false;
-    for (uint64_t j = 0; j < GH->NVars; ++j) {
-            VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->VarsStart +
-                                              j * GH->VarsSize];
-
-            string VName(VH->Name, VH->Name + NameSize);
-            size_t VNameNull = VName.find('\0');
-            if (VNameNull < NameSize)
-                VName.resize(VNameNull);
+        int Comp;
+        uint64_t FileVar = findFileVariable<IsBigEndian>(FH.getHeaderCache(), Vars[i].Name, Comp);
+        for (uint64_t j = 0; j < GH->NVars; ++j)
+        {
+            VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->VarsStart + j * GH->VarsSize];
 
             uint64_t ReadSize = RH->NElems * VH->Size + CRCSize;
-      if (VName != Vars[i].Name) {
+            if (j != FileVar)
+            {
                 Offset += ReadSize;
                 continue;
             }
 
+            VarFound = true;
+            beginVariable(Vars[i].Name);
+            bool IsFloat = (bool) (VH->Flags & FloatValue), IsSigned = (bool) (VH->Flags & SignedValue);
             size_t ElementSize = VH->Size;
             if (offsetof_safe(VH, ElementSize) < GH->VarsSize)
                 ElementSize = VH->ElementSize;
 
-            VarFound = true;
-            bool IsFloat = (bool) (VH->Flags & FloatValue),
-                 IsSigned = (bool) (VH->Flags & SignedValue);
-      if (VH->Size != Vars[i].Size) {
+            size_t VarSize = Comp < 0 ? (size_t) VH->Size : ElementSize;
+            ConvertKernel Convert = 0;
+            if (Vars[i].Convert)
+            {
+                Convert = checkConversion(Vars[i], VarSize, ElementSize, IsFloat, IsSigned,
+                                          OpenFileName);
+            }
+            else if (VarSize != Vars[i].Size)
+            {
                 stringstream ss;
                 ss << "Size mismatch for variable " << Vars[i].Name <<
                    " in: " << OpenFileName << ": current: " << Vars[i].Size <<
-                   ", file: " << VH->Size;
-                throw runtime_error(ss.str());
-      } else if (ElementSize != Vars[i].ElementSize) {
-                stringstream ss;
-                ss << "Element size mismatch for variable " << Vars[i].Name <<
-                   " in: " << OpenFileName << ": current: " << Vars[i].ElementSize <<
-                   ", file: " << ElementSize;
+                   ", file: " << VarSize;
                 throw runtime_error(ss.str());
-      } else if (IsFloat != Vars[i].IsFloat) {
+            }
+            else if (IsFloat != Vars[i].IsFloat)
+            {
                 string Float("float"), Int("integer");
                 stringstream ss;
                 ss << "Type mismatch for variable " << Vars[i].Name <<
@@ -1962,7 +5658,9 @@ void GenericIO::readData(int EffRank, size_t RowOffset, int Rank,
                    (Vars[i].IsFloat ? Float : Int) <<
                    ", file: " << (IsFloat ? Float : Int);
                 throw runtime_error(ss.str());
-      } else if (IsSigned != Vars[i].IsSigned) {
+            }
+            else if (IsSigned != Vars[i].IsSigned)
+            {
                 string Signed("signed"), Uns("unsigned");
                 stringstream ss;
                 ss << "Type mismatch for variable " << Vars[i].Name <<
@@ -1972,210 +5670,248 @@ void GenericIO::readData(int EffRank, size_t RowOffset, int Rank,
                 throw runtime_error(ss.str());
             }
 
-            size_t VarOffset = RowOffset * Vars[i].Size;
+            if (readOffset + readNumRows > RH->NElems)
+            {
+                stringstream ss;
+                ss << "Invalid row range for variable " << Vars[i].Name <<
+                   " in: " << OpenFileName << ": requested rows " << readOffset <<
+                   " to " << readOffset + readNumRows << ", rank has: " << RH->NElems;
+                throw runtime_error(ss.str());
+            }
+
+            size_t VarOffset = RowOffset * Vars[i].Stride;
             void *VarData = ((char *) Vars[i].Data) + VarOffset;
 
-            vector<unsigned char> LData;
-            void *Data = VarData;
-            bool HasExtraSpace = Vars[i].HasExtraSpace;
-            if (offsetof_safe(GH, BlocksStart) < GH->GlobalHeaderSize &&
-          GH->BlocksSize > 0) {
+            // Unfiltered blocks are read in place, and cannot be checked (the
+            // CRC covers the whole block). Compressed blocks are read and
+            // checked in full; chunked blocks only in the chunks overlapping the
+            // requested rows.
+            bool IsChunked = false, Transposed = false;
+            FrameFilter Filter = FrameRaw;
+            if (offsetof_safe(GH, BlocksStart) < GH->GlobalHeaderSize && GH->BlocksSize > 0)
+            {
                 BlockHeader<IsBigEndian> *BH = (BlockHeader<IsBigEndian> *)
                                                &FH.getHeaderCache()[GH->BlocksStart +
                                                        (RankIndex * GH->NVars + j) * GH->BlocksSize];
+
                 ReadSize = BH->Size + CRCSize;
                 Offset = BH->Start;
 
-        if (strncmp(BH->Filters[0], CompressName, FilterNameSize) == 0) {
-                    LData.resize(ReadSize);
-                    Data = &LData[0];
-                    HasExtraSpace = true;
-        } else if (BH->Filters[0][0] != '\0') {
-                    stringstream ss;
-                    ss << "Unknown filter \"" << BH->Filters[0] << "\" on variable " << Vars[i].Name;
-                    throw runtime_error(ss.str());
-                }
+                Filter = blockFrameFilter(BH, IsChunked, Vars[i].Name);
+                Transposed = isTransposed(BH);
             }
+            bool IsCompressed = Filter != FrameRaw;
+            size_t NComps = Transposed ? VH->Size / ElementSize : 1;
 
-            assert(HasExtraSpace && "Extra space required for reading");
-
-            char CRCSave[CRCSize];
-            char *CRCLoc = ((char *) Data) + ReadSize - CRCSize;
-            if (HasExtraSpace)
-                std::copy(CRCLoc, CRCLoc + CRCSize, CRCSave);
+            if (readNumRows == 0)
+                break;
 
-            int Retry = 0;
+            // Only the chunks of a single component of a transposed variable
+            // are read. Rows to be converted or stored with a stride, and a
+            // component of any other variable, are read (and unpacked) in the
+            // layout of the file, and then stored in a single pass; the rows
+            // of a compressed block are stored straight from the unpacked
+            // block.
+            bool Staged = Convert || Vars[i].Stride != Vars[i].Size ||
+                          (Comp >= 0 && !Transposed);
+            size_t StagedRowSize = Comp >= 0 && Transposed ? ElementSize : (size_t) VH->Size;
+            size_t StoredOffset = Comp >= 0 && !Transposed ? Comp * ElementSize : 0;
+            size_t StoredSize = Comp >= 0 ? ElementSize : (size_t) VH->Size;
+            vector<char> StagedRows;
+            char *DestData = (char *) VarData;
+            if (Staged && !(IsCompressed && !IsChunked))
             {
-                int RetryCount = 300;
-                const char *EnvStr = getenv("GENERICIO_RETRY_COUNT");
-                if (EnvStr)
-                    RetryCount = atoi(EnvStr);
-
-                int RetrySleep = 100; // ms
-                EnvStr = getenv("GENERICIO_RETRY_SLEEP");
-                if (EnvStr)
-                    RetrySleep = atoi(EnvStr);
-
-        for (; Retry < RetryCount; ++Retry) {
-          try {
-                        FH.get()->read(Data, ReadSize, Offset, Vars[i].Name);
-                        break;
-          } catch (...) { }
+                StagedRows.resize(readNumRows * StagedRowSize);
+                VarData = &StagedRows[0];
+            }
 
-                    usleep(1000 * RetrySleep);
-                }
+            // A compressed block (which is not chunked) is decompressed
+            // whole; with the decoded-block cache, it is kept for the next
+            // section.
+            vector<unsigned char> LData, Rows;
+            DecodedBlock *Cached = 0;
+            if (DecodedBlockCache && IsCompressed)
+            {
+                if (DecodedBlocks.size() < GH->NVars)
+                    DecodedBlocks.resize(GH->NVars);
+                Cached = &DecodedBlocks[j];
+            }
+            vector<unsigned char> &Block = Cached ? Cached->Rows : Rows;
+            bool CacheHit = Cached && Cached->FileName == OpenFileName &&
+                            Cached->Offset == Offset && Block.size() == RH->NElems * VH->Size;
+
+            int ChunkErr = 0;
+            bool ReadOkay;
+            double PhaseStart = statNow();
+            if (IsChunked)
+            {
+                ReadOkay = readChunkedRetrying<IsBigEndian>(j, Offset, RH->NElems, VH->Size, NComps,
+                                                            Transposed ? Comp : -1, readOffset,
+                                                            readNumRows, VarData, Vars[i].Name,
+                                                            ReadSize, ChunkErr);
+            }
+            else if (CacheHit)
+            {
+                ReadSize = 0;
+                ReadOkay = true;
+            }
+            else if (IsCompressed)
+            {
+                LData.resize(ReadSize);
+                ReadOkay = readRetrying(&LData[0], ReadSize, Offset, Vars[i].Name);
+            }
+            else
+            {
+                // Read section
+                ReadSize = readNumRows * VH->Size;
+                ReadOkay = readRetrying(VarData, ReadSize, Offset + readOffset * VH->Size, Vars[i].Name);
+            }
+            addPhase(StatIO, PhaseStart);
 
-        if (Retry == RetryCount) {
-                    ++NErrs[0];
-                    break;
-        } else if (Retry > 0) {
-                    EnvStr = getenv("GENERICIO_VERBOSE");
-          if (EnvStr) {
-                        int Mod = atoi(EnvStr);
-            if (Mod > 0) {
-                            int Rank;
-                            #ifndef GENERICIO_NO_MPI
-                            MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
-                            #else
-                            Rank = 0;
-                            #endif
-
-                            std::cerr << "Rank " << Rank << ": " << Retry <<
-                                      " I/O retries were necessary for reading " <<
-                                      Vars[i].Name << " from: " << OpenFileName << "\n";
-
-                            std::cerr.flush();
-                        }
-                    }
-                }
+            if (!ReadOkay)
+            {
+                ++NErrs[0];
+                break;
             }
 
             TotalReadSize += ReadSize;
+            addBytes(ReadSize, readNumRows * Vars[i].Size);
 
-            uint64_t CRC = crc64_omp(Data, ReadSize);
-      if (CRC != (uint64_t) -1) {
-                ++NErrs[1];
-
-                int Rank;
-                #ifndef GENERICIO_NO_MPI
-                MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
-                #else
-                Rank = 0;
-                #endif
-
-                // All ranks will do this and have a good time!
-                string dn = "gio_crc_errors";
-                mkdir(dn.c_str(), 0777);
-
-                srand(time(0));
-                int DumpNum = rand();
-                stringstream ssd;
-                ssd << dn << "/gio_crc_error_dump." << Rank << "." << DumpNum << ".bin";
-
-                stringstream ss;
-                ss << dn << "/gio_crc_error_log." << Rank << ".txt";
-
-                ofstream ofs(ss.str().c_str(), ofstream::out | ofstream::app);
-                ofs << "On-Disk CRC Error Report:\n";
-                ofs << "Variable: " << Vars[i].Name << "\n";
-                ofs << "File: " << OpenFileName << "\n";
-                ofs << "I/O Retries: " << Retry << "\n"; 
-                ofs << "Size: " << ReadSize << " bytes\n";
-                ofs << "Offset: " << Offset << " bytes\n";
-                ofs << "CRC: " << CRC << " (expected is -1)\n";
-                ofs << "Dump file: " << ssd.str() << "\n";
-                ofs << "\n";
-                ofs.close();
-
-                ofstream dofs(ssd.str().c_str(), ofstream::out);
-                dofs.write((const char *) Data, ReadSize);
-                dofs.close();
-
-                uint64_t RawCRC = crc64_omp(Data, ReadSize - CRCSize);
-                unsigned char *UData = (unsigned char *) Data;
-                crc64_invert(RawCRC, &UData[ReadSize - CRCSize]);
-                uint64_t NewCRC = crc64_omp(Data, ReadSize);
-                std::cerr << "Recalulated CRC: " << NewCRC << ((NewCRC == -1) ? "ok" : "bad") << "\n";
+            if (ChunkErr)
+            {
+                ++NErrs[ChunkErr];
                 break;
             }
 
-            if (HasExtraSpace)
-                std::copy(CRCSave, CRCSave + CRCSize, CRCLoc);
-
-      if (LData.size()) {
-                CompressHeader<IsBigEndian> *CH = (CompressHeader<IsBigEndian>*) &LData[0];
-
-                #ifdef _OPENMP
-                #pragma omp master
+            if (IsCompressed)
+            {
+                if (!CacheHit)
                 {
-                #endif
-
-       if (!blosc_initialized) {
-                        blosc_init();
-                        blosc_initialized = true;
+                    PhaseStart = statNow();
+                    uint64_t CRC = crc64_omp(&LData[0], ReadSize);
+                    addPhase(StatCRC, PhaseStart);
+                    if (CRC != (uint64_t) -1)
+                    {
+                        ++NErrs[1];
+                        break;
                     }
 
-                    #ifdef _OPENMP
-                    blosc_set_nthreads(omp_get_max_threads());
-                }
-                    #endif
-
-                blosc_decompress(&LData[0] + sizeof(CompressHeader<IsBigEndian>),
-                                 VarData, Vars[i].Size * RH->NElems);
-
-        if (CH->OrigCRC != crc64_omp(VarData, Vars[i].Size*RH->NElems)) {
-                    ++NErrs[2];
-                    break;
-                }
-            }
-
-            // Byte swap the data if necessary.
-            if (IsBigEndian != isBigEndian())
-                for (size_t j = 0;
-             j < RH->NElems*(Vars[i].Size/Vars[i].ElementSize); ++j) {
-                    char *Offset = ((char *) VarData) + j * Vars[i].ElementSize;
-                    bswap(Offset, Vars[i].ElementSize);
-                }
-
-            break;
-        }
-
-        if (!VarFound)
-            throw runtime_error("Variable " + Vars[i].Name +
-                                " not found in: " + OpenFileName);
+                    if (Cached)
+                        Cached->FileName.clear();
 
-        // This is for debugging.
-    if (NErrs[0] || NErrs[1] || NErrs[2]) {
-            const char *EnvStr = getenv("GENERICIO_VERBOSE");
-      if (EnvStr) {
-                int Mod = atoi(EnvStr);
-        if (Mod > 0) {
-                    int Rank;
-                    #ifndef GENERICIO_NO_MPI
-                    MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
-                    #else
-                    Rank = 0;
-                    #endif
+                    PhaseStart = statNow();
+                    Block.resize(RH->NElems * VH->Size);
+                    int Err = decompressFrame<IsBigEndian>(Filter, &LData[0], ReadSize - CRCSize,
+                                                           &Block[0], Block.size(),
+                                                           fileDictionary(FH.getDictionaries(), j));
+                    if (Err)
+                    {
+                        ++NErrs[Err];
+                        break;
+                    }
+                    addPhase(StatDecompress, PhaseStart);
 
-                    std::cerr << "Rank " << Rank << ": " << NErrs[0] << " I/O error(s), " <<
-                              NErrs[1] << " CRC error(s) and " << NErrs[2] <<
-                              " decompression CRC error(s) reading: " << Vars[i].Name <<
-                              " from: " << OpenFileName << "\n";
+                    if (Cached)
+                    {
+                        Cached->FileName = OpenFileName;
+                        Cached->Offset = Offset;
+                    }
+                }
 
-                    std::cerr.flush();
+                // (The rows are still in the order of the file, and are byte
+                // swapped below, in the variable or the staged rows.)
+                if (Staged && !Cached)
+                    VarData = &Block[readOffset * VH->Size];
+                else if (Staged)
+                {
+                    StagedRows.assign(Block.begin() + readOffset * VH->Size,
+                                      Block.begin() + (readOffset + readNumRows) * VH->Size);
+                    VarData = &StagedRows[0];
                 }
+                else
+                    std::copy(Block.begin() + readOffset * VH->Size,
+                              Block.begin() + (readOffset + readNumRows) * VH->Size,
+                              (unsigned char *) VarData);
             }
-        }
 
-        if (NErrs[0] || NErrs[1] || NErrs[2])
+            // Byte swap the data if necessary.
+            if (IsBigEndian != isBigEndian())
+            {
+                PhaseStart = statNow();
+                for (size_t j = 0; j < readNumRows*(StagedRowSize/ElementSize); ++j)
+                {
+                    char *Offset = ((char *) VarData) + j * ElementSize;
+                    bswap(Offset, ElementSize);
+                }
+                addPhase(StatByteSwap, PhaseStart);
+            }
+
+            if (Staged)
+                storeRows(((char *) VarData) + StoredOffset, StagedRowSize, DestData,
+                          Vars[i].Stride, readNumRows, StoredSize, Convert,
+                          StoredSize / ElementSize);
             break;
+        }
+        endVariable();
+
+        if (!VarFound)
+            throw runtime_error("Variable " + Vars[i].Name + " not found in: " + OpenFileName);
     }
 }
 
 
 
-void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRank, bool PrintStats, bool CollStats)
+
+uint64_t GenericIO::readDecodedBlockBytes(const vector<VariableInfo> &Columns, int EffRank)
+{
+    if (FH.isBigEndian())
+        return readDecodedBlockBytes<true>(Columns, EffRank);
+    else
+        return readDecodedBlockBytes<false>(Columns, EffRank);
+}
+
+template <bool IsBigEndian>
+uint64_t GenericIO::readDecodedBlockBytes(const vector<VariableInfo> &Columns, int EffRank)
+{
+    openAndReadHeader(Redistributing ? MismatchRedistribute : MismatchAllowed, EffRank, false);
+
+    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
+    if (!(offsetof_safe(GH, BlocksStart) < GH->GlobalHeaderSize && GH->BlocksSize > 0))
+        return 0;
+
+    size_t RankIndex = getRankIndex<IsBigEndian>(EffRank, GH, RankMap, FH.getHeaderCache());
+    RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->RanksStart +
+                                  RankIndex * GH->RanksSize];
+
+    // (Several components of a variable share its block.)
+    vector<bool> Counted(GH->NVars, false);
+    uint64_t Decoded = 0, MaxRead = 0;
+    for (size_t c = 0; c < Columns.size(); ++c)
+    {
+        int Comp;
+        uint64_t j = findFileVariable<IsBigEndian>(FH.getHeaderCache(), Columns[c].Name, Comp);
+        if (j >= GH->NVars || Counted[j])
+            continue;
+        Counted[j] = true;
+
+        VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->VarsStart + j * GH->VarsSize];
+        BlockHeader<IsBigEndian> *BH = (BlockHeader<IsBigEndian> *)
+                                       &FH.getHeaderCache()[GH->BlocksStart +
+                                               (RankIndex * GH->NVars + j) * GH->BlocksSize];
+        bool IsChunked;
+        if (blockFrameFilter(BH, IsChunked, Columns[c].Name) == FrameRaw)
+            continue;
+
+        Decoded += RH->NElems * VH->Size;
+        MaxRead = std::max(MaxRead, (uint64_t) BH->Size + CRCSize);
+    }
+
+    return Decoded + MaxRead;
+}
+
+void GenericIO::readDataSectionNoMPIBarrier(size_t readOffset, size_t readNumRows, int EffRank, bool PrintStats, bool CollStats)
 {
+    CallScope Scope(*this, "readDataSection");
     int Rank;
   #ifndef GENERICIO_NO_MPI
     MPI_Comm_rank(Comm, &Rank);
@@ -2210,12 +5946,11 @@ void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRa
         readDataSection(readOffset, readNumRows, EffRank, 0, Rank, TotalReadSize, NErrs);
     }
 
+    ReadStats.CRCErrors += NErrs[1];
+    ReadStats.DecompressionErrors += NErrs[2];
+
     int AllNErrs[3];
-  #ifndef GENERICIO_NO_MPI
-    MPI_Allreduce(NErrs, AllNErrs, 3, MPI_INT, MPI_SUM, Comm);
-  #else
     AllNErrs[0] = NErrs[0]; AllNErrs[1] = NErrs[1]; AllNErrs[2] = NErrs[2];
-  #endif
 
     if (AllNErrs[0] > 0 || AllNErrs[1] > 0 || AllNErrs[2] > 0)
     {
@@ -2226,10 +5961,6 @@ void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRa
         throw runtime_error(ss.str());
     }
 
-  #ifndef GENERICIO_NO_MPI
-    MPI_Barrier(Comm);
-  #endif
-
   #ifndef GENERICIO_NO_MPI
     double EndTime = MPI_Wtime();
   #else
@@ -2238,20 +5969,10 @@ void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRa
 
     double TotalTime = EndTime - StartTime;
     double MaxTotalTime;
-  #ifndef GENERICIO_NO_MPI
-    if (CollStats)
-        MPI_Reduce(&TotalTime, &MaxTotalTime, 1, MPI_DOUBLE, MPI_MAX, 0, Comm);
-    else
-  #endif
-        MaxTotalTime = TotalTime;
+    MaxTotalTime = TotalTime;
 
     uint64_t AllTotalReadSize;
-  #ifndef GENERICIO_NO_MPI
-    if (CollStats)
-        MPI_Reduce(&TotalReadSize, &AllTotalReadSize, 1, MPI_UINT64_T, MPI_SUM, 0, Comm);
-    else
-  #endif
-        AllTotalReadSize = TotalReadSize;
+    AllTotalReadSize = TotalReadSize;
 
     if (Rank == 0 && PrintStats)
     {
@@ -2263,449 +5984,1150 @@ void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRa
 }
 
 
-void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRank, size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3])
+void GenericIO::readDataSectionNoMPIBarrier(size_t readOffset, size_t readNumRows, int EffRank, size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3])
 {
     if (FH.isBigEndian())
-        readDataSection<true>(readOffset, readNumRows, EffRank, RowOffset, Rank, TotalReadSize, NErrs);
+        readDataSectionNoMPIBarrier<true>(readOffset, readNumRows, EffRank, RowOffset, Rank, TotalReadSize, NErrs);
     else
-        readDataSection<false>(readOffset, readNumRows, EffRank, RowOffset, Rank, TotalReadSize, NErrs);
+        readDataSectionNoMPIBarrier<false>(readOffset, readNumRows, EffRank, RowOffset, Rank, TotalReadSize, NErrs);
 }
 
+
 template <bool IsBigEndian>
-void GenericIO::readDataSection(size_t readOffset, size_t readNumRows, int EffRank, size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3])
+void GenericIO::readDataSectionNoMPIBarrier(size_t readOffset, size_t readNumRows, int EffRank, size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3])
 {
-    openAndReadHeader(Redistributing ? MismatchRedistribute : MismatchAllowed, EffRank, false);
+    readDataSection<IsBigEndian>(readOffset, readNumRows, EffRank, RowOffset, Rank, TotalReadSize, NErrs);
+}
 
-    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
 
-    if (EffRank == -1)
-        EffRank = Rank;
+size_t GenericIO::Cursor::DefaultMemoryBytes = 256*1024*1024;
 
-    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
-    size_t RankIndex = getRankIndex<IsBigEndian>(EffRank, GH, RankMap, FH.getHeaderCache());
+GenericIO::Cursor::Cursor(GenericIO &G, size_t MemoryBytes, const vector<string> &Names,
+                          int Part, int NParts)
+    : GIO(G), Reader(G), PartBegin(0), PartEnd(0), NextRow(0), BatchRows(0), Cur(0),
+      Queued(false) {
+    Reader.makeIndependentCursor();
+    Reader.DecodedBlockCache = true;
 
-    assert(RankIndex < GH->NRanks && "Invalid rank specified");
+    // The environment only replaces the default, not the caller's choice.
+  if (!MemoryBytes) {
+        MemoryBytes = DefaultMemoryBytes;
+        const char *EnvStr = getenv("GENERICIO_CURSOR_MEMORY");
+        if (EnvStr && strtoull(EnvStr, 0, 10) > 0)
+            MemoryBytes = strtoull(EnvStr, 0, 10);
+    }
 
-    RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->RanksStart +
-                                  RankIndex * GH->RanksSize];
+    if (NParts < 1 || Part < 0 || Part >= NParts)
+        throw runtime_error("Invalid cursor part for: " + GIO.OpenFileName);
+
+    vector<GenericIO::VariableInfo> VI;
+    GIO.getVariableInfo(VI);
+    if (Names.empty())
+        Columns = VI;
+  for (size_t c = 0; c < Names.size(); ++c) {
+        // Names are resolved as reads resolve them, so that a column which
+        // cannot be read (such as an invalid component) is rejected here.
+        int Comp;
+        uint64_t Found = GIO.FH.isBigEndian() ?
+            findFileVariable<true>(GIO.FH.getHeaderCache(), Names[c], Comp) :
+            findFileVariable<false>(GIO.FH.getHeaderCache(), Names[c], Comp);
+        if (Found >= VI.size())
+            throw runtime_error("Variable " + Names[c] + " not found in: " + GIO.OpenFileName);
+    if (Comp == -1) {
+            Columns.push_back(VI[Found]);
+            continue;
+        }
 
-    for (size_t i = 0; i < Vars.size(); ++i)
-    {
-        uint64_t Offset = RH->Start;
-        bool VarFound = false;
-        for (uint64_t j = 0; j < GH->NVars; ++j)
-        {
-            VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->VarsStart + j * GH->VarsSize];
+        // A single component of a variable of several is read as a variable
+        // of its element type.
+        const GenericIO::VariableInfo &V = VI[Found];
+        Columns.push_back(GenericIO::VariableInfo(Names[c], V.ElementSize, V.IsFloat,
+                                                  V.IsSigned, false, false, false, false,
+                                                  V.ElementSize));
+    }
+
+    size_t RowSize = 0;
+    for (size_t c = 0; c < Columns.size(); ++c)
+        RowSize += Columns[c].Size;
+    if (RowSize == 0)
+        throw runtime_error("No variables to read with a cursor from: " + GIO.OpenFileName);
+
+    // The rows are streamed by leaf, or by rank; adjacent leaves of a rank
+    // are read together.
+  if (GIO.hasOctree) {
+        for (size_t l = 0; l < GIO.octreeData.rows.size(); ++l)
+      if (GIO.octreeData.rows[l].numParticles) {
+                GIOOctreeRow &Leaf = GIO.octreeData.rows[l];
+                addRegionRun(Runs, (int) Leaf.partitionLocation, Leaf.offsetInFile,
+                             Leaf.numParticles, false);
+            }
+  } else {
+        int NRanks = GIO.readNRanks();
+        for (int r = 0; r < NRanks; ++r)
+            if (GIO.readNumElems(r))
+                addRegionRun(Runs, r, 0, GIO.readNumElems(r), false);
+    }
 
-            string VName(VH->Name, VH->Name + NameSize);
-            size_t VNameNull = VName.find('\0');
-            if (VNameNull < NameSize)
-                VName.resize(VNameNull);
+    uint64_t TotalRows = 0;
+  for (size_t r = 0; r < Runs.size(); ++r) {
+        RunFirst.push_back(TotalRows);
+        TotalRows += Runs[r].Count;
+    }
 
-            uint64_t ReadSize = RH->NElems * VH->Size + CRCSize;
-            if (VName != Vars[i].Name)
-            {
-                Offset += ReadSize;
+    PartBegin = NextRow = TotalRows * Part / NParts;
+    PartEnd = TotalRows * (Part + 1) / NParts;
+
+    // Compressed blocks which are not chunked are decompressed whole, and
+    // kept while the batches read their rows; the largest rank's come out of
+    // the budget first. When they alone exceed it, the bound cannot be kept,
+    // and the batches get the budget as if the file were chunked.
+    uint64_t DecodedBytes = 0;
+    vector<bool> RankSeen;
+  for (size_t r = 0; r < Runs.size(); ++r) {
+        if (RunFirst[r] + Runs[r].Count <= PartBegin || RunFirst[r] >= PartEnd)
+            continue;
+        if (RankSeen.size() <= (size_t) Runs[r].Rank)
+            RankSeen.resize(Runs[r].Rank + 1, false);
+        if (RankSeen[Runs[r].Rank])
+            continue;
+        RankSeen[Runs[r].Rank] = true;
+        DecodedBytes = std::max(DecodedBytes, Reader.readDecodedBlockBytes(Columns, Runs[r].Rank));
+    }
+
+  if (DecodedBytes + 2 * RowSize > MemoryBytes) {
+        if (DecodedBytes)
+            cerr << "GenericIO cursor: the compressed blocks of " << GIO.OpenFileName <<
+                 " (not chunked) need " << DecodedBytes << " bytes decompressed, more than the " <<
+                 MemoryBytes << " bytes allowed; write it with GENERICIO_CHUNK_ROWS to bound it" << endl;
+  } else {
+        MemoryBytes -= DecodedBytes;
+    }
+
+    BatchRows = std::max((size_t) 1, MemoryBytes / (2 * RowSize));
+    if (PartEnd - PartBegin < BatchRows)
+        BatchRows = std::max((uint64_t) 1, PartEnd - PartBegin);
+
+  for (int b = 0; b < 2; ++b) {
+        Batches[b].Data.resize(Columns.size());
+        for (size_t c = 0; c < Columns.size(); ++c)
+            Batches[b].Data[c].resize(BatchRows * Columns[c].Size + Reader.requestedExtraSpace());
+        Batches[b].NRows = 0;
+        Batches[b].FirstRow = PartBegin;
+        Batches[b].FileBytes = 0;
+    }
+
+    startRead();
+}
+
+GenericIO::Cursor::~Cursor() {
+    if (Pending.valid())
+        Pending.wait();
+}
+
+int GenericIO::Cursor::findColumn(const string &Name) const {
+    for (size_t c = 0; c < Columns.size(); ++c)
+        if (Columns[c].Name == Name)
+            return c;
+    return -1;
+}
+
+bool GenericIO::Cursor::next() {
+  if (!Queued) {
+        Batches[Cur].NRows = 0;
+        return false;
+    }
+
+    // The batch is accounted for in a call on the GenericIO, which lasts for
+    // as long as it is waited for.
+    GenericIO::CallScope Scope(GIO, "readCursor");
+    Batch &B = Batches[1 - Cur];
+    if (Pending.valid())
+        Pending.get();
+    else
+        readBatch(B);
+    Queued = false;
+
+    uint64_t RawBytes = 0;
+    for (size_t c = 0; c < Columns.size(); ++c)
+        RawBytes += B.NRows * Columns[c].Size;
+    GIO.addBytes(B.FileBytes, RawBytes);
+
+    Cur = 1 - Cur;
+    startRead();
+    return true;
+}
+
+// Assigns the next rows of the part to the other batch and, when cursors can
+// use threads, starts reading them.
+void GenericIO::Cursor::startRead() {
+    if (NextRow >= PartEnd)
+        return;
+
+    Batch &B = Batches[1 - Cur];
+    B.FirstRow = NextRow;
+    B.NRows = std::min((uint64_t) BatchRows, PartEnd - NextRow);
+    NextRow += B.NRows;
+    Queued = true;
+
+    if (GenericIO::cursorsCanUseThreads())
+        Pending = std::async(std::launch::async, &Cursor::readBatch, this, std::ref(B));
+}
+
+void GenericIO::Cursor::readBatch(Batch &B) {
+    Reader.clearVariables();
+    for (size_t c = 0; c < Columns.size(); ++c)
+        Reader.addVariable(Columns[c], &B.Data[c][0], GenericIO::VarHasExtraSpace);
+
+    B.FileBytes = 0;
+    uint64_t First = B.FirstRow, End = B.FirstRow + B.NRows;
+    size_t r = std::upper_bound(RunFirst.begin(), RunFirst.end(), First) - RunFirst.begin() - 1;
+  for (; First < End; ++r) {
+        uint64_t Offset = First - RunFirst[r];
+        uint64_t N = std::min(Runs[r].Count - Offset, End - First);
+
+        int NErrs[3] = { 0, 0, 0 };
+        Reader.readDataSection(Runs[r].Start + Offset, N, Runs[r].Rank, First - B.FirstRow, 0,
+                               B.FileBytes, NErrs);
+    if (NErrs[0] > 0 || NErrs[1] > 0 || NErrs[2] > 0) {
+            stringstream ss;
+            ss << "Experienced " << NErrs[0] << " I/O error(s), " <<
+               NErrs[1] << " CRC error(s) and " << NErrs[2] <<
+               " decompression CRC error(s) reading rank " << Runs[r].Rank << " of: " <<
+               GIO.OpenFileName;
+            throw runtime_error(ss.str());
+        }
+
+        First += N;
+    }
+}
+
+size_t NeighborQuery::DefaultCacheBytes = 256*1024*1024;
+
+// A leaf's positions (in double precision) and rows, sorted into the cells of
+// a uniform grid over the leaf's extents.
+struct NeighborQuery::Leaf {
+    int Rank;
+    double Ext[6];
+    size_t Cells[3];
+    double CellSize[3];
+    vector<uint64_t> CellStart;
+    vector<double> Pos;
+    vector<uint64_t> Rows;
+
+    size_t bytes() const {
+        return sizeof(Leaf) + CellStart.size() * sizeof(uint64_t) +
+               Pos.size() * sizeof(double) + Rows.size() * sizeof(uint64_t);
+    }
+
+    size_t cell(int d, double P) const {
+        // Clamped before the conversion, which is undefined out of range.
+        double C = floor((P - Ext[2*d]) / CellSize[d]);
+        if (!(C > 0))
+            return 0;
+        return C >= (double) (Cells[d] - 1) ? Cells[d] - 1 : (size_t) C;
+    }
+
+    // Appends the rows within Radius of P.
+    void search(const double P[3], double Radius, size_t Query,
+                vector< pair<size_t, NeighborQuery::Neighbor> > &Found) const {
+        size_t Lo[3], Hi[3];
+        for (int d = 0; d < 3; ++d) {
+            Lo[d] = cell(d, P[d] - Radius);
+            Hi[d] = cell(d, P[d] + Radius);
+        }
+
+        double R2 = Radius * Radius;
+        for (size_t i = Lo[0]; i <= Hi[0]; ++i)
+            for (size_t j = Lo[1]; j <= Hi[1]; ++j)
+        for (size_t k = Lo[2]; k <= Hi[2]; ++k) {
+                    size_t C = (i * Cells[1] + j) * Cells[2] + k;
+          for (uint64_t r = CellStart[C]; r < CellStart[C+1]; ++r) {
+                        const double *Q = &Pos[3*r];
+                        double D2 = (Q[0] - P[0]) * (Q[0] - P[0]) + (Q[1] - P[1]) * (Q[1] - P[1]) +
+                                    (Q[2] - P[2]) * (Q[2] - P[2]);
+                        if (D2 > R2)
+                            continue;
+
+                        NeighborQuery::Neighbor N = { Rank, Rows[r], { Q[0], Q[1], Q[2] }, sqrt(D2) };
+                        Found.push_back(std::make_pair(Query, N));
+                    }
+                }
+    }
+};
+
+NeighborQuery::NeighborQuery(GenericIO &G, size_t CB)
+    : GIO(G), CacheBytes(CB), CachedBytes(0), LeafReads(0), LeafHits(0) {
+    if (!GIO.isOctree())
+        throw runtime_error("Neighbour queries require an octree: " + GIO.OpenFileName);
+    Octree = GIO.getOctree();
+
+    const char *EnvStr = getenv("GENERICIO_NEIGHBOR_CACHE");
+    if (EnvStr)
+        CacheBytes = strtoull(EnvStr, 0, 10);
+
+    vector<GenericIO::VariableInfo> VI;
+    GIO.getVariableInfo(VI);
+  for (int d = 0; d < 3; ++d) {
+        const char *Name[3] = { "x", "y", "z" };
+        int Found = -1;
+        for (size_t i = 0; i < VI.size() && Found == -1; ++i)
+            if ((d == 0 && VI[i].IsPhysCoordX) || (d == 1 && VI[i].IsPhysCoordY) ||
+                (d == 2 && VI[i].IsPhysCoordZ) || VI[i].Name == Name[d])
+                Found = i;
+
+        if (Found == -1 || !VI[Found].IsFloat ||
+            (VI[Found].Size != sizeof(float) && VI[Found].Size != sizeof(double)))
+            throw runtime_error("Neighbour queries require (floating-point) position "
+                                "variables in: " + GIO.OpenFileName);
+        PosInfo.push_back(VI[Found]);
+    }
+
+    double Init[6] = { HUGE_VAL, -HUGE_VAL, HUGE_VAL, -HUGE_VAL, HUGE_VAL, -HUGE_VAL };
+    std::copy(Init, Init + 6, Bounds);
+  for (size_t l = 0; l < Octree.rows.size(); ++l) {
+        GIOOctreeRow &R = Octree.rows[l];
+        if (R.numParticles == 0)
+            continue;
+
+        double Ext[6] = { R.minX, R.maxX, R.minY, R.maxY, R.minZ, R.maxZ };
+    for (int d = 0; d < 3; ++d) {
+            Bounds[2*d]   = std::min(Bounds[2*d], Ext[2*d]);
+            Bounds[2*d+1] = std::max(Bounds[2*d+1], Ext[2*d+1]);
+        }
+    }
+}
+
+shared_ptr<NeighborQuery::Leaf> NeighborQuery::loadLeaf(GenericIO &Cursor, int L,
+                                                        uint64_t &FileBytes, uint64_t &RawBytes) {
+    GIOOctreeRow &R = Octree.rows[L];
+    size_t N = R.numParticles;
+
+    Cursor.clearVariables();
+    vector<char> Data[3];
+  for (int d = 0; d < 3; ++d) {
+        Data[d].resize(N * PosInfo[d].Size + Cursor.requestedExtraSpace());
+        Cursor.addVariable(PosInfo[d], &Data[d][0], true);
+    }
+
+    int NErrs[3] = { 0, 0, 0 };
+    Cursor.readDataSection(R.offsetInFile, N, (int) R.partitionLocation, 0, 0,
+                           FileBytes, NErrs);
+  if (NErrs[0] > 0 || NErrs[1] > 0 || NErrs[2] > 0) {
+        stringstream ss;
+        ss << "Experienced " << NErrs[0] << " I/O error(s), " <<
+           NErrs[1] << " CRC error(s) and " << NErrs[2] <<
+           " decompression CRC error(s) reading leaf " << L << " of: " << GIO.OpenFileName;
+        throw runtime_error(ss.str());
+    }
+
+    for (int d = 0; d < 3; ++d)
+        RawBytes += N * PosInfo[d].Size;
+
+    shared_ptr<Leaf> Lf(new Leaf);
+    Lf->Rank = (int) R.partitionLocation;
+    double Ext[6] = { R.minX, R.maxX, R.minY, R.maxY, R.minZ, R.maxZ };
+    std::copy(Ext, Ext + 6, Lf->Ext);
+
+    // About eight rows per cell.
+    size_t CellsPerDim = std::max((size_t) 1, (size_t) cbrt(N / 8.0));
+  for (int d = 0; d < 3; ++d) {
+        Lf->Cells[d] = CellsPerDim;
+        Lf->CellSize[d] = std::max(Ext[2*d+1] - Ext[2*d], 1e-300) / CellsPerDim;
+    }
+
+    vector<double> Pos(3 * N);
+    for (int d = 0; d < 3; ++d)
+        for (size_t r = 0; r < N; ++r)
+            Pos[3*r + d] = PosInfo[d].Size == sizeof(float) ?
+                           (double) ((float *) &Data[d][0])[r] : ((double *) &Data[d][0])[r];
+
+    // A counting sort of the rows into the cells.
+    vector<uint64_t> Cell(N);
+    Lf->CellStart.assign(CellsPerDim * CellsPerDim * CellsPerDim + 1, 0);
+  for (size_t r = 0; r < N; ++r) {
+        Cell[r] = (Lf->cell(0, Pos[3*r]) * CellsPerDim + Lf->cell(1, Pos[3*r+1])) * CellsPerDim +
+                  Lf->cell(2, Pos[3*r+2]);
+        ++Lf->CellStart[Cell[r] + 1];
+    }
+    for (size_t c = 1; c < Lf->CellStart.size(); ++c)
+        Lf->CellStart[c] += Lf->CellStart[c-1];
+
+    vector<uint64_t> Next(Lf->CellStart.begin(), Lf->CellStart.end() - 1);
+    Lf->Pos.resize(3 * N);
+    Lf->Rows.resize(N);
+  for (size_t r = 0; r < N; ++r) {
+        uint64_t To = Next[Cell[r]]++;
+        std::copy(&Pos[3*r], &Pos[3*r] + 3, &Lf->Pos[3*To]);
+        Lf->Rows[To] = R.offsetInFile + r;
+    }
+
+    return Lf;
+}
+
+// Returns the leaf from the cache, or reads it (and makes it the most
+// recently used, evicting the least recently used leaves over the bound).
+shared_ptr<NeighborQuery::Leaf> NeighborQuery::getLeaf(GenericIO &Cursor, int L,
+                                                       uint64_t &FileBytes, uint64_t &RawBytes) {
+    shared_ptr<Leaf> Lf;
+
+    #ifdef _OPENMP
+    #pragma omp critical(NeighborCache)
+    #endif
+  {
+        map<int, pair<shared_ptr<Leaf>, list<int>::iterator> >::iterator I = Cache.find(L);
+    if (I != Cache.end()) {
+            LRU.splice(LRU.begin(), LRU, I->second.second);
+            Lf = I->second.first;
+            ++LeafHits;
+        }
+    }
+
+    if (Lf)
+        return Lf;
+
+    Lf = loadLeaf(Cursor, L, FileBytes, RawBytes);
+
+    #ifdef _OPENMP
+    #pragma omp critical(NeighborCache)
+    #endif
+  {
+        ++LeafReads;
+    if (!Cache.count(L)) {
+            LRU.push_front(L);
+            Cache[L] = std::make_pair(Lf, LRU.begin());
+            CachedBytes += Lf->bytes();
+        }
+
+    while (CachedBytes > CacheBytes && !LRU.empty()) {
+            map<int, pair<shared_ptr<Leaf>, list<int>::iterator> >::iterator I = Cache.find(LRU.back());
+            CachedBytes -= I->second.first->bytes();
+            Cache.erase(I);
+            LRU.pop_back();
+        }
+    }
+
+    return Lf;
+}
+
+static bool nearerNeighbor(const NeighborQuery::Neighbor &A, const NeighborQuery::Neighbor &B) {
+    if (A.Distance != B.Distance)
+        return A.Distance < B.Distance;
+    if (A.Rank != B.Rank)
+        return A.Rank < B.Rank;
+    return A.Row < B.Row;
+}
+
+// Finds the rows within Radii[q] of each of the Queries (indices into the
+// points), replacing their results.
+void NeighborQuery::radiusRound(const vector<double> &Points, const vector<size_t> &Queries,
+                                const vector<double> &Radii, vector< vector<Neighbor> > &Result) {
+    // The queries are grouped by the leaves they need.
+    vector< pair<int, size_t> > LeafQueries;
+  for (size_t i = 0; i < Queries.size(); ++i) {
+        size_t q = Queries[i];
+        const double *P = &Points[3*q];
+        double R = Radii[q];
+        double Box[6] = { P[0] - R, P[0] + R, P[1] - R, P[1] + R, P[2] - R, P[2] + R };
+
+        vector<int> Leaves = Octree.getIntersectingLeaves(Box);
+    for (size_t l = 0; l < Leaves.size(); ++l) {
+            GIOOctreeRow &Row = Octree.rows[Leaves[l]];
+            if (Row.numParticles == 0)
                 continue;
-            }
 
-            VarFound = true;
-            bool IsFloat = (bool) (VH->Flags & FloatValue), IsSigned = (bool) (VH->Flags & SignedValue);
-            if (VH->Size != Vars[i].Size)
-            {
-                stringstream ss;
-                ss << "Size mismatch for variable " << Vars[i].Name <<
-                   " in: " << OpenFileName << ": current: " << Vars[i].Size <<
-                   ", file: " << VH->Size;
-                throw runtime_error(ss.str());
-            }
-            else if (IsFloat != Vars[i].IsFloat)
-            {
-                string Float("float"), Int("integer");
-                stringstream ss;
-                ss << "Type mismatch for variable " << Vars[i].Name <<
-                   " in: " << OpenFileName << ": current: " <<
-                   (Vars[i].IsFloat ? Float : Int) <<
-                   ", file: " << (IsFloat ? Float : Int);
-                throw runtime_error(ss.str());
-            }
-            else if (IsSigned != Vars[i].IsSigned)
-            {
-                string Signed("signed"), Uns("unsigned");
-                stringstream ss;
-                ss << "Type mismatch for variable " << Vars[i].Name <<
-                   " in: " << OpenFileName << ": current: " <<
-                   (Vars[i].IsSigned ? Signed : Uns) <<
-                   ", file: " << (IsSigned ? Signed : Uns);
-                throw runtime_error(ss.str());
+            // The distance to the leaf's extents.
+            double Ext[6] = { Row.minX, Row.maxX, Row.minY, Row.maxY, Row.minZ, Row.maxZ };
+            double D2 = 0;
+      for (int d = 0; d < 3; ++d) {
+                double Out = std::max(std::max(Ext[2*d] - P[d], P[d] - Ext[2*d+1]), 0.0);
+                D2 += Out * Out;
             }
 
-            size_t VarOffset = RowOffset * Vars[i].Size;
-            void *VarData = ((char *) Vars[i].Data) + VarOffset;
+            if (D2 <= R * R)
+                LeafQueries.push_back(std::make_pair(Leaves[l], q));
+        }
 
-            vector<unsigned char> LData;
-            void *Data = VarData;
-            bool HasExtraSpace = Vars[i].HasExtraSpace;
-            if (offsetof_safe(GH, BlocksStart) < GH->GlobalHeaderSize && GH->BlocksSize > 0)
-            {
-                BlockHeader<IsBigEndian> *BH = (BlockHeader<IsBigEndian> *)
-                                               &FH.getHeaderCache()[GH->BlocksStart +
-                                                       (RankIndex * GH->NVars + j) * GH->BlocksSize];
+        Result[q].clear();
+    }
 
-                ReadSize = BH->Size + CRCSize;
-                Offset = BH->Start;
+    std::sort(LeafQueries.begin(), LeafQueries.end());
+    vector<size_t> LeafStarts;
+    for (size_t i = 0; i < LeafQueries.size(); ++i)
+        if (i == 0 || LeafQueries[i].first != LeafQueries[i-1].first)
+            LeafStarts.push_back(i);
+    LeafStarts.push_back(LeafQueries.size());
 
-                if (strncmp(BH->Filters[0], CompressName, FilterNameSize) == 0)
-                {
-                    LData.resize(ReadSize);
-                    Data = &LData[0];
-                    HasExtraSpace = true;
-                }
-                else if (BH->Filters[0][0] != '\0')
-                {
-                    stringstream ss;
-                    ss << "Unknown filter \"" << BH->Filters[0] << "\" on variable " << Vars[i].Name;
-                    throw runtime_error(ss.str());
+    uint64_t FileBytes = 0, RawBytes = 0;
+    string Error;
+
+    #ifdef _OPENMP
+    #pragma omp parallel if(GenericIO::cursorsCanUseThreads() && LeafStarts.size() > 2) \
+                         reduction(+:FileBytes,RawBytes)
+    #endif
+  {
+        GenericIO Cursor(GIO);
+        Cursor.makeIndependentCursor();
+
+        vector< pair<size_t, Neighbor> > Found;
+
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+        #endif
+    for (int i = 0; i < (int) LeafStarts.size() - 1; ++i) {
+      try {
+                shared_ptr<Leaf> Lf = getLeaf(Cursor, LeafQueries[LeafStarts[i]].first,
+                                              FileBytes, RawBytes);
+        for (size_t j = LeafStarts[i]; j < LeafStarts[i+1]; ++j) {
+                    size_t q = LeafQueries[j].second;
+                    Lf->search(&Points[3*q], Radii[q], q, Found);
                 }
+      } catch (std::exception &e) {
+                #ifdef _OPENMP
+                #pragma omp critical
+                #endif
+                Error = e.what();
             }
+        }
+
+        #ifdef _OPENMP
+        #pragma omp critical
+        #endif
+        for (size_t i = 0; i < Found.size(); ++i)
+            Result[Found[i].first].push_back(Found[i].second);
+    }
+
+    GIO.addBytes(FileBytes, RawBytes);
+    if (!Error.empty())
+        throw runtime_error(Error);
+
+    for (size_t i = 0; i < Queries.size(); ++i)
+        std::sort(Result[Queries[i]].begin(), Result[Queries[i]].end(), nearerNeighbor);
+}
+
+void NeighborQuery::radius(const vector<double> &Points, double Radius,
+                           vector< vector<Neighbor> > &Result) {
+    GenericIO::CallScope Scope(GIO, "neighborRadius");
+    size_t NPoints = Points.size() / 3;
+    Result.assign(NPoints, vector<Neighbor>());
+
+    vector<size_t> Queries(NPoints);
+    for (size_t q = 0; q < NPoints; ++q)
+        Queries[q] = q;
+
+    radiusRound(Points, Queries, vector<double>(NPoints, Radius), Result);
+}
+
+// The radius expected to hold K of N rows spread uniformly over the box
+// Ext, measured in the dimensions in which the box has extent, so that flat
+// boxes have one too. Zero for a point (or no rows).
+static double expectedRadius(const double Ext[6], double N, size_t K) {
+    // The volume of the unit ball in 1, 2 and 3 dimensions.
+    static const double UnitBall[4] = { 1, 2, M_PI, 4.0 * M_PI / 3.0 };
+
+    double Measure = 1;
+    int Dims = 0;
+  for (int d = 0; d < 3; ++d) {
+    if (Ext[2*d+1] > Ext[2*d]) {
+            Measure *= Ext[2*d+1] - Ext[2*d];
+            ++Dims;
+        }
+    }
 
-            assert(HasExtraSpace && "Extra space required for reading");
+    if (Dims == 0 || N <= 0)
+        return 0;
+    return pow(K * Measure / (N * UnitBall[Dims]), 1.0 / Dims);
+}
 
-            int Retry = 0;
-            {
-                int RetryCount = 300;
-                const char *EnvStr = getenv("GENERICIO_RETRY_COUNT");
-                if (EnvStr)
-                    RetryCount = atoi(EnvStr);
+// The nearest neighbours are found by radius searches, starting from the
+// radius expected to hold K rows at the density of the leaf around the point,
+// and growing it for the points with fewer than K rows found. All rows within
+// the final radius are found, so the K nearest ones are exact.
+void NeighborQuery::nearest(const vector<double> &Points, size_t K,
+                            vector< vector<Neighbor> > &Result) {
+    GenericIO::CallScope Scope(GIO, "neighborNearest");
+    size_t NPoints = Points.size() / 3;
+    Result.assign(NPoints, vector<Neighbor>());
+    if (K == 0 || Bounds[0] > Bounds[1])
+        return;
 
-                int RetrySleep = 100; // ms
-                EnvStr = getenv("GENERICIO_RETRY_SLEEP");
-                if (EnvStr)
-                    RetrySleep = atoi(EnvStr);
+    uint64_t Total = 0;
+    for (size_t l = 0; l < Octree.rows.size(); ++l)
+        Total += Octree.rows[l].numParticles;
 
-                for (; Retry < RetryCount; ++Retry)
-                {
-                    try
-                    {
-                        //
-                        // Read section
-                        ReadSize = readNumRows * VH->Size;
-                        Offset = Offset + readOffset * VH->Size;
-                        FH.get()->read(Data, ReadSize, Offset, Vars[i].Name);
+    // Radii only grow from a positive start, which for a file of a single
+    // point (or of coincident points) is relative to its position.
+    double Extent = 0, Magnitude = 0;
+  for (int d = 0; d < 3; ++d) {
+        Extent = std::max(Extent, Bounds[2*d+1] - Bounds[2*d]);
+        Magnitude = std::max(Magnitude, std::max(std::abs(Bounds[2*d]), std::abs(Bounds[2*d+1])));
+    }
+    double MinRadius = 1e-6 * (Extent > 0 ? Extent : std::max(Magnitude, 1.0));
+
+    vector<double> Radii(NPoints);
+    vector<size_t> Queries(NPoints);
+  for (size_t q = 0; q < NPoints; ++q) {
+        const double *P = &Points[3*q];
+        double Point[6] = { P[0], P[0], P[1], P[1], P[2], P[2] };
+        vector<int> Leaves = Octree.getIntersectingLeaves(Point);
+
+        double Start = expectedRadius(Bounds, Total, K);
+    if (!Leaves.empty() && Octree.rows[Leaves[0]].numParticles > 0) {
+            GIOOctreeRow &R = Octree.rows[Leaves[0]];
+            double Ext[6] = { R.minX, R.maxX, R.minY, R.maxY, R.minZ, R.maxZ };
+            Start = expectedRadius(Ext, R.numParticles, K);
+        }
 
-                        break;
-                    }
-                    catch (...) { }
+        // Points outside the file's bounds start at their distance to it.
+        double D2 = 0;
+    for (int d = 0; d < 3; ++d) {
+            double Out = std::max(std::max(Bounds[2*d] - P[d], P[d] - Bounds[2*d+1]), 0.0);
+            D2 += Out * Out;
+        }
 
-                    usleep(1000 * RetrySleep);
-                }
+        Radii[q] = sqrt(D2) + std::max(Start, MinRadius);
+        Queries[q] = q;
+    }
 
-                if (Retry == RetryCount)
-                {
-                    ++NErrs[0];
-                    break;
-                }
-                else if (Retry > 0)
-                {
-                    EnvStr = getenv("GENERICIO_VERBOSE");
-                    if (EnvStr)
-                    {
-                        int Mod = atoi(EnvStr);
-                        if (Mod > 0)
-                        {
-                            int Rank;
-                          #ifndef GENERICIO_NO_MPI
-                            MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
-                          #else
-                            Rank = 0;
-                          #endif
-
-                            std::cerr << "Rank " << Rank << ": " << Retry <<
-                                      " I/O retries were necessary for reading " <<
-                                      Vars[i].Name << " from: " << OpenFileName << "\n";
-
-                            std::cerr.flush();
-                        }
-                    }
-                }
-            }
+    while (!Queries.empty()) {
+        radiusRound(Points, Queries, Radii, Result);
 
-            TotalReadSize += ReadSize;
+        vector<size_t> Pending;
+    for (size_t i = 0; i < Queries.size(); ++i) {
+            size_t q = Queries[i];
+      if (Result[q].size() >= K) {
+                Result[q].resize(K);
+                continue;
+            }
 
-            // Byte swap the data if necessary.
-            if (IsBigEndian != isBigEndian())
-                for (size_t j = 0; j < RH->NElems; ++j)
-                {
-                    char *Offset = ((char *) VarData) + j * Vars[i].Size;
-                    bswap(Offset, Vars[i].Size);
-                }
+            // Once the radius covers all of the file's bounds, all rows
+            // have been found.
+            const double *P = &Points[3*q];
+            double Far2 = 0;
+      for (int d = 0; d < 3; ++d) {
+                double Far = std::max(std::abs(P[d] - Bounds[2*d]), std::abs(P[d] - Bounds[2*d+1]));
+                Far2 += Far * Far;
+            }
+            if (Radii[q] * Radii[q] >= Far2)
+                continue;
 
-            break;
+            Radii[q] *= Result[q].empty() ? 2.0 :
+                        std::max(1.25, 1.1 * cbrt((double) K / Result[q].size()));
+            Pending.push_back(q);
         }
 
-        if (!VarFound)
-            throw runtime_error("Variable " + Vars[i].Name + " not found in: " + OpenFileName);
+        Queries.swap(Pending);
     }
 }
 
 
+// The id index file starts with these (and the writer's byte-order mark),
+// followed by the header fields, the blocks' id ranges, their Bloom filters
+// and the (id, location) entries, all 64-bit. A location packs the rank into
+// the top IdIndexRankBits bits and the row into the others. Since version 2,
+// the header ends with the data file's stamp (see getIdIndexStamp).
+static const char IdIndexMagic[] = "GIOIDIDX";
+static const uint64_t IdIndexByteOrder = 0x0102030405060708ULL;
+static const uint64_t IdIndexVersion = 2;
+static const int IdIndexRankBits = 24;
+static const int IdIndexHeaderWords = 8 + 4;
+
+// Bloom filters have about ten bits per entry, and seven hashes.
+static const uint64_t IdIndexBloomBits = 10;
+static const uint64_t IdIndexBloomHashes = 7;
+
+// Rows of a rank this close together are read together.
+static const uint64_t IdIndexReadGap = 64;
+
+static uint64_t mixId(uint64_t X) {
+    X = (X ^ (X >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    X = (X ^ (X >> 27)) * 0x94D049BB133111EBULL;
+    return X ^ (X >> 31);
+}
 
+static void setIdBloom(uint64_t *Bloom, uint64_t Words, uint64_t Hashes, int64_t Id) {
+    uint64_t H1 = mixId((uint64_t) Id), H2 = mixId(H1) | 1;
+    for (uint64_t i = 0; i < Hashes; ++i) {
+        uint64_t Bit = (H1 + i * H2) % (Words * 64);
+        Bloom[Bit / 64] |= (uint64_t) 1 << (Bit % 64);
+    }
+}
 
-void GenericIO::readDataSectionNoMPIBarrier(size_t readOffset, size_t readNumRows, int EffRank, bool PrintStats, bool CollStats)
-{
-    int Rank;
-  #ifndef GENERICIO_NO_MPI
-    MPI_Comm_rank(Comm, &Rank);
-  #else
-    Rank = 0;
-  #endif
+static bool testIdBloom(const uint64_t *Bloom, uint64_t Words, uint64_t Hashes, int64_t Id) {
+    uint64_t H1 = mixId((uint64_t) Id), H2 = mixId(H1) | 1;
+  for (uint64_t i = 0; i < Hashes; ++i) {
+        uint64_t Bit = (H1 + i * H2) % (Words * 64);
+        if (!(Bloom[Bit / 64] & ((uint64_t) 1 << (Bit % 64))))
+            return false;
+    }
 
-    uint64_t TotalReadSize = 0;
-  #ifndef GENERICIO_NO_MPI
-    double StartTime = MPI_Wtime();
+    return true;
+}
+
+// The size and modification time of the (opened) file, and the step, that an
+// index describes; a file of the same shape, or the same file rewritten, has
+// a different stamp.
+static void getIdIndexStamp(const string &FileName, int Step, uint64_t *Stamp) {
+    struct stat st;
+    if (stat(FileName.c_str(), &st) == -1)
+        throw runtime_error("Unable to stat: " + FileName + ": " + strerror(errno));
+
+    Stamp[0] = st.st_size;
+    Stamp[1] = st.st_mtime;
+  #if defined(__APPLE__)
+    Stamp[2] = st.st_mtimespec.tv_nsec;
   #else
-    double StartTime = double(clock()) / CLOCKS_PER_SEC;
+    Stamp[2] = st.st_mtim.tv_nsec;
   #endif
+    Stamp[3] = Step;
+}
 
-    int NErrs[3] = { 0, 0, 0 };
-
-    if (EffRank == -1 && Redistributing)
-    {
-        DisableCollErrChecking = true;
+template <typename T>
+static void copyIds(const void *Data, size_t N, uint64_t Rank, int64_t *Ids, uint64_t *Locs) {
+  for (size_t i = 0; i < N; ++i) {
+        Ids[i] = (int64_t) ((const T *) Data)[i];
+        Locs[i] = (Rank << (64 - IdIndexRankBits)) | i;
+    }
+}
 
-        size_t RowOffset = 0;
-        for (int i = 0, ie = SourceRanks.size(); i != ie; ++i)
-        {
-            readDataSection(readOffset, readNumRows, SourceRanks[i], RowOffset, Rank, TotalReadSize, NErrs);
-            RowOffset += readNumElems(SourceRanks[i]);
+void IdIndex::build(GenericIO &G, const string &Name, const string &IdName, size_t BlockEntries) {
+    GenericIO::CallScope Scope(G, "buildIdIndex");
+    string IndexName = Name.empty() ? defaultIndexName(G.FileName) : Name;
+    if (BlockEntries == 0)
+        throw runtime_error("Id index blocks must hold at least one entry");
+
+    vector<GenericIO::VariableInfo> VI;
+    G.getVariableInfo(VI);
+    int IdVar = -1;
+    for (size_t i = 0; i < VI.size() && IdVar == -1; ++i)
+        if (VI[i].Name == IdName)
+            IdVar = i;
+    if (IdVar == -1 || VI[IdVar].IsFloat || VI[IdVar].Size > sizeof(int64_t))
+        throw runtime_error("Id indices require an integer variable " + IdName +
+                            " in: " + G.OpenFileName);
+    GenericIO::VariableInfo &IdInfo = VI[IdVar];
+
+    uint64_t Stamp[4];
+    getIdIndexStamp(G.FileName, G.OpenStep, Stamp);
+
+    int NRanks = G.readNRanks();
+    vector<uint64_t> RankStart(NRanks + 1, 0);
+  for (int r = 0; r < NRanks; ++r) {
+        RankStart[r+1] = RankStart[r] + G.readNumElems(r);
+    if (G.readNumElems(r) >> (64 - IdIndexRankBits) || r >> IdIndexRankBits) {
+            stringstream ss;
+            ss << "Too many ranks or rows for an id index: " << G.OpenFileName;
+            throw runtime_error(ss.str());
         }
-
-        DisableCollErrChecking = false;
-    }
-    else
-    {
-        readDataSection(readOffset, readNumRows, EffRank, 0, Rank, TotalReadSize, NErrs);
     }
 
-    int AllNErrs[3];
-    AllNErrs[0] = NErrs[0]; AllNErrs[1] = NErrs[1]; AllNErrs[2] = NErrs[2];
-
-    if (AllNErrs[0] > 0 || AllNErrs[1] > 0 || AllNErrs[2] > 0)
-    {
-        stringstream ss;
-        ss << "Experienced " << AllNErrs[0] << " I/O error(s), " <<
-           AllNErrs[1] << " CRC error(s) and " << AllNErrs[2] <<
-           " decompression CRC error(s) reading: " << OpenFileName;
-        throw runtime_error(ss.str());
-    }
+    // The ranks' ids are read in parallel, each to its own entries.
+    uint64_t NEntries = RankStart[NRanks];
+    vector<int64_t> Ids(NEntries);
+    vector<uint64_t> Locs(NEntries);
+    uint64_t TotalReadSize = 0;
+    string Error;
 
-  #ifndef GENERICIO_NO_MPI
-    double EndTime = MPI_Wtime();
-  #else
-    double EndTime = double(clock()) / CLOCKS_PER_SEC;
-  #endif
+    #ifdef _OPENMP
+    #pragma omp parallel if(GenericIO::cursorsCanUseThreads() && NRanks > 1) reduction(+:TotalReadSize)
+    #endif
+  {
+        GenericIO Cursor(G);
+        Cursor.makeIndependentCursor();
+        vector<char> Data;
 
-    double TotalTime = EndTime - StartTime;
-    double MaxTotalTime;
-    MaxTotalTime = TotalTime;
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+        #endif
+    for (int r = 0; r < NRanks; ++r) {
+      try {
+                size_t N = RankStart[r+1] - RankStart[r];
+                Data.resize(N * IdInfo.Size + Cursor.requestedExtraSpace());
+                Cursor.clearVariables();
+                Cursor.addVariable(IdInfo, &Data[0], true);
+
+                int NErrs[3] = { 0, 0, 0 };
+                Cursor.readDataSection(0, N, r, 0, 0, TotalReadSize, NErrs);
+        if (NErrs[0] > 0 || NErrs[1] > 0 || NErrs[2] > 0) {
+                    stringstream ss;
+                    ss << "Experienced " << NErrs[0] << " I/O error(s), " <<
+                       NErrs[1] << " CRC error(s) and " << NErrs[2] <<
+                       " decompression CRC error(s) reading rank " << r << " of: " << G.OpenFileName;
+                    throw runtime_error(ss.str());
+                }
 
-    uint64_t AllTotalReadSize;
-    AllTotalReadSize = TotalReadSize;
+                int64_t *I = Ids.empty() ? 0 : &Ids[RankStart[r]];
+                uint64_t *L = Locs.empty() ? 0 : &Locs[RankStart[r]];
+                if (IdInfo.Size == 1)
+                    IdInfo.IsSigned ? copyIds<int8_t>(&Data[0], N, r, I, L) :
+                                      copyIds<uint8_t>(&Data[0], N, r, I, L);
+                else if (IdInfo.Size == 2)
+                    IdInfo.IsSigned ? copyIds<int16_t>(&Data[0], N, r, I, L) :
+                                      copyIds<uint16_t>(&Data[0], N, r, I, L);
+                else if (IdInfo.Size == 4)
+                    IdInfo.IsSigned ? copyIds<int32_t>(&Data[0], N, r, I, L) :
+                                      copyIds<uint32_t>(&Data[0], N, r, I, L);
+                else
+                    copyIds<int64_t>(&Data[0], N, r, I, L);
+      } catch (std::exception &e) {
+                #ifdef _OPENMP
+                #pragma omp critical
+                #endif
+                Error = e.what();
+            }
+        }
+    }
 
-    if (Rank == 0 && PrintStats)
-    {
-        double Rate = ((double) AllTotalReadSize) / MaxTotalTime / (1024.*1024.);
-        cout << "Read " << Vars.size() << " variables from " << FileName <<
-             " (" << AllTotalReadSize << " bytes) in " << MaxTotalTime << "s: " <<
-             Rate << " MB/s [excluding header read]" << endl;
+    if (!Error.empty())
+        throw runtime_error(Error);
+    G.addBytes(TotalReadSize, NEntries * IdInfo.Size);
+
+    // The entries are sorted by id, and then location (so that the first
+    // entry of an id is its first row).
+    vector<uint64_t> Order(NEntries);
+    for (uint64_t i = 0; i < NEntries; ++i)
+        Order[i] = i;
+  std::sort(Order.begin(), Order.end(), [&](uint64_t A, uint64_t B) {
+        return Ids[A] != Ids[B] ? Ids[A] < Ids[B] : Locs[A] < Locs[B];
+    });
+
+    uint64_t NBlocks = (NEntries + BlockEntries - 1) / BlockEntries;
+    uint64_t BloomWords = std::max((uint64_t) 1, (BlockEntries * IdIndexBloomBits + 63) / 64);
+    vector<int64_t> Ranges(2 * NBlocks);
+    vector<uint64_t> Blooms(NBlocks * BloomWords, 0);
+    vector<uint64_t> Entries(2 * NEntries);
+  for (uint64_t i = 0; i < NEntries; ++i) {
+        uint64_t b = i / BlockEntries;
+        int64_t Id = Ids[Order[i]];
+        if (i % BlockEntries == 0)
+            Ranges[2*b] = Id;
+        Ranges[2*b + 1] = Id;
+        setIdBloom(&Blooms[b * BloomWords], BloomWords, IdIndexBloomHashes, Id);
+
+        Entries[2*i] = (uint64_t) Id;
+        Entries[2*i + 1] = Locs[Order[i]];
     }
-}
 
+    uint64_t Header[IdIndexHeaderWords] = {
+        IdIndexByteOrder, IdIndexVersion, (uint64_t) NRanks, NEntries,
+        BlockEntries, BloomWords, IdIndexBloomHashes, NBlocks,
+        Stamp[0], Stamp[1], Stamp[2], Stamp[3]
+    };
 
-void GenericIO::readDataSectionNoMPIBarrier(size_t readOffset, size_t readNumRows, int EffRank, size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3])
-{
-    if (FH.isBigEndian())
-        readDataSectionNoMPIBarrier<true>(readOffset, readNumRows, EffRank, RowOffset, Rank, TotalReadSize, NErrs);
-    else
-        readDataSectionNoMPIBarrier<false>(readOffset, readNumRows, EffRank, RowOffset, Rank, TotalReadSize, NErrs);
+    ofstream Out(IndexName.c_str(), ios::binary | ios::trunc);
+    Out.write(IdIndexMagic, 8);
+    Out.write((const char *) Header, sizeof(Header));
+    Out.write((const char *) Ranges.data(), Ranges.size() * sizeof(int64_t));
+    Out.write((const char *) Blooms.data(), Blooms.size() * sizeof(uint64_t));
+    Out.write((const char *) Entries.data(), Entries.size() * sizeof(uint64_t));
+    Out.close();
+    if (!Out)
+        throw runtime_error("Unable to write the id index: " + IndexName);
 }
 
+IdIndex::IdIndex(GenericIO &G, const string &Name)
+    : GIO(G), IndexName(Name.empty() ? defaultIndexName(G.FileName) : Name), FD(-1),
+      Swap(false), BlockReads(0), BloomRejects(0) {
+    FD = open(IndexName.c_str(), O_RDONLY);
+    if (FD == -1)
+        throw runtime_error("Unable to open the id index: " + IndexName + ": " + strerror(errno));
 
-template <bool IsBigEndian>
-void GenericIO::readDataSectionNoMPIBarrier(size_t readOffset, size_t readNumRows, int EffRank, size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3])
-{
-    openAndReadHeader(Redistributing ? MismatchRedistribute : MismatchAllowed, EffRank, false);
+  try {
+        // The version is checked before the rest of the header is read, as
+        // older headers are shorter.
+        char Magic[8];
+        uint64_t Header[IdIndexHeaderWords];
+        readFully(Magic, 8, 0);
+        readFully(Header, 2 * sizeof(uint64_t), 8);
+
+        Swap = Header[0] != IdIndexByteOrder;
+    if (Swap)
+            for (int i = 0; i < 2; ++i)
+                bswap(&Header[i], sizeof(uint64_t));
+
+        if (string(Magic, 8) != string(IdIndexMagic, 8) || Header[0] != IdIndexByteOrder)
+            throw runtime_error("Not an id index: " + IndexName);
+    if (Header[1] != IdIndexVersion) {
+            stringstream ss;
+            ss << "Unsupported id index version " << Header[1] << " (rebuild it): " << IndexName;
+            throw runtime_error(ss.str());
+        }
 
-    assert(FH.getHeaderCache().size() && "HeaderCache must not be empty");
+        readFully(Header + 2, sizeof(Header) - 2 * sizeof(uint64_t), 8 + 2 * sizeof(uint64_t));
+    if (Swap)
+            for (int i = 2; i < IdIndexHeaderWords; ++i)
+                bswap(&Header[i], sizeof(uint64_t));
+
+        // The index must describe this file: its shape, and its stamp, so
+        // that an index of another file of the same shape, or of this file
+        // before it was rewritten, is not used.
+        uint64_t Stamp[4];
+        getIdIndexStamp(GIO.FileName, GIO.OpenStep, Stamp);
+        uint64_t NRows = 0;
+        for (int r = 0; r < GIO.readNRanks(); ++r)
+            NRows += GIO.readNumElems(r);
+        if (Header[2] != (uint64_t) GIO.readNRanks() || Header[3] != NRows ||
+            !std::equal(Stamp, Stamp + 4, Header + 8))
+            throw runtime_error("The id index " + IndexName + " does not match: " + GIO.FileName);
+
+        NEntries = Header[3];
+        BlockEntries = Header[4];
+        BloomWords = Header[5];
+        BloomHashes = Header[6];
+        uint64_t NBlocks = Header[7];
+        if (BlockEntries == 0 || BloomWords == 0 || NBlocks != (NEntries + BlockEntries - 1) / BlockEntries)
+            throw runtime_error("The id index is corrupt: " + IndexName);
+
+        uint64_t Offset = 8 + sizeof(Header);
+        vector<int64_t> Ranges(2 * NBlocks);
+        readFully(Ranges.data(), Ranges.size() * sizeof(int64_t), Offset);
+        Offset += Ranges.size() * sizeof(int64_t);
+
+        Blooms.resize(NBlocks * BloomWords);
+        readFully(Blooms.data(), Blooms.size() * sizeof(uint64_t), Offset);
+        Offset += Blooms.size() * sizeof(uint64_t);
+        EntriesOffset = Offset;
+
+    if (Swap) {
+            for (size_t i = 0; i < Ranges.size(); ++i)
+                bswap(&Ranges[i], sizeof(int64_t));
+            for (size_t i = 0; i < Blooms.size(); ++i)
+                bswap(&Blooms[i], sizeof(uint64_t));
+        }
 
-    if (EffRank == -1)
-        EffRank = Rank;
+    for (uint64_t b = 0; b < NBlocks; ++b) {
+            BlockMin.push_back(Ranges[2*b]);
+            BlockMax.push_back(Ranges[2*b + 1]);
+        }
+  } catch (...) {
+        close(FD);
+        throw;
+    }
+}
 
-    GlobalHeader<IsBigEndian> *GH = (GlobalHeader<IsBigEndian> *) &FH.getHeaderCache()[0];
-    size_t RankIndex = getRankIndex<IsBigEndian>(EffRank, GH, RankMap, FH.getHeaderCache());
+IdIndex::~IdIndex() {
+    close(FD);
+}
 
-    assert(RankIndex < GH->NRanks && "Invalid rank specified");
+void IdIndex::readFully(void *Buf, size_t Count, uint64_t Offset) {
+  while (Count > 0) {
+        ssize_t N = pread(FD, Buf, Count, Offset);
+    if (N == -1 && errno == EINTR)
+            continue;
+        if (N <= 0)
+            throw runtime_error("Unable to read the id index: " + IndexName +
+                                (N == 0 ? string(": truncated") : ": " + string(strerror(errno))));
+
+        Buf = (char *) Buf + N;
+        Count -= N;
+        Offset += N;
+    }
+}
 
-    RankHeader<IsBigEndian> *RH = (RankHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->RanksStart +
-                                  RankIndex * GH->RanksSize];
+bool IdIndex::mayContain(size_t Block, int64_t Id) const {
+    return testIdBloom(&Blooms[Block * BloomWords], BloomWords, BloomHashes, Id);
+}
 
-    for (size_t i = 0; i < Vars.size(); ++i)
-    {
-        uint64_t Offset = RH->Start;
-        bool VarFound = false;
-        for (uint64_t j = 0; j < GH->NVars; ++j)
-        {
-            VariableHeader<IsBigEndian> *VH = (VariableHeader<IsBigEndian> *) &FH.getHeaderCache()[GH->VarsStart + j * GH->VarsSize];
+// The ids are looked up in sorted order, so that each block is read (once)
+// for all of the ids that need it.
+void IdIndex::lookup(const vector<int64_t> &Ids, vector<Location> &Locs) {
+    Location NotFound = { -1, 0 };
+    Locs.assign(Ids.size(), NotFound);
+
+    vector< pair<uint64_t, size_t> > BlockIds;
+  for (size_t q = 0; q < Ids.size(); ++q) {
+        // The first entry of an id is in the first block ending at or after it.
+        uint64_t b = std::lower_bound(BlockMax.begin(), BlockMax.end(), Ids[q]) - BlockMax.begin();
+        if (b == BlockMax.size() || BlockMin[b] > Ids[q])
+            continue;
+
+    if (!mayContain(b, Ids[q])) {
+            ++BloomRejects;
+            continue;
+        }
 
-            string VName(VH->Name, VH->Name + NameSize);
-            size_t VNameNull = VName.find('\0');
-            if (VNameNull < NameSize)
-                VName.resize(VNameNull);
+        BlockIds.push_back(std::make_pair(b, q));
+    }
 
-            uint64_t ReadSize = RH->NElems * VH->Size + CRCSize;
-            if (VName != Vars[i].Name)
-            {
-                Offset += ReadSize;
-                continue;
+    std::sort(BlockIds.begin(), BlockIds.end());
+
+    vector<uint64_t> Entries;
+  for (size_t i = 0; i < BlockIds.size(); ) {
+        uint64_t b = BlockIds[i].first;
+        uint64_t N = std::min(BlockEntries, NEntries - b * BlockEntries);
+        Entries.resize(2 * N);
+        readFully(&Entries[0], Entries.size() * sizeof(uint64_t),
+                  EntriesOffset + 2 * b * BlockEntries * sizeof(uint64_t));
+        ++BlockReads;
+
+        if (Swap)
+            for (size_t e = 0; e < Entries.size(); ++e)
+                bswap(&Entries[e], sizeof(uint64_t));
+
+    for (; i < BlockIds.size() && BlockIds[i].first == b; ++i) {
+            size_t q = BlockIds[i].second;
+            uint64_t Lo = 0, Hi = N;
+      while (Lo < Hi) {
+                uint64_t Mid = (Lo + Hi) / 2;
+                if ((int64_t) Entries[2*Mid] < Ids[q])
+                    Lo = Mid + 1;
+                else
+                    Hi = Mid;
             }
 
-            VarFound = true;
-            bool IsFloat = (bool) (VH->Flags & FloatValue), IsSigned = (bool) (VH->Flags & SignedValue);
-            if (VH->Size != Vars[i].Size)
-            {
-                stringstream ss;
-                ss << "Size mismatch for variable " << Vars[i].Name <<
-                   " in: " << OpenFileName << ": current: " << Vars[i].Size <<
-                   ", file: " << VH->Size;
-                throw runtime_error(ss.str());
-            }
-            else if (IsFloat != Vars[i].IsFloat)
-            {
-                string Float("float"), Int("integer");
-                stringstream ss;
-                ss << "Type mismatch for variable " << Vars[i].Name <<
-                   " in: " << OpenFileName << ": current: " <<
-                   (Vars[i].IsFloat ? Float : Int) <<
-                   ", file: " << (IsFloat ? Float : Int);
-                throw runtime_error(ss.str());
-            }
-            else if (IsSigned != Vars[i].IsSigned)
-            {
-                string Signed("signed"), Uns("unsigned");
-                stringstream ss;
-                ss << "Type mismatch for variable " << Vars[i].Name <<
-                   " in: " << OpenFileName << ": current: " <<
-                   (Vars[i].IsSigned ? Signed : Uns) <<
-                   ", file: " << (IsSigned ? Signed : Uns);
-                throw runtime_error(ss.str());
+      if (Lo < N && (int64_t) Entries[2*Lo] == Ids[q]) {
+                uint64_t L = Entries[2*Lo + 1];
+                Locs[q].Rank = (int) (L >> (64 - IdIndexRankBits));
+                Locs[q].Row = L & (((uint64_t) 1 << (64 - IdIndexRankBits)) - 1);
             }
+        }
+    }
+}
 
-            size_t VarOffset = RowOffset * Vars[i].Size;
-            void *VarData = ((char *) Vars[i].Data) + VarOffset;
+// Groups the rows of the ids found into runs of nearby rows of a rank.
+void IdIndex::planRead(const vector<int64_t> &Ids, vector<IdRun> &Runs,
+                       vector<Location> &Locs) {
+  if (!PlannedIds.empty() && PlannedIds == Ids) {
+        Runs = PlannedRuns;
+        Locs = PlannedLocs;
+        return;
+    }
 
-            vector<unsigned char> LData;
-            void *Data = VarData;
-            bool HasExtraSpace = Vars[i].HasExtraSpace;
-            if (offsetof_safe(GH, BlocksStart) < GH->GlobalHeaderSize && GH->BlocksSize > 0)
-            {
-                BlockHeader<IsBigEndian> *BH = (BlockHeader<IsBigEndian> *)
-                                               &FH.getHeaderCache()[GH->BlocksStart +
-                                                       (RankIndex * GH->NVars + j) * GH->BlocksSize];
+    vector<Location> Found;
+    lookup(Ids, Found);
+
+    vector< pair<int, uint64_t> > Rows;
+    for (size_t q = 0; q < Found.size(); ++q)
+        if (Found[q].Rank != -1)
+            Rows.push_back(std::make_pair(Found[q].Rank, Found[q].Row));
+    std::sort(Rows.begin(), Rows.end());
+    Rows.erase(std::unique(Rows.begin(), Rows.end()), Rows.end());
+
+    Runs.clear();
+    Locs.clear();
+  for (size_t i = 0; i < Rows.size(); ++i) {
+        Location L = { Rows[i].first, Rows[i].second };
+        Locs.push_back(L);
+
+        if (Runs.empty() || Runs.back().Rank != L.Rank ||
+            L.Row - (Runs.back().Start + Runs.back().Count) > IdIndexReadGap) {
+            IdRun R;
+            R.Rank = L.Rank;
+            R.Start = L.Row;
+            R.Count = 0;
+            Runs.push_back(R);
+        }
 
-                ReadSize = BH->Size + CRCSize;
-                Offset = BH->Start;
+        Runs.back().Rows.push_back(L.Row - Runs.back().Start);
+        Runs.back().Count = L.Row - Runs.back().Start + 1;
+    }
 
-                if (strncmp(BH->Filters[0], CompressName, FilterNameSize) == 0)
-                {
-                    LData.resize(ReadSize);
-                    Data = &LData[0];
-                    HasExtraSpace = true;
-                }
-                else if (BH->Filters[0][0] != '\0')
-                {
-                    stringstream ss;
-                    ss << "Unknown filter \"" << BH->Filters[0] << "\" on variable " << Vars[i].Name;
-                    throw runtime_error(ss.str());
-                }
-            }
+    PlannedIds = Ids;
+    PlannedRuns = Runs;
+    PlannedLocs = Locs;
+}
 
-            assert(HasExtraSpace && "Extra space required for reading");
+size_t IdIndex::readNumElems(const vector<int64_t> &Ids) {
+    vector<IdRun> Runs;
+    vector<Location> Locs;
+    planRead(Ids, Runs, Locs);
 
-            int Retry = 0;
-            {
-                int RetryCount = 300;
-                const char *EnvStr = getenv("GENERICIO_RETRY_COUNT");
-                if (EnvStr)
-                    RetryCount = atoi(EnvStr);
+    size_t N = 0;
+    for (size_t r = 0; r < Runs.size(); ++r)
+        N += Runs[r].Count;
+    return N;
+}
 
-                int RetrySleep = 100; // ms
-                EnvStr = getenv("GENERICIO_RETRY_SLEEP");
-                if (EnvStr)
-                    RetrySleep = atoi(EnvStr);
+size_t IdIndex::read(const vector<int64_t> &Ids, vector<Location> *Locs) {
+    GenericIO::CallScope Scope(GIO, "readIds");
 
-                for (; Retry < RetryCount; ++Retry)
-                {
-                    try
-                    {
-                        //
-                        // Read section
-                        ReadSize = readNumRows * VH->Size;
-                        Offset = Offset + readOffset * VH->Size;
-                        FH.get()->read(Data, ReadSize, Offset, Vars[i].Name);
+    vector<IdRun> Runs;
+    vector<Location> Found;
+    planRead(Ids, Runs, Found);
 
-                        break;
-                    }
-                    catch (...) { }
+    // As in readRegion, each run is read to its own rows of the variables,
+    // where the rows of the ids are gathered, and the runs are compacted at
+    // the end.
+    vector<size_t> RunOffsets(Runs.size(), 0);
+    for (size_t r = 1; r < Runs.size(); ++r)
+        RunOffsets[r] = RunOffsets[r-1] + Runs[r-1].Count;
 
-                    usleep(1000 * RetrySleep);
-                }
+    vector<GenericIO::Variable> &Vars = GIO.Vars;
+    uint64_t TotalReadSize = 0;
+    int NErrs[3] = { 0, 0, 0 };
+    string Error;
 
-                if (Retry == RetryCount)
-                {
-                    ++NErrs[0];
-                    break;
-                }
-                else if (Retry > 0)
-                {
-                    EnvStr = getenv("GENERICIO_VERBOSE");
-                    if (EnvStr)
-                    {
-                        int Mod = atoi(EnvStr);
-                        if (Mod > 0)
-                        {
-                            int Rank;
-                            #ifndef GENERICIO_NO_MPI
-                            MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
-                            #else
-                            Rank = 0;
-                            #endif
-
-                            std::cerr << "Rank " << Rank << ": " << Retry <<
-                                      " I/O retries were necessary for reading " <<
-                                      Vars[i].Name << " from: " << OpenFileName << "\n";
-
-                            std::cerr.flush();
-                        }
-                    }
-                }
-            }
+    #ifdef _OPENMP
+    #pragma omp parallel if(GenericIO::cursorsCanUseThreads() && Runs.size() > 1) \
+                         reduction(+:TotalReadSize)
+    #endif
+  {
+        GenericIO Cursor(GIO);
+        Cursor.makeIndependentCursor();
 
-            TotalReadSize += ReadSize;
+        int CursorErrs[3] = { 0, 0, 0 };
 
-            // Byte swap the data if necessary.
-            if (IsBigEndian != isBigEndian())
-                for (size_t j = 0; j < RH->NElems; ++j)
-                {
-                    char *Offset = ((char *) VarData) + j * Vars[i].Size;
-                    bswap(Offset, Vars[i].Size);
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic)
+        #endif
+    for (int r = 0; r < (int) Runs.size(); ++r) {
+      try {
+                int RunErrs[3] = { 0, 0, 0 };
+                Cursor.readDataSection(Runs[r].Start, Runs[r].Count, Runs[r].Rank,
+                                       RunOffsets[r], 0, TotalReadSize, RunErrs);
+        if (RunErrs[0] || RunErrs[1] || RunErrs[2]) {
+                    for (int e = 0; e < 3; ++e)
+                        CursorErrs[e] += RunErrs[e];
+                    continue;
                 }
 
-            break;
+                const vector<uint64_t> &Rows = Runs[r].Rows;
+                if (Rows.size() < Runs[r].Count)
+                    for (size_t i = 0; i < Vars.size(); ++i)
+                        for (size_t k = 0; k < Rows.size(); ++k)
+                            moveRows(Vars[i], RunOffsets[r] + Rows[k], 1, RunOffsets[r] + k);
+      } catch (std::exception &e) {
+                #ifdef _OPENMP
+                #pragma omp critical
+                #endif
+                Error = e.what();
+            }
         }
 
-        if (!VarFound)
-            throw runtime_error("Variable " + Vars[i].Name + " not found in: " + OpenFileName);
+        #ifdef _OPENMP
+        #pragma omp critical
+        #endif
+        for (int e = 0; e < 3; ++e)
+            NErrs[e] += CursorErrs[e];
+    }
+
+    if (!Error.empty())
+        throw runtime_error(Error);
+
+    GIO.ReadStats.CRCErrors += NErrs[1];
+    GIO.ReadStats.DecompressionErrors += NErrs[2];
+  if (NErrs[0] > 0 || NErrs[1] > 0 || NErrs[2] > 0) {
+        stringstream ss;
+        ss << "Experienced " << NErrs[0] << " I/O error(s), " <<
+           NErrs[1] << " CRC error(s) and " << NErrs[2] <<
+           " decompression CRC error(s) reading: " << GIO.OpenFileName;
+        throw runtime_error(ss.str());
     }
+
+    size_t Out = 0, RowSize = 0;
+    for (size_t i = 0; i < Vars.size(); ++i)
+        RowSize += Vars[i].Size;
+  for (size_t r = 0; r < Runs.size(); ++r) {
+        if (Out != RunOffsets[r])
+            for (size_t i = 0; i < Vars.size(); ++i)
+                moveRows(Vars[i], RunOffsets[r], Runs[r].Rows.size(), Out);
+        Out += Runs[r].Rows.size();
+    }
+
+    GIO.addBytes(TotalReadSize, Out * RowSize);
+    GIO.NumReadRows = Out;
+    if (Locs)
+        Locs->swap(Found);
+    return Out;
 }
 
 } /* END namespace cosmotk */
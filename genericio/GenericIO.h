@@ -42,11 +42,17 @@
 #ifndef GENERICIO_H
 #define GENERICIO_H
 
+#include <atomic>
 #include <cstdlib>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
 #include <vector>
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <limits>
 #include <stdint.h>
 
@@ -72,18 +78,43 @@ namespace gio
 class GenericFileIO
 {
   public:
+    GenericFileIO() {}
     virtual ~GenericFileIO() {}
 
+  public:
+    // A piece of memory written by writev.
+  struct Segment {
+        Segment(const void *B, size_t C) : Buf(B), Count(C) {}
+
+        const void *Buf;
+        size_t Count;
+    };
+
   public:
     virtual void open(const std::string &FN, bool ForReading = false) = 0;
     virtual void setSize(size_t sz) = 0;
+    virtual size_t getSize() = 0;
     virtual void read(void *buf, size_t count, off_t offset,
                       const std::string &D) = 0;
     virtual void write(const void *buf, size_t count, off_t offset,
                        const std::string &D) = 0;
 
+    // Writes the segments back to back, starting at offset (collective for
+    // the collective backend). Reads have no vectored form: each variable
+    // of a rank is read (and checked, and possibly decompressed) on its own.
+    virtual void writev(const std::vector<Segment> &Segments, off_t offset,
+                        const std::string &D);
+
+    // The bytes transferred by the last read made by the calling thread, also
+    // when it failed part of the way through. This is per thread because
+    // cursors on different threads may share one handle.
+  size_t getReadDone() {
+        return ReadDone;
+    }
+
   protected:
     std::string FileName;
+    static thread_local size_t ReadDone;
 };
 
 #ifndef GENERICIO_NO_MPI
@@ -95,8 +126,11 @@ class GenericFileIO_MPI : public GenericFileIO {
   public:
     virtual void open(const std::string &FN, bool ForReading = false);
     virtual void setSize(size_t sz);
+    virtual size_t getSize();
     virtual void read(void *buf, size_t count, off_t offset, const std::string &D);
     virtual void write(const void *buf, size_t count, off_t offset, const std::string &D);
+    virtual void writev(const std::vector<Segment> &Segments, off_t offset,
+                        const std::string &D);
 
   protected:
     MPI_File FH;
@@ -110,6 +144,8 @@ class GenericFileIO_MPICollective : public GenericFileIO_MPI {
   public:
     void read(void *buf, size_t count, off_t offset, const std::string &D);
     void write(const void *buf, size_t count, off_t offset, const std::string &D);
+    void writev(const std::vector<Segment> &Segments, off_t offset,
+                const std::string &D);
 };
 #endif //GENERICIO_NO_MPI
 
@@ -121,8 +157,13 @@ class GenericFileIO_POSIX : public GenericFileIO {
   public:
     void open(const std::string &FN, bool ForReading = false);
     void setSize(size_t sz);
+    size_t getSize();
     void read(void *buf, size_t count, off_t offset, const std::string &D);
     void write(const void *buf, size_t count, off_t offset, const std::string &D);
+  #ifdef __linux__
+    void writev(const std::vector<Segment> &Segments, off_t offset,
+                const std::string &D);
+  #endif
 
   protected:
     int FH;
@@ -172,6 +213,9 @@ class is_array {
 };
 } // namespace detail
 
+class NeighborQuery;
+class IdIndex;
+
 class GenericIO {
   public:
   enum VariableFlags {
@@ -182,7 +226,9 @@ class GenericIO {
         VarIsPhysCoordX  =  (1 << 1),
         VarIsPhysCoordY  =  (1 << 2),
         VarIsPhysCoordZ  =  (1 << 3),
-        VarMaybePhysGhost = (1 << 4)
+        VarMaybePhysGhost = (1 << 4),
+        VarConvert = (1 << 5) // When reading, convert the values from the
+        // type in the file (see addConvertedVariable).
     };
 
   struct VariableInfo {
@@ -247,8 +293,10 @@ class GenericIO {
               IsPhysCoordX(Flags & VarIsPhysCoordX),
               IsPhysCoordY(Flags & VarIsPhysCoordY),
               IsPhysCoordZ(Flags & VarIsPhysCoordZ),
-        MaybePhysGhost(Flags & VarMaybePhysGhost) {
+        MaybePhysGhost(Flags & VarMaybePhysGhost),
+        Convert(Flags & VarConvert) {
             deduceTypeInfo(D);
+            Stride = Size;
         }
 
         template <typename T>
@@ -258,9 +306,11 @@ class GenericIO {
               IsPhysCoordX(Flags & VarIsPhysCoordX),
               IsPhysCoordY(Flags & VarIsPhysCoordY),
               IsPhysCoordZ(Flags & VarIsPhysCoordZ),
-        MaybePhysGhost(Flags & VarMaybePhysGhost) {
+        MaybePhysGhost(Flags & VarMaybePhysGhost),
+        Convert(Flags & VarConvert) {
             deduceTypeInfoFromElement(D);
             Size = ElementSize * NumElements;
+            Stride = Size;
         }
 
         Variable(const VariableInfo &VI, void *D, unsigned Flags = 0)
@@ -271,7 +321,8 @@ class GenericIO {
               IsPhysCoordY((Flags & VarIsPhysCoordY) || VI.IsPhysCoordY),
               IsPhysCoordZ((Flags & VarIsPhysCoordZ) || VI.IsPhysCoordZ),
               MaybePhysGhost((Flags & VarMaybePhysGhost) || VI.MaybePhysGhost),
-              ElementSize(VI.ElementSize) {}
+              ElementSize(VI.ElementSize), Stride(VI.Size),
+              Convert(Flags & VarConvert) {}
 
         std::string Name;
         std::size_t Size;
@@ -282,6 +333,10 @@ class GenericIO {
         bool IsPhysCoordX, IsPhysCoordY, IsPhysCoordZ;
         bool MaybePhysGhost;
         std::size_t ElementSize;
+        // The bytes from one row to the next in Data (Size unless the rows
+        // are members of a larger structure).
+        std::size_t Stride;
+        bool Convert;
     };
 
   public:
@@ -294,21 +349,35 @@ class GenericIO {
   #ifndef GENERICIO_NO_MPI
     GenericIO(const MPI_Comm &C, const std::string &FN, unsigned FIOT = -1)
         : NElems(0), FileIOType(FIOT == (unsigned) - 1 ? DefaultFileIOType : FIOT),
-          Partition(DefaultPartition), Comm(C), FileName(FN), Redistributing(false),
+          Partition(DefaultPartition), Comm(C), FileName(FN),
+          Redistribution(DefaultRedistribution), Redistributing(false),
           DisableCollErrChecking(false), SplitComm(MPI_COMM_NULL), 
-          hasOctree(false), octreeLeafshuffle(false), numOctreeLevels(0)
+          hasOctree(false), octreeLeafOrder(OctreeLeafSimulation), numOctreeLevels(0),
+          octreeAdaptive(false), octreeMaxLeafParticles(0),
+          Step(0), NSteps(1), OpenStep(0), NumReadRows(0), DecodedBlockCache(false),
+          HeaderPrefetch(DefaultHeaderPrefetch), PrefixFileSize(0),
+          ReadRetry(DefaultReadRetry), CurCall(-1), CurVar(-1),
+          CallRetriesBefore(0), CallStart(0), Tracing(false), DroppedTraceEvents(0)
     {
         std::fill(PhysOrigin, PhysOrigin + 3, 0.0);
         std::fill(PhysScale,  PhysScale + 3, 0.0);
+        std::fill(SpatialDomain, SpatialDomain + 6, 0.0);
     }
   #else
     GenericIO(const std::string &FN, unsigned FIOT = -1)
         : NElems(0), FileIOType(FIOT == (unsigned) - 1 ? DefaultFileIOType : FIOT),
-          Partition(DefaultPartition), FileName(FN), Redistributing(false),
-          DisableCollErrChecking(false), hasOctree(false), octreeLeafshuffle(false), numOctreeLevels(0)
+          Partition(DefaultPartition), FileName(FN),
+          Redistribution(DefaultRedistribution), Redistributing(false),
+          DisableCollErrChecking(false), hasOctree(false), octreeLeafOrder(OctreeLeafSimulation), numOctreeLevels(0),
+          octreeAdaptive(false), octreeMaxLeafParticles(0),
+          Step(0), NSteps(1), OpenStep(0), NumReadRows(0), DecodedBlockCache(false),
+          HeaderPrefetch(DefaultHeaderPrefetch), PrefixFileSize(0),
+          ReadRetry(DefaultReadRetry), CurCall(-1), CurVar(-1),
+          CallRetriesBefore(0), CallStart(0), Tracing(false), DroppedTraceEvents(0)
     {
         std::fill(PhysOrigin, PhysOrigin + 3, 0.0);
         std::fill(PhysScale,  PhysScale + 3, 0.0);
+        std::fill(SpatialDomain, SpatialDomain + 6, 0.0);
     }
   #endif
 
@@ -353,12 +422,48 @@ class GenericIO {
     }
 
 
+    // Order of the particles within an octree leaf: the order they are written
+    // in, randomly shuffled (for sampling by reading a leaf's first rows), or
+    // the Morton order of their positions (so that neighbouring rows are
+    // spatially close, and sub-leaf regions can be read through the index of
+    // the leaves' cells)
+    enum OctreeLeafOrder {
+        OctreeLeafSimulation = GIO_OCTREE_ORDER_SIMULATION,
+        OctreeLeafShuffled = GIO_OCTREE_ORDER_SHUFFLED,
+        OctreeLeafMorton = GIO_OCTREE_ORDER_MORTON
+    };
+
     void useOctree(int _numOctreeLevels, bool _octreeLeafshuffle=true)
+    {
+        useOctree(_numOctreeLevels, _octreeLeafshuffle ? OctreeLeafShuffled : OctreeLeafSimulation);
+    }
+
+    void useOctree(int _numOctreeLevels, OctreeLeafOrder _octreeLeafOrder)
     {
         numOctreeLevels = _numOctreeLevels;
-        octreeLeafshuffle = _octreeLeafshuffle;
+        octreeLeafOrder = _octreeLeafOrder;
         
         hasOctree = true;
+        octreeAdaptive = false;
+    }
+
+
+    // Adaptive octree: leaves are split until they hold at most
+    // _maxParticlesPerLeaf particles or are _maxDepth levels below the rank
+    void useAdaptiveOctree(uint64_t _maxParticlesPerLeaf, int _maxDepth, bool _octreeLeafshuffle=true)
+    {
+        useAdaptiveOctree(_maxParticlesPerLeaf, _maxDepth,
+                          _octreeLeafshuffle ? OctreeLeafShuffled : OctreeLeafSimulation);
+    }
+
+    void useAdaptiveOctree(uint64_t _maxParticlesPerLeaf, int _maxDepth, OctreeLeafOrder _octreeLeafOrder)
+    {
+        numOctreeLevels = _maxDepth;
+        octreeMaxLeafParticles = _maxParticlesPerLeaf;
+        octreeLeafOrder = _octreeLeafOrder;
+
+        hasOctree = true;
+        octreeAdaptive = true;
     }
 
 
@@ -371,6 +476,15 @@ class GenericIO {
 
 
     void addOctreeRow(uint64_t _blockID, uint64_t _extents[6], uint64_t _numParticles, uint64_t _offsetInFile, uint64_t _partitionLocation)
+    {
+        double _doubleExtents[6];
+        for (int i=0; i<6; i++)
+            _doubleExtents[i] = _extents[i];
+
+        addOctreeRow(_blockID, _doubleExtents, _numParticles, _offsetInFile, _partitionLocation);
+    }
+
+    void addOctreeRow(uint64_t _blockID, double _extents[6], uint64_t _numParticles, uint64_t _offsetInFile, uint64_t _partitionLocation)
     {
         GIOOctreeRow temp;
 
@@ -390,6 +504,11 @@ class GenericIO {
     }
 
 
+    // When reading, a single component of a variable of several (e.g. a
+    // float4) can be read by naming it <variable>.<component>, where the
+    // component is x, y, z or w, or its index (e.g. "pos.x" or "pos.0"), into
+    // a variable of its element type. Only that component is read from files
+    // written with transposed variables (see setDefaultTranspose).
     template <typename T>
     void addVariable(const std::string &Name, T *Data,
                    unsigned Flags = 0) {
@@ -408,6 +527,29 @@ class GenericIO {
         Vars.push_back(Variable(VI, Data, Flags));
     }
 
+    // When reading, the values of a variable can be converted from the type
+    // in the file to the type of Data (as by a C++ conversion, between signed,
+    // unsigned and floating-point values of 1, 2, 4 or 8 bytes), and stored
+    // Stride bytes apart (e.g. into a member of an array of structures; zero
+    // means sizeof(T)). The conversion happens as each block is read, so no
+    // extra space is needed. The file must have the same number of values per
+    // row as T (or name a single component).
+    template <typename T>
+    void addConvertedVariable(const std::string &Name, T *Data,
+                            std::size_t Stride = 0, unsigned Flags = 0) {
+        Variable V(Name, Data, Flags | VarConvert);
+        if (Stride)
+            V.Stride = Stride;
+        Vars.push_back(V);
+    }
+
+    template <typename T, typename A>
+    void addConvertedVariable(const std::string &Name,
+                            std::vector<T, A> &Data, unsigned Flags = 0) {
+        T *D = Data.empty() ? 0 : &Data[0];
+        addConvertedVariable(Name, D, 0, Flags);
+    }
+
     template <typename T>
     void addScalarizedVariable(const std::string &Name, T *Data,
                              std::size_t NumElements, unsigned Flags = 0) {
@@ -424,6 +566,12 @@ class GenericIO {
   #ifndef GENERICIO_NO_MPI
     // Writing
     void write();
+
+    // Writes the variables as a new step at the end of a multi-step file. The
+    // file is created if it does not exist, and an existing single-step file
+    // becomes the first step. The steps are listed in an index at the end of
+    // the file, so any step can be opened without scanning the others.
+    void append();
   #endif
 
   enum MismatchBehavior {
@@ -432,10 +580,53 @@ class GenericIO {
         MismatchRedistribute
     };
 
+    // How MismatchRedistribute assigns the file's rows to the readers: whole
+    // file-rank blocks, or an even split of all rows (by row count or by
+    // stored bytes), reading partial blocks at the edges. The row-based modes
+    // apply to single-file outputs read on a different number of ranks; other
+    // reads use whole blocks. Can also be set with GENERICIO_REDISTRIBUTE
+    // (blocks, rows or bytes).
+    //
+    // RedistributeSpatial requires an octree and a 3D Cartesian communicator:
+    // each reader gets exactly the rows whose positions lie inside its
+    // subdomain of the octree's bounding box, reading only the intersecting
+    // leaves (the position variables must be among those read). Since rows in
+    // boundary leaves are filtered, readNumElems() is an upper bound, and
+    // readNumRows() gives the rows stored by readData().
+  enum RedistributionMode {
+        RedistributeBlocks,
+        RedistributeRows,
+        RedistributeBytes,
+        RedistributeSpatial
+    };
+
+  void setRedistributionMode(RedistributionMode M) {
+        Redistribution = M;
+    }
+
+  static void setDefaultRedistributionMode(RedistributionMode M) {
+        DefaultRedistribution = M;
+    }
+
     // Reading
     void openAndReadHeader(MismatchBehavior MB = MismatchDisallowed,
                            int EffRank = -1, bool CheckPartMap = true);
 
+    // Multi-step files: the step opened by openAndReadHeader (0 by default),
+    // and the number of steps in the open file (1 for single-step files).
+    void setStep(int S) {
+        Step = S;
+        Catalog.clear();
+    }
+
+    int getStep() {
+        return Step;
+    }
+
+    int readNSteps() {
+        return (int) NSteps;
+    }
+
     int readNRanks();
     void readDims(int Dims[3]);
 
@@ -452,6 +643,17 @@ class GenericIO {
     void getVariableInfo(std::vector<VariableInfo> &VI);
 
     std::size_t readNumElems(int EffRank = -1);
+
+    // The rows stored by the last readData() call.
+    std::size_t readNumRows() {
+        return NumReadRows;
+    }
+
+    // With spatial redistribution, this reader's subdomain (minX, maxX, minY,
+    // maxY, minZ, maxZ; the outer faces of the global domain are unbounded).
+    void getSpatialDomain(double Domain[6]) {
+        std::copy(SpatialDomain, SpatialDomain + 6, Domain);
+    }
     void readCoords(int Coords[3], int EffRank = -1);
     int readGlobalRankNumber(int EffRank = -1);
 
@@ -466,11 +668,60 @@ class GenericIO {
     void printOctree(){ octreeData.print(); }
 
     void readOctreeHeader(int octreeOffset, int octreeStringSize, bool bigEndian);
+    void readOctreeHeader(const char *octreeSection, size_t octreeStringSize, bool bigEndian);
 
     GIOOctree getOctree(){ return octreeData; }
+
+    // Region reads: reads the rows whose position lies inside Box (minX,
+    // maxX, minY, maxY, minZ, maxZ; closed) into the variables, compacted, and
+    // returns their number (also given by readNumRows()). Only the octree
+    // leaves intersecting the box are read, from several threads; the rows of
+    // leaves on the boundary of the box are filtered on position, so the
+    // (floating-point) position variables must be among those read. With
+    // Periodic, the box wraps around the physical domain (readPhysOrigin(),
+    // readPhysScale()). The leaves of all ranks are read, or only those of
+    // EffRank. Region reads are independent: each rank may read its own box.
+    //
+    // The variables need space for readRegionNumElems() rows, an upper bound
+    // (the rows of all intersecting leaves).
+    std::size_t readRegionNumElems(const double Box[6], bool Periodic = false,
+                                   int EffRank = -1);
+    std::size_t readRegion(const double Box[6], bool Periodic = false,
+                           int EffRank = -1);
+
+    // Streams the rows of the file in batches of bounded size (see below).
+    class Cursor;
     
     void getSourceRanks(std::vector<int> &SR);
 
+    // The rows read from each of the source ranks (all of them, unless a
+    // row-based redistribution mode is used).
+    void getSourceRows(std::vector<uint64_t> &Starts, std::vector<uint64_t> &Counts);
+
+    // Where the block of a global rank lives: its partition (0 for files
+    // which are not partitioned), its index within that partition's file,
+    // and the file offset at which its data starts.
+  struct RankInfo {
+        int Partition;
+        uint64_t Index;
+        uint64_t NElems;
+        uint64_t Start;
+        int Coords[3];
+        int GlobalRank;
+    };
+
+    // Reads the headers of all partitions of a partitioned file at once,
+    // dividing them among the ranks of the communicator (and the threads of
+    // each rank), and merges them into an index of all global ranks. Once it
+    // has been read, readNumElems, readCoords and readGlobalRankNumber no
+    // longer open the partition of the requested rank. Must be called
+    // collectively after openAndReadHeader.
+    void readRankCatalog();
+
+    const std::vector<RankInfo> &getRankCatalog() {
+        return Catalog;
+    }
+
     template <typename T>
     T getValue(int variableID, size_t index)
     {
@@ -501,6 +752,197 @@ class GenericIO {
         DefaultShouldCompress = C;
     }
 
+    // When nonzero, each variable of each rank is written in chunks of this
+    // many rows, each with its own CRC (and compression), so that partial
+    // reads can be verified. Can also be set with GENERICIO_CHUNK_ROWS.
+  static void setDefaultChunkRows(uint64_t R) {
+        DefaultChunkRows = R;
+    }
+
+    // When compressing, integer variables are also tried with the INTPACK
+    // filter (frame-of-reference or zigzag delta coding, bit-packed in blocks
+    // of 256 values), alone and followed by blosc, and the smallest encoding
+    // is kept. Off by default, because older readers cannot read INTPACK
+    // frames; GENERICIO_INTPACK=1 enables it.
+  static void setDefaultIntPack(bool P) {
+        DefaultIntPack = P;
+    }
+
+    // When nonzero (and compressing), a zstd dictionary of up to this many
+    // bytes is trained for each variable from samples of all of the ranks'
+    // blocks, stored once in the header, and tried for every block (and
+    // chunk). This suits files of many small blocks, which compress poorly on
+    // their own. A dictionary is at most 1/32 of its variable's total size,
+    // and small variables (under 32 KB in all) get none. Can also be set with
+    // GENERICIO_DICT_SIZE.
+  static void setDefaultDictionarySize(std::size_t S) {
+        DefaultDictionarySize = S;
+    }
+
+    // When nonzero (and compressing), each variable is compressed with a
+    // single codec chosen per rank by compressing a sample of its data with
+    // each candidate (blosc with byte shuffling and blosclz, blosc with bit
+    // shuffling and lz4, INTPACK, INTPACK followed by blosc, and the trained
+    // dictionary): the one giving the smallest result while compressing at
+    // least this many MB/s is used, and the variable is stored raw when none
+    // does, or when the best saves less than 5%. The choice is kept for the
+    // variable's next 15 writes by this process. Can also be set with
+    // GENERICIO_ADAPTIVE.
+  static void setDefaultAdaptiveCompression(double MinMBps) {
+        DefaultAdaptiveCompression = MinMBps;
+    }
+
+    // When set, each variable of several components (e.g. a float4, or a
+    // struct whose first member is x) is stored transposed: each component as
+    // a separate stream of its own chunks (see setDefaultChunkRows; one chunk
+    // otherwise), each compressed (when compressing) on its own. Readers
+    // re-interleave the components, or read just one of them. Can also be set
+    // with GENERICIO_TRANSPOSE.
+  static void setDefaultTranspose(bool T) {
+        DefaultTranspose = T;
+    }
+
+    // When opening a file, its first bytes (this many, or the whole file if
+    // smaller) are fetched with a single read, and the header is taken from
+    // them when it fits. Zero reads just the global header first. Can also
+    // be set with GENERICIO_HEADER_PREFETCH.
+  void setHeaderPrefetch(std::size_t S) {
+        HeaderPrefetch = S;
+    }
+
+  static void setDefaultHeaderPrefetch(std::size_t S) {
+        DefaultHeaderPrefetch = S;
+    }
+
+    // How failed data reads are retried. The wait before each retry starts
+    // at InitialDelay seconds and grows by a factor of Backoff up to MaxDelay,
+    // randomized by up to +/- Jitter of itself so that ranks which failed
+    // together do not retry together. A read is given up on after MaxRetries
+    // retries or, if nonzero, Deadline seconds after its first attempt. The
+    // default deadline keeps the old worst case of 300 retries 0.1 s apart.
+    // Can also be set with GENERICIO_RETRY_COUNT, GENERICIO_RETRY_SLEEP (the
+    // initial delay, in ms) and GENERICIO_RETRY_DEADLINE (in seconds).
+  struct RetryPolicy {
+    RetryPolicy()
+        : MaxRetries(300), InitialDelay(0.1), MaxDelay(10), Backoff(2),
+          Jitter(0.5), Deadline(30) {}
+
+        int MaxRetries;
+        double InitialDelay, MaxDelay, Backoff, Jitter, Deadline;
+    };
+
+  void setRetryPolicy(const RetryPolicy &P) {
+        ReadRetry = P;
+    }
+
+  static void setDefaultRetryPolicy(const RetryPolicy &P) {
+        DefaultReadRetry = P;
+    }
+
+    // Counts of this object's data reads and of their transient errors.
+  struct IOStats {
+    IOStats()
+        : Reads(0), Retries(0), RetriedBytes(0), FailedReads(0),
+          CRCErrors(0), DecompressionErrors(0), RetryWait(0) {}
+
+        uint64_t Reads;         // read requests, not counting retries
+        uint64_t Retries;
+        uint64_t RetriedBytes;  // bytes requested again by retries
+        uint64_t FailedReads;   // reads given up on
+        uint64_t CRCErrors, DecompressionErrors;
+        double RetryWait;       // seconds spent waiting to retry
+    };
+
+  const IOStats &getIOStats() {
+        return ReadStats;
+    }
+
+  void resetIOStats() {
+        ReadStats = IOStats();
+    }
+
+    // The stages of a call whose time is accounted separately.
+  enum StatPhase {
+        StatIO,
+        StatCRC,
+        StatCompress,
+        StatDecompress,
+        StatByteSwap,
+        StatOctree,
+        StatHeader,
+        StatBarrier,
+        NumStatPhases
+    };
+
+    static const char *getStatPhaseName(StatPhase P);
+
+    // The bytes of one variable in one call, as stored in the file (with
+    // their CRCs, possibly compressed) and in memory, and the time spent on
+    // it in each phase.
+  struct VariableStats {
+        std::string Name;
+        uint64_t FileBytes, RawBytes;
+        double Time[NumStatPhases];
+    };
+
+    // The write, append, readData, readDataSection or (standalone)
+    // openAndReadHeader calls of one name on this object, or, when tracing,
+    // one such call. Start is the wall-clock time (MPI_Wtime, when available)
+    // at which the first of them started; the times and counts are summed.
+    // Traced is set for the record of a single traced call.
+  struct CallStats {
+        std::string Call;
+        bool Traced;
+        double Start, TotalTime;
+        uint64_t FileBytes, RawBytes;
+        uint64_t Retries;
+        double Time[NumStatPhases];
+        std::vector<VariableStats> Vars;
+    };
+
+    // The statistics of the calls made so far, in the order first made. Only
+    // traced calls get a record each, so that the log of a long-running
+    // reader stays bounded.
+  const std::vector<CallStats> &getCallStats() {
+        return CallLog;
+    }
+
+  void clearCallStats() {
+        CallLog.clear();
+        TraceEvents.clear();
+        DroppedTraceEvents = 0;
+    }
+
+    // The minimum, maximum (and the rank which had it) and mean over the
+    // ranks of the communicator of the totals of the recorded calls: the time
+    // in each phase, followed by the total time. Bytes and retries are
+    // summed. Must be called collectively.
+  struct ReducedStats {
+        double Min[NumStatPhases + 1], Max[NumStatPhases + 1], Mean[NumStatPhases + 1];
+        int MaxRank[NumStatPhases + 1];
+        uint64_t FileBytes, RawBytes, Retries;
+    };
+
+    void reduceCallStats(ReducedStats &RS);
+
+    // When tracing (which can also be enabled with GENERICIO_TRACE), each
+    // timed phase is also kept as an event, and writeTrace writes the events
+    // of all ranks, one process per rank, to a single Chrome trace (JSON)
+    // file for chrome://tracing or Perfetto. Must be called collectively.
+  void setTracing(bool T) {
+        Tracing = T;
+    }
+
+    // Tracing keeps at most this many events per object (the default can
+    // also be set with GENERICIO_TRACE_EVENTS); once they are used up, calls
+    // are again accumulated by name, and the phases which could not be kept
+    // are counted, per rank, in the trace.
+  static void setMaxTraceEvents(std::size_t N) {
+        MaxTraceEvents = N;
+    }
+
+    void writeTrace(const std::string &TraceFileName);
+
   #ifndef GENERICIO_NO_MPI
   static void setCollectiveMPIIOThreshold(std::size_t T) {
       #ifndef GENERICIO_NO_NEVER_USE_COLLECTIVE_IO
@@ -510,18 +952,97 @@ class GenericIO {
   #endif
 
   private:
+    friend class NeighborQuery;
+    friend class IdIndex;
+
     // Implementation functions templated on the Endianness of the underlying
     // data.
 
   #ifndef GENERICIO_NO_MPI
     template <bool IsBigEndian>
-    void write();
+    void write(bool Append = false);
   #endif
 
     template <bool IsBigEndian>
     void readHeaderLeader(void *GHPtr, MismatchBehavior MB, int Rank, int NRanks,
                           int SplitNRanks, std::string &LocalFileName,
-                          uint64_t &HeaderSize, std::vector<char> &Header);
+                          uint64_t &HeaderSize, std::vector<char> &Header,
+                          uint64_t HeaderStart = 0);
+
+    template <bool IsBigEndian>
+    uint64_t readStepHeaderStart(const std::string &LocalFileName, const void *GHPtr);
+
+    template <bool IsBigEndian>
+    void loadDictionaries();
+
+    void fetchHeaderPrefix(const std::string &LocalFileName);
+
+    // Call statistics: a call is recorded from beginCall to endCall (nested
+    // calls are part of the outermost one), and phases are accounted to the
+    // current call and, if any, the current variable.
+    void beginCall(const char *Call);
+    void endCall();
+    void beginVariable(const std::string &Name);
+    void endVariable() {
+        CurVar = -1;
+    }
+    void addPhase(StatPhase P, double Start);
+    void addBytes(uint64_t FileBytes, uint64_t RawBytes);
+
+  class CallScope {
+      public:
+    CallScope(GenericIO &G, const char *Call) : GIO(G), Own(G.CurCall < 0) {
+            if (Own)
+                GIO.beginCall(Call);
+        }
+
+    ~CallScope() {
+            if (Own)
+                GIO.endCall();
+        }
+
+      private:
+        GenericIO &GIO;
+        bool Own;
+    };
+    RetryPolicy getRetryPolicy();
+    bool readRetrying(void *Buf, std::size_t Count, uint64_t Offset,
+                      const std::string &D);
+    void readThroughPrefix(void *Buf, std::size_t Count, uint64_t Offset,
+                           const std::string &D);
+    template <bool IsBigEndian>
+    bool readChunkedRetrying(uint64_t Var, uint64_t BlockStart, uint64_t NElems,
+                             std::size_t RowSize, std::size_t NComps, int Comp,
+                             uint64_t FirstRow, uint64_t NRows, void *Dest,
+                             const std::string &Name, uint64_t &ReadSize, int &Err);
+
+    template <bool IsBigEndian>
+    void planSpatialRedistribution(std::vector<char> &Header,
+                                   const std::string &LocalFileName);
+
+    void filterSpatialRows(size_t RowOffset, size_t NRows, size_t &NKept);
+
+    void getPositionVars(int PosVar[3], const std::string &Error);
+
+    // Contiguous rows of one rank, from adjacent leaves selected by a region
+    // read; runs including leaves on the boundary of the region are filtered.
+  struct RegionRun {
+        int Rank;
+        uint64_t Start, Count;
+        bool Filtered;
+    };
+
+    void makeIndependentCursor();
+    static bool cursorsCanUseThreads();
+
+    void planRegion(const double Box[6], bool Periodic, int EffRank,
+                    std::vector<double> &Boxes, std::vector<RegionRun> &Runs);
+    static void regionOverlap(const double Ext[6], const std::vector<double> &Boxes,
+                              double Pad, bool &Overlaps, bool &Inside);
+    static void addRegionRun(std::vector<RegionRun> &Runs, int Rank, uint64_t Start,
+                             uint64_t Count, bool Filtered);
+    void filterRegionRows(const int PosVar[3], size_t RowOffset, size_t NRows,
+                          const std::vector<double> &Boxes, size_t &NKept);
 
     template <bool IsBigEndian>
     int readNRanks();
@@ -562,6 +1083,14 @@ class GenericIO {
     void readDataSection(size_t readOffset, size_t readNumRows, int EffRank, 
                          size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3]);
 
+    // The memory needed to read sections of the given variables of a rank
+    // with the decoded-block cache: its compressed blocks (those not
+    // chunked), decompressed, and the largest of them as read.
+    uint64_t readDecodedBlockBytes(const std::vector<VariableInfo> &Columns, int EffRank);
+
+    template <bool IsBigEndian>
+    uint64_t readDecodedBlockBytes(const std::vector<VariableInfo> &Columns, int EffRank);
+
     
     void readDataSectionNoMPIBarrier(size_t readOffset, size_t readNumRows, int EffRank, 
                                      size_t RowOffset, int Rank, uint64_t &TotalReadSize, int NErrs[3]);
@@ -579,8 +1108,10 @@ class GenericIO {
     // Octree Data
     GIOOctree octreeData;
     bool hasOctree;         
-    bool octreeLeafshuffle;     // shuffle paticles in a leaf
-    int numOctreeLevels;        // num octree leaves = 8^numOctreeLevels
+    OctreeLeafOrder octreeLeafOrder;    // order of the paticles in a leaf
+    int numOctreeLevels;        // num octree leaves = 8^numOctreeLevels (max depth when adaptive)
+    bool octreeAdaptive;        // split leaves by particle count instead of uniformly
+    uint64_t octreeMaxLeafParticles;
 
     std::size_t NElems;
 
@@ -596,14 +1127,32 @@ class GenericIO {
     static unsigned DefaultFileIOType;
     static int DefaultPartition;
     static bool DefaultShouldCompress;
+    static uint64_t DefaultChunkRows;
+    static bool DefaultIntPack;
+    static std::size_t DefaultDictionarySize;
+    static double DefaultAdaptiveCompression;
+    static bool DefaultTranspose;
+    static RedistributionMode DefaultRedistribution;
+    static std::size_t DefaultHeaderPrefetch;
+    static std::size_t MaxTraceEvents;
+    static RetryPolicy DefaultReadRetry;
 
   #ifndef GENERICIO_NO_MPI
     static std::size_t CollectiveMPIIOThreshold;
   #endif
 
+    RedistributionMode Redistribution;
+
     // When redistributing, the rank blocks which this process should read.
     bool Redistributing, DisableCollErrChecking;
     std::vector<int> SourceRanks;
+    // With row-based redistribution, the row range read from each source rank
+    // (empty otherwise).
+    std::vector<uint64_t> SourceRowStarts, SourceRowCounts;
+    // With spatial redistribution, whether the rows read from each source need
+    // to be filtered by position, and this reader's subdomain.
+    std::vector<char> SourceRowsFiltered;
+    double SpatialDomain[6];
 
     std::vector<int> RankMap;
   #ifndef GENERICIO_NO_MPI
@@ -611,9 +1160,65 @@ class GenericIO {
   #endif
     std::string OpenFileName;
 
+    // Multi-step files
+    int Step;
+    uint64_t NSteps;
+    int OpenStep;
+
+    // Rows stored by the last readData
+    std::size_t NumReadRows;
+
+    // With DecodedBlockCache (used by cursors, which read the rows of a block
+    // in several sections), the last compressed block of each file variable
+    // that was read whole is kept decompressed, by the file and offset of
+    // the block, so that it is decompressed only once.
+  struct DecodedBlock {
+        std::string FileName;
+        uint64_t Offset;
+        std::vector<unsigned char> Rows;
+    };
+
+    bool DecodedBlockCache;
+    std::vector<DecodedBlock> DecodedBlocks;
+
+    // All global ranks, indexed by global rank, once readRankCatalog has
+    // been called (empty otherwise).
+    std::vector<RankInfo> Catalog;
+
+    // The speculatively-read start of the last file whose header this process
+    // read (see setHeaderPrefetch), that file's size and, if it has steps,
+    // the end of the file read for the step index.
+    std::size_t HeaderPrefetch;
+    std::string PrefixFileName;
+    uint64_t PrefixFileSize;
+    std::vector<char> HeaderPrefix;
+    std::vector<char> HeaderTail;
+
+    RetryPolicy ReadRetry;
+    IOStats ReadStats;
+
+    std::vector<CallStats> CallLog;
+    int CurCall, CurVar;
+    uint64_t CallRetriesBefore;
+    double CallStart;
+
+  struct TraceEvent {
+        int Call, Var;
+        StatPhase Phase;
+        double Start, Time;
+    };
+
+    bool Tracing;
+    std::vector<TraceEvent> TraceEvents;
+    uint64_t DroppedTraceEvents;
+
+    bool traceFull() const;
+
     // This reference counting mechanism allows the the GenericIO class
     // to be used in a cursor mode. To do this, make a copy of the class
-    // after reading the header but prior to adding the variables.
+    // after reading the header but prior to adding the variables. Each copy
+    // may then read on its own thread; the copies share the file handle and
+    // the header cache, which are not modified after the header read.
   struct FHManager {
     FHManager() : CountedFH(0) {
             allocate();
@@ -621,7 +1226,8 @@ class GenericIO {
 
     FHManager(const FHManager& F) {
             CountedFH = F.CountedFH;
-            CountedFH->Cnt += 1;
+            if (CountedFH)
+                CountedFH->Cnt += 1;
         }
 
     ~FHManager() {
@@ -642,6 +1248,13 @@ class GenericIO {
             return CountedFH->HeaderCache;
         }
 
+    std::vector<std::shared_ptr<void> > &getDictionaries() {
+            if (!CountedFH)
+                allocate();
+
+            return CountedFH->Dicts;
+        }
+
     bool isBigEndian() {
             return CountedFH ? CountedFH->IsBigEndian : false;
         }
@@ -656,10 +1269,8 @@ class GenericIO {
         };
 
     void close() {
-            if (CountedFH && CountedFH->Cnt == 1)
+            if (CountedFH && --CountedFH->Cnt == 0)
                 delete CountedFH;
-            else if (CountedFH)
-                CountedFH->Cnt -= 1;
 
             CountedFH = 0;
         }
@@ -679,17 +1290,293 @@ class GenericIO {
 
           public:
             GenericFileIO *GFIO;
-            size_t Cnt;
+            // Cursors on different threads may copy and release the handle
+            // concurrently.
+            std::atomic<size_t> Cnt;
 
             // Used for reading
             std::vector<char> HeaderCache;
             bool IsBigEndian;
+
+            // The variables' decompression dictionaries (ZSTD_DDict), built
+            // once from the header; null for variables without one.
+            std::vector<std::shared_ptr<void> > Dicts;
         };
 
         FHWCnt *CountedFH;
     } FH;
 };
 
+// Streams the rows of a file (of all of its ranks, or of the leaves of its
+// octree, in leaf order, when it has one) in batches of up to a fixed number
+// of rows, so that files larger than memory can be processed in turn. The
+// batches are sized to fit the memory budget twice: while one is processed,
+// the next is read into the other on a separate thread (when independent
+// cursors can use threads; otherwise it is read by next()). Only the
+// variables named in Columns (all, if empty; a single component can be named
+// as for addVariable) are read. With NParts, the rows are split evenly into
+// NParts contiguous ranges of the stream, of which only part Part is read
+// (e.g. by each rank of a communicator).
+//
+// Compressed blocks which are not chunked can only be decompressed whole; the
+// cursor keeps the block of each column it is reading, so that each is
+// decompressed once, and the largest rank's blocks count against the budget
+// (the batches get the rest). If those blocks alone exceed the budget, a
+// warning is printed and the bound is not kept: only chunked (or
+// uncompressed) files can be streamed in less memory than their largest rank
+// takes.
+//
+// The GenericIO must have read the header; its variables are not used. A
+// MemoryBytes of zero uses the default.
+class GenericIO::Cursor {
+  public:
+    Cursor(GenericIO &G, std::size_t MemoryBytes = 0,
+           const std::vector<std::string> &Columns = std::vector<std::string>(),
+           int Part = 0, int NParts = 1);
+    ~Cursor();
+
+    // Makes the next batch current, and returns false once all rows have
+    // been read.
+    bool next();
+
+    // The rows of the current batch, and the position of its first row in
+    // the stream (over all parts).
+    std::size_t getNumRows() const {
+        return Batches[Cur].NRows;
+    }
+
+    uint64_t getFirstRow() const {
+        return Batches[Cur].FirstRow;
+    }
+
+    // The most rows of a batch, and the rows of this part.
+    std::size_t getBatchRows() const {
+        return BatchRows;
+    }
+
+    uint64_t getNumPartRows() const {
+        return PartEnd - PartBegin;
+    }
+
+    const std::vector<VariableInfo> &getColumns() const {
+        return Columns;
+    }
+
+    // The index of the column of the given name, or -1.
+    int findColumn(const std::string &Name) const;
+
+    // The current batch's values of a column, valid until the next call to
+    // next().
+    const void *getData(std::size_t Column) const {
+        return &Batches[Cur].Data[Column][0];
+    }
+
+    template <typename T>
+    const T *getData(const std::string &Name) const {
+        int C = findColumn(Name);
+        if (C == -1)
+            throw std::runtime_error("Variable " + Name + " is not read by the cursor");
+        return (const T *) getData(C);
+    }
+
+    // Used by cursors constructed with no memory bound; can also be set with
+    // GENERICIO_CURSOR_MEMORY (in bytes).
+  static void setDefaultMemoryBytes(std::size_t B) {
+        DefaultMemoryBytes = B;
+    }
+
+  private:
+    Cursor(const Cursor &);
+    Cursor &operator=(const Cursor &);
+
+  struct Batch {
+        std::vector< std::vector<char> > Data;
+        std::size_t NRows;
+        uint64_t FirstRow, FileBytes;
+    };
+
+    void startRead();
+    void readBatch(Batch &B);
+
+    GenericIO &GIO;
+    // Reads the batches, independently of GIO.
+    GenericIO Reader;
+    std::vector<VariableInfo> Columns;
+
+    // The runs of rows (of a rank each) streamed, and the position of each
+    // run's first row in the stream.
+    std::vector<RegionRun> Runs;
+    std::vector<uint64_t> RunFirst;
+    uint64_t PartBegin, PartEnd, NextRow;
+    std::size_t BatchRows;
+
+    Batch Batches[2];
+    int Cur;
+    bool Queued;
+    std::future<void> Pending;
+
+    static std::size_t DefaultMemoryBytes;
+};
+
+// Batched radius and k-nearest-neighbour queries over a file with an octree.
+// The query points of a batch are grouped by the leaves they need, each leaf
+// is read once for all of them (its positions only) and indexed with a
+// uniform grid, and the leaves are searched in parallel. Loaded leaves are
+// kept in an LRU cache, bounded in bytes, so that later batches (and the
+// rounds of a nearest-neighbour batch) share reads.
+//
+// The GenericIO must have read the header; its variables are not used.
+// Neighbours are identified by their rank and row, from which other columns
+// can be read with readDataSection.
+class NeighborQuery {
+  public:
+  struct Neighbor {
+        int Rank;
+        uint64_t Row;
+        double Pos[3];
+        double Distance;
+    };
+
+    NeighborQuery(GenericIO &G, std::size_t CacheBytes = DefaultCacheBytes);
+
+    // For each query point (x, y, z triples), the rows within Radius of it,
+    // nearest first.
+    void radius(const std::vector<double> &Points, double Radius,
+                std::vector< std::vector<Neighbor> > &Result);
+
+    // For each query point, its K nearest rows (all rows, if the file has
+    // fewer), nearest first.
+    void nearest(const std::vector<double> &Points, std::size_t K,
+                 std::vector< std::vector<Neighbor> > &Result);
+
+    // The leaves read, and found in the cache, so far.
+    std::size_t getLeafReads() const {
+        return LeafReads;
+    }
+
+    std::size_t getLeafHits() const {
+        return LeafHits;
+    }
+
+    // Can also be set with GENERICIO_NEIGHBOR_CACHE (in bytes).
+  static void setDefaultCacheBytes(std::size_t B) {
+        DefaultCacheBytes = B;
+    }
+
+  private:
+    struct Leaf;
+
+    void radiusRound(const std::vector<double> &Points,
+                     const std::vector<std::size_t> &Queries,
+                     const std::vector<double> &Radii,
+                     std::vector< std::vector<Neighbor> > &Result);
+    std::shared_ptr<Leaf> getLeaf(GenericIO &Cursor, int L, uint64_t &FileBytes,
+                                  uint64_t &RawBytes);
+    std::shared_ptr<Leaf> loadLeaf(GenericIO &Cursor, int L, uint64_t &FileBytes,
+                                   uint64_t &RawBytes);
+
+    GenericIO &GIO;
+    GIOOctree Octree;
+    std::vector<GenericIO::VariableInfo> PosInfo;
+    double Bounds[6];
+
+    std::size_t CacheBytes, CachedBytes;
+    std::size_t LeafReads, LeafHits;
+    std::list<int> LRU;
+    std::map<int, std::pair<std::shared_ptr<Leaf>, std::list<int>::iterator> > Cache;
+
+    static std::size_t DefaultCacheBytes;
+};
+
+// An index of a file's particle ids, kept in a sidecar file (by default the
+// file's name with ".ids" appended). The (id, rank, row) entries are sorted by
+// id and stored in fixed-size blocks, so that each block covers an id range;
+// the blocks' ranges and a Bloom filter of each block's ids are kept in
+// memory, and only the blocks that may hold a requested id are read.
+//
+// The index is built from the file by build (or GenericIOBuildIdIndex) and is
+// checked against the file's ranks and rows, size, modification time and
+// step when opened; an index of a rewritten (or touched) file must be rebuilt.
+// Lookups are not thread-safe.
+class IdIndex {
+  public:
+  struct Location {
+        int Rank;           // -1 if the id is not in the file
+        uint64_t Row;
+    };
+
+    // Builds the index from the id variable (of any integer type) of all
+    // ranks of the (opened) file. The calling process reads all ids.
+    static void build(GenericIO &G, const std::string &IndexName = "",
+                      const std::string &IdName = "id",
+                      std::size_t BlockEntries = DefaultBlockEntries);
+
+    static std::string defaultIndexName(const std::string &FileName) {
+        return FileName + ".ids";
+    }
+
+    IdIndex(GenericIO &G, const std::string &IndexName = "");
+    ~IdIndex();
+
+    // The location of each of the ids (the first one, by rank and row, for
+    // ids that appear more than once).
+    void lookup(const std::vector<int64_t> &Ids, std::vector<Location> &Locs);
+
+    // Reads the GenericIO's variables for the rows of the ids that are in
+    // the file, in the order of the file (by rank, then row), and returns the
+    // number of rows read; if given, Locs receives their locations. Nearby
+    // rows are read together, so the variables must have space for
+    // readNumElems rows.
+    std::size_t readNumElems(const std::vector<int64_t> &Ids);
+    std::size_t read(const std::vector<int64_t> &Ids,
+                     std::vector<Location> *Locs = 0);
+
+    std::size_t getNumEntries() const {
+        return NEntries;
+    }
+
+    // The blocks read, and the ones skipped because of their Bloom filter
+    // (although the id is in their range), so far.
+    std::size_t getBlockReads() const {
+        return BlockReads;
+    }
+
+    std::size_t getBloomRejects() const {
+        return BloomRejects;
+    }
+
+    static const std::size_t DefaultBlockEntries = 4096;
+
+  private:
+  struct IdRun {
+        int Rank;
+        uint64_t Start, Count;
+        std::vector<uint64_t> Rows;     // relative to Start
+    };
+
+    void planRead(const std::vector<int64_t> &Ids, std::vector<IdRun> &Runs,
+                  std::vector<Location> &Locs);
+    bool mayContain(std::size_t Block, int64_t Id) const;
+    void readFully(void *Buf, std::size_t Count, uint64_t Offset);
+
+    GenericIO &GIO;
+    std::string IndexName;
+    int FD;
+    bool Swap;
+
+    uint64_t NEntries, BlockEntries, BloomWords, BloomHashes;
+    uint64_t EntriesOffset;
+    std::vector<int64_t> BlockMin, BlockMax;
+    std::vector<uint64_t> Blooms;
+
+    // The last read's plan, so that readNumElems and read look up once
+    std::vector<int64_t> PlannedIds;
+    std::vector<IdRun> PlannedRuns;
+    std::vector<Location> PlannedLocs;
+
+    std::size_t BlockReads, BloomRejects;
+};
+
 } /* END namespace cosmotk */
 #endif // GENERICIO_H
 
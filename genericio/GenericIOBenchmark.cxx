@@ -0,0 +1,624 @@
+/*
+ *                    Copyright (C) 2015, UChicago Argonne, LLC
+ *                               All Rights Reserved
+ *
+ *                               Generic IO (ANL-15-066)
+ *                     Hal Finkel, Argonne National Laboratory
+ *
+ *                              OPEN SOURCE LICENSE
+ *
+ * Under the terms of Contract No. DE-AC02-06CH11357 with UChicago Argonne,
+ * LLC, the U.S. Government retains certain rights in this software.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the names of UChicago Argonne, LLC or the Department of Energy
+ *      nor the names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior written
+ *      permission.
+ *
+ * *****************************************************************************
+ *
+ *                                  DISCLAIMER
+ * THE SOFTWARE IS SUPPLIED “AS IS” WITHOUT WARRANTY OF ANY KIND.  NEITHER THE
+ * UNTED STATES GOVERNMENT, NOR THE UNITED STATES DEPARTMENT OF ENERGY, NOR
+ * UCHICAGO ARGONNE, LLC, NOR ANY OF THEIR EMPLOYEES, MAKES ANY WARRANTY,
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LEGAL LIABILITY OR RESPONSIBILITY FOR THE
+ * ACCURACY, COMPLETENESS, OR USEFULNESS OF ANY INFORMATION, DATA, APPARATUS,
+ * PRODUCT, OR PROCESS DISCLOSED, OR REPRESENTS THAT ITS USE WOULD NOT INFRINGE
+ * PRIVATELY OWNED RIGHTS.
+ *
+ * *****************************************************************************
+ */
+
+// A parameterized read/write benchmark. Each option may be given a
+// comma-separated list of values, and every combination is run. For each one,
+// the file is written (with the MPI library) and then read back in each of the
+// requested ways. The results, including the per-phase statistics of the
+// GenericIO calls reduced over the ranks, are printed as JSON.
+//
+// The frontend (non-MPI) build cannot write, and so benchmarks the reads of an
+// existing file (-i).
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <chrono>
+#include <stdint.h>
+
+#include "GenericIO.h"
+
+using namespace std;
+using namespace gio;
+
+static const char *BackendNames[] = { "mpi", "posix", "mpi-collective" };
+
+struct Options
+{
+    Options() : Reps(1), SectionFraction(0.1), Keep(false)
+    {
+        Backends.push_back(GenericIO::FileIOPOSIX);
+        Compress.push_back(0);
+        ChunkRows.push_back(0);
+        OctreeLevels.push_back(0);
+        Rows.push_back(1000000);
+        Columns.push_back(9);
+        Reads.push_back("full");
+        Partitions.push_back(1);
+
+        // The non-position columns of the HACC particle schema (the positions
+        // are always float).
+        Types.push_back("f32"); Types.push_back("f32"); Types.push_back("f32");
+        Types.push_back("f32"); Types.push_back("i64"); Types.push_back("u16");
+    }
+
+    vector<unsigned> Backends;
+    vector<uint64_t> Compress, ChunkRows, OctreeLevels, Rows, Columns, Partitions;
+    vector<string> Types, Reads;
+    int Reps;
+    double SectionFraction;
+    bool Keep;
+    string FileName, InputName, OutputName;
+};
+
+static vector<string> splitList(const string &S)
+{
+    vector<string> L;
+    stringstream ss(S);
+    string Item;
+    while (getline(ss, Item, ','))
+        if (!Item.empty())
+            L.push_back(Item);
+
+    if (L.empty())
+        throw runtime_error("Empty list: " + S);
+    return L;
+}
+
+static vector<uint64_t> splitNumbers(const string &S)
+{
+    vector<string> L = splitList(S);
+    vector<uint64_t> N;
+    for (size_t i = 0; i < L.size(); ++i)
+        N.push_back(strtoull(L[i].c_str(), 0, 10));
+    return N;
+}
+
+static unsigned backendFromName(const string &Name)
+{
+    for (unsigned i = 0; i < sizeof(BackendNames)/sizeof(BackendNames[0]); ++i)
+        if (Name == BackendNames[i])
+            return i;
+
+    throw runtime_error("Unknown backend: " + Name);
+}
+
+// The VariableInfo of a benchmark column type (f32, f64, i32, i64, u16, u32,
+// u64).
+static GenericIO::VariableInfo columnInfo(const string &Name, const string &Type)
+{
+    if (Type.size() < 2 || (Type[0] != 'f' && Type[0] != 'i' && Type[0] != 'u'))
+        throw runtime_error("Unknown column type: " + Type);
+
+    size_t Bits = atoi(Type.c_str() + 1);
+    if (Bits != 8 && Bits != 16 && Bits != 32 && Bits != 64)
+        throw runtime_error("Unknown column type: " + Type);
+    if (Type[0] == 'f' && Bits < 32)
+        throw runtime_error("Unknown column type: " + Type);
+
+    return GenericIO::VariableInfo(Name, Bits / 8, Type[0] == 'f', Type[0] != 'u',
+                                   Name == "x", Name == "y", Name == "z", false);
+}
+
+// A run is one operation (a write or one kind of read) of one combination of
+// options.
+struct Run
+{
+    string Config, Op;
+    int Rep;
+    double Time;
+    GenericIO::ReducedStats Stats;
+};
+
+static void printRun(ostream &os, const Run &R, int NRanks)
+{
+    double Rate = R.Time > 0 ? ((double) R.Stats.RawBytes) / R.Time / (1024.*1024.) : 0;
+
+    os << "{" << R.Config << ",\"ranks\":" << NRanks << ",\"op\":\"" << R.Op <<
+          "\",\"rep\":" << R.Rep << ",\"time\":" << R.Time <<
+          ",\"file_bytes\":" << R.Stats.FileBytes << ",\"raw_bytes\":" << R.Stats.RawBytes <<
+          ",\"mb_per_s\":" << Rate << ",\"retries\":" << R.Stats.Retries << ",\"phases\":{";
+    for (int p = 0; p <= GenericIO::NumStatPhases; ++p)
+    {
+        if (p > 0)
+            os << ",";
+        os << "\"" << (p < GenericIO::NumStatPhases ?
+                       GenericIO::getStatPhaseName((GenericIO::StatPhase) p) : "total") <<
+              "\":{\"min\":" << R.Stats.Min[p] << ",\"max\":" << R.Stats.Max[p] <<
+              ",\"mean\":" << R.Stats.Mean[p] << ",\"max_rank\":" << R.Stats.MaxRank[p] << "}";
+    }
+    os << "}}";
+}
+
+static double now()
+{
+  #ifndef GENERICIO_NO_MPI
+    return MPI_Wtime();
+  #else
+    // Wall-clock time: clock() would sum the CPU time of all of the threads.
+    return std::chrono::duration<double>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+  #endif
+}
+
+static void barrier()
+{
+  #ifndef GENERICIO_NO_MPI
+    MPI_Barrier(MPI_COMM_WORLD);
+  #endif
+}
+
+// The maximum over the ranks of a rank's time.
+static double maxTime(double T)
+{
+  #ifndef GENERICIO_NO_MPI
+    double MaxT;
+    MPI_Allreduce(&T, &MaxT, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return MaxT;
+  #else
+    return T;
+  #endif
+}
+
+// Reads the file in one of the ways: full (whole ranks), section (the
+// requested fraction of the rows of each rank, starting at a quarter) or leaf
+// (each octree leaf separately). The file ranks are dealt out round robin.
+// Returns false if the read does not apply to the file (or, with collective
+// I/O, if the ranks would not make the same number of reads).
+static bool readFile(const Options &O, const string &FileName, unsigned Backend,
+                     const string &Read, int Rank, int NRanks, GenericIO::ReducedStats &RS,
+                     double &Time)
+{
+  #ifndef GENERICIO_NO_MPI
+    GenericIO GIO(MPI_COMM_WORLD, FileName, Backend);
+  #else
+    GenericIO GIO(FileName, Backend);
+  #endif
+    GIO.openAndReadHeader(GenericIO::MismatchAllowed);
+
+    if (Read == "leaf" && !GIO.isOctree())
+        return false;
+
+    vector<GenericIO::VariableInfo> VI;
+    GIO.getVariableInfo(VI);
+
+    int NR = GIO.readNRanks();
+    size_t MaxNElem = 0;
+    for (int i = Rank; i < NR; i += NRanks)
+        MaxNElem = max(MaxNElem, GIO.readNumElems(i));
+
+    vector<vector<char> > Data(VI.size());
+    for (size_t i = 0; i < VI.size(); ++i)
+    {
+        Data[i].resize(MaxNElem * VI[i].Size + GIO.requestedExtraSpace());
+        GIO.addVariable(VI[i], &Data[i][0], GenericIO::VarHasExtraSpace);
+    }
+
+    GIOOctree Octree;
+    if (GIO.isOctree())
+        Octree = GIO.getOctree();
+
+    // Collective I/O requires all ranks to make the same number of reads.
+    size_t NReads = 0;
+    for (int i = Rank; i < NR; i += NRanks)
+        if (Read != "leaf")
+            ++NReads;
+        else
+            for (size_t l = 0; l < Octree.rows.size(); ++l)
+                NReads += (int) Octree.rows[l].partitionLocation == i;
+
+  #ifndef GENERICIO_NO_MPI
+    if (Backend == GenericIO::FileIOMPICollective)
+    {
+        uint64_t MinMax[2] = { NReads, ~(uint64_t) NReads }, AllMinMax[2];
+        MPI_Allreduce(MinMax, AllMinMax, 2, MPI_UINT64_T, MPI_MIN, MPI_COMM_WORLD);
+        if (AllMinMax[0] != ~AllMinMax[1])
+            return false;
+    }
+  #endif
+
+    GIO.clearCallStats();
+    barrier();
+    double Start = now();
+
+    for (int i = Rank; i < NR; i += NRanks)
+    {
+        if (Read == "full")
+        {
+            GIO.readData(i, false, false);
+        }
+        else if (Read == "section")
+        {
+            size_t NElem = GIO.readNumElems(i);
+            size_t Count = (size_t) (NElem * O.SectionFraction);
+            GIO.readDataSection(min(NElem / 4, NElem - Count), Count, i, false, false);
+        }
+        else if (Read == "leaf")
+        {
+            for (size_t l = 0; l < Octree.rows.size(); ++l)
+                if ((int) Octree.rows[l].partitionLocation == i)
+                    GIO.readDataSection(Octree.rows[l].offsetInFile, Octree.rows[l].numParticles,
+                                        i, false, false);
+        }
+        else
+        {
+            throw runtime_error("Unknown read: " + Read);
+        }
+    }
+
+    Time = maxTime(now() - Start);
+    GIO.reduceCallStats(RS);
+    return true;
+}
+
+#ifndef GENERICIO_NO_MPI
+// Fills a column: positions are uniform within the rank's block of the
+// domain, floating-point values uniform in [0, 1) and integers are row ids
+// (unique across the ranks).
+static void fillColumn(const GenericIO::VariableInfo &VI, vector<char> &Data,
+                       size_t N, uint64_t FirstId, double Lo, double Hi)
+{
+    for (size_t i = 0; i < N; ++i)
+    {
+        char *V = &Data[i * VI.Size];
+        if (VI.IsFloat)
+        {
+            double D = (VI.IsPhysCoordX || VI.IsPhysCoordY || VI.IsPhysCoordZ) ?
+                       Lo + (Hi - Lo) * drand48() : drand48();
+            if (VI.Size == 4)
+                *(float *) V = (float) D;
+            else
+                *(double *) V = D;
+        }
+        else
+        {
+            uint64_t Id = FirstId + i;
+            memcpy(V, &Id, VI.Size);    // the low-order bytes (little endian)
+        }
+    }
+}
+
+// Writes the benchmark file of one combination of options.
+static void writeFile(const Options &O, const string &FileName, unsigned Backend,
+                      uint64_t Compress, uint64_t ChunkRows, uint64_t OctreeLevels,
+                      uint64_t Rows, uint64_t Columns, uint64_t Partitions,
+                      GenericIO::ReducedStats &RS, double &Time)
+{
+    int Rank, NRanks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &NRanks);
+
+    // The octree is built over a Cartesian decomposition of the domain.
+    int Dims[3] = { 0, 0, 0 }, Periods[3] = { 0, 0, 0 }, Coords[3];
+    MPI_Dims_create(NRanks, 3, Dims);
+    MPI_Comm CartComm;
+    MPI_Cart_create(MPI_COMM_WORLD, 3, Dims, Periods, 0, &CartComm);
+    MPI_Cart_coords(CartComm, Rank, 3, Coords);
+
+    const double Scale = 256.0;
+
+    GenericIO::setDefaultShouldCompress(Compress != 0);
+    GenericIO::setDefaultChunkRows(ChunkRows);
+
+    {
+        GenericIO GIO(CartComm, FileName, Backend);
+        GIO.setNumElems(Rows);
+        GIO.setPhysOrigin(0.0);
+        GIO.setPhysScale(Scale);
+        GIO.setPartition((int) (Rank * Partitions / NRanks));
+        if (OctreeLevels > 0)
+            GIO.useOctree((int) OctreeLevels);
+
+        static const char *PosNames[] = { "x", "y", "z" };
+        vector<vector<char> > Data(Columns);
+        for (size_t i = 0; i < Columns; ++i)
+        {
+            stringstream Name;
+            if (i < 3)
+                Name << PosNames[i];
+            else
+                Name << "c" << i;
+
+            GenericIO::VariableInfo VI =
+                columnInfo(Name.str(), i < 3 ? string("f32") : O.Types[(i - 3) % O.Types.size()]);
+
+            int d = i < 3 ? i : 0;
+            double Lo = Coords[d] * Scale / Dims[d], Hi = (Coords[d] + 1) * Scale / Dims[d];
+
+            Data[i].resize(Rows * VI.Size + GIO.requestedExtraSpace());
+            fillColumn(VI, Data[i], Rows, Rank * Rows, Lo, Hi);
+            GIO.addVariable(VI, &Data[i][0], GenericIO::VarHasExtraSpace);
+        }
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        double Start = MPI_Wtime();
+
+        GIO.write();
+
+        Time = maxTime(MPI_Wtime() - Start);
+        GIO.reduceCallStats(RS);
+    }
+
+    MPI_Comm_free(&CartComm);
+
+    GenericIO::setDefaultShouldCompress(false);
+    GenericIO::setDefaultChunkRows(0);
+}
+
+static void removeFile(const string &FileName, uint64_t Partitions)
+{
+    remove(FileName.c_str());
+    for (uint64_t p = 0; p < Partitions; ++p)
+    {
+        stringstream ss;
+        ss << FileName << "#" << p;
+        remove(ss.str().c_str());
+    }
+}
+#endif
+
+static void usage(const char *Name)
+{
+    cerr << "Usage: " << Name << " [options] <fileName>\n"
+         "  Each option takes a comma-separated list of values; every combination is run.\n"
+         "  -b <backends>     posix, mpi, mpi-collective (default: posix)\n"
+         "  -c <0|1>          blosc compression (default: 0)\n"
+         "  -k <rows>         chunk rows, 0 for unchunked blocks (default: 0)\n"
+         "  -l <levels>       octree levels, 0 for no octree (default: 0)\n"
+         "  -r <rows>         rows per rank (default: 1000000)\n"
+         "  -n <columns>      column count, the first three being the float positions (default: 9)\n"
+         "  -t <types>        types of the other columns, repeated as needed: f32, f64,\n"
+         "                    i8, i16, i32, i64, u8, u16, u32, u64 (default: f32,f32,f32,f32,i64,u16)\n"
+         "  -p <partitions>   number of partitions (files) (default: 1)\n"
+         "  -R <reads>        full, section, leaf (default: full)\n"
+         "  -f <fraction>     fraction of the rows read by section reads (default: 0.1)\n"
+         "  -x <reps>         repetitions (default: 1)\n"
+         "  -i                read an existing file <fileName> instead of writing\n"
+         "  -o <output>       JSON output file (default: standard output)\n"
+         "  -K                keep the written files\n";
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+  #ifndef GENERICIO_NO_MPI
+    MPI_Init(&argc, &argv);
+  #endif
+
+    int Rank, NRanks;
+  #ifndef GENERICIO_NO_MPI
+    MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &NRanks);
+  #else
+    Rank = 0;
+    NRanks = 1;
+  #endif
+
+    Options O;
+    bool ReadOnly = false;
+    int a = 1;
+    try
+    {
+        for (; a < argc - 1 && argv[a][0] == '-'; ++a)
+        {
+            string Opt(argv[a]);
+            if (Opt == "-i")
+            {
+                ReadOnly = true;
+                continue;
+            }
+            else if (Opt == "-K")
+            {
+                O.Keep = true;
+                continue;
+            }
+
+            if (a + 1 >= argc - 1)
+                usage(argv[0]);
+
+            string Val(argv[++a]);
+            if (Opt == "-b")
+            {
+                vector<string> L = splitList(Val);
+                O.Backends.clear();
+                for (size_t i = 0; i < L.size(); ++i)
+                    O.Backends.push_back(backendFromName(L[i]));
+            }
+            else if (Opt == "-c") O.Compress = splitNumbers(Val);
+            else if (Opt == "-k") O.ChunkRows = splitNumbers(Val);
+            else if (Opt == "-l") O.OctreeLevels = splitNumbers(Val);
+            else if (Opt == "-r") O.Rows = splitNumbers(Val);
+            else if (Opt == "-n") O.Columns = splitNumbers(Val);
+            else if (Opt == "-t") O.Types = splitList(Val);
+            else if (Opt == "-p") O.Partitions = splitNumbers(Val);
+            else if (Opt == "-R") O.Reads = splitList(Val);
+            else if (Opt == "-f") O.SectionFraction = atof(Val.c_str());
+            else if (Opt == "-x") O.Reps = atoi(Val.c_str());
+            else if (Opt == "-o") O.OutputName = Val;
+            else usage(argv[0]);
+        }
+
+        if (a != argc - 1 || argv[a][0] == '-')
+            usage(argv[0]);
+        O.FileName = argv[a];
+
+      #ifdef GENERICIO_NO_MPI
+        if (!ReadOnly)
+        {
+            cerr << argv[0] << ": this build cannot write, use -i to read an existing file" << endl;
+            exit(-1);
+        }
+      #endif
+
+        for (size_t i = 0; i < O.Columns.size(); ++i)
+            if (O.Columns[i] < 3)
+                throw runtime_error("At least the three position columns are required");
+        for (size_t i = 0; i < O.Types.size(); ++i)
+            columnInfo("c", O.Types[i]);
+    }
+    catch (exception &e)
+    {
+        cerr << argv[0] << ": " << e.what() << endl;
+        usage(argv[0]);
+    }
+
+    // The library reports each write on standard output, so, when the JSON
+    // goes there, those reports are sent to standard error.
+    streambuf *CoutBuf = cout.rdbuf(), *OutBuf = CoutBuf;
+    ofstream OutFile;
+    if (Rank == 0 && !O.OutputName.empty())
+    {
+        OutFile.open(O.OutputName.c_str());
+        if (!OutFile)
+            throw runtime_error("Unable to open the output file: " + O.OutputName);
+        OutBuf = OutFile.rdbuf();
+    }
+    else
+    {
+        cout.rdbuf(cerr.rdbuf());
+    }
+    ostream Out(OutBuf);
+    Out.precision(9);
+
+    if (Rank == 0)
+        Out << "[";
+    bool First = true;
+
+    vector<Run> Runs;
+    for (size_t b = 0; b < O.Backends.size(); ++b)
+    {
+        if (ReadOnly)
+        {
+            for (int rep = 0; rep < O.Reps; ++rep)
+                for (size_t r = 0; r < O.Reads.size(); ++r)
+                {
+                    Run R;
+                    stringstream Config;
+                    Config << "\"file\":\"" << O.FileName << "\",\"backend\":\"" <<
+                              BackendNames[O.Backends[b]] << "\"";
+                    R.Config = Config.str();
+                    R.Op = O.Reads[r];
+                    R.Rep = rep;
+                    if (!readFile(O, O.FileName, O.Backends[b], O.Reads[r], Rank, NRanks,
+                                  R.Stats, R.Time))
+                        continue;
+                    Runs.push_back(R);
+                }
+
+            continue;
+        }
+
+      #ifndef GENERICIO_NO_MPI
+        for (size_t c = 0; c < O.Compress.size(); ++c)
+        for (size_t k = 0; k < O.ChunkRows.size(); ++k)
+        for (size_t l = 0; l < O.OctreeLevels.size(); ++l)
+        for (size_t r = 0; r < O.Rows.size(); ++r)
+        for (size_t n = 0; n < O.Columns.size(); ++n)
+        for (size_t p = 0; p < O.Partitions.size(); ++p)
+        for (int rep = 0; rep < O.Reps; ++rep)
+        {
+            stringstream Config;
+            Config << "\"backend\":\"" << BackendNames[O.Backends[b]] <<
+                      "\",\"compress\":" << O.Compress[c] << ",\"chunk_rows\":" << O.ChunkRows[k] <<
+                      ",\"octree_levels\":" << O.OctreeLevels[l] <<
+                      ",\"rows_per_rank\":" << O.Rows[r] << ",\"columns\":" << O.Columns[n] <<
+                      ",\"partitions\":" << O.Partitions[p];
+
+            Run W;
+            W.Config = Config.str();
+            W.Op = "write";
+            W.Rep = rep;
+            writeFile(O, O.FileName, O.Backends[b], O.Compress[c], O.ChunkRows[k],
+                      O.OctreeLevels[l], O.Rows[r], O.Columns[n], O.Partitions[p],
+                      W.Stats, W.Time);
+            Runs.push_back(W);
+
+            for (size_t rd = 0; rd < O.Reads.size(); ++rd)
+            {
+                Run R(W);
+                R.Op = O.Reads[rd];
+                if (readFile(O, O.FileName, O.Backends[b], O.Reads[rd], Rank, NRanks,
+                             R.Stats, R.Time))
+                    Runs.push_back(R);
+            }
+
+            MPI_Barrier(MPI_COMM_WORLD);
+            if (Rank == 0 && !O.Keep)
+                removeFile(O.FileName, O.Partitions[p]);
+            MPI_Barrier(MPI_COMM_WORLD);
+
+            // Each configuration is printed as soon as it is done.
+            for (size_t i = 0; Rank == 0 && i < Runs.size(); ++i)
+            {
+                Out << (First ? "\n" : ",\n");
+                printRun(Out, Runs[i], NRanks);
+                First = false;
+            }
+            Out.flush();
+            Runs.clear();
+        }
+      #endif
+    }
+
+    for (size_t i = 0; Rank == 0 && i < Runs.size(); ++i)
+    {
+        Out << (First ? "\n" : ",\n");
+        printRun(Out, Runs[i], NRanks);
+        First = false;
+    }
+    if (Rank == 0)
+        Out << "\n]" << endl;
+
+    cout.rdbuf(CoutBuf);
+
+  #ifndef GENERICIO_NO_MPI
+    MPI_Finalize();
+  #endif
+
+    return 0;
+}
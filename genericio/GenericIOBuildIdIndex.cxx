@@ -0,0 +1,150 @@
+/*
+ *                    Copyright (C) 2015, UChicago Argonne, LLC
+ *                               All Rights Reserved
+ *
+ *                               Generic IO (ANL-15-066)
+ *                 Pascal Grosset, Los Alamos National Laboratory
+ *
+ *                              OPEN SOURCE LICENSE
+ *
+ * Under the terms of Contract No. DE-AC02-06CH11357 with UChicago Argonne,
+ * LLC, the U.S. Government retains certain rights in this software.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the names of UChicago Argonne, LLC or the Department of Energy
+ *      nor the names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior written
+ *      permission.
+ *
+ * *****************************************************************************
+ *
+ *                                  DISCLAIMER
+ * THE SOFTWARE IS SUPPLIED “AS IS” WITHOUT WARRANTY OF ANY KIND.  NEITHER THE
+ * UNTED STATES GOVERNMENT, NOR THE UNITED STATES DEPARTMENT OF ENERGY, NOR
+ * UCHICAGO ARGONNE, LLC, NOR ANY OF THEIR EMPLOYEES, MAKES ANY WARRANTY,
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LEGAL LIABILITY OR RESPONSIBILITY FOR THE
+ * ACCURACY, COMPLETENESS, OR USEFULNESS OF ANY INFORMATION, DATA, APPARATUS,
+ * PRODUCT, OR PROCESS DISCLOSED, OR REPRESENTS THAT ITS USE WOULD NOT INFRINGE
+ * PRIVATELY OWNED RIGHTS.
+ *
+ * *****************************************************************************
+ */
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "GenericIO.h"
+
+//
+// Usage: GenericIOBuildIdIndex [--id name] [--block n] [--lookup id,id,...] <file> [index]
+//
+//   --id name			the id variable (default id)
+//   --block n			entries per index block (default 4096)
+//   --lookup ids		print the rank and row of the ids, from the existing index
+//
+// The index is written to (or read from) the file's name with ".ids" appended,
+// unless another name is given.
+//
+
+int main(int argc, char *argv[])
+{
+    std::string idName = "id";
+    size_t blockEntries = gio::IdIndex::DefaultBlockEntries;
+    std::vector<int64_t> lookupIds;
+    bool lookup = false;
+
+    int a = 1;
+    for (; a < argc && argv[a][0] == '-' && argv[a][1] == '-'; a++)
+    {
+        std::string opt = argv[a];
+        if (a + 1 >= argc)
+            break;
+
+        if (opt == "--id")
+            idName = argv[++a];
+        else if (opt == "--block")
+            blockEntries = strtoull(argv[++a], 0, 10);
+        else if (opt == "--lookup")
+        {
+            std::stringstream ss(argv[++a]);
+            std::string id;
+            while (std::getline(ss, id, ','))
+                lookupIds.push_back(strtoll(id.c_str(), 0, 10));
+            lookup = true;
+        }
+        else
+            break;
+    }
+
+    if (a >= argc || argc - a > 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--id name] [--block n] [--lookup id,id,...] <file> [index]" << std::endl;
+        return 1;
+    }
+    std::string fileName = argv[a];
+    std::string indexName = a + 1 < argc ? argv[a + 1] : "";
+
+  #ifndef GENERICIO_NO_MPI
+    MPI_Init(&argc, &argv);
+  #endif
+
+    int ret = 0;
+    try
+    {
+      #ifndef GENERICIO_NO_MPI
+        gio::GenericIO GIO(MPI_COMM_SELF, fileName, gio::GenericIO::FileIOPOSIX);
+      #else
+        gio::GenericIO GIO(fileName, gio::GenericIO::FileIOPOSIX);
+      #endif
+        GIO.openAndReadHeader(gio::GenericIO::MismatchAllowed, -1, true);
+
+        if (lookup)
+        {
+            gio::IdIndex index(GIO, indexName);
+            std::vector<gio::IdIndex::Location> locs;
+            index.lookup(lookupIds, locs);
+
+            std::cout << "# id rank row" << std::endl;
+            for (size_t i = 0; i < lookupIds.size(); i++)
+                if (locs[i].Rank == -1)
+                    std::cout << lookupIds[i] << " -" << std::endl;
+                else
+                    std::cout << lookupIds[i] << " " << locs[i].Rank << " " << locs[i].Row << std::endl;
+
+            std::cout << "# blocks read: " << index.getBlockReads() << ", rejected by Bloom filters: "
+                      << index.getBloomRejects() << std::endl;
+        }
+        else
+        {
+            gio::IdIndex::build(GIO, indexName, idName, blockEntries);
+
+            gio::IdIndex index(GIO, indexName);
+            std::cout << "Indexed " << index.getNumEntries() << " ids of " << fileName << " in "
+                      << (indexName.empty() ? gio::IdIndex::defaultIndexName(fileName) : indexName) << std::endl;
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        ret = 1;
+    }
+
+  #ifndef GENERICIO_NO_MPI
+    MPI_Finalize();
+  #endif
+
+    return ret;
+}
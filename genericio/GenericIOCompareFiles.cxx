@@ -15,6 +15,113 @@
 #include "GenericIO.h"
 
 
+#ifdef GENERICIO_NO_MPI
+//
+// Reads the rows of every rank as strings and passes them to processRank in
+// rank order. The ranks are read in parallel, each thread through its own
+// cursor (a copy of gioReader made before adding the variables).
+template <typename ProcessRank>
+static void readRankRows(gio::GenericIO &gioReader, size_t maxNumElementsPerRank, ProcessRank processRank)
+{
+	int numDataRanks = gioReader.readNRanks();
+
+	std::vector<gio::GenericIO::VariableInfo> VI;
+	gioReader.getVariableInfo(VI);
+	int numVars = static_cast<int>(VI.size());
+
+	std::string error;
+
+  #ifdef _OPENMP
+	#pragma omp parallel
+  #endif
+	{
+		gio::GenericIO threadReader(gioReader);
+
+		std::vector<GioData> readInData;
+		for (size_t i=0; i<numVars; i++)
+		{
+			GioData temp;
+			temp.init(i, VI[i].Name, static_cast<int>(VI[i].Size), VI[i].IsFloat, VI[i].IsSigned, VI[i].IsPhysCoordX, VI[i].IsPhysCoordY, VI[i].IsPhysCoordZ);
+			temp.determineDataType();
+
+			temp.setNumElements(maxNumElementsPerRank);
+			temp.allocateMem(1);
+
+
+			readInData.push_back(temp);
+
+			if (readInData[i].dataType == "float")
+				threadReader.addVariable( (readInData[i].name).c_str(), (float*)readInData[i].data, true);
+			else if (readInData[i].dataType == "double")
+				threadReader.addVariable( (readInData[i].name).c_str(), (double*)readInData[i].data, true);
+			else if (readInData[i].dataType == "int8_t")
+				threadReader.addVariable((readInData[i].name).c_str(), (int8_t*)readInData[i].data, true);
+			else if (readInData[i].dataType == "int16_t")
+				threadReader.addVariable((readInData[i].name).c_str(), (int16_t*)readInData[i].data, true);
+			else if (readInData[i].dataType == "int32_t")
+				threadReader.addVariable((readInData[i].name).c_str(), (int32_t*)readInData[i].data, true);
+			else if (readInData[i].dataType == "int64_t")
+				threadReader.addVariable((readInData[i].name).c_str(), (int64_t*)readInData[i].data, true);
+			else if (readInData[i].dataType == "uint8_t")
+				threadReader.addVariable((readInData[i].name).c_str(), (uint8_t*)readInData[i].data, true);
+			else if (readInData[i].dataType == "uint16_t")
+				threadReader.addVariable((readInData[i].name).c_str(), (uint16_t*)readInData[i].data, true);
+			else if (readInData[i].dataType == "uint32_t")
+				threadReader.addVariable((readInData[i].name).c_str(), (uint32_t*)readInData[i].data, true);
+			else if (readInData[i].dataType == "uint64_t")
+				threadReader.addVariable((readInData[i].name).c_str(), (uint64_t*)readInData[i].data, true);
+		}
+
+	  #ifdef _OPENMP
+		#pragma omp for schedule(dynamic) ordered
+	  #endif
+		for (int r=0; r<numDataRanks; ++r)
+		{
+			std::vector<std::string> rows;
+			std::string rankError;
+
+			try
+			{
+				size_t NElem = threadReader.readNumElems(r);
+				threadReader.readData(r, false);
+
+				for (size_t j=0; j<NElem; j++)
+				{
+					std::string str;
+					for (int i=0; i<numVars; i++)
+						str += readInData[i].getValueStr(j) + " ";
+
+					rows.push_back(str);
+				}
+			}
+			catch (std::exception &e)
+			{
+				rankError = e.what();
+			}
+
+		  #ifdef _OPENMP
+			#pragma omp ordered
+		  #endif
+			{
+				if (error.empty())
+				{
+					error = rankError;
+					if (error.empty())
+						processRank(r, rows);
+				}
+			}
+		}
+
+		for (size_t i=0; i<readInData.size(); i++)
+			readInData[i].deAllocateMem();
+	}
+
+	if (!error.empty())
+		throw std::runtime_error(error);
+}
+#endif
+
+
 int main(int argc, char *argv[])
 {
   #ifndef GENERICIO_NO_MPI
@@ -70,69 +177,17 @@ int main(int argc, char *argv[])
 		}
 
 
-		// Read in the scalars information
-		std::vector<gio::GenericIO::VariableInfo> VI;
-		gioReader->getVariableInfo(VI);
-		int numVars = static_cast<int>(VI.size());
-
-
 		//
 		// Read in data
-		for (int r=0; r<numDataRanks; ++r)
-	    {
-	    	std::cout << "Processing rank " << r << std::endl;
-
-	        size_t NElem = gioReader->readNumElems(r);
-
-
-	        std::vector<GioData> readInData;
-			for (size_t i=0; i<numVars; i++)
-			{
-				GioData temp;
-				temp.init(i, VI[i].Name, static_cast<int>(VI[i].Size), VI[i].IsFloat, VI[i].IsSigned, VI[i].IsPhysCoordX, VI[i].IsPhysCoordY, VI[i].IsPhysCoordZ);
-				temp.determineDataType();
-
-				temp.setNumElements(maxNumElementsPerRank);
-				temp.allocateMem(1);
-
-
-				readInData.push_back(temp);
-
-				if (readInData[i].dataType == "float")
-					gioReader->addVariable( (readInData[i].name).c_str(), (float*)readInData[i].data, true);
-				else if (readInData[i].dataType == "double")
-					gioReader->addVariable( (readInData[i].name).c_str(), (double*)readInData[i].data, true);
-				else if (readInData[i].dataType == "int8_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (int8_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "int16_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (int16_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "int32_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (int32_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "int64_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (int64_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "uint8_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (uint8_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "uint16_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (uint16_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "uint32_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (uint32_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "uint64_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (uint64_t*)readInData[i].data, true);
-			}
-		
-			gioReader->readData(r, false); 
+		readRankRows(*gioReader, maxNumElementsPerRank, [&](int r, const std::vector<std::string> &rows)
+		{
+			std::cout << "Processing rank " << r << std::endl;
 
-			
-			for (size_t j=0; j<NElem; j++)
+			for (size_t j=0; j<rows.size(); j++)
 			{
-				std::string str;
-				for (int i=0; i<numVars; i++)
-					str += readInData[i].getValueStr(j) + " ";
-
-				entries.insert( str );
+				entries.insert( rows[j] );
 			}
-
-		}
+		});
 	}
 
 	{
@@ -155,72 +210,21 @@ int main(int argc, char *argv[])
 		}
 
 
-		// Read in the scalars information
-		std::vector<gio::GenericIO::VariableInfo> VI;
-		gioReader->getVariableInfo(VI);
-		int numVars = static_cast<int>(VI.size());
-
-
 		//
 		// Read in data
-		for (int r=0; r<numDataRanks; ++r)
-	    {
-	    	std::cout << "Comparing rank " << r << std::endl;
-
-	        size_t NElem = gioReader->readNumElems(r);
-
-
-	        std::vector<GioData> readInData;
-			for (size_t i=0; i<numVars; i++)
-			{
-				GioData temp;
-				temp.init(i, VI[i].Name, static_cast<int>(VI[i].Size), VI[i].IsFloat, VI[i].IsSigned, VI[i].IsPhysCoordX, VI[i].IsPhysCoordY, VI[i].IsPhysCoordZ);
-				temp.determineDataType();
-
-				temp.setNumElements(maxNumElementsPerRank);
-				temp.allocateMem(1);
-
-
-				readInData.push_back(temp);
-
-				if (readInData[i].dataType == "float")
-					gioReader->addVariable( (readInData[i].name).c_str(), (float*)readInData[i].data, true);
-				else if (readInData[i].dataType == "double")
-					gioReader->addVariable( (readInData[i].name).c_str(), (double*)readInData[i].data, true);
-				else if (readInData[i].dataType == "int8_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (int8_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "int16_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (int16_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "int32_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (int32_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "int64_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (int64_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "uint8_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (uint8_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "uint16_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (uint16_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "uint32_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (uint32_t*)readInData[i].data, true);
-				else if (readInData[i].dataType == "uint64_t")
-					gioReader->addVariable((readInData[i].name).c_str(), (uint64_t*)readInData[i].data, true);
-			}
-		
-			gioReader->readData(r, false); 
+		readRankRows(*gioReader, maxNumElementsPerRank, [&](int r, const std::vector<std::string> &rows)
+		{
+			std::cout << "Comparing rank " << r << std::endl;
 
-			
-			for (size_t j=0; j<NElem; j++)
+			for (size_t j=0; j<rows.size(); j++)
 			{
-				std::string str;
-				for (int i=0; i<numVars; i++)
-					str += readInData[i].getValueStr(j) + " ";
-
-				auto it = entries.find( str );
+				auto it = entries.find( rows[j] );
 				if ( it == entries.end() )
-					std::cout << str << " does not exist " << std::endl;
+					std::cout << rows[j] << " does not exist " << std::endl;
 				else
-					entries.erase ( str );
+					entries.erase ( rows[j] );
 			}
-		}
+		});
 	}
 
 
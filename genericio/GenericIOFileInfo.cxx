@@ -42,6 +42,8 @@
 #include <iostream>
 #include <vector>
 #include <set>
+#include <string>
+#include <stdexcept>
 
 #include "GenericIO.h"
 
@@ -101,34 +103,66 @@ int main(int argc, char *argv[])
 
 
                 //
-                // Create space to read data into
-                std::vector< std::vector<char> > Vars(partitionVI.size());
-                for (size_t i = 0; i < partitionVI.size(); ++i)
+                // Read the map's ranks in parallel, each thread through its own
+                // cursor (a copy of GIO made before adding the variables), and
+                // gather the partitions in rank order
+                std::vector< std::vector<int32_t> > rankPartitions(numRanksInInput);
+                std::string error;
+
+                #ifdef _OPENMP
+                #pragma omp parallel
+                #endif
                 {
+                    gio::GenericIO TGIO(GIO);
 
-                    Vars[i].resize(partitionVI[i].Size * maxNumParticlesPerRank + GIO.requestedExtraSpace());
-                    GIO.addVariable(partitionVI[i], &Vars[i][0], true);
+                    //
+                    // Create space to read data into
+                    std::vector< std::vector<char> > Vars(partitionVI.size());
+                    for (size_t i = 0; i < partitionVI.size(); ++i)
+                    {
+
+                        Vars[i].resize(partitionVI[i].Size * maxNumParticlesPerRank + TGIO.requestedExtraSpace());
+                        TGIO.addVariable(partitionVI[i], &Vars[i][0], true);
+                    }
+
+                    #ifdef _OPENMP
+                    #pragma omp for schedule(dynamic)
+                    #endif
+                    for (int i = 0; i < numRanksInInput; i++)
+                    {
+                        try
+                        {
+                            size_t numElements = TGIO.readNumElems(i);
+                            TGIO.readData(i, false);
+
+                            // Info in rank map; mpi_rank, partition, x, y, z - int32_t
+                            for (size_t j = 0; j < numElements; j++)
+                                rankPartitions[i].push_back(TGIO.getValue<int32_t>(1, j));
+                        }
+                        catch (std::exception &e)
+                        {
+                            #ifdef _OPENMP
+                            #pragma omp critical
+                            #endif
+                            error = e.what();
+                        }
+                    }
                 }
 
+                if (!error.empty())
+                    throw std::runtime_error(error);
 
                 for (int i = 0; i < numRanksInInput; i++)
                 {
-                    size_t numElements = GIO.readNumElems(i);
-                    GIO.readData(i, false);
-
-                    // Info in rank map; mpi_rank, partition, x, y, z - int32_t
-                    for (size_t j = 0; j < numElements; j++)
-                    {
-                        int32_t _partitionInfo = GIO.getValue<int32_t>(1, j);
-                        partitionInfo.push_back(_partitionInfo);
-                        partitionCounting.insert(_partitionInfo);
-                    }
+                    partitionInfo.insert(partitionInfo.end(), rankPartitions[i].begin(), rankPartitions[i].end());
+                    partitionCounting.insert(rankPartitions[i].begin(), rankPartitions[i].end());
                 }
             }
 
             // Get all the other info
             showMap = false;
             GIO.openAndReadHeader(gio::GenericIO::MismatchAllowed, -1, !showMap);
+            GIO.readRankCatalog();
 
             GIO.readDims(dims);
             GIO.readPhysOrigin(physOrigin);
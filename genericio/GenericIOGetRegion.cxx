@@ -113,6 +113,9 @@ int main(int argc, char *argv[])
     bool PrintRankInfo = true;
     bool OctreeSample = false;
     float octreeSamplePercentage = 0.1;
+    bool Region = false;
+    bool Periodic = false;
+    double regionExtents[6];
     int FileNameIdx = 1;
     if (argc > 2)
     {
@@ -145,11 +148,24 @@ int main(int argc, char *argv[])
                 --argc; --argc; 
             }
         }
+        else if (string(argv[1]) == "--region" || string(argv[1]) == "--periodic-region")
+        {
+            Periodic = string(argv[1]) == "--periodic-region";
+            if (argc == 9)
+            {
+                for (int i=0; i<6; i++)
+                    regionExtents[i] = atof( argv[2+i] );
+                Region = true;
+
+                FileNameIdx += 7;
+                argc -= 7;
+            }
+        }
     }
 
     if (argc < 2)
     {
-        cerr << "Usage: " << argv[0] << " [--no-rank-info|--no-data|--show-map|--octree-sample x] <mpiioName>" << endl;
+        cerr << "Usage: " << argv[0] << " [--no-rank-info|--no-data|--show-map|--octree-sample x|--region|--periodic-region minX maxX minY maxY minZ maxZ] <mpiioName>" << endl;
         exit(-1);
     }
 
@@ -194,6 +210,13 @@ int main(int argc, char *argv[])
             MaxNElem = max(MaxNElem, NElem);
         }
 
+        if (Region && !GIO.isOctree())
+            throw runtime_error("--region requires a file with an octree: " + FileName);
+
+        // The region is read at once, from the leaves of all ranks
+        if (Region)
+            MaxNElem = GIO.readRegionNumElems(regionExtents, Periodic);
+
         vector<PrinterBase *> Printers;
         for (size_t i = 0; i < VI.size(); ++i)
         {
@@ -360,7 +383,28 @@ int main(int argc, char *argv[])
         }
         cout << endl;
 
-        for (int i = 0; i < NR; ++i)
+        if (Region)
+        {
+            size_t NRows = GIO.readRegion(regionExtents, Periodic);
+
+            cout << "\n# Reading " << NRows << " rows in region " <<
+                regionExtents[0] << "-" << regionExtents[1] << ", " <<
+                regionExtents[2] << "-" << regionExtents[3] << ", " <<
+                regionExtents[4] << "-" << regionExtents[5] << std::endl;
+
+            for (size_t j = 0; j < NRows; ++j)
+            {
+                for (size_t k = 0; k < Printers.size(); ++k)
+                {
+                    Printers[k]->print(cout, j);
+                    if (k != Printers.size() - 1)
+                        cout << "\t";
+                }
+                cout << endl;
+            }
+        }
+
+        for (int i = 0; i < NR && !Region; ++i)
         {
             size_t NElem = GIO.readNumElems(i);
             int Coords[3];
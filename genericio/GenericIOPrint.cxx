@@ -42,6 +42,7 @@
 #include <cstdlib>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <string>
 #include <algorithm>
 #include <limits>
@@ -88,20 +89,75 @@ class Printer : public PrinterBase
 };
 
 template <typename T>
-PrinterBase *addPrinter(GenericIO::VariableInfo &V,
-                        GenericIO &GIO, size_t MNE)
+bool canPrint(const GenericIO::VariableInfo &V)
 {
     if (sizeof(T) != V.ElementSize)
-        return 0;
+        return false;
 
     if (V.IsFloat == numeric_limits<T>::is_integer)
-        return 0;
+        return false;
     if (V.IsSigned != numeric_limits<T>::is_signed)
+        return false;
+
+    return true;
+}
+
+template <typename T>
+PrinterBase *addPrinter(GenericIO::VariableInfo &V,
+                        GenericIO &GIO, size_t MNE)
+{
+    if (!canPrint<T>(V))
         return 0;
 
     return new Printer<T>(GIO, MNE, V.Size / V.ElementSize, V.Name);
 }
 
+#define FOR_PRINTABLE_TYPES(M) \
+    M(float); M(double); M(unsigned char); M(signed char); M(int16_t); \
+    M(uint16_t); M(int32_t); M(uint32_t); M(int64_t); M(uint64_t)
+
+static bool canPrint(const GenericIO::VariableInfo &V)
+{
+    bool OK = false;
+  #define CAN_PRINT(T) \
+    OK = OK || canPrint<T>(V)
+    FOR_PRINTABLE_TYPES(CAN_PRINT);
+  #undef CAN_PRINT
+
+    return OK;
+}
+
+// Adds a printer (and so a variable) for each of the variables to GIO.
+static void addPrinters(vector<GenericIO::VariableInfo> &VI, GenericIO &GIO,
+                        size_t MaxNElem, vector<PrinterBase *> &Printers)
+{
+    for (size_t i = 0; i < VI.size(); ++i)
+    {
+        PrinterBase *P = 0;
+
+      #define ADD_PRINTER(T) \
+        if (!P) P = addPrinter<T>(VI[i], GIO, MaxNElem)
+        FOR_PRINTABLE_TYPES(ADD_PRINTER);
+      #undef ADD_PRINTER
+
+        Printers.push_back(P);
+    }
+}
+
+static void printRows(ostream &os, vector<PrinterBase *> &Printers, size_t NRows)
+{
+    for (size_t j = 0; j < NRows; ++j)
+    {
+        for (size_t k = 0; k < Printers.size(); ++k)
+        {
+            Printers[k]->print(os, j);
+            if (k != Printers.size() - 1)
+                os << "\t";
+        }
+        os << endl;
+    }
+}
+
 int main(int argc, char *argv[])
 {
   #ifndef GENERICIO_NO_MPI
@@ -113,6 +169,7 @@ int main(int argc, char *argv[])
     bool PrintRankInfo = true;
     bool OctreeSample = false;
     float octreeSamplePercentage = 0.1;
+    int Step = 0;
     int FileNameIdx = 1;
     if (argc > 2)
     {
@@ -145,11 +202,21 @@ int main(int argc, char *argv[])
                 --argc; --argc; 
             }
         }
+        else if (string(argv[1]) == "--step")
+        {
+            if (argc == 4)
+            {
+                Step = atoi( argv[2] );
+
+                ++FileNameIdx;  ++FileNameIdx;
+                --argc; --argc;
+            }
+        }
     }
 
     if (argc < 2)
     {
-        cerr << "Usage: " << argv[0] << " [--no-rank-info|--no-data|--show-map|--octree-sample x] <mpiioName>" << endl;
+        cerr << "Usage: " << argv[0] << " [--no-rank-info|--no-data|--show-map|--octree-sample x|--step n] <mpiioName>" << endl;
         exit(-1);
     }
 
@@ -180,7 +247,9 @@ int main(int argc, char *argv[])
         GenericIO GIO(FileName, Method);
       #endif
 
+        GIO.setStep(Step);
         GIO.openAndReadHeader(GenericIO::MismatchAllowed, -1, !ShowMap);
+        GIO.readRankCatalog();
 
         int NR = GIO.readNRanks();
 
@@ -194,27 +263,9 @@ int main(int argc, char *argv[])
             MaxNElem = max(MaxNElem, NElem);
         }
 
-        vector<PrinterBase *> Printers;
         for (size_t i = 0; i < VI.size(); ++i)
         {
-            PrinterBase *P = 0;
-
-          #define ADD_PRINTER(T) \
-            if (!P) P = addPrinter<T>(VI[i], GIO, MaxNElem)
-                ADD_PRINTER(float);
-                ADD_PRINTER(double);
-                ADD_PRINTER(unsigned char);
-                ADD_PRINTER(signed char);
-                ADD_PRINTER(int16_t);
-                ADD_PRINTER(uint16_t);
-                ADD_PRINTER(int32_t);
-                ADD_PRINTER(uint32_t);
-                ADD_PRINTER(int64_t);
-                ADD_PRINTER(uint64_t);
-          #undef ADD_PRINTER
-
-            if (!P) throw runtime_error("Don't know how to print variable: " + VI[i].Name);
-            Printers.push_back(P);
+            if (!canPrint(VI[i])) throw runtime_error("Don't know how to print variable: " + VI[i].Name);
         }
 
         int Dims[3];
@@ -360,76 +411,98 @@ int main(int argc, char *argv[])
         }
         cout << endl;
 
-        for (int i = 0; i < NR; ++i)
-        {
-            size_t NElem = GIO.readNumElems(i);
-            int Coords[3];
-            GIO.readCoords(Coords, i);
-            if (PrintRankInfo)
-                cout << "# rank " << GIO.readGlobalRankNumber(i) << ": " <<
-                     Coords[0] << "," << Coords[1] << "," <<
-                     Coords[2] << ": " << NElem << " row(s)" << endl;
-
-            if (!OctreeSample)
-                if (NoData)
-                    continue;
+        // The ranks are read in parallel, each thread through its own cursor
+        // (a copy of GIO made before adding the variables) and with its own
+        // printers. The output of each rank is collected and written in rank
+        // order. Without MPI threading support, the MPI build reads serially.
+      #ifndef GENERICIO_NO_MPI
+        bool Threaded = false;
+      #else
+        bool Threaded = true;
+      #endif
 
-            
-            if (!OctreeSample)
+        string Error;
+        #ifdef _OPENMP
+        #pragma omp parallel if(Threaded)
+        #endif
+        {
+            GenericIO TGIO(GIO);
+            vector<PrinterBase *> Printers;
+            addPrinters(VI, TGIO, MaxNElem, Printers);
+
+            #ifdef _OPENMP
+            #pragma omp for schedule(dynamic) ordered
+            #endif
+            for (int i = 0; i < NR; ++i)
             {
-                GIO.readData(i, false);
+                stringstream Out;
+                string RankError;
 
-                for (size_t j = 0; j < NElem; ++j)
+                try
                 {
-                    for (size_t k = 0; k < Printers.size(); ++k)
+                    size_t NElem = TGIO.readNumElems(i);
+                    int Coords[3];
+                    TGIO.readCoords(Coords, i);
+                    if (PrintRankInfo)
+                        Out << "# rank " << TGIO.readGlobalRankNumber(i) << ": " <<
+                            Coords[0] << "," << Coords[1] << "," <<
+                            Coords[2] << ": " << NElem << " row(s)" << endl;
+
+                    if (!OctreeSample && !NoData)
                     {
-                        Printers[k]->print(cout, j);
-                        if (k != Printers.size() - 1)
-                            cout << "\t";
+                        TGIO.readData(i, false);
+                        printRows(Out, Printers, NElem);
                     }
-                    cout << endl;
-                }
-            }
-            else
-            {
-                GIOOctree octreeData = GIO.getOctree();
-                for (int l=0; l<octreeData.rows.size(); l++)
-                {
-                    size_t octreeRankOffset, octreeRankNumRows;
-                    if ( octreeData.rows[l].partitionLocation ==  i)    // Find ranks that i am reading now 
+                    else if (OctreeSample)
                     {
-                        octreeRankOffset  = octreeData.rows[l].offsetInFile;
-                        octreeRankNumRows = octreeData.rows[l].numParticles * octreeSamplePercentage;
-                    
-                        GIO.readDataSection(octreeRankOffset, octreeRankNumRows, i, false); 
-                
-                        cout << "\n# Reading " << octreeRankNumRows << " out of " << octreeData.rows[l].numParticles << 
-                            " rows for octree leaf " << l << " in rank " << i << " with extents " <<
-                            octreeData.rows[l].minX << "-" << octreeData.rows[l].maxX << ", " <<
-                            octreeData.rows[l].minY << "-" << octreeData.rows[l].maxY << ", " <<
-                            octreeData.rows[l].minZ << "-" << octreeData.rows[l].maxZ << std::endl;
-
-                        for (size_t j = 0; j < octreeRankNumRows; ++j)
+                        GIOOctree octreeData = TGIO.getOctree();
+                        for (int l=0; l<octreeData.rows.size(); l++)
                         {
-                            for (size_t k = 0; k < Printers.size(); ++k)
+                            size_t octreeRankOffset, octreeRankNumRows;
+                            if ( octreeData.rows[l].partitionLocation ==  i)    // Find ranks that i am reading now 
                             {
-                                Printers[k]->print(cout, j);
-                                if (k != Printers.size() - 1)
-                                    cout << "\t";
+                                octreeRankOffset  = octreeData.rows[l].offsetInFile;
+                                octreeRankNumRows = octreeData.rows[l].numParticles * octreeSamplePercentage;
+
+                                TGIO.readDataSection(octreeRankOffset, octreeRankNumRows, i, false); 
+
+                                Out << "\n# Reading " << octreeRankNumRows << " out of " << octreeData.rows[l].numParticles << 
+                                    " rows for octree leaf " << l << " in rank " << i << " with extents " <<
+                                    octreeData.rows[l].minX << "-" << octreeData.rows[l].maxX << ", " <<
+                                    octreeData.rows[l].minY << "-" << octreeData.rows[l].maxY << ", " <<
+                                    octreeData.rows[l].minZ << "-" << octreeData.rows[l].maxZ << std::endl;
+
+                                printRows(Out, Printers, octreeRankNumRows);
                             }
-                            cout << endl;
                         }
                     }
                 }
+                catch (exception &e)
+                {
+                    RankError = e.what();
+                }
+
+                // After an error, nothing from later ranks is printed.
+                #ifdef _OPENMP
+                #pragma omp ordered
+                #endif
+                {
+                    if (Error.empty())
+                    {
+                        cout << Out.str();
+                        Error = RankError;
+                    }
+                }
             }
 
-            
+            for (size_t i = 0; i < Printers.size(); ++i)
+            {
+                delete Printers[i];
+            }
         }
 
-        for (size_t i = 0; i < Printers.size(); ++i)
-        {
-            delete Printers[i];
-        }
+        if (!Error.empty())
+            throw runtime_error(Error);
     }
 
     #ifndef GENERICIO_NO_MPI
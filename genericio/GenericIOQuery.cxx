@@ -0,0 +1,1004 @@
+/*
+ *                    Copyright (C) 2015, UChicago Argonne, LLC
+ *                               All Rights Reserved
+ *
+ *                               Generic IO (ANL-15-066)
+ *                 Pascal Grosset, Los Alamos National Laboratory
+ *
+ *                              OPEN SOURCE LICENSE
+ *
+ * Under the terms of Contract No. DE-AC02-06CH11357 with UChicago Argonne,
+ * LLC, the U.S. Government retains certain rights in this software.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the names of UChicago Argonne, LLC or the Department of Energy
+ *      nor the names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior written
+ *      permission.
+ *
+ * *****************************************************************************
+ *
+ *                                  DISCLAIMER
+ * THE SOFTWARE IS SUPPLIED “AS IS” WITHOUT WARRANTY OF ANY KIND.  NEITHER THE
+ * UNTED STATES GOVERNMENT, NOR THE UNITED STATES DEPARTMENT OF ENERGY, NOR
+ * UCHICAGO ARGONNE, LLC, NOR ANY OF THEIR EMPLOYEES, MAKES ANY WARRANTY,
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LEGAL LIABILITY OR RESPONSIBILITY FOR THE
+ * ACCURACY, COMPLETENESS, OR USEFULNESS OF ANY INFORMATION, DATA, APPARATUS,
+ * PRODUCT, OR PROCESS DISCLOSED, OR REPRESENTS THAT ITS USE WOULD NOT INFRINGE
+ * PRIVATELY OWNED RIGHTS.
+ *
+ * *****************************************************************************
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "GenericIO.h"
+
+using namespace std;
+using namespace gio;
+
+//
+// Usage: GenericIOQuery [options] <file>
+//
+//   --where pred		keep the rows for which pred holds: <column><op><value>,
+//				where op is one of < <= > >= == != (may be repeated)
+//   --select cols		the columns (comma separated) of the rows to output
+//				(default all)
+//   --agg aggs			output aggregates of the rows instead (comma separated):
+//				count, sum(col), min(col), max(col), mean(col) and
+//				hist(col,lo,hi,bins), which counts the values in [lo, hi]
+//   --group-by col		compute the aggregates for each value of an integer column
+//   --csv file			write the CSV output to a file (default standard output)
+//   --out file			write the rows to a new GenericIO file instead (MPI only)
+//   --memory bytes		the memory for the batches of rows read at once
+//
+// A column can also be a single component of a variable of several (e.g.
+// pos.x). Each rank scans an even share of the file's rows with a cursor, a
+// batch at a time, on all of its threads: the predicates and aggregates are
+// evaluated column at a time. The results are gathered to rank 0, and rows
+// are output in the order of the file.
+//
+
+enum CompareOp { OpLT, OpLE, OpGT, OpGE, OpEQ, OpNE };
+
+struct Predicate
+{
+    string Column;
+    int Col;
+    CompareOp Op;
+    double D;
+    int64_t I;
+    bool IsInt;     // the value is an integer (and is compared as one to integers)
+};
+
+enum AggregateKind { AggCount, AggSum, AggMin, AggMax, AggMean, AggHist };
+
+// A group's aggregates are kept in a record of doubles: the row count,
+// followed by each aggregate's value (its sum, minimum or maximum, or its
+// histogram's bins) at Offset.
+struct Aggregate
+{
+    string Spec;
+    AggregateKind Kind;
+    string Column;
+    int Col;
+    double Lo, Hi;
+    size_t NBins;
+    size_t Offset;
+};
+
+// The groups seen by one thread (or rank): their keys, and their records.
+struct Groups
+{
+    unordered_map<int64_t, size_t> Index;
+    vector<int64_t> Keys;
+    vector<double> Recs;
+};
+
+// Clears the mask of the rows whose value does not compare with C by Op,
+// the values being compared as K.
+template <typename T, typename K>
+static void compareRows(const T *V, size_t N, CompareOp Op, K C, unsigned char *Mask)
+{
+    switch (Op)
+    {
+    case OpLT: for (size_t i = 0; i < N; ++i) Mask[i] &= (unsigned char) ((K) V[i] < C); break;
+    case OpLE: for (size_t i = 0; i < N; ++i) Mask[i] &= (unsigned char) ((K) V[i] <= C); break;
+    case OpGT: for (size_t i = 0; i < N; ++i) Mask[i] &= (unsigned char) ((K) V[i] > C); break;
+    case OpGE: for (size_t i = 0; i < N; ++i) Mask[i] &= (unsigned char) ((K) V[i] >= C); break;
+    case OpEQ: for (size_t i = 0; i < N; ++i) Mask[i] &= (unsigned char) ((K) V[i] == C); break;
+    case OpNE: for (size_t i = 0; i < N; ++i) Mask[i] &= (unsigned char) ((K) V[i] != C); break;
+    }
+}
+
+// Integer columns are compared with integer values exactly (as int64_t, or
+// as uint64_t for unsigned 64-bit columns and non-negative values);
+// everything else is compared in double precision. Each branch is
+// instantiated for every column type, but only taken where the conversion
+// to its type is exact.
+template <typename T>
+static void maskRows(const void *Data, size_t N, const Predicate &P, unsigned char *Mask)
+{
+    const T *V = (const T *) Data;
+    if (!P.IsInt || !numeric_limits<T>::is_integer)
+        compareRows(V, N, P.Op, P.D, Mask);
+    else if (numeric_limits<T>::is_signed || sizeof(T) < sizeof(int64_t))
+        compareRows(V, N, P.Op, P.I, Mask);
+    else if (P.I >= 0)
+        compareRows(V, N, P.Op, (uint64_t) P.I, Mask);
+    else
+        compareRows(V, N, P.Op, P.D, Mask);
+}
+
+static size_t histogramBin(double X, const Aggregate &A)
+{
+    size_t B = (size_t) ((X - A.Lo) * (A.NBins / (A.Hi - A.Lo)));
+    return B < A.NBins ? B : A.NBins - 1;
+}
+
+// Adds the values of the rows in the mask to the aggregate of a single group.
+template <typename T>
+static void accumulateMasked(const void *Data, const unsigned char *Mask, size_t N,
+                             const Aggregate &A, double *Rec)
+{
+    const T *V = (const T *) Data;
+    double *R = Rec + A.Offset;
+    switch (A.Kind)
+    {
+    case AggSum:
+    case AggMean:
+    {
+        double S = 0;
+      #ifdef _OPENMP
+      #pragma omp simd reduction(+:S)
+      #endif
+        for (size_t i = 0; i < N; ++i)
+            S += Mask[i] ? (double) V[i] : 0.0;
+        R[0] += S;
+        break;
+    }
+    case AggMin:
+    {
+        double M = R[0];
+      #ifdef _OPENMP
+      #pragma omp simd reduction(min:M)
+      #endif
+        for (size_t i = 0; i < N; ++i)
+            M = std::min(M, Mask[i] ? (double) V[i] : HUGE_VAL);
+        R[0] = M;
+        break;
+    }
+    case AggMax:
+    {
+        double M = R[0];
+      #ifdef _OPENMP
+      #pragma omp simd reduction(max:M)
+      #endif
+        for (size_t i = 0; i < N; ++i)
+            M = std::max(M, Mask[i] ? (double) V[i] : -HUGE_VAL);
+        R[0] = M;
+        break;
+    }
+    case AggHist:
+        for (size_t i = 0; i < N; ++i)
+        {
+            double X = (double) V[i];
+            if (Mask[i] && X >= A.Lo && X <= A.Hi)
+                R[histogramBin(X, A)] += 1;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Adds the values of the selected rows to the aggregate of their groups'
+// records (Slot giving the record of each).
+template <typename T>
+static void accumulateGroups(const void *Data, const size_t *Sel, const size_t *Slot, size_t K,
+                             const Aggregate &A, double *Recs, size_t RecLen)
+{
+    const T *V = (const T *) Data;
+    switch (A.Kind)
+    {
+    case AggSum:
+    case AggMean:
+        for (size_t k = 0; k < K; ++k)
+            Recs[Slot[k] * RecLen + A.Offset] += (double) V[Sel[k]];
+        break;
+    case AggMin:
+        for (size_t k = 0; k < K; ++k)
+        {
+            double &M = Recs[Slot[k] * RecLen + A.Offset];
+            M = std::min(M, (double) V[Sel[k]]);
+        }
+        break;
+    case AggMax:
+        for (size_t k = 0; k < K; ++k)
+        {
+            double &M = Recs[Slot[k] * RecLen + A.Offset];
+            M = std::max(M, (double) V[Sel[k]]);
+        }
+        break;
+    case AggHist:
+        for (size_t k = 0; k < K; ++k)
+        {
+            double X = (double) V[Sel[k]];
+            if (X >= A.Lo && X <= A.Hi)
+                Recs[Slot[k] * RecLen + A.Offset + histogramBin(X, A)] += 1;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+template <typename T>
+static void groupKeys(const void *Data, const size_t *Sel, size_t K, int64_t *Keys)
+{
+    const T *V = (const T *) Data;
+    for (size_t k = 0; k < K; ++k)
+        Keys[k] = (int64_t) V[Sel[k]];
+}
+
+template <typename T>
+static void printValues(ostream &OS, const char *Data, size_t NValues)
+{
+    for (size_t j = 0; j < NValues; ++j)
+    {
+        T V;
+        memcpy(&V, Data + j * sizeof(T), sizeof(T));
+        if (j)
+            OS << ",";
+        if (!numeric_limits<T>::is_integer)
+            OS << setprecision(numeric_limits<T>::max_digits10) << V;
+        else if (numeric_limits<T>::is_signed)
+            OS << (long long) V;
+        else
+            OS << (unsigned long long) V;
+    }
+}
+
+// The kernels for a column, instantiated for its element type.
+struct ColumnKernels
+{
+    void (*Mask)(const void *, size_t, const Predicate &, unsigned char *);
+    void (*AccumulateMasked)(const void *, const unsigned char *, size_t, const Aggregate &,
+                             double *);
+    void (*AccumulateGroups)(const void *, const size_t *, const size_t *, size_t,
+                             const Aggregate &, double *, size_t);
+    void (*Keys)(const void *, const size_t *, size_t, int64_t *);
+    void (*Print)(ostream &, const char *, size_t);
+};
+
+template <typename T>
+static ColumnKernels kernelsFor()
+{
+    ColumnKernels K = { maskRows<T>, accumulateMasked<T>, accumulateGroups<T>, groupKeys<T>,
+                        printValues<T> };
+    return K;
+}
+
+static bool getKernels(const GenericIO::VariableInfo &V, ColumnKernels &K)
+{
+    if (V.IsFloat)
+    {
+        if (V.ElementSize == sizeof(float))
+            K = kernelsFor<float>();
+        else if (V.ElementSize == sizeof(double))
+            K = kernelsFor<double>();
+        else
+            return false;
+        return true;
+    }
+
+    switch (V.ElementSize)
+    {
+    case 1: K = V.IsSigned ? kernelsFor<int8_t>() : kernelsFor<uint8_t>(); return true;
+    case 2: K = V.IsSigned ? kernelsFor<int16_t>() : kernelsFor<uint16_t>(); return true;
+    case 4: K = V.IsSigned ? kernelsFor<int32_t>() : kernelsFor<uint32_t>(); return true;
+    case 8: K = V.IsSigned ? kernelsFor<int64_t>() : kernelsFor<uint64_t>(); return true;
+    }
+    return false;
+}
+
+static string trim(const string &S)
+{
+    size_t B = S.find_first_not_of(" \t"), E = S.find_last_not_of(" \t");
+    return B == string::npos ? string() : S.substr(B, E - B + 1);
+}
+
+// Splits S at the commas which are not inside parentheses.
+static void splitList(const string &S, vector<string> &Parts)
+{
+    int Depth = 0;
+    size_t Start = 0;
+    for (size_t i = 0; i <= S.size(); ++i)
+    {
+        if (i == S.size() || (S[i] == ',' && Depth == 0))
+        {
+            string P = trim(S.substr(Start, i - Start));
+            if (!P.empty())
+                Parts.push_back(P);
+            Start = i + 1;
+        }
+        else if (S[i] == '(')
+            ++Depth;
+        else if (S[i] == ')')
+            --Depth;
+    }
+}
+
+static double parseNumber(const string &S, const string &Context)
+{
+    char *End;
+    double D = strtod(S.c_str(), &End);
+    if (S.empty() || *End)
+        throw runtime_error("Invalid number '" + S + "' in: " + Context);
+    return D;
+}
+
+static Predicate parsePredicate(const string &S)
+{
+    static const char *Ops[] = { "<=", ">=", "==", "!=", "<", ">" };
+    static const CompareOp OpCodes[] = { OpLE, OpGE, OpEQ, OpNE, OpLT, OpGT };
+
+    size_t At = S.find_first_of("<>=!");
+    if (At == string::npos)
+        throw runtime_error("Invalid predicate: " + S);
+
+    Predicate P;
+    P.Col = -1;
+    size_t OpLen = 0;
+    for (int o = 0; o < 6 && !OpLen; ++o)
+        if (S.compare(At, strlen(Ops[o]), Ops[o]) == 0)
+        {
+            P.Op = OpCodes[o];
+            OpLen = strlen(Ops[o]);
+        }
+    if (!OpLen)
+        throw runtime_error("Invalid predicate: " + S);
+
+    P.Column = trim(S.substr(0, At));
+    string Value = trim(S.substr(At + OpLen));
+    P.D = parseNumber(Value, S);
+
+    char *End;
+    P.I = strtoll(Value.c_str(), &End, 10);
+    P.IsInt = !*End;
+    return P;
+}
+
+static Aggregate parseAggregate(const string &S)
+{
+    Aggregate A;
+    A.Spec = S;
+    A.Col = -1;
+    A.Lo = A.Hi = 0;
+    A.NBins = 0;
+
+    size_t Open = S.find('(');
+    string Name = trim(S.substr(0, Open));
+    vector<string> Args;
+    if (Open != string::npos)
+    {
+        if (S[S.size() - 1] != ')')
+            throw runtime_error("Invalid aggregate: " + S);
+        splitList(S.substr(Open + 1, S.size() - Open - 2), Args);
+    }
+
+    if (Name == "count" && Args.empty())
+        A.Kind = AggCount;
+    else if (Name == "sum" && Args.size() == 1)
+        A.Kind = AggSum;
+    else if (Name == "min" && Args.size() == 1)
+        A.Kind = AggMin;
+    else if (Name == "max" && Args.size() == 1)
+        A.Kind = AggMax;
+    else if ((Name == "mean" || Name == "avg") && Args.size() == 1)
+        A.Kind = AggMean;
+    else if (Name == "hist" && Args.size() == 4)
+    {
+        A.Kind = AggHist;
+        A.Lo = parseNumber(Args[1], S);
+        A.Hi = parseNumber(Args[2], S);
+        A.NBins = (size_t) parseNumber(Args[3], S);
+        if (A.NBins == 0 || !(A.Lo < A.Hi))
+            throw runtime_error("Invalid histogram: " + S);
+    }
+    else
+        throw runtime_error("Invalid aggregate: " + S);
+
+    if (!Args.empty())
+        A.Column = Args[0];
+    return A;
+}
+
+static void addColumnName(vector<string> &Names, const string &Name)
+{
+    for (size_t i = 0; i < Names.size(); ++i)
+        if (Names[i] == Name)
+            return;
+    Names.push_back(Name);
+}
+
+// Merges the record of a group into another.
+static void mergeRecord(double *Into, const double *From, const vector<Aggregate> &Aggs)
+{
+    Into[0] += From[0];
+    for (size_t a = 0; a < Aggs.size(); ++a)
+    {
+        const Aggregate &A = Aggs[a];
+        if (A.Kind == AggMin)
+            Into[A.Offset] = std::min(Into[A.Offset], From[A.Offset]);
+        else if (A.Kind == AggMax)
+            Into[A.Offset] = std::max(Into[A.Offset], From[A.Offset]);
+        else if (A.Kind != AggCount)
+            for (size_t b = 0; b < (A.Kind == AggHist ? A.NBins : 1); ++b)
+                Into[A.Offset + b] += From[A.Offset + b];
+    }
+}
+
+static void initRecord(double *Rec, const vector<Aggregate> &Aggs, size_t RecLen)
+{
+    std::fill(Rec, Rec + RecLen, 0.0);
+    for (size_t a = 0; a < Aggs.size(); ++a)
+        if (Aggs[a].Kind == AggMin)
+            Rec[Aggs[a].Offset] = HUGE_VAL;
+        else if (Aggs[a].Kind == AggMax)
+            Rec[Aggs[a].Offset] = -HUGE_VAL;
+}
+
+// The record of the group of Key, added if it is new.
+static size_t findGroup(Groups &G, int64_t Key, const vector<Aggregate> &Aggs, size_t RecLen)
+{
+    unordered_map<int64_t, size_t>::iterator I = G.Index.find(Key);
+    if (I != G.Index.end())
+        return I->second;
+
+    size_t Slot = G.Keys.size();
+    G.Index[Key] = Slot;
+    G.Keys.push_back(Key);
+    G.Recs.resize((Slot + 1) * RecLen);
+    initRecord(&G.Recs[Slot * RecLen], Aggs, RecLen);
+    return Slot;
+}
+
+static void writeAggregates(ostream &OS, const map<int64_t, vector<double> > &Result,
+                            const vector<Aggregate> &Aggs, const string &GroupBy)
+{
+    if (!GroupBy.empty())
+        OS << GroupBy << ",";
+    for (size_t a = 0; a < Aggs.size(); ++a)
+    {
+        if (a)
+            OS << ",";
+        if (Aggs[a].Kind != AggHist)
+        {
+            OS << Aggs[a].Spec;
+            continue;
+        }
+
+        for (size_t b = 0; b < Aggs[a].NBins; ++b)
+            OS << (b ? "," : "") << Aggs[a].Spec << "[" << b << "]";
+    }
+    OS << "\n";
+
+    OS << setprecision(numeric_limits<double>::digits10);
+    for (map<int64_t, vector<double> >::const_iterator I = Result.begin(); I != Result.end(); ++I)
+    {
+        const double *Rec = &I->second[0];
+        if (!GroupBy.empty())
+            OS << I->first << ",";
+        for (size_t a = 0; a < Aggs.size(); ++a)
+        {
+            const Aggregate &A = Aggs[a];
+            if (a)
+                OS << ",";
+            if (A.Kind == AggCount)
+                OS << (uint64_t) Rec[0];
+            else if (A.Kind == AggSum)
+                OS << Rec[A.Offset];
+            else if (A.Kind == AggHist)
+                for (size_t b = 0; b < A.NBins; ++b)
+                    OS << (b ? "," : "") << (uint64_t) Rec[A.Offset + b];
+            else if (Rec[0] == 0)
+                OS << "nan";
+            else
+                OS << (A.Kind == AggMean ? Rec[A.Offset] / Rec[0] : Rec[A.Offset]);
+        }
+        OS << "\n";
+    }
+}
+
+static void writeRows(ostream &OS, const vector< vector<char> > &Rows, size_t NRows,
+                      const vector<GenericIO::VariableInfo> &Cols,
+                      const vector<ColumnKernels> &Kernels)
+{
+    for (size_t r = 0; r < NRows; ++r)
+    {
+        for (size_t c = 0; c < Cols.size(); ++c)
+        {
+            if (c)
+                OS << ",";
+            Kernels[c].Print(OS, &Rows[c][r * Cols[c].Size], Cols[c].Size / Cols[c].ElementSize);
+        }
+        OS << "\n";
+    }
+}
+
+#ifndef GENERICIO_NO_MPI
+// Sends a (possibly large) string to rank 0, in pieces.
+static void sendText(const string &Text)
+{
+    uint64_t Size = Text.size();
+    MPI_Send(&Size, 1, MPI_UINT64_T, 0, 0, MPI_COMM_WORLD);
+    for (uint64_t Off = 0; Off < Size; Off += 1 << 30)
+        MPI_Send((void *) (Text.data() + Off), (int) std::min(Size - Off, (uint64_t) 1 << 30),
+                 MPI_CHAR, 0, 0, MPI_COMM_WORLD);
+}
+
+static void recvText(int From, string &Text)
+{
+    uint64_t Size;
+    MPI_Recv(&Size, 1, MPI_UINT64_T, From, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    Text.resize(Size);
+    for (uint64_t Off = 0; Off < Size; Off += 1 << 30)
+        MPI_Recv(&Text[Off], (int) std::min(Size - Off, (uint64_t) 1 << 30), MPI_CHAR, From, 0,
+                 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    vector<Predicate> preds;
+    vector<Aggregate> aggs;
+    vector<string> select;
+    string groupBy, csvName, outName;
+    size_t memory = 0;
+    bool usage = false;
+
+    int a = 1;
+    for (; a < argc && argv[a][0] == '-' && argv[a][1] == '-'; a++)
+    {
+        string opt = argv[a];
+        if (a + 1 >= argc)
+        {
+            usage = true;
+            break;
+        }
+
+        try
+        {
+            if (opt == "--where")
+                preds.push_back(parsePredicate(argv[++a]));
+            else if (opt == "--select")
+                splitList(argv[++a], select);
+            else if (opt == "--agg")
+            {
+                vector<string> specs;
+                splitList(argv[++a], specs);
+                for (size_t i = 0; i < specs.size(); ++i)
+                    aggs.push_back(parseAggregate(specs[i]));
+            }
+            else if (opt == "--group-by")
+                groupBy = argv[++a];
+            else if (opt == "--csv")
+                csvName = argv[++a];
+            else if (opt == "--out")
+                outName = argv[++a];
+            else if (opt == "--memory")
+                memory = strtoull(argv[++a], 0, 10);
+            else
+                usage = true;
+        }
+        catch (std::exception &e)
+        {
+            cerr << e.what() << endl;
+            return 1;
+        }
+    }
+
+    if (usage || a + 1 != argc || (!groupBy.empty() && aggs.empty()) ||
+        (!outName.empty() && (!aggs.empty() || !csvName.empty())))
+    {
+        cerr << "Usage: " << argv[0] << " [--where pred]... [--select cols] [--agg aggs [--group-by col]] "
+             "[--csv file | --out file] [--memory bytes] <file>" << endl;
+        return 1;
+    }
+    string fileName = argv[a];
+
+  #ifndef GENERICIO_NO_MPI
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    int rank, nRanks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nRanks);
+  #else
+    int rank = 0, nRanks = 1;
+  #endif
+
+    int ret = 0;
+    try
+    {
+      #ifndef GENERICIO_NO_MPI
+        GenericIO GIO(MPI_COMM_SELF, fileName, GenericIO::FileIOPOSIX);
+      #else
+        if (!outName.empty())
+            throw runtime_error("Writing GenericIO files requires MPI");
+        GenericIO GIO(fileName, GenericIO::FileIOPOSIX);
+      #endif
+        GIO.openAndReadHeader(GenericIO::MismatchAllowed, -1, true);
+
+        bool rowMode = aggs.empty();
+        if (rowMode && select.empty())
+        {
+            vector<GenericIO::VariableInfo> VI;
+            GIO.getVariableInfo(VI);
+            for (size_t i = 0; i < VI.size(); ++i)
+                select.push_back(VI[i].Name);
+        }
+
+        vector<string> names;
+        if (rowMode)
+            for (size_t i = 0; i < select.size(); ++i)
+                addColumnName(names, select[i]);
+        for (size_t i = 0; i < preds.size(); ++i)
+            addColumnName(names, preds[i].Column);
+        for (size_t i = 0; i < aggs.size(); ++i)
+            if (aggs[i].Kind != AggCount)
+                addColumnName(names, aggs[i].Column);
+        if (!groupBy.empty())
+            addColumnName(names, groupBy);
+        if (names.empty())
+        {
+            // Counting all rows still needs a column to stream.
+            vector<GenericIO::VariableInfo> VI;
+            GIO.getVariableInfo(VI);
+            if (VI.empty())
+                throw runtime_error("No variables in: " + fileName);
+            size_t Smallest = 0;
+            for (size_t i = 1; i < VI.size(); ++i)
+                if (VI[i].Size < VI[Smallest].Size)
+                    Smallest = i;
+            names.push_back(VI[Smallest].Name);
+        }
+
+        GenericIO::Cursor cursor(GIO, memory, names, rank, nRanks);
+
+        const vector<GenericIO::VariableInfo> &cols = cursor.getColumns();
+        vector<ColumnKernels> kernels(cols.size());
+        vector<bool> typed(cols.size());
+        for (size_t c = 0; c < cols.size(); ++c)
+            typed[c] = getKernels(cols[c], kernels[c]);
+
+        // Predicates, aggregates and groups are evaluated on scalar columns.
+        for (size_t i = 0; i < preds.size(); ++i)
+            preds[i].Col = cursor.findColumn(preds[i].Column);
+        size_t recLen = 1;
+        for (size_t i = 0; i < aggs.size(); ++i)
+        {
+            aggs[i].Col = aggs[i].Kind == AggCount ? -1 : cursor.findColumn(aggs[i].Column);
+            aggs[i].Offset = recLen;
+            recLen += aggs[i].Kind == AggCount ? 0 : aggs[i].Kind == AggHist ? aggs[i].NBins : 1;
+        }
+        int groupCol = groupBy.empty() ? -1 : cursor.findColumn(groupBy);
+
+        vector<int> scalarCols;
+        for (size_t i = 0; i < preds.size(); ++i)
+            scalarCols.push_back(preds[i].Col);
+        for (size_t i = 0; i < aggs.size(); ++i)
+            if (aggs[i].Col != -1)
+                scalarCols.push_back(aggs[i].Col);
+        if (groupCol != -1)
+            scalarCols.push_back(groupCol);
+        for (size_t i = 0; i < scalarCols.size(); ++i)
+        {
+            const GenericIO::VariableInfo &V = cols[scalarCols[i]];
+            if (!typed[scalarCols[i]] || V.Size != V.ElementSize)
+                throw runtime_error("Column " + V.Name + " is not a scalar number");
+        }
+        if (groupCol != -1 && cols[groupCol].IsFloat)
+            throw runtime_error("Column " + groupBy + " is not an integer");
+
+        vector<int> outCols;
+        for (size_t i = 0; rowMode && i < select.size(); ++i)
+        {
+            outCols.push_back(cursor.findColumn(select[i]));
+            if (!typed[outCols.back()] && outName.empty())
+                throw runtime_error("Column " + select[i] + " cannot be printed");
+        }
+
+        int nThreads = 1;
+      #ifdef _OPENMP
+        nThreads = omp_get_max_threads();
+      #endif
+
+        // Each thread evaluates its slice of each batch into its own groups
+        // (a single one, without grouping), which are merged at the end.
+        vector<Groups> threadGroups(nThreads);
+        for (int t = 0; t < nThreads; ++t)
+            if (!rowMode && groupCol == -1)
+                findGroup(threadGroups[t], 0, aggs, recLen);
+
+        vector< vector<char> > rows(outCols.size());
+        uint64_t nRows = 0, nScanned = 0;
+        vector< vector<size_t> > sel(nThreads);
+        vector<size_t> sliceKept(nThreads), sliceOut(nThreads);
+        vector<unsigned char> mask(cursor.getBatchRows());
+
+        while (cursor.next())
+        {
+            size_t n = cursor.getNumRows();
+            nScanned += n;
+
+          #ifdef _OPENMP
+          #pragma omp parallel num_threads(nThreads)
+          #endif
+            {
+                int t = 0;
+              #ifdef _OPENMP
+                t = omp_get_thread_num();
+              #endif
+                size_t begin = n * t / nThreads, end = n * (t + 1) / nThreads, sn = end - begin;
+                unsigned char *m = &mask[0] + begin;
+
+                std::fill(m, m + sn, 1);
+                for (size_t i = 0; i < preds.size(); ++i)
+                {
+                    const Predicate &P = preds[i];
+                    kernels[P.Col].Mask((const char *) cursor.getData(P.Col) + begin * cols[P.Col].Size,
+                                        sn, P, m);
+                }
+
+                vector<size_t> &s = sel[t];
+                s.resize(sn);
+                size_t k = 0;
+                for (size_t r = 0; r < sn; ++r)
+                {
+                    s[k] = r;
+                    k += m[r];
+                }
+                sliceKept[t] = k;
+
+                Groups &g = threadGroups[t];
+                if (!rowMode && groupCol == -1)
+                {
+                    g.Recs[0] += k;
+                    for (size_t i = 0; i < aggs.size(); ++i)
+                        if (aggs[i].Col != -1)
+                            kernels[aggs[i].Col].AccumulateMasked(
+                                (const char *) cursor.getData(aggs[i].Col) + begin * cols[aggs[i].Col].Size,
+                                m, sn, aggs[i], &g.Recs[0]);
+                }
+                else if (!rowMode)
+                {
+                    vector<int64_t> keys(k);
+                    vector<size_t> slots(k);
+                    kernels[groupCol].Keys((const char *) cursor.getData(groupCol) +
+                                           begin * cols[groupCol].Size, &s[0], k, &keys[0]);
+                    for (size_t r = 0; r < k; ++r)
+                    {
+                        slots[r] = r && keys[r] == keys[r-1] ? slots[r-1] :
+                                   findGroup(g, keys[r], aggs, recLen);
+                        g.Recs[slots[r] * recLen] += 1;
+                    }
+                    for (size_t i = 0; i < aggs.size(); ++i)
+                        if (aggs[i].Col != -1)
+                            kernels[aggs[i].Col].AccumulateGroups(
+                                (const char *) cursor.getData(aggs[i].Col) + begin * cols[aggs[i].Col].Size,
+                                &s[0], &slots[0], k, aggs[i], &g.Recs[0], recLen);
+                }
+
+                if (rowMode)
+                {
+                  #ifdef _OPENMP
+                  #pragma omp barrier
+                  #pragma omp single
+                  #endif
+                    {
+                        for (int u = 0; u < nThreads; ++u)
+                        {
+                            sliceOut[u] = nRows;
+                            nRows += sliceKept[u];
+                        }
+                        for (size_t c = 0; c < outCols.size(); ++c)
+                            rows[c].resize(nRows * cols[outCols[c]].Size);
+                    }
+
+                    // The selected rows are gathered, in order, after those
+                    // of the earlier slices.
+                    for (size_t c = 0; c < outCols.size(); ++c)
+                    {
+                        size_t size = cols[outCols[c]].Size;
+                        const char *in = (const char *) cursor.getData(outCols[c]) + begin * size;
+                        char *out = &rows[c][0] + sliceOut[t] * size;
+                        for (size_t r = 0; r < k; ++r)
+                            memcpy(out + r * size, in + s[r] * size, size);
+                    }
+                }
+            }
+        }
+
+        if (!rowMode)
+        {
+            // The threads' groups, then the ranks', are merged.
+            Groups &merged = threadGroups[0];
+            for (int t = 1; t < nThreads; ++t)
+                for (size_t i = 0; i < threadGroups[t].Keys.size(); ++i)
+                {
+                    size_t slot = findGroup(merged, threadGroups[t].Keys[i], aggs, recLen);
+                    mergeRecord(&merged.Recs[slot * recLen], &threadGroups[t].Recs[i * recLen], aggs);
+                }
+
+            map<int64_t, vector<double> > result;
+          #ifndef GENERICIO_NO_MPI
+            int nGroups = (int) merged.Keys.size();
+            vector<int> rankGroups(nRanks), keyOffsets(nRanks), recCounts(nRanks), recOffsets(nRanks);
+            MPI_Gather(&nGroups, 1, MPI_INT, &rankGroups[0], 1, MPI_INT, 0, MPI_COMM_WORLD);
+            int total = 0;
+            for (int r = 0; r < nRanks; ++r)
+            {
+                keyOffsets[r] = total;
+                recCounts[r] = rankGroups[r] * (int) recLen;
+                recOffsets[r] = total * (int) recLen;
+                total += rankGroups[r];
+            }
+
+            vector<int64_t> allKeys(std::max(total, 1));
+            vector<double> allRecs(std::max(total, 1) * recLen);
+            MPI_Gatherv(merged.Keys.empty() ? 0 : &merged.Keys[0], nGroups, MPI_INT64_T,
+                        &allKeys[0], &rankGroups[0], &keyOffsets[0], MPI_INT64_T, 0, MPI_COMM_WORLD);
+            MPI_Gatherv(merged.Recs.empty() ? 0 : &merged.Recs[0], nGroups * (int) recLen, MPI_DOUBLE,
+                        &allRecs[0], &recCounts[0], &recOffsets[0], MPI_DOUBLE, 0, MPI_COMM_WORLD);
+          #else
+            int total = (int) merged.Keys.size();
+            vector<int64_t> &allKeys = merged.Keys;
+            vector<double> &allRecs = merged.Recs;
+          #endif
+
+            if (rank == 0)
+            {
+                for (int i = 0; i < total; ++i)
+                {
+                    vector<double> &rec = result[allKeys[i]];
+                    if (rec.empty())
+                    {
+                        rec.resize(recLen);
+                        initRecord(&rec[0], aggs, recLen);
+                    }
+                    mergeRecord(&rec[0], &allRecs[i * recLen], aggs);
+                }
+                if (groupCol == -1 && result.empty())
+                {
+                    vector<double> &rec = result[0];
+                    rec.resize(recLen);
+                    initRecord(&rec[0], aggs, recLen);
+                }
+
+                ofstream ofs;
+                if (!csvName.empty())
+                    ofs.open(csvName.c_str());
+                writeAggregates(csvName.empty() ? cout : ofs, result, aggs, groupBy);
+            }
+        }
+      #ifndef GENERICIO_NO_MPI
+        else if (!outName.empty())
+        {
+            double origin[3], scale[3];
+            GIO.readPhysOrigin(origin);
+            GIO.readPhysScale(scale);
+
+            GenericIO newGIO(MPI_COMM_WORLD, outName);
+            newGIO.setNumElems(nRows);
+            for (int d = 0; d < 3; ++d)
+            {
+                newGIO.setPhysOrigin(origin[d], d);
+                newGIO.setPhysScale(scale[d], d);
+            }
+            for (size_t c = 0; c < outCols.size(); ++c)
+            {
+                // The rows no longer follow the file's rank topology.
+                GenericIO::VariableInfo V = cols[outCols[c]];
+                V.IsPhysCoordX = V.IsPhysCoordY = V.IsPhysCoordZ = V.MaybePhysGhost = false;
+                rows[c].resize(nRows * V.Size + newGIO.requestedExtraSpace());
+                newGIO.addVariable(V, &rows[c][0], GenericIO::VarHasExtraSpace);
+            }
+            newGIO.write();
+        }
+      #endif
+        else
+        {
+            vector<GenericIO::VariableInfo> outInfo;
+            vector<ColumnKernels> outKernels;
+            for (size_t c = 0; c < outCols.size(); ++c)
+            {
+                outInfo.push_back(cols[outCols[c]]);
+                outKernels.push_back(kernels[outCols[c]]);
+            }
+
+            stringstream text;
+            writeRows(text, rows, nRows, outInfo, outKernels);
+            if (rank == 0)
+            {
+                ofstream ofs;
+                if (!csvName.empty())
+                    ofs.open(csvName.c_str());
+                ostream &os = csvName.empty() ? cout : ofs;
+
+                for (size_t c = 0; c < outInfo.size(); ++c)
+                {
+                    size_t nValues = outInfo[c].Size / outInfo[c].ElementSize;
+                    for (size_t j = 0; j < nValues; ++j)
+                    {
+                        os << (c || j ? "," : "") << outInfo[c].Name;
+                        if (nValues > 1)
+                            os << "." << j;
+                    }
+                }
+                os << "\n" << text.str();
+
+              #ifndef GENERICIO_NO_MPI
+                for (int r = 1; r < nRanks; ++r)
+                {
+                    string other;
+                    recvText(r, other);
+                    os << other;
+                }
+              #endif
+                os.flush();
+            }
+          #ifndef GENERICIO_NO_MPI
+            else
+                sendText(text.str());
+          #endif
+        }
+
+        uint64_t allScanned = nScanned;
+      #ifndef GENERICIO_NO_MPI
+        MPI_Reduce(&nScanned, &allScanned, 1, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+      #endif
+        if (rank == 0 && !csvName.empty())
+            cout << "Scanned " << allScanned << " rows of " << fileName << endl;
+    }
+    catch (std::exception &e)
+    {
+        cerr << e.what() << endl;
+        ret = 1;
+      #ifndef GENERICIO_NO_MPI
+        MPI_Abort(MPI_COMM_WORLD, ret);
+      #endif
+    }
+
+  #ifndef GENERICIO_NO_MPI
+    MPI_Finalize();
+  #endif
+
+    return ret;
+}
@@ -31,6 +31,7 @@ int main(int argc, char *argv[])
     GenericIO::setNaturalDefaultPartition();
     //GenericIO::setDefaultShouldCompress(true);
     GenericIO::setDefaultShouldCompress(false);
+    GenericIO::setDefaultRedistributionMode(GenericIO::RedistributeRows);
 
 
     {
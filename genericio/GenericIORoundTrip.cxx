@@ -0,0 +1,613 @@
+/*
+ *                    Copyright (C) 2015, UChicago Argonne, LLC
+ *                               All Rights Reserved
+ *
+ *                               Generic IO (ANL-15-066)
+ *                 Pascal Grosset, Los Alamos National Laboratory
+ *
+ *                              OPEN SOURCE LICENSE
+ *
+ * Under the terms of Contract No. DE-AC02-06CH11357 with UChicago Argonne,
+ * LLC, the U.S. Government retains certain rights in this software.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   1. Redistributions of source code must retain the above copyright notice,
+ *      this list of conditions and the following disclaimer.
+ *
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ *   3. Neither the names of UChicago Argonne, LLC or the Department of Energy
+ *      nor the names of its contributors may be used to endorse or promote
+ *      products derived from this software without specific prior written
+ *      permission.
+ *
+ * *****************************************************************************
+ *
+ *                                  DISCLAIMER
+ * THE SOFTWARE IS SUPPLIED “AS IS” WITHOUT WARRANTY OF ANY KIND.  NEITHER THE
+ * UNTED STATES GOVERNMENT, NOR THE UNITED STATES DEPARTMENT OF ENERGY, NOR
+ * UCHICAGO ARGONNE, LLC, NOR ANY OF THEIR EMPLOYEES, MAKES ANY WARRANTY,
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LEGAL LIABILITY OR RESPONSIBILITY FOR THE
+ * ACCURACY, COMPLETENESS, OR USEFULNESS OF ANY INFORMATION, DATA, APPARATUS,
+ * PRODUCT, OR PROCESS DISCLOSED, OR REPRESENTS THAT ITS USE WOULD NOT INFRINGE
+ * PRIVATELY OWNED RIGHTS.
+ *
+ * *****************************************************************************
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "GenericIO.h"
+
+using namespace std;
+using namespace gio;
+
+//
+// Usage: GenericIORoundTrip [-r rows] [-l levels] [-d] <file>
+//
+// Writes a file of known values (rows per rank, with an octree of the given
+// levels when nonzero, and double positions with -d) from all ranks, and has
+// rank 0 read it back in each of the ways a reader can: whole variables,
+// single components, converted values into an array of structures, a cursor,
+// through an id index (left in <file>.ids) and, with an octree, by region and
+// by nearest-neighbour queries. The format written is chosen by the usual
+// environment variables (GENERICIO_COMPRESS, GENERICIO_CHUNK_ROWS,
+// GENERICIO_TRANSPOSE, GENERICIO_INTPACK, GENERICIO_DICT_SIZE), so that the
+// regression tests can check each of them. Prints a line for each check and
+// exits with a nonzero status if any fails.
+//
+
+static const double BoxSize = 64;
+
+// The ranks' decomposition of the box, the rows written by each, and the
+// type of the positions.
+static int Dims[3];
+static uint64_t RankRows;
+static bool DoublePositions = false;
+
+// Every value is a function of the row's id, so that the rows can be checked
+// in any order (as written into an octree). The positions of each rank's
+// rows lie in its part of the box (ranks being numbered as by
+// MPI_Cart_create).
+static double position(int64_t Id, int d)
+{
+    int64_t Rank = Id / RankRows;
+    int64_t Coords[3] = { Rank / (Dims[1] * Dims[2]), (Rank / Dims[2]) % Dims[1], Rank % Dims[2] };
+    double Cell = BoxSize / Dims[d];
+    double P = Cell * (Coords[d] + (double) ((Id * 7919 + d * 104729) % 100003) / 100003);
+    return DoublePositions ? P : (double) (float) P;
+}
+
+static float velocity(int64_t Id, int d)
+{
+    return (float) (Id % 1000) + 0.25f * d;
+}
+
+static int32_t tag(int64_t Id)
+{
+    return (int32_t) (Id % 201) - 100;
+}
+
+static uint16_t mask(int64_t Id)
+{
+    return (uint16_t) (Id * 37);
+}
+
+static uint64_t mix(uint64_t Z)
+{
+    Z += 0x9e3779b97f4a7c15ULL;
+    Z = (Z ^ (Z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    Z = (Z ^ (Z >> 27)) * 0x94d049bb133111ebULL;
+    return Z ^ (Z >> 31);
+}
+
+// One of a few random 64-bit values: incompressible for blosc, but what a
+// trained dictionary is for.
+static uint64_t kind(int64_t Id)
+{
+    return mix(mix(Id) % 32);
+}
+
+typedef float float3[3];
+
+static void writeFile(const string &FileName, size_t NRows, int Levels)
+{
+    int NRanks, Rank;
+    MPI_Comm_size(MPI_COMM_WORLD, &NRanks);
+    MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+
+    int Periods[3] = { 0, 0, 0 };
+    std::fill(Dims, Dims + 3, 0);
+    MPI_Dims_create(NRanks, 3, Dims);
+    RankRows = NRows;
+    MPI_Comm Comm;
+    MPI_Cart_create(MPI_COMM_WORLD, 3, Dims, Periods, 0, &Comm);
+
+    {
+        GenericIO GIO(Comm, FileName, GenericIO::FileIOPOSIX);
+        GIO.setNumElems(NRows);
+        GIO.setPhysOrigin(0.0);
+        GIO.setPhysScale(BoxSize);
+
+        size_t Extra = GIO.requestedExtraSpace();
+        vector<float> X, Y, Z;
+        vector<double> XD, YD, ZD;
+        if (DoublePositions)
+        {
+            XD.resize(NRows + Extra), YD.resize(NRows + Extra), ZD.resize(NRows + Extra);
+        }
+        else
+        {
+            X.resize(NRows + Extra), Y.resize(NRows + Extra), Z.resize(NRows + Extra);
+        }
+        vector<float> Vel(3 * NRows + Extra);
+        vector<int64_t> Ids(NRows + Extra);
+        vector<int32_t> Tags(NRows + Extra);
+        vector<uint16_t> Masks(NRows + Extra);
+        vector<uint64_t> Kinds(NRows + Extra);
+        for (size_t i = 0; i < NRows; ++i)
+        {
+            int64_t Id = (int64_t) Rank * NRows + i;
+            if (DoublePositions)
+            {
+                XD[i] = position(Id, 0);
+                YD[i] = position(Id, 1);
+                ZD[i] = position(Id, 2);
+            }
+            else
+            {
+                X[i] = (float) position(Id, 0);
+                Y[i] = (float) position(Id, 1);
+                Z[i] = (float) position(Id, 2);
+            }
+            for (int d = 0; d < 3; ++d)
+                Vel[3 * i + d] = velocity(Id, d);
+            Ids[i] = Id;
+            Tags[i] = tag(Id);
+            Masks[i] = mask(Id);
+            Kinds[i] = kind(Id);
+        }
+
+        if (DoublePositions)
+        {
+            GIO.addVariable("x", XD, GenericIO::VarHasExtraSpace | GenericIO::VarIsPhysCoordX);
+            GIO.addVariable("y", YD, GenericIO::VarHasExtraSpace | GenericIO::VarIsPhysCoordY);
+            GIO.addVariable("z", ZD, GenericIO::VarHasExtraSpace | GenericIO::VarIsPhysCoordZ);
+        }
+        else
+        {
+            GIO.addVariable("x", X, GenericIO::VarHasExtraSpace | GenericIO::VarIsPhysCoordX);
+            GIO.addVariable("y", Y, GenericIO::VarHasExtraSpace | GenericIO::VarIsPhysCoordY);
+            GIO.addVariable("z", Z, GenericIO::VarHasExtraSpace | GenericIO::VarIsPhysCoordZ);
+        }
+        GIO.addVariable("vel", (float3 *) &Vel[0], GenericIO::VarHasExtraSpace);
+        GIO.addVariable("id", Ids, GenericIO::VarHasExtraSpace);
+        GIO.addVariable("tag", Tags, GenericIO::VarHasExtraSpace);
+        GIO.addVariable("mask", Masks, GenericIO::VarHasExtraSpace);
+        GIO.addVariable("kind", Kinds, GenericIO::VarHasExtraSpace);
+        if (Levels > 0)
+            GIO.useOctree(Levels);
+        GIO.write();
+    }
+
+    MPI_Comm_free(&Comm);
+}
+
+// Reports a check, counting its failures.
+static void report(const string &Check, const string &Error, int &NFailed)
+{
+    if (Error.empty())
+    {
+        cout << Check << ": okay" << endl;
+        return;
+    }
+
+    cout << Check << ": FAILED: " << Error << endl;
+    ++NFailed;
+}
+
+static string rowError(int Rank, size_t Row, const string &What)
+{
+    stringstream ss;
+    ss << "rank " << Rank << ", row " << Row << ": " << What;
+    return ss.str();
+}
+
+// Reads the whole variables of every rank (the positions, of either type, as
+// doubles), checking them, and returns the ids of each rank's rows (in the
+// order of the file).
+static string checkData(GenericIO &GIO, size_t TotalRows, vector< vector<int64_t> > &RankIds)
+{
+    int NRanks = GIO.readNRanks();
+    RankIds.assign(NRanks, vector<int64_t>());
+    vector<bool> Seen(TotalRows, false);
+    for (int r = 0; r < NRanks; ++r)
+    {
+        size_t N = GIO.readNumElems(r), Extra = GIO.requestedExtraSpace();
+        vector<double> X(N + Extra), Y(N + Extra), Z(N + Extra);
+        vector<float> Vel(3 * N + Extra);
+        vector<int64_t> Ids(N + Extra);
+        vector<int32_t> Tags(N + Extra);
+        vector<uint16_t> Masks(N + Extra);
+        vector<uint64_t> Kinds(N + Extra);
+
+        GIO.clearVariables();
+        GIO.addConvertedVariable("x", X, GenericIO::VarHasExtraSpace);
+        GIO.addConvertedVariable("y", Y, GenericIO::VarHasExtraSpace);
+        GIO.addConvertedVariable("z", Z, GenericIO::VarHasExtraSpace);
+        GIO.addVariable("vel", (float3 *) &Vel[0], true);
+        GIO.addVariable("id", Ids, true);
+        GIO.addVariable("tag", Tags, true);
+        GIO.addVariable("mask", Masks, true);
+        GIO.addVariable("kind", Kinds, true);
+        GIO.readData(r, false);
+
+        for (size_t i = 0; i < N; ++i)
+        {
+            int64_t Id = Ids[i];
+            if (Id < 0 || (uint64_t) Id >= TotalRows || Seen[Id])
+                return rowError(r, i, "unexpected id");
+            Seen[Id] = true;
+
+            if (X[i] != position(Id, 0) || Y[i] != position(Id, 1) || Z[i] != position(Id, 2))
+                return rowError(r, i, "wrong position");
+            for (int d = 0; d < 3; ++d)
+                if (Vel[3 * i + d] != velocity(Id, d))
+                    return rowError(r, i, "wrong velocity");
+            if (Tags[i] != tag(Id) || Masks[i] != mask(Id) || Kinds[i] != kind(Id))
+                return rowError(r, i, "wrong integer value");
+        }
+
+        RankIds[r].assign(Ids.begin(), Ids.begin() + N);
+    }
+
+    for (size_t i = 0; i < TotalRows; ++i)
+        if (!Seen[i])
+            return "missing rows";
+    return "";
+}
+
+// Reads single components of the velocity.
+static string checkComponents(GenericIO &GIO, const vector< vector<int64_t> > &RankIds)
+{
+    for (size_t r = 0; r < RankIds.size(); ++r)
+    {
+        size_t N = RankIds[r].size(), Extra = GIO.requestedExtraSpace();
+        vector<float> VelY(N + Extra), VelZ(N + Extra);
+
+        GIO.clearVariables();
+        GIO.addVariable("vel.y", VelY, true);
+        GIO.addVariable("vel.2", VelZ, true);
+        GIO.readData(r, false);
+
+        for (size_t i = 0; i < N; ++i)
+            if (VelY[i] != velocity(RankIds[r][i], 1) || VelZ[i] != velocity(RankIds[r][i], 2))
+                return rowError(r, i, "wrong component");
+    }
+
+    return "";
+}
+
+// Reads converted values into the members of an array of structures.
+static string checkConverted(GenericIO &GIO, const vector< vector<int64_t> > &RankIds)
+{
+    struct Row
+    {
+        double X;
+        int32_t Id;
+        double VelX;
+        float Tag;
+        int64_t Mask;
+    };
+
+    for (size_t r = 0; r < RankIds.size(); ++r)
+    {
+        size_t N = RankIds[r].size();
+        vector<Row> Rows(N + 1);
+
+        GIO.clearVariables();
+        GIO.addConvertedVariable("x", &Rows[0].X, sizeof(Row));
+        GIO.addConvertedVariable("id", &Rows[0].Id, sizeof(Row));
+        GIO.addConvertedVariable("vel.x", &Rows[0].VelX, sizeof(Row));
+        GIO.addConvertedVariable("tag", &Rows[0].Tag, sizeof(Row));
+        GIO.addConvertedVariable("mask", &Rows[0].Mask, sizeof(Row));
+        GIO.readData(r, false);
+
+        for (size_t i = 0; i < N; ++i)
+        {
+            int64_t Id = RankIds[r][i];
+            if (Rows[i].X != position(Id, 0) || Rows[i].Id != (int32_t) Id ||
+                Rows[i].VelX != (double) velocity(Id, 0) || Rows[i].Tag != (float) tag(Id) ||
+                Rows[i].Mask != (int64_t) mask(Id))
+                return rowError(r, i, "wrong converted value");
+        }
+    }
+
+    return "";
+}
+
+// Streams some of the columns (including a component) through a cursor of
+// a few kilobytes, so that the rows arrive in many batches.
+static string checkCursor(GenericIO &GIO, size_t TotalRows)
+{
+    vector<string> Names;
+    Names.push_back("id");
+    Names.push_back("x");
+    Names.push_back("vel.z");
+
+    GenericIO::Cursor C(GIO, 4096, Names);
+    uint64_t NRows = 0;
+    size_t NBatches = 0;
+    while (C.next())
+    {
+        const int64_t *Ids = C.getData<int64_t>("id");
+        const float *X = DoublePositions ? 0 : C.getData<float>("x");
+        const double *XD = DoublePositions ? C.getData<double>("x") : 0;
+        const float *VelZ = C.getData<float>("vel.z");
+        for (size_t i = 0; i < C.getNumRows(); ++i)
+            if ((DoublePositions ? XD[i] : (double) X[i]) != position(Ids[i], 0) ||
+                VelZ[i] != velocity(Ids[i], 2))
+                return rowError(-1, NRows + i, "wrong value from the cursor");
+
+        NRows += C.getNumRows();
+        ++NBatches;
+    }
+
+    if (NRows != TotalRows)
+        return "wrong number of rows from the cursor";
+    if (TotalRows > C.getBatchRows() && NBatches < 2)
+        return "the cursor did not batch the rows";
+    return "";
+}
+
+// Builds the id index and looks up some of the ids, and one not in the file.
+static string checkIdIndex(GenericIO &GIO, size_t TotalRows,
+                           const vector< vector<int64_t> > &RankIds)
+{
+    GIO.clearVariables();
+    IdIndex::build(GIO);
+    IdIndex Index(GIO);
+    if (Index.getNumEntries() != TotalRows)
+        return "wrong number of index entries";
+
+    vector<int64_t> Ids;
+    for (size_t i = 0; i < TotalRows; i += TotalRows / 16 + 1)
+        Ids.push_back(i);
+    Ids.push_back(TotalRows - 1);
+    Ids.push_back(TotalRows + 5);
+
+    vector<IdIndex::Location> Locs;
+    Index.lookup(Ids, Locs);
+    for (size_t i = 0; i < Ids.size(); ++i)
+    {
+        bool InFile = (uint64_t) Ids[i] < TotalRows;
+        if (!InFile)
+        {
+            if (Locs[i].Rank != -1)
+                return "found an id not in the file";
+            continue;
+        }
+
+        if (Locs[i].Rank < 0 || (size_t) Locs[i].Rank >= RankIds.size() ||
+            Locs[i].Row >= RankIds[Locs[i].Rank].size() ||
+            RankIds[Locs[i].Rank][Locs[i].Row] != Ids[i])
+            return "wrong location of id " + to_string(Ids[i]);
+    }
+
+    return "";
+}
+
+// Reads a few boxes (one of them wrapping around the periodic box) by region,
+// and compares the ids read with those of the rows whose positions lie in the
+// box.
+static string checkRegion(GenericIO &GIO, size_t TotalRows)
+{
+    const double Boxes[][7] = {
+        // minX, maxX, minY, maxY, minZ, maxZ, periodic
+        { 5, 30, 10, 50, 0, 20, 0 },
+        { 31, 33, 0, 64, 0, 64, 0 },
+        { 60, 70, -3, 9, 20, 40, 1 },
+    };
+
+    for (size_t b = 0; b < sizeof(Boxes) / sizeof(Boxes[0]); ++b)
+    {
+        const double *Box = Boxes[b];
+        bool Periodic = Box[6] != 0;
+
+        vector<int64_t> Expected;
+        for (size_t Id = 0; Id < TotalRows; ++Id)
+        {
+            bool Inside = true;
+            for (int d = 0; d < 3 && Inside; ++d)
+            {
+                double P = position(Id, d);
+                Inside = (Box[2*d] <= P && P <= Box[2*d+1]) ||
+                         (Periodic && ((Box[2*d] <= P + BoxSize && P + BoxSize <= Box[2*d+1]) ||
+                                       (Box[2*d] <= P - BoxSize && P - BoxSize <= Box[2*d+1])));
+            }
+            if (Inside)
+                Expected.push_back(Id);
+        }
+
+        size_t N = GIO.readRegionNumElems(Box, Periodic), Extra = GIO.requestedExtraSpace();
+        vector<double> X(N + Extra), Y(N + Extra), Z(N + Extra);
+        vector<int64_t> Ids(N + Extra);
+        GIO.clearVariables();
+        GIO.addConvertedVariable("x", X, GenericIO::VarHasExtraSpace);
+        GIO.addConvertedVariable("y", Y, GenericIO::VarHasExtraSpace);
+        GIO.addConvertedVariable("z", Z, GenericIO::VarHasExtraSpace);
+        GIO.addConvertedVariable("id", Ids, GenericIO::VarHasExtraSpace);
+        size_t NRead = GIO.readRegion(Box, Periodic);
+
+        Ids.resize(NRead);
+        std::sort(Ids.begin(), Ids.end());
+        if (Ids != Expected)
+        {
+            stringstream ss;
+            ss << "box " << b << ": read " << NRead << " rows, expected " << Expected.size();
+            return ss.str();
+        }
+    }
+
+    return "";
+}
+
+// Checks the neighbours found for each query point against the distances of
+// all rows (of which those of the same distance may be found in any order).
+static string checkNeighborResult(const vector<double> &Points, size_t q, size_t TotalRows,
+                                  const vector< vector<int64_t> > &RankIds,
+                                  const vector<NeighborQuery::Neighbor> &Found,
+                                  double Radius, size_t K)
+{
+    const double *P = &Points[3*q];
+    vector<double> Distances;
+    for (size_t Id = 0; Id < TotalRows; ++Id)
+    {
+        double D2 = 0;
+        for (int d = 0; d < 3; ++d)
+            D2 += (position(Id, d) - P[d]) * (position(Id, d) - P[d]);
+        if (K || D2 <= Radius * Radius)
+            Distances.push_back(sqrt(D2));
+    }
+    std::sort(Distances.begin(), Distances.end());
+    if (K)
+        Distances.resize(std::min(K, Distances.size()));
+
+    stringstream ss;
+    ss << "point " << q << ": ";
+    if (Found.size() != Distances.size())
+    {
+        ss << "found " << Found.size() << " neighbours, expected " << Distances.size();
+        return ss.str();
+    }
+
+    for (size_t i = 0; i < Found.size(); ++i)
+    {
+        const NeighborQuery::Neighbor &N = Found[i];
+        if (N.Rank < 0 || (size_t) N.Rank >= RankIds.size() || N.Row >= RankIds[N.Rank].size())
+            return ss.str() + "neighbour in no row";
+
+        int64_t Id = RankIds[N.Rank][N.Row];
+        if (N.Pos[0] != position(Id, 0) || N.Pos[1] != position(Id, 1) || N.Pos[2] != position(Id, 2))
+            return ss.str() + "wrong neighbour position";
+        if (N.Distance != Distances[i])
+            return ss.str() + "wrong neighbour distance";
+    }
+
+    return "";
+}
+
+// Finds the nearest rows, and those within a radius, of a few points (one of
+// them outside the box) and compares them with a brute-force search.
+static string checkNeighbors(GenericIO &GIO, size_t TotalRows,
+                             const vector< vector<int64_t> > &RankIds)
+{
+    const double Coords[][3] = {
+        { 10, 20, 30 }, { 32, 32, 32 }, { 0, 0, 0 }, { 63.5, 1, 40 }, { 70, -5, 30 },
+    };
+    vector<double> Points;
+    for (size_t q = 0; q < sizeof(Coords) / sizeof(Coords[0]); ++q)
+        Points.insert(Points.end(), Coords[q], Coords[q] + 3);
+
+    const size_t K = 10;
+    const double Radius = 3;
+    NeighborQuery Query(GIO);
+    vector< vector<NeighborQuery::Neighbor> > Nearest, Within;
+    Query.nearest(Points, K, Nearest);
+    Query.radius(Points, Radius, Within);
+
+    for (size_t q = 0; q < Points.size() / 3; ++q)
+    {
+        string Error = checkNeighborResult(Points, q, TotalRows, RankIds, Nearest[q], 0, K);
+        if (Error.empty())
+            Error = checkNeighborResult(Points, q, TotalRows, RankIds, Within[q], Radius, 0);
+        if (!Error.empty())
+            return Error;
+    }
+
+    return "";
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+
+    size_t NRows = 10000;
+    int Levels = 0;
+    int a = 1;
+    for (; a + 1 < argc && argv[a][0] == '-'; ++a)
+    {
+        string Opt = argv[a];
+        if (Opt == "-r")
+            NRows = strtoull(argv[++a], 0, 10);
+        else if (Opt == "-l")
+            Levels = atoi(argv[++a]);
+        else if (Opt == "-d")
+            DoublePositions = true;
+        else
+            break;
+    }
+
+    if (a != argc - 1 || NRows == 0)
+    {
+        cerr << "Usage: " << argv[0] << " [-r rows] [-l levels] [-d] <file>" << endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    string FileName = argv[a];
+    int Rank, NRanks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &Rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &NRanks);
+
+    int NFailed = 0;
+    try
+    {
+        writeFile(FileName, NRows, Levels);
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        if (Rank == 0)
+        {
+            size_t TotalRows = NRows * NRanks;
+            GenericIO GIO(MPI_COMM_SELF, FileName, GenericIO::FileIOPOSIX);
+            GIO.openAndReadHeader(GenericIO::MismatchAllowed);
+            GIO.readDims(Dims);
+
+            vector< vector<int64_t> > RankIds;
+            string Error = checkData(GIO, TotalRows, RankIds);
+            report("data", Error, NFailed);
+            if (Error.empty())
+            {
+                report("components", checkComponents(GIO, RankIds), NFailed);
+                report("converted", checkConverted(GIO, RankIds), NFailed);
+                report("cursor", checkCursor(GIO, TotalRows), NFailed);
+                report("ids", checkIdIndex(GIO, TotalRows, RankIds), NFailed);
+                if (GIO.isOctree())
+                {
+                    report("region", checkRegion(GIO, TotalRows), NFailed);
+                    report("neighbors", checkNeighbors(GIO, TotalRows, RankIds), NFailed);
+                }
+            }
+        }
+    }
+    catch (exception &e)
+    {
+        cerr << argv[0] << ": " << e.what() << endl;
+        ++NFailed;
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, &NFailed, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Finalize();
+    return NFailed ? 1 : 0;
+}
@@ -164,6 +164,7 @@ struct gio_vtab
     {
         memset(&vtab, 0, sizeof(sqlite3_vtab));
         GIO.openAndReadHeader(GenericIO::MismatchAllowed);
+        GIO.readRankCatalog();
     }
 
     sqlite3_vtab          vtab;
@@ -184,6 +185,7 @@ struct gio_cursor
         memset(&cursor, 0, sizeof(sqlite3_vtab_cursor));
 
         GIO.openAndReadHeader(GenericIO::MismatchAllowed);
+        GIO.readRankCatalog();
 
         size_t MaxNumElems = GIO.readNumElems(0);
         int NR = GIO.readNRanks();
@@ -316,7 +318,7 @@ int gio_connect(sqlite3* db, void *, int argc, const char *const *argv,
                 node.zMax = sqliteOctreeData.rows[i].maxZ;
                 node.rows = sqliteOctreeData.rows[i].numParticles;
                 rank = sqliteOctreeData.rows[i].partitionLocation;
-                node.index = sqliteOctreeData.rows[i].blockID;
+                node.index = sqliteOctreeData.rows[i].offsetInFile;   // row offset of the leaf within its rank
 
                 tab->OctreeNodes[rank].push_back(node);
             }
@@ -105,13 +105,12 @@ int main(int argc, char *argv[])
             GenericIO GIO(FileName, Method);
             #endif
 
+            // Without MPI, the one process reads every rank of the file.
             #ifndef GENERICIO_NO_MPI
-            bool MustMatch = true;
+            GIO.openAndReadHeader(GenericIO::MismatchRedistribute);
             #else
-            bool MustMatch = false;
+            GIO.openAndReadHeader(GenericIO::MismatchAllowed);
             #endif
-            GIO.openAndReadHeader(MustMatch ? GenericIO::MismatchRedistribute :
-                                  GenericIO::MismatchDisallowed);
             if (Verbose) cout << "\theader: okay" << endl;
 
 
@@ -130,6 +129,7 @@ int main(int argc, char *argv[])
             }
             #endif
 
+            #ifndef GENERICIO_NO_MPI
             vector< vector<char> > Vars(VI.size());
             for (size_t i = 0; i < VI.size(); ++i)
             {
@@ -137,15 +137,57 @@ int main(int argc, char *argv[])
                 GIO.addVariable(VI[i], &Vars[i][0], true);
             }
 
-            #ifndef GENERICIO_NO_MPI
             GIO.readData(-1, false);
             if (Verbose) cout << "\tdata from rank " << Rank << ": okay" << endl;
             #else
-            for (int i = 0; i < NR; ++i)
+            // The ranks are verified in parallel, each thread reading through
+            // its own cursor (a copy of GIO made before adding the variables),
+            // and reported in rank order up to the first failure.
+            string Error;
+
+            #ifdef _OPENMP
+            #pragma omp parallel
+            #endif
             {
-                GIO.readData(i, false);
-                if (Verbose) cout << "\tdata from rank " << i << ": okay" << endl;
+                GenericIO TGIO(GIO);
+
+                vector< vector<char> > Vars(VI.size());
+                for (size_t i = 0; i < VI.size(); ++i)
+                {
+                    Vars[i].resize(VI[i].Size * MaxNElem + TGIO.requestedExtraSpace());
+                    TGIO.addVariable(VI[i], &Vars[i][0], true);
+                }
+
+                #ifdef _OPENMP
+                #pragma omp for schedule(dynamic) ordered
+                #endif
+                for (int i = 0; i < NR; ++i)
+                {
+                    string RankError;
+                    try
+                    {
+                        TGIO.readData(i, false);
+                    }
+                    catch (exception &e)
+                    {
+                        RankError = e.what();
+                    }
+
+                    #ifdef _OPENMP
+                    #pragma omp ordered
+                    #endif
+                    {
+                        if (Error.empty())
+                        {
+                            Error = RankError;
+                            if (Error.empty() && Verbose) cout << "\tdata from rank " << i << ": okay" << endl;
+                        }
+                    }
+                }
             }
+
+            if (!Error.empty())
+                throw runtime_error(Error);
             #endif
 
             if (Rank == 0)
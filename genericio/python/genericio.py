@@ -52,6 +52,12 @@ libpygio.get_elem_num.argtypes=[ct.c_char_p]
 libpygio.get_elem_num_in_leaf.restype=ct.c_int64
 libpygio.get_elem_num_in_leaf.argtypes=[ct.c_char_p, ct.c_int]
 
+libpygio.get_num_ranks.restype=ct.c_int
+libpygio.get_num_ranks.argtypes=[ct.c_char_p]
+
+libpygio.get_rank_catalog.restype=None
+libpygio.get_rank_catalog.argtypes=[ct.c_char_p, ct.POINTER(ct.c_int64)]
+
 libpygio.get_variable_type.restype=ct.c_int
 libpygio.get_variable_type.argtypes=[ct.c_char_p, ct.c_char_p]
 
@@ -107,6 +113,12 @@ libpygio.get_num_octree_leaves.argtypes=[ct.c_char_p, ct.POINTER(ct.c_int)]
 libpygio.get_octree_leaves.restype=ct.POINTER(ct.c_int)
 libpygio.get_octree_leaves.argtypes=[ct.c_char_p, ct.POINTER(ct.c_int)]
 
+libpygio.get_num_octree_leaves_box.restype=ct.c_int
+libpygio.get_num_octree_leaves_box.argtypes=[ct.c_char_p, ct.POINTER(ct.c_double)]
+
+libpygio.get_octree_leaves_box.restype=ct.POINTER(ct.c_int)
+libpygio.get_octree_leaves_box.argtypes=[ct.c_char_p, ct.POINTER(ct.c_double)]
+
 
 
 
@@ -181,6 +193,15 @@ def gio_inspect(file_name):
     libpygio.inspect_gio(file_name)
 
 
+def gio_rank_catalog(file_name):
+    # one row per global rank: partition, index in partition, number of
+    # elements, data offset, global rank
+    num_ranks = libpygio.get_num_ranks(file_name)
+    result = np.ndarray((num_ranks, 5), dtype=np.int64)
+    libpygio.get_rank_catalog(file_name, result.ctypes.data_as(ct.POINTER(ct.c_int64)))
+    return result
+
+
 def gio_get_num_variables(file_name):
     return ( libpygio.get_num_variables(file_name) )
 
@@ -200,13 +221,15 @@ def gio_get_octree(file_name):
 
 
 def gio_get_octree_leaves(file_name, extents):
-    exts = (ct.c_int * len(extents))(*extents)
+    # extents: [minX, maxX, minY, maxY, minZ, maxZ], compared against the
+    # full-precision leaf extents stored in the file
+    exts = (ct.c_double * len(extents))(*[float(e) for e in extents])
 
-    num_leaves = libpygio.get_num_octree_leaves(file_name, exts)
+    num_leaves = libpygio.get_num_octree_leaves_box(file_name, exts)
 
     result = np.ndarray((num_leaves),dtype=np.int32)
     result.ctypes.data_as(ct.POINTER(ct.c_int32))
     
-    result = libpygio.get_octree_leaves( file_name, exts )
+    result = libpygio.get_octree_leaves_box( file_name, exts )
 
     return num_leaves, result
@@ -82,6 +82,7 @@ int64_t get_elem_num(char* file_name)
 {
     gio::GenericIO reader(file_name);
     reader.openAndReadHeader(gio::GenericIO::MismatchAllowed);
+    reader.readRankCatalog();
 
     int num_ranks = reader.readNRanks();
     uint64_t size = 0;
@@ -92,6 +93,36 @@ int64_t get_elem_num(char* file_name)
 }
 
 
+int get_num_ranks(char* file_name)
+{
+    gio::GenericIO reader(file_name);
+    reader.openAndReadHeader(gio::GenericIO::MismatchAllowed);
+
+    int num_ranks = reader.readNRanks();
+    reader.close();
+    return num_ranks;
+}
+
+
+void get_rank_catalog(char* file_name, int64_t* catalog)
+{
+    gio::GenericIO reader(file_name);
+    reader.openAndReadHeader(gio::GenericIO::MismatchAllowed);
+    reader.readRankCatalog();
+
+    const std::vector<gio::GenericIO::RankInfo> &ranks = reader.getRankCatalog();
+    for (size_t i = 0; i < ranks.size(); ++i)
+    {
+        catalog[5*i + 0] = ranks[i].Partition;
+        catalog[5*i + 1] = ranks[i].Index;
+        catalog[5*i + 2] = ranks[i].NElems;
+        catalog[5*i + 3] = ranks[i].Start;
+        catalog[5*i + 4] = ranks[i].GlobalRank;
+    }
+    reader.close();
+}
+
+
 
 int64_t get_elem_num_in_leaf(char* file_name, int leaf_id)
 {
@@ -266,4 +297,28 @@ int* get_octree_leaves(char* file_name, int extents[])
     std::copy(intersectedLeaves.begin(), intersectedLeaves.end(), x);
 
     return x;
-}
\ No newline at end of file
+}
+
+
+int get_num_octree_leaves_box(char* file_name, double extents[])
+{
+    gio::GenericIO reader(file_name);
+    reader.openAndReadHeader(gio::GenericIO::MismatchAllowed);
+
+    GIOOctree tempOctree = reader.getOctree();
+    return tempOctree.getIntersectingLeaves(extents).size();
+}
+
+int* get_octree_leaves_box(char* file_name, double extents[])
+{
+    gio::GenericIO reader(file_name);
+    reader.openAndReadHeader(gio::GenericIO::MismatchAllowed);
+
+    GIOOctree tempOctree = reader.getOctree();
+    std::vector<int> intersectedLeaves = tempOctree.getIntersectingLeaves(extents);
+
+    int *x = new int[intersectedLeaves.size()];
+    std::copy(intersectedLeaves.begin(), intersectedLeaves.end(), x);
+
+    return x;
+}
@@ -55,6 +55,7 @@ void read_gio(char* file_name, std::string var_name, T*& data, int field_count)
 {
     gio::GenericIO reader(file_name);
     reader.openAndReadHeader(gio::GenericIO::MismatchAllowed);
+    reader.readRankCatalog();
     int num_ranks = reader.readNRanks();
     uint64_t max_size = 0;
     uint64_t rank_size[num_ranks];
@@ -125,6 +126,11 @@ void read_gio_rankLeaf(char* file_name, int leaf_id, std::string var_name, T*& d
 
 extern "C" int64_t get_elem_num(char* file_name);
 
+// One row of 5 values per global rank: partition, index within the
+// partition, number of elements, data offset and global rank.
+extern "C" int get_num_ranks(char* file_name);
+extern "C" void get_rank_catalog(char* file_name, int64_t* catalog);
+
 extern "C" void read_gio_float (char* file_name, char* var_name, float* data, int field_count);
 extern "C" void read_gio_double(char* file_name, char* var_name, double* data, int field_count);
 extern "C" void read_gio_int32 (char* file_name, char* var_name, int* data, int field_count);
@@ -155,6 +161,8 @@ extern "C" char* get_variable(char* file_name, int var);
 extern "C" char* get_octree(char* file_name);
 extern "C" int* get_octree_leaves(char* file_name, int extents[]);
 extern "C" int get_num_octree_leaves(char* file_name, int extents[]);
+extern "C" int* get_octree_leaves_box(char* file_name, double extents[]);
+extern "C" int get_num_octree_leaves_box(char* file_name, double extents[]);
 extern "C" int64_t get_elem_num_in_leaf(char* file_name,  int leaf_id);
 
 extern "C" int get_octree_rank(char* file_name, int extents[]);
@@ -130,15 +130,19 @@ class OctreeRow:
 
 class Octree:
 	def __init__ (self):
+		self.version = 1
 		self.preShuffled = 0
 		self.decompositionLevel = 0
 		self.numEntries = 0
+		self.numNodes = 0
 		self.rows = []
 
 	def printMe(self):
+		print("Version:", self.version)
 		print("Pre-Shuffled:", self.preShuffled)
 		print("Decomposition level:", self.decompositionLevel)
 		print("Num Entries:", self.numEntries)
+		print("Num Nodes:", self.numNodes)
 
 		print("(index, minX, maxX, minY, maxY, minZ,maxZ, #particles, offset_in_rank_file, rank_location)")
 		for i in range(0,self.numEntries):
@@ -256,6 +260,14 @@ def main(argv):
 	if headerInfo.octreeSize != 0:
 		octreeData = Octree()
 
+		# versioned octree sections start with a magic and a version; legacy
+		# ones start directly with preShuffled and store integer extents
+		extentFormat = "q"
+		if fileContent[pos:pos+8] == b"GIOOCTRE":
+			octreeData.version = struct.unpack("q", fileContent[pos+8:pos+16])[0]
+			extentFormat = "d"
+			pos = pos + 16
+
 		octreeData.preShuffled = struct.unpack("q", fileContent[pos:pos+8])[0]
 		pos = pos + 8
 
@@ -272,22 +284,22 @@ def main(argv):
 			octreeDataRow.blockID = struct.unpack("q", fileContent[pos:pos+8])[0]
 			pos = pos + 8
 
-			octreeDataRow.minX = struct.unpack("q", fileContent[pos:pos+8])[0]
+			octreeDataRow.minX = struct.unpack(extentFormat, fileContent[pos:pos+8])[0]
 			pos = pos + 8
 
-			octreeDataRow.maxX = struct.unpack("q", fileContent[pos:pos+8])[0]
+			octreeDataRow.maxX = struct.unpack(extentFormat, fileContent[pos:pos+8])[0]
 			pos = pos + 8
 
-			octreeDataRow.minY = struct.unpack("q", fileContent[pos:pos+8])[0]
+			octreeDataRow.minY = struct.unpack(extentFormat, fileContent[pos:pos+8])[0]
 			pos = pos + 8
 
-			octreeDataRow.maxY = struct.unpack("q", fileContent[pos:pos+8])[0]
+			octreeDataRow.maxY = struct.unpack(extentFormat, fileContent[pos:pos+8])[0]
 			pos = pos + 8
 
-			octreeDataRow.minZ = struct.unpack("q", fileContent[pos:pos+8])[0]
+			octreeDataRow.minZ = struct.unpack(extentFormat, fileContent[pos:pos+8])[0]
 			pos = pos + 8
 
-			octreeDataRow.maxZ = struct.unpack("q", fileContent[pos:pos+8])[0]
+			octreeDataRow.maxZ = struct.unpack(extentFormat, fileContent[pos:pos+8])[0]
 			pos = pos + 8
 
 			octreeDataRow.numParticles = struct.unpack("q", fileContent[pos:pos+8])[0]
@@ -300,6 +312,11 @@ def main(argv):
 			pos = pos + 8
 
 			octreeData.rows.append(octreeDataRow)
+
+		# version 3 adds the internal nodes of adaptive octrees
+		if octreeData.version >= 3:
+			octreeData.numNodes = struct.unpack("q", fileContent[pos:pos+8])[0]
+			pos = pos + 8 + octreeData.numNodes*80
 		
 		print("\nOctree:")
 		octreeData.printMe()
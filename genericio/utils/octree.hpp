@@ -11,27 +11,121 @@
 #include <algorithm>
 #include <random>
 #include <stdio.h>
+#include <string.h>
+#include <stdexcept>
 
 
 #include "memory.h"
 #include "timer.h"
 
+// Octree section layout versions. Version 1 (legacy) has no magic and stores
+// the leaf extents as rounded integers; version 2 starts with GIO_OCTREE_MAGIC
+// followed by the version and stores the extents as IEEE doubles; version 3
+// appends the internal nodes of adaptive octrees after the leaf rows; version
+// 4 appends the sub-leaf index of Morton-ordered leaves after the nodes (and
+// is only written when there is one).
+#define GIO_OCTREE_MAGIC "GIOOCTRE"
+#define GIO_OCTREE_MAGIC_SIZE 8
+#define GIO_OCTREE_VERSION 4
+#define GIO_OCTREE_NONE ((uint64_t)-1)
+
+// Order of the particles within a leaf (stored in the preShuffled field)
+#define GIO_OCTREE_ORDER_SIMULATION 0
+#define GIO_OCTREE_ORDER_SHUFFLED 1
+#define GIO_OCTREE_ORDER_MORTON 2
+
+// Morton keys have 21 bits per dimension; Morton-ordered leaves are indexed
+// by the row ranges of their cells a few levels down, so that the cells hold
+// about GIO_OCTREE_SUBLEAF_ROWS rows on average.
+#define GIO_MORTON_BITS 21
+#define GIO_OCTREE_SUBLEAF_ROWS 64
+#define GIO_OCTREE_MAX_SUBLEAF_LEVELS 4
+
+// Half-open leaf/node extents [min, max) against a closed query box
+inline bool gioOctreeBoxIntersect(const double minMax[6], const double extents[6])
+{
+	if ((extents[0] < minMax[1]) && (extents[1] >= minMax[0]))
+		if ((extents[2] < minMax[3]) && (extents[3] >= minMax[2]))
+			if ((extents[4] < minMax[5]) && (extents[5] >= minMax[4]))
+				return true;
+
+	return false;
+}
+
+// Levels of the sub-leaf index of leaves holding particlesPerLeaf particles on average
+inline int gioOctreeSubLeafLevels(uint64_t particlesPerLeaf)
+{
+	int levels = 1;
+	while (levels < GIO_OCTREE_MAX_SUBLEAF_LEVELS &&
+		   ((uint64_t)GIO_OCTREE_SUBLEAF_ROWS << (3*(levels + 1))) <= particlesPerLeaf)
+		levels++;
+
+	return levels;
+}
+
+// Spreads the low 21 bits of v so that there are two zero bits between them
+inline uint64_t gioMortonSpread(uint64_t v)
+{
+	v &= 0x1fffff;
+	v = (v | (v << 32)) & 0x1f00000000ffffULL;
+	v = (v | (v << 16)) & 0x1f0000ff0000ffULL;
+	v = (v | (v << 8))  & 0x100f00f00f00f00fULL;
+	v = (v | (v << 4))  & 0x10c30c30c30c30c3ULL;
+	v = (v | (v << 2))  & 0x1249249249249249ULL;
+	return v;
+}
+
+// Morton key of a position within extents (minX, maxX, minY, maxY, minZ, maxZ),
+// with x in the most significant bit of each level. Positions outside of the
+// extents are clamped onto them.
+inline uint64_t gioMortonKey(double x, double y, double z, const double extents[6])
+{
+	double pos[3] = {x, y, z};
+	uint64_t key = 0;
+	for (int d=0; d<3; d++)
+	{
+		double width = extents[2*d+1] - extents[2*d];
+		double q = width > 0 ? (pos[d] - extents[2*d]) / width * (1 << GIO_MORTON_BITS) : 0;
+		uint64_t cell = q <= 0 ? 0 : (q >= (1 << GIO_MORTON_BITS) - 1 ? (1 << GIO_MORTON_BITS) - 1 : (uint64_t) q);
+		key |= gioMortonSpread(cell) << (2 - d);
+	}
+
+	return key;
+}
+
+// Extents of cell 'cell' of the 8^levels cells of extents, in Morton order
+inline void gioMortonCellExtents(const double extents[6], int levels, uint64_t cell, double cellExtents[6])
+{
+	uint64_t coord[3] = {0, 0, 0};
+	for (int l=levels-1; l>=0; l--)
+		for (int d=0; d<3; d++)
+			coord[d] = (coord[d] << 1) | ((cell >> (3*l + 2 - d)) & 1);
+
+	for (int d=0; d<3; d++)
+	{
+		double width = (extents[2*d+1] - extents[2*d]) / (1 << levels);
+		cellExtents[2*d]   = extents[2*d] + coord[d] * width;
+		cellExtents[2*d+1] = extents[2*d] + (coord[d] + 1) * width;
+	}
+}
+
+
 struct GIOOctreeRow
 {
     uint64_t blockID;
-    uint64_t minX;
-    uint64_t maxX;
-    uint64_t minY;
-    uint64_t maxY;
-    uint64_t minZ;
-    uint64_t maxZ;
+    double minX;
+    double maxX;
+    double minY;
+    double maxY;
+    double minZ;
+    double maxZ;
     uint64_t numParticles;
     uint64_t offsetInFile;
     uint64_t partitionLocation;
 
 	GIOOctreeRow(){ } ;
-	GIOOctreeRow(uint64_t id, uint64_t _minX, uint64_t _maxX, uint64_t _minY, uint64_t _maxY,
-				uint64_t _minZ, uint64_t _maxZ , uint64_t _numP, uint64_t _offsetInFile, uint64_t _parLocation)
+	GIOOctreeRow(uint64_t id, double _minX, double _maxX, double _minY, double _maxY,
+				double _minZ, double _maxZ , uint64_t _numP, uint64_t _offsetInFile, uint64_t _parLocation)
 	{
 		blockID = id;
 		minX = _minX; maxX = _maxX;
@@ -43,14 +137,34 @@ struct GIOOctreeRow
 	}
 
 
+	// extents: minX, maxX, minY, maxY, minZ, maxZ of the query box; a leaf covers [min, max)
+	bool intersect(double extents[])
+	{
+		double minMax[6] = {minX, maxX, minY, maxY, minZ, maxZ};
+		return gioOctreeBoxIntersect(minMax, extents);
+	}
+
+	bool intersect(float extents[])
+	{
+		double _extents[6];
+		for (int i=0; i<6; i++)
+			_extents[i] = extents[i];
+
+		return intersect(_extents);
+	}
+
 	bool intersect(int extents[])
 	{
-		if ((extents[0] < maxX) && (extents[1] >= minX))
-			if ((extents[2] < maxY) && (extents[3] >= minY))
-				if ((extents[4] < maxZ) && (extents[5] >= minZ))
-					return true;
+		double _extents[6];
+		for (int i=0; i<6; i++)
+			_extents[i] = extents[i];
 
-		return false;
+		return intersect(_extents);
+	}
+
+	bool contains(double x, double y, double z)
+	{
+		return (x >= minX && x < maxX) && (y >= minY && y < maxY) && (z >= minZ && z < maxZ);
 	}
 
 
@@ -73,17 +187,46 @@ struct GIOOctreeRow
 };
 
 
+// Node of an adaptive octree. Children of an internal node are stored
+// contiguously starting at firstChild; leaves point to their octree row.
+struct GIOOctreeNode
+{
+	double extents[6];			// minX, maxX, minY, maxY, minZ, maxZ
+	uint64_t firstChild;		// index of the first of 8 children, GIO_OCTREE_NONE for leaves
+	uint64_t leafID;			// row of the leaf, GIO_OCTREE_NONE for internal nodes
+	uint64_t numParticles;		// # particles in the subtree
+	uint64_t depth;				// 0 for the root of a rank
+
+	GIOOctreeNode(): firstChild(GIO_OCTREE_NONE), leafID(GIO_OCTREE_NONE), numParticles(0), depth(0) { }
+
+	bool isLeaf() const { return firstChild == GIO_OCTREE_NONE; }
+};
+
+
 struct GIOOctree
 {
-    uint64_t preShuffled;			// particles shuffeed in leaves or not
+    uint64_t preShuffled;			// order of the particles in leaves, GIO_OCTREE_ORDER_*
     uint64_t decompositionLevel;	// 
     uint64_t numEntries;			// # of octree leaves
     std::vector<GIOOctreeRow> rows;
+    std::vector<GIOOctreeNode> nodes;	// internal structure of adaptive octrees, empty otherwise
+
+    // Sub-leaf index of Morton-ordered leaves: the first row (relative to the
+    // leaf) of each of the 8^subLeafLevels cells of each leaf, empty otherwise
+    uint64_t subLeafLevels;
+    std::vector<uint64_t> subLeafStarts;
+
+    uint64_t version;				// layout of the serialized section, see GIO_OCTREE_VERSION
+
+    GIOOctree(): preShuffled(0), decompositionLevel(0), numEntries(0), subLeafLevels(0), version(GIO_OCTREE_VERSION) { }
 
     std::string serialize(bool bigEndian)
     {
         std::stringstream ss;
 
+        ss.write(GIO_OCTREE_MAGIC, GIO_OCTREE_MAGIC_SIZE);
+        ss << serialize_uint64(hasSubLeafIndex() ? 4 : 3, bigEndian);
+
         ss << serialize_uint64(preShuffled, bigEndian);
         ss << serialize_uint64(decompositionLevel, bigEndian);
         ss << serialize_uint64(numEntries, bigEndian);
@@ -92,42 +235,97 @@ struct GIOOctree
         for (int i=0; i<numEntries; i++)
         {
             ss << serialize_uint64(rows[i].blockID, bigEndian);
-            ss << serialize_uint64(rows[i].minX, bigEndian);
-            ss << serialize_uint64(rows[i].maxX, bigEndian);
-            ss << serialize_uint64(rows[i].minY, bigEndian);
-            ss << serialize_uint64(rows[i].maxY, bigEndian);
-            ss << serialize_uint64(rows[i].minZ, bigEndian);
-            ss << serialize_uint64(rows[i].maxZ, bigEndian);
+            ss << serialize_double(rows[i].minX, bigEndian);
+            ss << serialize_double(rows[i].maxX, bigEndian);
+            ss << serialize_double(rows[i].minY, bigEndian);
+            ss << serialize_double(rows[i].maxY, bigEndian);
+            ss << serialize_double(rows[i].minZ, bigEndian);
+            ss << serialize_double(rows[i].maxZ, bigEndian);
             ss << serialize_uint64(rows[i].numParticles, bigEndian);
             ss << serialize_uint64(rows[i].offsetInFile, bigEndian);
             ss << serialize_uint64(rows[i].partitionLocation, bigEndian);
         }
+
+        ss << serialize_uint64(nodes.size(), bigEndian);
+        for (size_t i=0; i<nodes.size(); i++)
+        {
+            for (int j=0; j<6; j++)
+                ss << serialize_double(nodes[i].extents[j], bigEndian);
+            ss << serialize_uint64(nodes[i].firstChild, bigEndian);
+            ss << serialize_uint64(nodes[i].leafID, bigEndian);
+            ss << serialize_uint64(nodes[i].numParticles, bigEndian);
+            ss << serialize_uint64(nodes[i].depth, bigEndian);
+        }
+
+        if (hasSubLeafIndex())
+        {
+            ss << serialize_uint64(subLeafLevels, bigEndian);
+            for (size_t i=0; i<subLeafStarts.size(); i++)
+                ss << serialize_uint64(subLeafStarts[i], bigEndian);
+        }
         
         return ss.str();
     }
 
 
-    void deserialize(char *serializedString, bool bigEndian)
+    // Reads both the versioned layout and the legacy (integer extents) one.
+    // If serializedSize is given, the section is checked against it.
+    void deserialize(char *serializedString, bool bigEndian, size_t serializedSize = 0)
     {
-        preShuffled 		= deserialize_uint64(&serializedString[0],  bigEndian);
-        decompositionLevel 	= deserialize_uint64(&serializedString[8], bigEndian);
-        numEntries 			= deserialize_uint64(&serializedString[16], bigEndian);
+        int serializedOffset = 0;
+
+        version = 1;
+        if (serializedSize == 0 || serializedSize >= GIO_OCTREE_MAGIC_SIZE + 8)
+            if (std::string(serializedString, GIO_OCTREE_MAGIC_SIZE) == GIO_OCTREE_MAGIC)
+            {
+                version = deserialize_uint64(&serializedString[GIO_OCTREE_MAGIC_SIZE], bigEndian);
+                serializedOffset = GIO_OCTREE_MAGIC_SIZE + 8;
+            }
+
+        if (version > GIO_OCTREE_VERSION)
+        {
+            std::stringstream ss;
+            ss << "Unsupported octree section version " << version;
+            throw std::runtime_error(ss.str());
+        }
+
+        if (serializedSize != 0 && serializedSize < serializedOffset + 24)
+            throw std::runtime_error("Octree section is truncated");
+
+        preShuffled 		= deserialize_uint64(&serializedString[serializedOffset + 0],  bigEndian);
+        decompositionLevel 	= deserialize_uint64(&serializedString[serializedOffset + 8], bigEndian);
+        numEntries 			= deserialize_uint64(&serializedString[serializedOffset + 16], bigEndian);
+        serializedOffset += 24;	// adding togehter the previous header
+
+        if (serializedSize != 0 && serializedSize < serializedOffset + numEntries*80)
+            throw std::runtime_error("Octree section is truncated");
 		
         rows.clear();
-        int serializedOffset = 24;	// adding togehter the previous header
-
+        rows.reserve(numEntries);
 		
         for (int i=0; i<numEntries; i++)
         {
         	GIOOctreeRow temp;
 			
             temp.blockID 	= deserialize_uint64(&serializedString[serializedOffset + 0], 		bigEndian);
-            temp.minX 		= deserialize_uint64(&serializedString[serializedOffset + 8], 		bigEndian);
-            temp.maxX 		= deserialize_uint64(&serializedString[serializedOffset + 16], 		bigEndian);
-            temp.minY 		= deserialize_uint64(&serializedString[serializedOffset + 24], 		bigEndian);
-            temp.maxY 		= deserialize_uint64(&serializedString[serializedOffset + 32], 		bigEndian);
-            temp.minZ 		= deserialize_uint64(&serializedString[serializedOffset + 40], 		bigEndian);
-            temp.maxZ 		= deserialize_uint64(&serializedString[serializedOffset + 48], 		bigEndian);
+            if (version == 1)
+            {
+                temp.minX 	= deserialize_uint64(&serializedString[serializedOffset + 8], 		bigEndian);
+                temp.maxX 	= deserialize_uint64(&serializedString[serializedOffset + 16], 		bigEndian);
+                temp.minY 	= deserialize_uint64(&serializedString[serializedOffset + 24], 		bigEndian);
+                temp.maxY 	= deserialize_uint64(&serializedString[serializedOffset + 32], 		bigEndian);
+                temp.minZ 	= deserialize_uint64(&serializedString[serializedOffset + 40], 		bigEndian);
+                temp.maxZ 	= deserialize_uint64(&serializedString[serializedOffset + 48], 		bigEndian);
+            }
+            else
+            {
+                temp.minX 	= deserialize_double(&serializedString[serializedOffset + 8], 		bigEndian);
+                temp.maxX 	= deserialize_double(&serializedString[serializedOffset + 16], 		bigEndian);
+                temp.minY 	= deserialize_double(&serializedString[serializedOffset + 24], 		bigEndian);
+                temp.maxY 	= deserialize_double(&serializedString[serializedOffset + 32], 		bigEndian);
+                temp.minZ 	= deserialize_double(&serializedString[serializedOffset + 40], 		bigEndian);
+                temp.maxZ 	= deserialize_double(&serializedString[serializedOffset + 48], 		bigEndian);
+            }
             temp.numParticles = deserialize_uint64(&serializedString[serializedOffset + 56], 	bigEndian);
             temp.offsetInFile = deserialize_uint64(&serializedString[serializedOffset + 64], 	bigEndian);
             temp.partitionLocation = deserialize_uint64(&serializedString[serializedOffset + 72], bigEndian);
@@ -136,9 +334,133 @@ struct GIOOctree
             rows.push_back(temp);
 			
         }
+
+        nodes.clear();
+        if (version >= 3)
+        {
+            if (serializedSize != 0 && serializedSize < serializedOffset + 8)
+                throw std::runtime_error("Octree section is truncated");
+
+            uint64_t numNodes = deserialize_uint64(&serializedString[serializedOffset], bigEndian);
+            serializedOffset += 8;
+
+            if (serializedSize != 0 && serializedSize < serializedOffset + numNodes*80)
+                throw std::runtime_error("Octree section is truncated");
+
+            nodes.resize(numNodes);
+            for (uint64_t i=0; i<numNodes; i++)
+            {
+                for (int j=0; j<6; j++)
+                    nodes[i].extents[j] = deserialize_double(&serializedString[serializedOffset + j*8], bigEndian);
+                nodes[i].firstChild   = deserialize_uint64(&serializedString[serializedOffset + 48], bigEndian);
+                nodes[i].leafID       = deserialize_uint64(&serializedString[serializedOffset + 56], bigEndian);
+                nodes[i].numParticles = deserialize_uint64(&serializedString[serializedOffset + 64], bigEndian);
+                nodes[i].depth        = deserialize_uint64(&serializedString[serializedOffset + 72], bigEndian);
+
+                serializedOffset += 80;
+            }
+        }
+
+        subLeafLevels = 0;
+        subLeafStarts.clear();
+        if (version >= 4)
+        {
+            if (serializedSize != 0 && serializedSize < serializedOffset + 8)
+                throw std::runtime_error("Octree section is truncated");
+
+            subLeafLevels = deserialize_uint64(&serializedString[serializedOffset], bigEndian);
+            serializedOffset += 8;
+
+            if (subLeafLevels > GIO_MORTON_BITS)
+                throw std::runtime_error("Octree sub-leaf index is invalid");
+
+            uint64_t numStarts = numEntries * getNumSubLeafCells();
+            if (serializedSize != 0 && serializedSize < serializedOffset + numStarts*8)
+                throw std::runtime_error("Octree section is truncated");
+
+            subLeafStarts.resize(numStarts);
+            for (uint64_t i=0; i<numStarts; i++)
+                subLeafStarts[i] = deserialize_uint64(&serializedString[serializedOffset + i*8], bigEndian);
+        }
     }
 
 
+    bool isAdaptive() { return !nodes.empty(); }
+
+    bool hasSubLeafIndex() { return subLeafLevels > 0 && !subLeafStarts.empty(); }
+
+    uint64_t getNumSubLeafCells() { return (uint64_t)1 << (3*subLeafLevels); }
+
+    // Rows [start, start + count) of a leaf (relative to the leaf) are in its
+    // sub-leaf cell, whose extents are given
+    void getSubLeafCell(int leaf, uint64_t cell, uint64_t &start, uint64_t &count, double cellExtents[6])
+    {
+        uint64_t numCells = getNumSubLeafCells();
+        start = subLeafStarts[leaf*numCells + cell];
+        count = (cell + 1 < numCells ? subLeafStarts[leaf*numCells + cell + 1] : rows[leaf].numParticles) - start;
+
+        double extents[6] = {rows[leaf].minX, rows[leaf].maxX, rows[leaf].minY, rows[leaf].maxY, rows[leaf].minZ, rows[leaf].maxZ};
+        gioMortonCellExtents(extents, subLeafLevels, cell, cellExtents);
+    }
+
+
+    // Leaves whose extents intersect the query box (minX, maxX, minY, maxY, minZ, maxZ).
+    // Adaptive octrees are traversed from the rank roots so that the cost follows
+    // the number of populated nodes overlapping the box; empty leaves are skipped.
+    std::vector<int> getIntersectingLeaves(double extents[])
+    {
+        std::vector<int> leaves;
+
+        if (nodes.empty())
+        {
+            for (int i=0; i<rows.size(); i++)
+                if (rows[i].intersect(extents))
+                    leaves.push_back(i);
+
+            return leaves;
+        }
+
+        std::vector<uint64_t> stack;
+        for (uint64_t i=nodes.size(); i-- > 0; )
+            if (nodes[i].depth == 0)
+                stack.push_back(i);
+
+        while (!stack.empty())
+        {
+            GIOOctreeNode &node = nodes[stack.back()];
+            stack.pop_back();
+
+            if (node.numParticles == 0 || !gioOctreeBoxIntersect(node.extents, extents))
+                continue;
+
+            if (node.isLeaf())
+                leaves.push_back(node.leafID);
+            else
+                for (int c=7; c>=0; c--)
+                    stack.push_back(node.firstChild + c);
+        }
+
+        return leaves;
+    }
+
+
+	double deserialize_double(char* serializedStr, bool bigEndian)
+	{
+		uint64_t bits = deserialize_uint64(serializedStr, bigEndian);
+		double num;
+		memcpy(&num, &bits, sizeof(double));
+
+		return num;
+	}
+
+	std::string serialize_double(double t, bool bigEndian)
+	{
+		uint64_t bits;
+		memcpy(&bits, &t, sizeof(double));
+
+		return serialize_uint64(bits, bigEndian);
+	}
+
 
 	uint64_t deserialize_uint64(char* serializedStr, bool bigEndian)
 	{
@@ -160,14 +482,14 @@ struct GIOOctree
 		{
 			// Big Endian
 			num =   	
-			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[0])) << 0 ) |
-			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[1])) << 8 ) |
-			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[2])) << 16) |
-			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[3])) << 24) |
-			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[4])) << 32) |
-			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[5])) << 40) |
-			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[6])) << 48) |
-			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[7])) << 56) ;
+			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[0])) << 56) |
+			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[1])) << 48) |
+			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[2])) << 40) |
+			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[3])) << 32) |
+			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[4])) << 24) |
+			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[5])) << 16) |
+			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[6])) << 8 ) |
+			(static_cast<uint64_t>(static_cast<uint8_t>( serializedStr[7])) << 0 ) ;
 		}
 
 		return num;
@@ -223,31 +545,48 @@ struct GIOOctree
 	}
 
 
+	// First row of a rank; rows are grouped by rank in rank order
+	size_t getFirstRow(int rank)
+	{
+		size_t i = 0;
+		while (i < rows.size() && rows[i].partitionLocation < rank)
+			i++;
+
+		return i;
+	}
+
+	size_t getNumLeaves(int rank)
+	{
+		size_t first = getFirstRow(rank), i = first;
+		while (i < rows.size() && rows[i].partitionLocation == rank)
+			i++;
+
+		return i - first;
+	}
+
 	size_t getCount(int rank, int leaf)
 	{
-		int numLeavesPerRank = (int) pow(8.0f, numEntries-1);
-		return rows[rank*numLeavesPerRank + leaf].numParticles;
+		return rows[getFirstRow(rank) + leaf].numParticles;
 	}
 
 	size_t getOffset(int rank, int leaf)
 	{
-		int numLeavesPerRank = (int) pow(8.0f, numEntries-1);
-		return rows[rank*numLeavesPerRank + leaf].offsetInFile;;
+		return rows[getFirstRow(rank) + leaf].offsetInFile;
 	}
 
 
 	std::vector<float> getExtents(int rank, int leaf)
 	{
-		int numLeavesPerRank = (int) pow(8.0f, numEntries-1);
+		size_t row = getFirstRow(rank) + leaf;
 
 		std::vector<float> extents;
 		
-		extents.push_back( rows[rank*numLeavesPerRank + leaf].minX );
-		extents.push_back( rows[rank*numLeavesPerRank + leaf].maxX );
-		extents.push_back( rows[rank*numLeavesPerRank + leaf].minY );
-		extents.push_back( rows[rank*numLeavesPerRank + leaf].maxY );
-		extents.push_back( rows[rank*numLeavesPerRank + leaf].minZ );
-		extents.push_back( rows[rank*numLeavesPerRank + leaf].maxZ );
+		extents.push_back( rows[row].minX );
+		extents.push_back( rows[row].maxX );
+		extents.push_back( rows[row].minY );
+		extents.push_back( rows[row].maxY );
+		extents.push_back( rows[row].minZ );
+		extents.push_back( rows[row].maxZ );
 
 		return extents;
 	}
@@ -255,13 +594,10 @@ struct GIOOctree
 
 	std::vector<GIOOctreeRow> getLeavesForRank(int rank)
 	{
-		std::vector<GIOOctreeRow> _rows;
+		size_t first = getFirstRow(rank);
+		size_t numLeaves = getNumLeaves(rank);
 
-		int numLeavesPerRank = (int) pow(8.0f, numEntries-1);
-		for (int i=0; i<numLeavesPerRank; i++)
-			_rows.push_back( rows[rank*numLeavesPerRank + i]);
-	
-		return _rows;
+		return std::vector<GIOOctreeRow>(rows.begin() + first, rows.begin() + first + numLeaves);
 	}
 
 	std::string getOctreeStr()
@@ -276,9 +612,13 @@ struct GIOOctree
 
     void print()
     {
-    	std::cout << "\nPre-Shuffled (0=No, 1=Yes): " << preShuffled << std::endl;
+    	std::cout << "\nLeaf order (0=Simulation, 1=Shuffled, 2=Morton): " << preShuffled << std::endl;
     	std::cout << "Decomposition Level: " << decompositionLevel << std::endl;
     	std::cout << "Num Entries: " << numEntries << std::endl;
+    	if (!nodes.empty())
+    		std::cout << "Adaptive, Num Nodes: " << nodes.size() << std::endl;
+    	if (hasSubLeafIndex())
+    		std::cout << "Sub-leaf index levels: " << subLeafLevels << std::endl;
 
     	std::cout << "\nIndex : minX - maxX, minY - maxY, minZ - maxZ, #particles, offset in file, rank location"<< std::endl;
     	for (int i=0; i<numEntries; i++)
@@ -329,6 +669,10 @@ class Octree
 
 	template <typename T> void reorder(T arr[], size_t index[], size_t n);
 	std::vector<size_t> createIndex(int numPartitions, std::vector<int> partitionPosition, std::vector<uint64_t>partitionCount, size_t numElements);
+
+	template <typename T> void splitAdaptiveNode(uint64_t nodeId, T inputArrayX[], T inputArrayY[], T inputArrayZ[], size_t order[], size_t scratch[], size_t numElements,
+									uint64_t maxParticlesPerLeaf, int maxDepth, std::vector<float> &leavesExtents, std::vector<GIOOctreeNode> &nodes,
+									std::vector<int> &leafPosition, std::vector<uint64_t> &leafCount);
 	
   public:
   	
@@ -342,8 +686,15 @@ class Octree
 	std::vector<PartitionExtents> ComputeMyLeaves(float myRankExtents[6], int _numLevels);
 	
 	template <typename T> void reorganizeArray(int numPartitions, std::vector<uint64_t>partitionCount, std::vector<int> partitionPosition, T array[], size_t numElements, bool shuffle);
-	template <typename T> void reorganizeArrayInPlace(int numPartitions, std::vector<uint64_t>partitionCount, std::vector<int> partitionPosition, T array[], size_t numElements, bool shuffle);
+	template <typename T> void reorganizeArrayInPlace(int numPartitions, std::vector<uint64_t>partitionCount, std::vector<int> partitionPosition, T array[], size_t numElements, bool shuffle,
+									const std::vector<size_t> *order = NULL);
+	template <typename T> std::vector<size_t> createMortonIndex(int numPartitions, std::vector<uint64_t> &partitionCount, std::vector<int> &partitionPosition,
+									T inputArrayX[], T inputArrayY[], T inputArrayZ[], size_t numElements, float partitionExtents[],
+									int subLeafLevels, std::vector<uint64_t> &subLeafStarts);
 	template <typename T> std::vector<uint64_t> findLeaf(T inputArrayX[], T inputArrayY[], T inputArrayZ[], size_t numElements, int numPartitions, float partitionExtents[], std::vector<int> &partitionPosition);
+	template <typename T> std::vector<uint64_t> buildAdaptiveLeaves(T inputArrayX[], T inputArrayY[], T inputArrayZ[], size_t numElements,
+									uint64_t maxParticlesPerLeaf, int maxDepth, std::vector<float> &leavesExtents,
+									std::vector<GIOOctreeNode> &nodes, std::vector<int> &leafPosition);
 
 	template <typename T> bool checkPosition(float extents[], T _x, T _y, T _z);
 	template <typename T> bool checkPositionInclusive(float extents[], T _x, T _y, T _z);
@@ -457,16 +808,71 @@ inline std::vector<size_t> Octree::createIndex(int numPartitions, std::vector<in
 }
 
 
+// Destination of each particle when the leaves are in Morton order: particles
+// are grouped by leaf, and sorted by the Morton key of their position within
+// the leaf (ties keep their order). The first row of each of the
+// 8^subLeafLevels cells of each leaf is appended to subLeafStarts.
+template <typename T>
+inline std::vector<size_t> Octree::createMortonIndex(int numPartitions, std::vector<uint64_t> &partitionCount, std::vector<int> &partitionPosition,
+									T inputArrayX[], T inputArrayY[], T inputArrayZ[], size_t numElements, float partitionExtents[],
+									int subLeafLevels, std::vector<uint64_t> &subLeafStarts)
+{
+	Timer clock;
+	clock.start();
+
+	std::vector<size_t> index = createIndex(numPartitions, partitionPosition, partitionCount, numElements);
+
+	std::vector< std::pair<uint64_t, size_t> > keys(numElements);
+	for (size_t i=0; i<numElements; i++)
+	{
+		int p = partitionPosition[i];
+		double leafExtents[6];
+		for (int j=0; j<6; j++)
+			leafExtents[j] = partitionExtents[p*6 + j];
+
+		keys[index[i]] = std::make_pair(gioMortonKey(inputArrayX[i], inputArrayY[i], inputArrayZ[i], leafExtents), i);
+	}
+
+	uint64_t numCells = (uint64_t)1 << (3*subLeafLevels);
+	size_t startPos = 0;
+	for (int p=0; p<numPartitions; p++)
+	{
+		std::sort(keys.begin() + startPos, keys.begin() + startPos + partitionCount[p]);
+
+		size_t pos = 0;
+		for (uint64_t c=0; c<numCells; c++)
+		{
+			subLeafStarts.push_back(pos);
+			while (pos < partitionCount[p] && (keys[startPos + pos].first >> (3*(GIO_MORTON_BITS - subLeafLevels))) == c)
+				pos++;
+		}
+
+		for (size_t j=0; j<partitionCount[p]; j++)
+			index[keys[startPos + j].second] = startPos + j;
+
+		startPos += partitionCount[p];
+	}
+
+	clock.stop();
+	log << "Octree::createMortonIndex took " << clock.getDuration() << " s " << std::endl;
+
+	return index;
+}
+
+
+// If order is given, it is the destination of each element (and the leaves
+// are not shuffled).
 template <typename T>				    	
 inline void Octree::reorganizeArrayInPlace(int numPartitions, std::vector<uint64_t>partitionCount, 
-									std::vector<int> partitionPosition, T array[], size_t numElements, bool shuffle)
+									std::vector<int> partitionPosition, T array[], size_t numElements, bool shuffle,
+									const std::vector<size_t> *order)
 {
 	Timer clock, indexClock, reorderClock, shuffleClock;
   clock.start();
 
 
   indexClock.start();
-	std::vector<size_t> index = createIndex(numPartitions, partitionPosition, partitionCount, numElements);
+	std::vector<size_t> index = order ? *order : createIndex(numPartitions, partitionPosition, partitionCount, numElements);
   indexClock.stop();
 
 
@@ -477,7 +883,7 @@ inline void Octree::reorganizeArrayInPlace(int numPartitions, std::vector<uint64
 
 	
   shuffleClock.start();
-	if (shuffle)
+	if (shuffle && !order)
 	{
   		std::mt19937 g(0);	// to ensure reproducability
 
@@ -683,6 +1089,117 @@ inline std::vector<uint64_t> Octree::findLeaf(T inputArrayX[], T inputArrayY[],
 
 
 
+// Adaptive octree: starting from the rank extents, a node is split into its 8
+// octants while it holds more than maxParticlesPerLeaf particles and is less
+// than maxDepth deep. Leaves are numbered in depth first order, nodes store
+// the tree (with node and leaf indices local to the rank).
+template <typename T> 
+inline std::vector<uint64_t> Octree::buildAdaptiveLeaves(T inputArrayX[], T inputArrayY[], T inputArrayZ[], size_t numElements,
+									uint64_t maxParticlesPerLeaf, int maxDepth, std::vector<float> &leavesExtents,
+									std::vector<GIOOctreeNode> &nodes, std::vector<int> &leafPosition)
+{
+	Timer clock;
+	clock.start();
+
+	std::vector<uint64_t> leafCount;
+	leavesExtents.clear();
+	nodes.clear();
+	leafPosition.assign(numElements, 0);
+
+	std::vector<size_t> order(numElements), scratch(numElements);
+	for (size_t i=0; i<numElements; i++)
+		order[i] = i;
+
+	GIOOctreeNode root;
+	for (int i=0; i<6; i++)
+		root.extents[i] = rankExtents[i];
+	nodes.push_back(root);
+
+	splitAdaptiveNode(0, inputArrayX, inputArrayY, inputArrayZ, numElements ? &order[0] : NULL, numElements ? &scratch[0] : NULL,
+						numElements, std::max(maxParticlesPerLeaf, (uint64_t)1), maxDepth, leavesExtents, nodes, leafPosition, leafCount);
+
+	clock.stop();
+	log << "Octree::buildAdaptiveLeaves created " << leafCount.size() << " leaves and " << nodes.size() << " nodes" << std::endl;
+	log << "Octree::buildAdaptiveLeaves took " << clock.getDuration() << " s " << std::endl;
+
+	return leafCount;
+}
+
+
+template <typename T> 
+inline void Octree::splitAdaptiveNode(uint64_t nodeId, T inputArrayX[], T inputArrayY[], T inputArrayZ[], size_t order[], size_t scratch[], size_t numElements,
+									uint64_t maxParticlesPerLeaf, int maxDepth, std::vector<float> &leavesExtents, std::vector<GIOOctreeNode> &nodes,
+									std::vector<int> &leafPosition, std::vector<uint64_t> &leafCount)
+{
+	nodes[nodeId].numParticles = numElements;
+
+	if (numElements <= maxParticlesPerLeaf || nodes[nodeId].depth >= (uint64_t)maxDepth)
+	{
+		nodes[nodeId].leafID = leafCount.size();
+		for (int i=0; i<6; i++)
+			leavesExtents.push_back(nodes[nodeId].extents[i]);
+
+		for (size_t i=0; i<numElements; i++)
+			leafPosition[order[i]] = leafCount.size();
+
+		leafCount.push_back(numElements);
+		return;
+	}
+
+	// Same float arithmetic as ComputeMyLeaves for the split planes
+	float ext[6], mid[3];
+	for (int i=0; i<6; i++)
+		ext[i] = nodes[nodeId].extents[i];
+	for (int d=0; d<3; d++)
+		mid[d] = (ext[d*2] + ext[d*2 + 1])/2;
+
+	// Octant c has bit 0 set for the upper x half, bit 1 for y and bit 2 for z
+	size_t octantCount[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+	for (size_t i=0; i<numElements; i++)
+	{
+		size_t p = order[i];
+		int c = (inputArrayX[p] >= mid[0]) | ((inputArrayY[p] >= mid[1]) << 1) | ((inputArrayZ[p] >= mid[2]) << 2);
+		octantCount[c]++;
+	}
+
+	size_t octantStart[9];
+	octantStart[0] = 0;
+	for (int c=0; c<8; c++)
+		octantStart[c+1] = octantStart[c] + octantCount[c];
+
+	size_t octantPos[8];
+	std::copy(octantStart, octantStart + 8, octantPos);
+	for (size_t i=0; i<numElements; i++)
+	{
+		size_t p = order[i];
+		int c = (inputArrayX[p] >= mid[0]) | ((inputArrayY[p] >= mid[1]) << 1) | ((inputArrayZ[p] >= mid[2]) << 2);
+		scratch[octantPos[c]++] = p;
+	}
+	std::copy(scratch, scratch + numElements, order);
+
+
+	uint64_t firstChild = nodes.size();
+	nodes[nodeId].firstChild = firstChild;
+	for (int c=0; c<8; c++)
+	{
+		GIOOctreeNode child;
+		for (int d=0; d<3; d++)
+		{
+			child.extents[d*2]     = (c >> d) & 1 ? mid[d] : ext[d*2];
+			child.extents[d*2 + 1] = (c >> d) & 1 ? ext[d*2 + 1] : mid[d];
+		}
+		child.depth = nodes[nodeId].depth + 1;
+		nodes.push_back(child);
+	}
+
+	for (int c=0; c<8; c++)
+		splitAdaptiveNode(firstChild + c, inputArrayX, inputArrayY, inputArrayZ, order + octantStart[c], scratch + octantStart[c],
+							octantCount[c], maxParticlesPerLeaf, maxDepth, leavesExtents, nodes, leafPosition, leafCount);
+}
+
+
+
+
 inline std::vector<float> Octree::getMyLeavesExtent(float myRankExtents[6], int numLevels)
 {
 	std::vector<PartitionExtents> myLeaves = ComputeMyLeaves(myRankExtents, numLevels);